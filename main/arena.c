@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN     sizeof(void*)
+
+bool arena_init(arena_t* arena, size_t size) {
+    arena->base = malloc(size);
+    arena->size = (arena->base != NULL) ? size : 0;
+    arena->used = 0;
+    arena->sealed = false;
+    return arena->base != NULL;
+}
+
+void arena_deinit(arena_t* arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->sealed = false;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (arena->sealed || offset > arena->size || size > arena->size - offset)
+        return NULL;
+
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+char* arena_strdup(arena_t* arena, const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = arena_alloc(arena, len);
+    if (copy != NULL)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+void arena_seal(arena_t* arena) {
+    arena->sealed = true;
+}
+
+size_t arena_mark(const arena_t* arena) {
+    return arena->used;
+}
+
+void arena_reset(arena_t* arena, size_t mark) {
+    if (mark < arena->used)
+        arena->used = mark;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bump allocator over one contiguous block */
+typedef struct {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    bool sealed;
+} arena_t;
+
+/* Allocate the backing block */
+bool arena_init(arena_t* arena, size_t size);
+
+
+/* Release the backing block and everything allocated from it */
+void arena_deinit(arena_t* arena);
+
+
+/* Allocate from the arena, NULL when full or sealed */
+void* arena_alloc(arena_t* arena, size_t size);
+
+char* arena_strdup(arena_t* arena, const char* str);
+
+
+/* Reject any further allocation */
+void arena_seal(arena_t* arena);
+
+
+/* Current allocation point, everything allocated after it can be given back */
+size_t arena_mark(const arena_t* arena);
+
+
+/* Give back everything allocated since mark */
+void arena_reset(arena_t* arena, size_t mark);
@@ -0,0 +1,161 @@
+#include <string.h>
+#include <math.h>
+
+#include "cbor_reader.h"
+
+static bool cbor_get_be(cbor_reader_t* reader, int width, uint64_t* val) {
+    if (reader->len - reader->pos < (size_t) width)
+        return false;
+
+    *val = 0;
+    for (int i = 0; i < width; i++)
+        *val = (*val << 8) | reader->buf[reader->pos++];
+    return true;
+}
+
+static double cbor_half_to_double(uint16_t half) {
+    int exp = (half >> 10) & 0x1F;
+    int mant = half & 0x3FF;
+    double val;
+
+    if (exp == 0)
+        val = ldexp(mant, -24);
+    else if (exp != 31)
+        val = ldexp(mant + 1024, exp - 25);
+    else
+        val = (mant == 0) ? INFINITY : NAN;
+
+    return (half & 0x8000) ? -val : val;
+}
+
+void cbor_reader_init(cbor_reader_t* reader, const void* buf, size_t len) {
+    reader->buf = buf;
+    reader->len = len;
+    reader->pos = 0;
+}
+
+bool cbor_read_item(cbor_reader_t* reader, cbor_item_t* item) {
+    if (reader->pos >= reader->len)
+        return false;
+
+    uint8_t initial = reader->buf[reader->pos++];
+    uint8_t major = initial >> 5;
+    uint8_t info = initial & 0x1F;
+    uint64_t arg = info;
+    bool indefinite = false;
+
+    if (info == 24 || info == 25 || info == 26 || info == 27) {
+        if (!cbor_get_be(reader, 1 << (info - 24), &arg))
+            return false;
+    } else if (info == 31) {
+        indefinite = true;
+    } else if (info > 27) {
+        return false;
+    }
+
+    switch (major) {
+    case 0:
+    case 1:
+    case 6:
+        if (indefinite)
+            return false;
+        item->type = (major == 0) ? CBOR_ITEM_UINT : (major == 1) ? CBOR_ITEM_NEGINT : CBOR_ITEM_TAG;
+        item->uint_val = arg;
+        return true;
+
+    case 2:
+    case 3:
+        /* Indefinite length strings are not supported */
+        if (indefinite || arg > reader->len - reader->pos)
+            return false;
+        item->type = (major == 2) ? CBOR_ITEM_BYTES : CBOR_ITEM_TEXT;
+        item->str.ptr = (const char*) reader->buf + reader->pos;
+        item->str.len = arg;
+        reader->pos += arg;
+        return true;
+
+    case 4:
+    case 5:
+        item->type = (major == 4) ? CBOR_ITEM_ARRAY : CBOR_ITEM_MAP;
+        item->count = indefinite ? CBOR_INDEFINITE_COUNT : arg;
+        return true;
+
+    default:
+        break;
+    }
+
+    /* Major type 7: simple values and floats */
+    switch (info) {
+    case 20:
+    case 21:
+        item->type = CBOR_ITEM_BOOL;
+        item->bool_val = (info == 21);
+        return true;
+    case 22:
+    case 23:
+        item->type = CBOR_ITEM_NULL;
+        return true;
+    case 25:
+        item->type = CBOR_ITEM_FLOAT;
+        item->float_val = cbor_half_to_double(arg);
+        return true;
+    case 26: {
+        uint32_t bits = arg;
+        float single;
+        memcpy(&single, &bits, sizeof(single));
+        item->type = CBOR_ITEM_FLOAT;
+        item->float_val = single;
+        return true;
+    }
+    case 27:
+        item->type = CBOR_ITEM_FLOAT;
+        memcpy(&item->float_val, &arg, sizeof(item->float_val));
+        return true;
+    case 31:
+        item->type = CBOR_ITEM_BREAK;
+        return true;
+    default:
+        item->type = CBOR_ITEM_SIMPLE;
+        item->uint_val = arg;
+        return true;
+    }
+}
+
+static bool cbor_skip_depth(cbor_reader_t* reader, const cbor_item_t* item, int depth) {
+    if (item->type != CBOR_ITEM_ARRAY && item->type != CBOR_ITEM_MAP && item->type != CBOR_ITEM_TAG)
+        return true;
+
+    if (depth >= CBOR_READER_MAX_DEPTH)
+        return false;
+
+    uint64_t remaining;
+    if (item->type == CBOR_ITEM_TAG)
+        remaining = 1;
+    else if (item->count == CBOR_INDEFINITE_COUNT)
+        remaining = CBOR_INDEFINITE_COUNT;
+    else if (item->type == CBOR_ITEM_MAP)
+        remaining = item->count * 2;
+    else
+        remaining = item->count;
+
+    while (remaining > 0) {
+        cbor_item_t child;
+        if (!cbor_read_item(reader, &child))
+            return false;
+
+        if (child.type == CBOR_ITEM_BREAK)
+            return remaining == CBOR_INDEFINITE_COUNT;
+
+        if (!cbor_skip_depth(reader, &child, depth + 1))
+            return false;
+
+        if (remaining != CBOR_INDEFINITE_COUNT)
+            remaining--;
+    }
+
+    return true;
+}
+
+bool cbor_skip(cbor_reader_t* reader, const cbor_item_t* item) {
+    return cbor_skip_depth(reader, item, 0);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum nesting skipped by cbor_skip */
+#define CBOR_READER_MAX_DEPTH           8
+
+/* Count of an indefinite length map or array */
+#define CBOR_INDEFINITE_COUNT           UINT64_MAX
+
+typedef enum {
+    CBOR_ITEM_UINT,
+    CBOR_ITEM_NEGINT,
+    CBOR_ITEM_BYTES,
+    CBOR_ITEM_TEXT,
+    CBOR_ITEM_ARRAY,
+    CBOR_ITEM_MAP,
+    CBOR_ITEM_TAG,
+    CBOR_ITEM_BOOL,
+    CBOR_ITEM_NULL,
+    CBOR_ITEM_FLOAT,
+    CBOR_ITEM_BREAK,
+    CBOR_ITEM_SIMPLE,
+} cbor_item_type_t;
+
+/* Decoded item head, strings point into the input buffer */
+typedef struct {
+    cbor_item_type_t type;
+    union {
+        uint64_t uint_val;              /* UINT, NEGINT (-1 - value), TAG, SIMPLE */
+        uint64_t count;                 /* ARRAY, MAP, CBOR_INDEFINITE_COUNT if indefinite */
+        bool bool_val;
+        double float_val;
+        struct {
+            const char* ptr;
+            size_t len;
+        } str;                          /* BYTES, TEXT, definite length only */
+    };
+} cbor_item_t;
+
+/* In-place reader over an encoded buffer */
+typedef struct {
+    const uint8_t* buf;
+    size_t len;
+    size_t pos;
+} cbor_reader_t;
+
+void cbor_reader_init(cbor_reader_t* reader, const void* buf, size_t len);
+
+
+/* Read the next item head, the contents of maps, arrays and tags follow it */
+bool cbor_read_item(cbor_reader_t* reader, cbor_item_t* item);
+
+
+/* Skip over the contents of an item that was just read */
+bool cbor_skip(cbor_reader_t* reader, const cbor_item_t* item);
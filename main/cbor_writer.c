@@ -0,0 +1,120 @@
+#include <string.h>
+#include <math.h>
+
+#include "cbor_writer.h"
+
+/* Major types */
+#define CBOR_UINT               0x00
+#define CBOR_NEGINT             0x20
+#define CBOR_TEXT               0x60
+#define CBOR_ARRAY              0x80
+#define CBOR_MAP                0xA0
+
+#define CBOR_INDEFINITE         0x1F
+#define CBOR_FALSE              0xF4
+#define CBOR_TRUE               0xF5
+#define CBOR_NULL               0xF6
+#define CBOR_FLOAT32            0xFA
+#define CBOR_FLOAT64            0xFB
+#define CBOR_BREAK              0xFF
+
+static void cbor_put(cbor_writer_t* writer, const void* data, size_t len) {
+    if (writer->len < writer->size) {
+        size_t room = writer->size - writer->len;
+        memcpy(writer->buf + writer->len, data, (len < room) ? len : room);
+    }
+    writer->len += len;
+}
+
+static void cbor_put_byte(cbor_writer_t* writer, uint8_t byte) {
+    cbor_put(writer, &byte, 1);
+}
+
+/* Big endian argument of the given byte width */
+static void cbor_put_be(cbor_writer_t* writer, uint64_t val, int width) {
+    uint8_t bytes[8];
+    for (int i = width - 1; i >= 0; i--) {
+        bytes[i] = val & 0xFF;
+        val >>= 8;
+    }
+    cbor_put(writer, bytes, width);
+}
+
+static void cbor_put_head(cbor_writer_t* writer, uint8_t major, uint64_t val) {
+    if (val < 24) {
+        cbor_put_byte(writer, major | val);
+    } else if (val <= UINT8_MAX) {
+        cbor_put_byte(writer, major | 24);
+        cbor_put_be(writer, val, 1);
+    } else if (val <= UINT16_MAX) {
+        cbor_put_byte(writer, major | 25);
+        cbor_put_be(writer, val, 2);
+    } else if (val <= UINT32_MAX) {
+        cbor_put_byte(writer, major | 26);
+        cbor_put_be(writer, val, 4);
+    } else {
+        cbor_put_byte(writer, major | 27);
+        cbor_put_be(writer, val, 8);
+    }
+}
+
+void cbor_writer_init(cbor_writer_t* writer, uint8_t* buf, size_t size) {
+    writer->buf = buf;
+    writer->size = (buf != NULL) ? size : 0;
+    writer->len = 0;
+}
+
+size_t cbor_writer_finish(cbor_writer_t* writer) {
+    return writer->len;
+}
+
+void cbor_write_map_begin(cbor_writer_t* writer) {
+    cbor_put_byte(writer, CBOR_MAP | CBOR_INDEFINITE);
+}
+
+void cbor_write_array_begin(cbor_writer_t* writer) {
+    cbor_put_byte(writer, CBOR_ARRAY | CBOR_INDEFINITE);
+}
+
+void cbor_write_break(cbor_writer_t* writer) {
+    cbor_put_byte(writer, CBOR_BREAK);
+}
+
+void cbor_write_string(cbor_writer_t* writer, const char* str) {
+    size_t len = strlen(str);
+    cbor_put_head(writer, CBOR_TEXT, len);
+    cbor_put(writer, str, len);
+}
+
+void cbor_write_number(cbor_writer_t* writer, double num) {
+
+    /* Smallest exact encoding: integer, single or double precision float */
+    if (num == floor(num) && fabs(num) < 9007199254740992.0) {
+        if (num >= 0)
+            cbor_put_head(writer, CBOR_UINT, (uint64_t) num);
+        else
+            cbor_put_head(writer, CBOR_NEGINT, (uint64_t) (-1 - num));
+        return;
+    }
+
+    float single = (float) num;
+    if ((double) single == num || isnan(num)) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        cbor_put_byte(writer, CBOR_FLOAT32);
+        cbor_put_be(writer, bits, 4);
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &num, sizeof(bits));
+        cbor_put_byte(writer, CBOR_FLOAT64);
+        cbor_put_be(writer, bits, 8);
+    }
+}
+
+void cbor_write_bool(cbor_writer_t* writer, bool val) {
+    cbor_put_byte(writer, val ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void cbor_write_null(cbor_writer_t* writer) {
+    cbor_put_byte(writer, CBOR_NULL);
+}
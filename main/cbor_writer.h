@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Single pass CBOR (RFC 8949) writer into a fixed buffer.
+ * Maps and arrays use indefinite length so nothing has to be counted
+ * ahead. Like json_writer, a NULL buffer only measures. */
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t len;
+} cbor_writer_t;
+
+/* Start writing into buf, which may be NULL to only measure */
+void cbor_writer_init(cbor_writer_t* writer, uint8_t* buf, size_t size);
+
+
+/* Return the encoded length */
+size_t cbor_writer_finish(cbor_writer_t* writer);
+
+
+/* Structure */
+void cbor_write_map_begin(cbor_writer_t* writer);
+
+void cbor_write_array_begin(cbor_writer_t* writer);
+
+void cbor_write_break(cbor_writer_t* writer);
+
+
+/* Values */
+void cbor_write_string(cbor_writer_t* writer, const char* str);
+
+void cbor_write_number(cbor_writer_t* writer, double num);
+
+void cbor_write_bool(cbor_writer_t* writer, bool val);
+
+void cbor_write_null(cbor_writer_t* writer);
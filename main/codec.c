@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "cbor_reader.h"
+#include "codec.h"
+#include "json_reader.h"
+
+static const char* codec_names[CODEC_COUNT] = {
+    [CODEC_JSON] = "json",
+    [CODEC_CBOR] = "cbor",
+};
+
+const char* codec_name(codec_type_t type) {
+    return (type < CODEC_COUNT) ? codec_names[type] : "unknown";
+}
+
+bool codec_from_name(const char* name, size_t len, codec_type_t* type) {
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (strlen(codec_names[i]) == len && memcmp(codec_names[i], name, len) == 0) {
+            *type = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void codec_writer_init(codec_writer_t* writer, codec_type_t type, void* buf, size_t size) {
+    writer->type = type;
+    if (type == CODEC_CBOR)
+        cbor_writer_init(&writer->cbor, buf, size);
+    else
+        json_writer_init(&writer->json, buf, size);
+}
+
+size_t codec_writer_len(const codec_writer_t* writer) {
+    return (writer->type == CODEC_CBOR) ? writer->cbor.len : writer->json.len;
+}
+
+size_t codec_writer_finish(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        return cbor_writer_finish(&writer->cbor);
+    return json_writer_finish(&writer->json);
+}
+
+void codec_write_map_begin(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_map_begin(&writer->cbor);
+    else
+        json_write_object_begin(&writer->json);
+}
+
+void codec_write_map_end(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_break(&writer->cbor);
+    else
+        json_write_object_end(&writer->json);
+}
+
+void codec_write_array_begin(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_array_begin(&writer->cbor);
+    else
+        json_write_array_begin(&writer->json);
+}
+
+void codec_write_array_end(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_break(&writer->cbor);
+    else
+        json_write_array_end(&writer->json);
+}
+
+void codec_write_key(codec_writer_t* writer, const char* key) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_string(&writer->cbor, key);
+    else
+        json_write_key(&writer->json, key);
+}
+
+void codec_write_string(codec_writer_t* writer, const char* str) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_string(&writer->cbor, str);
+    else
+        json_write_string(&writer->json, str);
+}
+
+void codec_write_number(codec_writer_t* writer, double num) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_number(&writer->cbor, num);
+    else
+        json_write_number(&writer->json, num);
+}
+
+void codec_write_bool(codec_writer_t* writer, bool val) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_bool(&writer->cbor, val);
+    else
+        json_write_bool(&writer->json, val);
+}
+
+void codec_write_null(codec_writer_t* writer) {
+    if (writer->type == CODEC_CBOR)
+        cbor_write_null(&writer->cbor);
+    else
+        json_write_null(&writer->json);
+}
+
+typedef struct {
+    codec_member_cb_t cb;
+    void* ctx;
+    char key_buf[CODEC_STR_MAX];
+    char str_buf[CODEC_STR_MAX];
+} codec_json_walk_t;
+
+static bool codec_json_member(const char* data, const json_token_t* key, const json_token_t* item, void* ctx) {
+    codec_json_walk_t* walk = ctx;
+
+    const char* key_str = data + key->start;
+    size_t key_len = key->end - key->start;
+    if (key->escaped) {
+        int ret = json_token_unescape(data, key, walk->key_buf, sizeof(walk->key_buf));
+        if (ret < 0)
+            return true;
+        key_str = walk->key_buf;
+        key_len = ret;
+    }
+
+    codec_value_t value = { .type = CODEC_VALUE_OTHER };
+    switch (item->type) {
+    case JSON_TOKEN_TRUE:
+    case JSON_TOKEN_FALSE:
+        value.type = CODEC_VALUE_BOOL;
+        value.bool_val = (item->type == JSON_TOKEN_TRUE);
+        break;
+    case JSON_TOKEN_NUMBER:
+        if (json_token_number(data, item, &value.num_val))
+            value.type = CODEC_VALUE_NUMBER;
+        break;
+    case JSON_TOKEN_STRING:
+        value.type = CODEC_VALUE_STRING;
+        value.str = data + item->start;
+        value.str_len = item->end - item->start;
+        if (item->escaped) {
+            int ret = json_token_unescape(data, item, walk->str_buf, sizeof(walk->str_buf));
+            value.type = (ret < 0) ? CODEC_VALUE_OTHER : CODEC_VALUE_STRING;
+            value.str = walk->str_buf;
+            value.str_len = (ret < 0) ? 0 : ret;
+        }
+        break;
+    case JSON_TOKEN_NULL:
+        value.type = CODEC_VALUE_NULL;
+        break;
+    case JSON_TOKEN_OBJECT:
+    case JSON_TOKEN_ARRAY:
+        value.str = data + item->start;
+        value.str_len = item->end - item->start;
+        break;
+    default:
+        break;
+    }
+
+    return walk->cb(key_str, key_len, &value, walk->ctx);
+}
+
+static bool codec_decode_json_map(const char* data, size_t len, codec_member_cb_t cb, void* ctx) {
+    json_token_t tokens[CODEC_JSON_MAX_TOKENS];
+    codec_json_walk_t walk = { .cb = cb, .ctx = ctx };
+
+    /* Too many tokens, e.g. a long channel_ids map: checked, then walked member by member */
+    int count = json_reader_parse(data, len, tokens, CODEC_JSON_MAX_TOKENS);
+    if (count == JSON_READER_ERROR_NOMEM)
+        return json_reader_walk_object(data, len, codec_json_member, &walk);
+
+    if (count <= 0 || tokens[0].type != JSON_TOKEN_OBJECT)
+        return false;
+
+    uint16_t index = 1;
+    for (uint16_t member = 0; member < tokens[0].size; member++) {
+        const json_token_t* key = &tokens[index];
+        const json_token_t* item = &tokens[index + 1];
+        index = item->next;
+
+        if (!codec_json_member(data, key, item, &walk))
+            break;
+    }
+
+    return true;
+}
+
+/* Read every member of the map, calling cb for each unless it is NULL */
+static bool codec_walk_cbor_map(const uint8_t* data, size_t len, codec_member_cb_t cb, void* ctx) {
+    cbor_reader_t reader;
+    cbor_item_t map, key, item;
+
+    cbor_reader_init(&reader, data, len);
+    if (!cbor_read_item(&reader, &map) || map.type != CBOR_ITEM_MAP)
+        return false;
+
+    for (uint64_t i = 0; map.count == CBOR_INDEFINITE_COUNT || i < map.count; i++) {
+        if (!cbor_read_item(&reader, &key))
+            return false;
+        if (key.type == CBOR_ITEM_BREAK && map.count == CBOR_INDEFINITE_COUNT)
+            break;
+        size_t item_start = reader.pos;
+        if (key.type != CBOR_ITEM_TEXT || !cbor_read_item(&reader, &item))
+            return false;
+
+        codec_value_t value = { .type = CODEC_VALUE_OTHER };
+        switch (item.type) {
+        case CBOR_ITEM_BOOL:
+            value.type = CODEC_VALUE_BOOL;
+            value.bool_val = item.bool_val;
+            break;
+        case CBOR_ITEM_UINT:
+            value.type = CODEC_VALUE_NUMBER;
+            value.num_val = (double) item.uint_val;
+            break;
+        case CBOR_ITEM_NEGINT:
+            value.type = CODEC_VALUE_NUMBER;
+            value.num_val = -1.0 - (double) item.uint_val;
+            break;
+        case CBOR_ITEM_FLOAT:
+            value.type = CODEC_VALUE_NUMBER;
+            value.num_val = item.float_val;
+            break;
+        case CBOR_ITEM_TEXT:
+            value.type = CODEC_VALUE_STRING;
+            value.str = item.str.ptr;
+            value.str_len = item.str.len;
+            break;
+        case CBOR_ITEM_NULL:
+            value.type = CODEC_VALUE_NULL;
+            break;
+        default:
+            if (!cbor_skip(&reader, &item))
+                return false;
+            if (item.type == CBOR_ITEM_MAP || item.type == CBOR_ITEM_ARRAY) {
+                value.str = (const char*) data + item_start;
+                value.str_len = reader.pos - item_start;
+            }
+            break;
+        }
+
+        if (cb != NULL && !cb(key.str.ptr, key.str.len, &value, ctx))
+            break;
+    }
+
+    return true;
+}
+
+static bool codec_decode_cbor_map(const uint8_t* data, size_t len, codec_member_cb_t cb, void* ctx) {
+    /* Check the whole map first, a truncated payload calls back for none of its members */
+    if (!codec_walk_cbor_map(data, len, NULL, NULL))
+        return false;
+    return codec_walk_cbor_map(data, len, cb, ctx);
+}
+
+bool codec_decode_map(codec_type_t type, const void* data, size_t len, codec_member_cb_t cb, void* ctx) {
+    if (type == CODEC_CBOR)
+        return codec_decode_cbor_map(data, len, cb, ctx);
+    return codec_decode_json_map(data, len, cb, ctx);
+}
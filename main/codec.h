@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cbor_writer.h"
+#include "json_writer.h"
+
+/* Tokens to decode a JSON map in one pass, nested maps and arrays count, one per
+ * element and two per member. Larger maps are walked member by member instead. */
+#ifndef CODEC_JSON_MAX_TOKENS
+#define CODEC_JSON_MAX_TOKENS           64
+#endif
+
+/* Longest escaped JSON key or string decoded, including NUL */
+#define CODEC_STR_MAX                   64
+
+/* Payload wire formats */
+typedef enum {
+    CODEC_JSON,
+    CODEC_CBOR,
+    CODEC_COUNT,
+} codec_type_t;
+
+/* Encoder for any codec, maps hold key/value pairs written in turn */
+typedef struct {
+    codec_type_t type;
+    union {
+        json_writer_t json;
+        cbor_writer_t cbor;
+    };
+} codec_writer_t;
+
+/* Decoded scalar value, strings point into the input and are not NUL terminated.
+ * OTHER values that are a map or an array carry their encoded bytes in str,
+ * a nested map can be decoded with codec_decode_map. */
+typedef enum {
+    CODEC_VALUE_NULL,
+    CODEC_VALUE_BOOL,
+    CODEC_VALUE_NUMBER,
+    CODEC_VALUE_STRING,
+    CODEC_VALUE_OTHER,
+} codec_value_type_t;
+
+typedef struct {
+    codec_value_type_t type;
+    bool bool_val;
+    double num_val;
+    const char* str;
+    size_t str_len;
+} codec_value_t;
+
+/* Called for each member of a decoded map, return false to stop.
+ * Keys and strings with escapes are decoded into a buffer that only lasts the call. */
+typedef bool (*codec_member_cb_t)(const char* key, size_t key_len, const codec_value_t* value, void* ctx);
+
+/* Codec name on the wire */
+const char* codec_name(codec_type_t type);
+
+
+/* Look up a codec by name */
+bool codec_from_name(const char* name, size_t len, codec_type_t* type);
+
+
+/* Start writing into buf, which may be NULL to only measure */
+void codec_writer_init(codec_writer_t* writer, codec_type_t type, void* buf, size_t size);
+
+
+/* Bytes written so far, may exceed the buffer size */
+size_t codec_writer_len(const codec_writer_t* writer);
+
+
+/* Return the encoded length, JSON output is also NUL terminated */
+size_t codec_writer_finish(codec_writer_t* writer);
+
+
+/* Structure */
+void codec_write_map_begin(codec_writer_t* writer);
+
+void codec_write_map_end(codec_writer_t* writer);
+
+void codec_write_array_begin(codec_writer_t* writer);
+
+void codec_write_array_end(codec_writer_t* writer);
+
+void codec_write_key(codec_writer_t* writer, const char* key);
+
+
+/* Values */
+void codec_write_string(codec_writer_t* writer, const char* str);
+
+void codec_write_number(codec_writer_t* writer, double num);
+
+void codec_write_bool(codec_writer_t* writer, bool val);
+
+void codec_write_null(codec_writer_t* writer);
+
+
+/* Decode a top level map, calling cb for each member with a scalar or OTHER value.
+ * The whole map is checked first, cb is not called for a malformed one. */
+bool codec_decode_map(codec_type_t type, const void* data, size_t len, codec_member_cb_t cb, void* ctx);
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "codec.h"
+#include "command_pipeline.h"
+#include "device.h"
+
+static const char* TAG = "command";
+
+static QueueHandle_t command_queue;
+
+/* Updated from the MQTT task and the worker, every access is atomic */
+static command_pipeline_stats_t g_stats;
+
+static void stats_add(uint32_t* counter, uint32_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static void stats_max(uint32_t* max, uint32_t value) {
+    uint32_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(max, &cur, value, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Convert a decoded value to a command for the channel, false if the types do not match */
+static bool command_from_value(const device_channel_t* channel, const codec_value_t* value, device_command_t* cmd) {
+    cmd->channel_id = channel->id;
+
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        if (value->type != CODEC_VALUE_BOOL)
+            return false;
+        cmd->value.bool_val = value->bool_val;
+        return true;
+
+    case CHANNEL_TYPE_NUMBER:
+        if (value->type != CODEC_VALUE_NUMBER)
+            return false;
+        cmd->value.num_val = (float) value->num_val;
+        return true;
+
+    case CHANNEL_TYPE_CHOICE:
+    case CHANNEL_TYPE_STRING:
+        if (value->type != CODEC_VALUE_STRING || value->str_len >= COMMAND_STR_MAX)
+            return false;
+        memcpy(cmd->value.str_val, value->str, value->str_len);
+        cmd->value.str_val[value->str_len] = '\0';
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* Typed update for the device, str_val points into the command */
+static void command_to_update(const device_command_t* cmd, device_update_t* update) {
+    const device_channel_t* channel = device_get_channel_in(cmd->device, cmd->channel_id);
+    update->channel_id = cmd->channel_id;
+
+    switch (channel != NULL ? channel->type : CHANNEL_TYPE_BOOL) {
+    case CHANNEL_TYPE_NUMBER:
+        update->type = DEVICE_VALUE_NUMBER;
+        update->value.num_val = cmd->value.num_val;
+        break;
+
+    case CHANNEL_TYPE_CHOICE:
+    case CHANNEL_TYPE_STRING:
+        update->type = DEVICE_VALUE_STRING;
+        update->value.str_val = cmd->value.str_val;
+        break;
+
+    default:
+        update->type = DEVICE_VALUE_BOOL;
+        update->value.bool_val = cmd->value.bool_val;
+        break;
+    }
+}
+
+static void command_worker_task(void* arg) {
+    device_command_t batch[COMMAND_BATCH_SIZE];
+    device_update_t updates[COMMAND_BATCH_SIZE];
+
+    for (;;) {
+        if (xQueueReceive(command_queue, &batch[0], portMAX_DELAY) != pdTRUE)
+            continue;
+
+        /* Drain whatever else is already waiting */
+        int count = 1;
+        while (count < COMMAND_BATCH_SIZE && xQueueReceive(command_queue, &batch[count], 0) == pdTRUE)
+            count++;
+
+        /* One validated pass per run of commands for the same device */
+        for (int i = 0; i < count; i++)
+            command_to_update(&batch[i], &updates[i]);
+
+        uint16_t applied = 0;
+        for (int first = 0; first < count; ) {
+            int last = first + 1;
+            while (last < count && batch[last].device == batch[first].device)
+                last++;
+            applied += device_update_channels_in(batch[first].device, &updates[first], last - first);
+            first = last;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (updates[i].status != DEVICE_UPDATE_OK)
+                ESP_LOGW(TAG, "Rejected command for channel %u: %s", updates[i].channel_id,
+                            device_update_status_name(updates[i].status));
+        }
+
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < count; i++) {
+            uint32_t latency = (uint32_t) (now - batch[i].enqueue_time);
+            __atomic_fetch_add(&g_stats.latency_total_us, latency, __ATOMIC_RELAXED);
+            stats_max(&g_stats.latency_max_us, latency);
+        }
+
+        stats_add(&g_stats.applied, applied);
+        stats_add(&g_stats.rejected, count - applied);
+        stats_add(&g_stats.batches, 1);
+        ESP_LOGD(TAG, "Applied %u of %d commands", applied, count);
+    }
+}
+
+bool command_pipeline_start(void) {
+    command_queue = xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(device_command_t));
+    if (command_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create command queue");
+        return false;
+    }
+
+    if (xTaskCreate(command_worker_task, "command", COMMAND_TASK_STACK_SIZE, NULL,
+                    COMMAND_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create command task");
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct {
+    device_t* device;
+    int64_t now;
+    int queued;
+} command_submit_t;
+
+static bool command_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    command_submit_t* submit = ctx;
+    device_command_t cmd;
+
+    /* Keyed by short ID once the server assigned them, by name otherwise */
+    const device_channel_t* channel = device_find_channel_key_in(submit->device, key, key_len);
+    if (channel == NULL || !channel->cmd || !command_from_value(channel, value, &cmd)) {
+        ESP_LOGW(TAG, "Rejected command for channel %.*s", (int) key_len, key);
+        stats_add(&g_stats.rejected, 1);
+        return true;
+    }
+
+    cmd.device = submit->device;
+    cmd.enqueue_time = submit->now;
+    if (xQueueSend(command_queue, &cmd, 0) != pdTRUE) {
+        stats_add(&g_stats.dropped, 1);
+        return true;
+    }
+
+    stats_add(&g_stats.enqueued, 1);
+    submit->queued++;
+    return true;
+}
+
+int command_pipeline_submit_to(device_t* dev, const char* data, size_t data_len) {
+    command_submit_t submit = { .device = dev, .now = esp_timer_get_time() };
+
+    if (!codec_decode_map(device_get_codec(), data, data_len, command_member, &submit)) {
+        ESP_LOGW(TAG, "Invalid command payload");
+        stats_add(&g_stats.rejected, 1);
+        return 0;
+    }
+
+    stats_max(&g_stats.depth_max, uxQueueMessagesWaiting(command_queue));
+
+    return submit.queued;
+}
+
+int command_pipeline_submit(const char* data, size_t data_len) {
+    return command_pipeline_submit_to(device_get_self(), data, data_len);
+}
+
+void command_pipeline_get_stats(command_pipeline_stats_t* stats) {
+    stats->enqueued = __atomic_load_n(&g_stats.enqueued, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&g_stats.dropped, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&g_stats.rejected, __ATOMIC_RELAXED);
+    stats->applied = __atomic_load_n(&g_stats.applied, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&g_stats.batches, __ATOMIC_RELAXED);
+    stats->depth_max = __atomic_load_n(&g_stats.depth_max, __ATOMIC_RELAXED);
+    stats->latency_max_us = __atomic_load_n(&g_stats.latency_max_us, __ATOMIC_RELAXED);
+    stats->latency_total_us = __atomic_load_n(&g_stats.latency_total_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/* Pending commands, further commands are dropped while the queue is full */
+#define COMMAND_QUEUE_LENGTH            32
+
+/* Maximum commands applied per worker wake-up */
+#define COMMAND_BATCH_SIZE              8
+
+/* Maximum string/choice value length, including NUL */
+#define COMMAND_STR_MAX                 32
+
+#define COMMAND_TASK_STACK_SIZE         3072
+#define COMMAND_TASK_PRIORITY           5
+
+/* Parsed command for one channel */
+typedef struct {
+    device_t* device;
+    uint16_t channel_id;
+    int64_t enqueue_time;
+
+    union {
+        bool bool_val;
+        float num_val;
+        char str_val[COMMAND_STR_MAX];
+    } value;
+} device_command_t;
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t dropped;
+    uint32_t rejected;
+    uint32_t applied;
+    uint32_t batches;
+    uint32_t depth_max;
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+} command_pipeline_stats_t;
+
+/* Create the command queue and worker task */
+bool command_pipeline_start(void);
+
+
+/* Parse a command payload and queue one command per channel.
+ * Called from the MQTT task, never blocks. Returns the number queued. */
+int command_pipeline_submit(const char* data, size_t data_len);
+
+/* Same as above for another device, e.g. a gateway sub-device */
+int command_pipeline_submit_to(device_t* dev, const char* data, size_t data_len);
+
+
+/* Get pipeline counters */
+void command_pipeline_get_stats(command_pipeline_stats_t* stats);
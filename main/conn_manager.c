@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+
+#include "device_port.h"
+#endif
+
+#include "conn_manager.h"
+#include "metrics.h"
+
+void conn_init(conn_t* conn, const conn_ops_t* ops, bool ap_known) {
+    memset(conn, 0, sizeof(conn_t));
+    conn->ops = ops;
+    conn->state = CONN_STATE_IDLE;
+    conn->ap_known = ap_known;
+
+    conn->wifi_reconnect = metrics_histogram("wifi_reconnect");
+    conn->mqtt_reconnect = metrics_histogram("mqtt_reconnect");
+}
+
+uint32_t conn_backoff_ms(const conn_t* conn, uint16_t attempt) {
+    uint32_t delay = CONN_BACKOFF_MAX_MS;
+    if (attempt < 16 && ((uint32_t) CONN_BACKOFF_BASE_MS << attempt) < CONN_BACKOFF_MAX_MS)
+        delay = (uint32_t) CONN_BACKOFF_BASE_MS << attempt;
+
+    /* A fleet that lost the same access point spreads out instead of retrying in step */
+    return delay / 2 + conn->ops->random(conn->ops->ctx) % (delay / 2 + 1);
+}
+
+const char* conn_state_name(conn_state_t state) {
+    switch (state) {
+    case CONN_STATE_IDLE:               return "idle";
+    case CONN_STATE_WIFI_CONNECTING:    return "wifi connecting";
+    case CONN_STATE_WIFI_BACKOFF:       return "wifi backoff";
+    case CONN_STATE_WIFI_CONNECTED:     return "wifi connected";
+    case CONN_STATE_MQTT_CONNECTING:    return "mqtt connecting";
+    case CONN_STATE_MQTT_BACKOFF:       return "mqtt backoff";
+    case CONN_STATE_CONNECTED:          return "connected";
+    default:                            return "unknown";
+    }
+}
+
+/* Histograms take microseconds, saturated past about 71 minutes */
+static void conn_observe_since(metric_t* metric, int64_t since_us, int64_t now_us) {
+    int64_t elapsed_us = now_us - since_us;
+    metrics_observe_us(metric, (elapsed_us > UINT32_MAX) ? UINT32_MAX : (uint32_t) elapsed_us);
+}
+
+static void conn_wifi_connect(conn_t* conn) {
+    conn->fast = conn->ap_known && conn->attempts < CONN_FAST_PATH_ATTEMPTS;
+    conn->stats.wifi_attempts++;
+    if (conn->fast)
+        conn->stats.fast_attempts++;
+
+    conn->state = CONN_STATE_WIFI_CONNECTING;
+    conn->ops->wifi_connect(conn->ops->ctx, conn->fast);
+}
+
+static void conn_mqtt_connect(conn_t* conn) {
+    conn->stats.mqtt_attempts++;
+    conn->state = CONN_STATE_MQTT_CONNECTING;
+    conn->ops->mqtt_connect(conn->ops->ctx);
+}
+
+static void conn_backoff(conn_t* conn, conn_state_t state) {
+    conn->stats.backoff_ms = conn_backoff_ms(conn, conn->attempts);
+    conn->state = state;
+    conn->ops->set_timer(conn->ops->ctx, conn->stats.backoff_ms);
+}
+
+static void conn_wifi_lost(conn_t* conn, int64_t now) {
+    bool was_up = conn->state >= CONN_STATE_WIFI_CONNECTED;
+
+    if (conn->state >= CONN_STATE_MQTT_CONNECTING)
+        conn->ops->mqtt_stop(conn->ops->ctx);
+
+    if (was_up) {
+        /* A fresh loss, start over from the shortest delay and the fast path */
+        conn->stats.wifi_losses++;
+        conn->attempts = 0;
+        conn->wifi_down_us = now;
+        if (conn->link_down_us == 0)
+            conn->link_down_us = now;
+    } else {
+        /* The remembered access point may have moved, scan from now on */
+        if (conn->fast)
+            conn->stats.fast_failures++;
+        conn->attempts++;
+    }
+
+    conn_backoff(conn, CONN_STATE_WIFI_BACKOFF);
+}
+
+static void conn_mqtt_lost(conn_t* conn, int64_t now) {
+    if (conn->state == CONN_STATE_CONNECTED) {
+        conn->stats.mqtt_losses++;
+        conn->attempts = 0;
+        conn->link_down_us = now;
+    } else {
+        conn->attempts++;
+    }
+
+    conn_backoff(conn, CONN_STATE_MQTT_BACKOFF);
+}
+
+void conn_handle(conn_t* conn, conn_event_t event) {
+    int64_t now = conn->ops->now_us(conn->ops->ctx);
+
+    switch (event) {
+    case CONN_EVENT_START:
+        if (conn->state != CONN_STATE_IDLE)
+            break;
+
+        /* The first connection counts as a reconnect from boot */
+        conn->attempts = 0;
+        conn->wifi_down_us = now;
+        conn->link_down_us = now;
+        conn_wifi_connect(conn);
+        break;
+
+    case CONN_EVENT_WIFI_CONNECTED:
+        if (conn->state == CONN_STATE_WIFI_CONNECTING) {
+            conn->ap_known = true;
+            conn->state = CONN_STATE_WIFI_CONNECTED;
+        }
+        break;
+
+    case CONN_EVENT_GOT_IP:
+        if (conn->state != CONN_STATE_WIFI_CONNECTING && conn->state != CONN_STATE_WIFI_CONNECTED)
+            break;
+
+        if (conn->wifi_down_us != 0)
+            conn_observe_since(conn->wifi_reconnect, conn->wifi_down_us, now);
+        conn->wifi_down_us = 0;
+        conn->attempts = 0;
+        conn_mqtt_connect(conn);
+        break;
+
+    case CONN_EVENT_WIFI_DISCONNECTED:
+        if (conn->state != CONN_STATE_IDLE)
+            conn_wifi_lost(conn, now);
+        break;
+
+    case CONN_EVENT_MQTT_CONNECTED:
+        if (conn->state != CONN_STATE_MQTT_CONNECTING)
+            break;
+
+        if (conn->link_down_us != 0)
+            conn_observe_since(conn->mqtt_reconnect, conn->link_down_us, now);
+        conn->link_down_us = 0;
+        conn->attempts = 0;
+        conn->state = CONN_STATE_CONNECTED;
+        break;
+
+    case CONN_EVENT_MQTT_DISCONNECTED:
+        /* Ignored while Wi-Fi is down, MQTT was stopped on purpose */
+        if (conn->state == CONN_STATE_MQTT_CONNECTING || conn->state == CONN_STATE_CONNECTED)
+            conn_mqtt_lost(conn, now);
+        break;
+
+    case CONN_EVENT_TIMER:
+        if (conn->state == CONN_STATE_WIFI_BACKOFF)
+            conn_wifi_connect(conn);
+        else if (conn->state == CONN_STATE_MQTT_BACKOFF)
+            conn_mqtt_connect(conn);
+        break;
+
+    default:
+        break;
+    }
+}
+
+#ifdef ESP_PLATFORM
+static const char* TAG = "conn";
+
+/* Last access point, kept for the fast path */
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+} conn_ap_t;
+
+#define CONN_AP_NVS_KEY         "conn_ap"
+
+static conn_t g_conn;
+static conn_ops_t g_conn_ops;
+static conn_ap_t g_ap;
+static QueueHandle_t g_conn_queue;
+static esp_timer_handle_t g_conn_timer;
+static conn_mqtt_action_t g_mqtt_connect;
+static conn_mqtt_action_t g_mqtt_stop;
+static bool g_mqtt_running;
+
+static void esp_wifi_connect_to(void* ctx, bool fast) {
+    wifi_config_t cfg;
+    if (esp_wifi_get_config(WIFI_IF_STA, &cfg) == ESP_OK) {
+        cfg.sta.bssid_set = fast;
+        if (fast)
+            memcpy(cfg.sta.bssid, g_ap.bssid, sizeof(g_ap.bssid));
+        cfg.sta.channel = fast ? g_ap.channel : 0;
+        esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    }
+
+    ESP_LOGI(TAG, "Wi-Fi connecting%s", fast ? " to the last access point" : "");
+    esp_wifi_connect();
+}
+
+static void esp_mqtt_connect(void* ctx) {
+    g_mqtt_running = true;
+    g_mqtt_connect();
+}
+
+static void esp_mqtt_stop(void* ctx) {
+    if (g_mqtt_running)
+        g_mqtt_stop();
+    g_mqtt_running = false;
+}
+
+static void esp_set_timer(void* ctx, uint32_t ms) {
+    esp_timer_stop(g_conn_timer);
+    esp_timer_start_once(g_conn_timer, (uint64_t) ms * 1000);
+    ESP_LOGI(TAG, "Retrying in %u ms", (unsigned) ms);
+}
+
+static uint32_t esp_random_u32(void* ctx) {
+    return esp_random();
+}
+
+static int64_t esp_now_us(void* ctx) {
+    return esp_timer_get_time();
+}
+
+static void conn_timer_callback(void* arg) {
+    conn_manager_post(CONN_EVENT_TIMER);
+}
+
+static void conn_task(void* arg) {
+    for (;;) {
+        conn_event_t event;
+        if (xQueueReceive(g_conn_queue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        conn_state_t state = g_conn.state;
+        conn_handle(&g_conn, event);
+        if (g_conn.state != state)
+            ESP_LOGI(TAG, "%s -> %s", conn_state_name(state), conn_state_name(g_conn.state));
+    }
+}
+
+bool conn_manager_start(conn_mqtt_action_t mqtt_connect, conn_mqtt_action_t mqtt_stop) {
+    g_mqtt_connect = mqtt_connect;
+    g_mqtt_stop = mqtt_stop;
+
+    g_conn_ops.wifi_connect = esp_wifi_connect_to;
+    g_conn_ops.mqtt_connect = esp_mqtt_connect;
+    g_conn_ops.mqtt_stop = esp_mqtt_stop;
+    g_conn_ops.set_timer = esp_set_timer;
+    g_conn_ops.random = esp_random_u32;
+    g_conn_ops.now_us = esp_now_us;
+
+    size_t len = sizeof(g_ap);
+    bool ap_known = device_port_get_blob(CONN_AP_NVS_KEY, &g_ap, &len) && len == sizeof(g_ap);
+    conn_init(&g_conn, &g_conn_ops, ap_known);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = conn_timer_callback,
+        .name = "conn",
+    };
+
+    g_conn_queue = xQueueCreate(CONN_EVENT_QUEUE_LENGTH, sizeof(conn_event_t));
+    if (g_conn_queue == NULL || esp_timer_create(&timer_args, &g_conn_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to allocate connection manager");
+        return false;
+    }
+
+    if (xTaskCreate(conn_task, "conn", CONN_TASK_STACK_SIZE, NULL,
+                    CONN_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create connection task");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Started, last access point %s", ap_known ? "known" : "unknown");
+    return true;
+}
+
+void conn_manager_post(conn_event_t event) {
+    if (g_conn_queue != NULL && xQueueSend(g_conn_queue, &event, 0) != pdTRUE)
+        ESP_LOGW(TAG, "Event %d dropped", event);
+}
+
+void conn_manager_wifi_connected(const uint8_t bssid[6], uint8_t channel) {
+    conn_ap_t ap = { .channel = channel };
+    memcpy(ap.bssid, bssid, sizeof(ap.bssid));
+
+    /* Written only when it changed, roaming between two APs still wears little */
+    if (memcmp(&ap, &g_ap, sizeof(ap)) != 0) {
+        g_ap = ap;
+        device_port_set_blob(CONN_AP_NVS_KEY, &ap, sizeof(ap));
+    }
+
+    conn_manager_post(CONN_EVENT_WIFI_CONNECTED);
+}
+
+conn_state_t conn_manager_get_state(void) {
+    return g_conn.state;
+}
+
+void conn_manager_get_stats(conn_stats_t* stats) {
+    *stats = g_conn.stats;
+}
+#endif
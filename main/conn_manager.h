@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+/* Retry delays double from the base up to the cap, each one jittered over its upper half */
+#define CONN_BACKOFF_BASE_MS            1000
+#define CONN_BACKOFF_MAX_MS             60000
+
+/* Attempts after a loss that go straight to the last access point before scanning */
+#define CONN_FAST_PATH_ATTEMPTS         1
+
+#define CONN_EVENT_QUEUE_LENGTH         8
+
+#define CONN_TASK_STACK_SIZE            3072
+#define CONN_TASK_PRIORITY              4
+
+typedef enum {
+    CONN_STATE_IDLE,
+    CONN_STATE_WIFI_CONNECTING,
+    CONN_STATE_WIFI_BACKOFF,
+    CONN_STATE_WIFI_CONNECTED,          /* associated, waiting for an address */
+    CONN_STATE_MQTT_CONNECTING,
+    CONN_STATE_MQTT_BACKOFF,
+    CONN_STATE_CONNECTED,
+} conn_state_t;
+
+typedef enum {
+    CONN_EVENT_START,
+    CONN_EVENT_WIFI_CONNECTED,
+    CONN_EVENT_WIFI_DISCONNECTED,       /* link lost or connection attempt failed */
+    CONN_EVENT_GOT_IP,
+    CONN_EVENT_MQTT_CONNECTED,
+    CONN_EVENT_MQTT_DISCONNECTED,       /* session lost or connection attempt failed */
+    CONN_EVENT_TIMER,                   /* the timer set by set_timer expired */
+} conn_event_t;
+
+/* Link actions, called from whatever task runs conn_handle */
+typedef struct {
+    /* Connect the station, fast goes to the remembered BSSID and channel without scanning */
+    void (*wifi_connect)(void* ctx, bool fast);
+    void (*mqtt_connect)(void* ctx);
+    void (*mqtt_stop)(void* ctx);
+
+    /* One-shot timer delivering CONN_EVENT_TIMER, replaces the pending one */
+    void (*set_timer)(void* ctx, uint32_t ms);
+
+    uint32_t (*random)(void* ctx);
+    int64_t (*now_us)(void* ctx);
+    void* ctx;
+} conn_ops_t;
+
+typedef struct {
+    uint32_t wifi_losses;
+    uint32_t mqtt_losses;               /* sessions lost with Wi-Fi still up */
+    uint32_t wifi_attempts;
+    uint32_t mqtt_attempts;
+    uint32_t fast_attempts;
+    uint32_t fast_failures;
+    uint32_t backoff_ms;                /* last delay chosen */
+} conn_stats_t;
+
+/* Wi-Fi and MQTT connection state machine, one event at a time */
+typedef struct {
+    const conn_ops_t* ops;
+    conn_state_t state;
+    bool ap_known;                      /* a BSSID and channel are remembered */
+    bool fast;                          /* the current attempt uses them */
+    uint16_t attempts;                  /* failed attempts since the last loss */
+
+    int64_t wifi_down_us;               /* 0 while Wi-Fi is up */
+    int64_t link_down_us;               /* 0 while MQTT is connected */
+
+    conn_stats_t stats;
+    metric_t* wifi_reconnect;           /* loss or boot to IP address */
+    metric_t* mqtt_reconnect;           /* loss or boot to MQTT connected */
+} conn_t;
+
+/* Prepare the state machine, ap_known when a BSSID and channel were saved */
+void conn_init(conn_t* conn, const conn_ops_t* ops, bool ap_known);
+
+
+/* Feed one event, actions go through the ops */
+void conn_handle(conn_t* conn, conn_event_t event);
+
+
+/* Jittered delay before the given retry, attempt 0 follows the loss */
+uint32_t conn_backoff_ms(const conn_t* conn, uint16_t attempt);
+
+
+const char* conn_state_name(conn_state_t state);
+
+
+/* ESP-IDF binding: one task runs the state machine, the last access point is kept in NVS */
+
+typedef void (*conn_mqtt_action_t)(void);
+
+/* Start the connection task, MQTT actions are run from it */
+bool conn_manager_start(conn_mqtt_action_t mqtt_connect, conn_mqtt_action_t mqtt_stop);
+
+
+/* Queue an event, from event handlers */
+void conn_manager_post(conn_event_t event);
+
+
+/* Station associated, remembers the access point for the fast path */
+void conn_manager_wifi_connected(const uint8_t bssid[6], uint8_t channel);
+
+
+/* Get the state and counters */
+conn_state_t conn_manager_get_state(void);
+
+void conn_manager_get_stats(conn_stats_t* stats);
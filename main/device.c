@@ -1,67 +1,382 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
-#include <cJSON.h>
 
-#include <esp_wifi.h>
 #include <esp_log.h>
-#include <nvs.h>
 
+#include "arena.h"
+#include "codec.h"
 #include "device.h"
+#include "device_port.h"
+#include "log_sink.h"
+#include "metrics.h"
 
+/* The device this board represents, gateway sub-devices come from device_create */
 static device_t g_device;
 
+/* Serializes value writers of every device, readers go through value_seq */
+static void* g_value_lock;
+
+/* Channel value change listeners */
+static struct {
+    device_change_cb_t cb;
+    void* ctx;
+} g_change_listeners[DEVICE_MAX_CHANGE_LISTENERS];
+static uint8_t g_change_listener_count;
+
+/* Follows channels added to or removed from the board's device */
+static struct {
+    device_schema_cb_t cb;
+    void* ctx;
+} g_schema_listener;
+
+/* Device API timings, registered by device_init */
+static metric_t* g_metric_set_value;
+static metric_t* g_metric_prov_parse;
+static metric_t* g_metric_prov_serialize;
+static metric_t* g_metric_read_retries;
+static metric_t* g_metric_read_locked;
+
 static const char* TAG = "device";
 
-void print_device_channels(void) {
-    device_channel_t* temp = g_device.channels;
-    ESP_LOGI(TAG, "Device channels:");
+/* Initial number of hash buckets in the channel name index */
+#define CHANNEL_HASH_BUCKETS_MIN        16
+
+/* Lock-free read attempts before a reader waits for the writer lock */
+#define VALUE_READ_RETRIES              8
+
+#if (DEVICE_AGGREGATE_WINDOWS & (DEVICE_AGGREGATE_WINDOWS - 1)) != 0 || DEVICE_AGGREGATE_WINDOWS > 128
+#error "DEVICE_AGGREGATE_WINDOWS must be a power of two up to 128"
+#endif
+
+/* Samples of the open window and a ring of closed ones. Writers fill the open
+ * window and push with the writer lock held, the reporter pops without it. */
+struct device_aggregate_t {
+    uint32_t window_ms;
+    int64_t start_us;           /* first sample of the open window */
+    uint32_t count;             /* samples in the open window, 0 when none */
+    float min;
+    float max;
+    float sum;
+    float last;
+
+    device_window_t ring[DEVICE_AGGREGATE_WINDOWS];
+    uint8_t head;               /* free running, written by writers */
+    uint8_t tail;               /* free running, written by the reporter */
+    uint8_t reported;           /* windows visited by the last report, consumed once it is sent */
+};
+
+/* FNV-1a hash of the channel name */
+static uint32_t channel_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    while (temp != NULL) {
-        printf("%10s:\n", temp->name);
-        printf("        type: %d\n", temp->type);
-        printf("         cmd: %d\n", temp->cmd);
-        
-        switch (temp->type) {
-        case CHANNEL_TYPE_BOOL:
-            printf("       value: %s\n", (temp->data_value.bool_val) ? "true" : "false");
-            break;
+/* Move the hash chains into zeroed buckets, bucket_count is a power of two */
+static void channel_index_rehash_into(device_t* dev, device_channel_t** buckets, uint16_t bucket_count) {
+    for (uint16_t i = 0; i < dev->hash_bucket_count; i++) {
+        device_channel_t* temp = dev->hash_buckets[i];
+        while (temp != NULL) {
+            device_channel_t* next = temp->hash_next;
+            uint16_t bucket = channel_name_hash(temp->name) & (bucket_count - 1);
+            temp->hash_next = buckets[bucket];
+            buckets[bucket] = temp;
+            temp = next;
+        }
+    }
+}
 
-        case CHANNEL_TYPE_NUMBER:
-            printf("         min: %.2f\n", temp->prov_data.num_prov.min);
-            printf("         max: %.2f\n", temp->prov_data.num_prov.max);
-            printf("     multiof: %.2f\n", temp->prov_data.num_prov.multipleof);
-            printf("       value: %.2f\n", temp->data_value.num_val);
-            break;
+static bool channel_index_rehash(device_t* dev, uint16_t bucket_count) {
+    device_channel_t** buckets = calloc(bucket_count, sizeof(device_channel_t*));
+    if (buckets == NULL)
+        return false;
 
-        case CHANNEL_TYPE_CHOICE: {
-            prov_opt_list_t* temp_opt = temp->prov_data.opts_prov;
-            printf("        enum:\n");
-            while(temp_opt != NULL) {
-                printf("              %s\n", temp_opt->opt);
-                temp_opt = temp_opt->next;
-            }
-            printf("       value: %s\n", (temp->data_value.str_val != NULL) ? temp->data_value.str_val : "null");
-            break;
+    channel_index_rehash_into(dev, buckets, bucket_count);
+    free(dev->hash_buckets);
+    dev->hash_buckets = buckets;
+    dev->hash_bucket_count = bucket_count;
+    return true;
+}
+
+/* Assign a stable ID to the channel and add it to the name index. A sealed
+ * index no longer moves, readers may be using it: it takes what room it has. */
+static bool channel_index_insert(device_t* dev, device_channel_t* channel) {
+    if (dev->channel_count == DEVICE_CHANNEL_ID_INVALID)
+        return false;
+
+    if (dev->index_in_arena && dev->channel_count == dev->channel_table_size)
+        return false;
+
+    if (dev->channel_count == dev->channel_table_size) {
+        uint16_t size = dev->channel_table_size ? dev->channel_table_size * 2 : CHANNEL_HASH_BUCKETS_MIN;
+        device_channel_t** table = realloc(dev->channel_table, size * sizeof(device_channel_t*));
+        if (table == NULL)
+            return false;
+        dev->channel_table = table;
+
+        uint16_t old_words = (dev->channel_table_size + 31) / 32;
+        uint16_t words = (size + 31) / 32;
+        uint32_t* bitmap = realloc(dev->changed_bitmap, words * sizeof(uint32_t));
+        if (bitmap == NULL)
+            return false;
+        memset(bitmap + old_words, 0, (words - old_words) * sizeof(uint32_t));
+        dev->changed_bitmap = bitmap;
+        dev->channel_table_size = size;
+    }
+
+    /* Keep the load factor at or below 1, a sealed index was sized for its room */
+    if (dev->channel_count >= dev->hash_bucket_count && !dev->index_in_arena) {
+        uint16_t bucket_count = dev->hash_bucket_count ? dev->hash_bucket_count * 2 : CHANNEL_HASH_BUCKETS_MIN;
+        if (!channel_index_rehash(dev, bucket_count))
+            return false;
+    }
+
+    channel->id = dev->channel_count++;
+    __atomic_store_n(&dev->channel_table[channel->id], channel, __ATOMIC_RELAXED);
+
+    uint16_t bucket = channel_name_hash(channel->name) & (dev->hash_bucket_count - 1);
+    channel->hash_next = dev->hash_buckets[bucket];
+    dev->hash_buckets[bucket] = channel;
+    return true;
+}
+
+static device_channel_t* channel_index_find(const device_t* dev, const char* name) {
+    if (dev->hash_bucket_count == 0)
+        return NULL;
+
+    device_channel_t* temp = dev->hash_buckets[channel_name_hash(name) & (dev->hash_bucket_count - 1)];
+    while (temp != NULL && strcmp(temp->name, name) != 0)
+        temp = temp->hash_next;
+
+    return temp;
+}
+
+/* Remove the channel from the name index, its ID is never reused */
+static void channel_index_remove(device_t* dev, device_channel_t* channel) {
+    device_channel_t** link = &dev->hash_buckets[channel_name_hash(channel->name) & (dev->hash_bucket_count - 1)];
+    while (*link != channel)
+        link = &(*link)->hash_next;
+    *link = channel->hash_next;
+
+    /* The reporter loads slots without the lock */
+    __atomic_store_n(&dev->channel_table[channel->id], NULL, __ATOMIC_RELAXED);
+    __atomic_fetch_and(&dev->changed_bitmap[channel->id / 32], ~(1u << (channel->id % 32)), __ATOMIC_RELAXED);
+}
+
+/* Decimal keys are short IDs, a name made of digits only could not be told apart */
+static bool channel_name_valid(const char* name) {
+    for (const char* c = name; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9')
+            return true;
+    }
+    return false;
+}
+
+/* Allocate a channel from the schema arena, the name is used as is */
+static device_channel_t* device_alloc_channel(device_t* dev, const char* name, bool cmd, channel_type_t type) {
+    if (!channel_name_valid(name)) {
+        ESP_LOGE(TAG, "Channel name \"%s\" must not be empty or all digits", name);
+        return NULL;
+    }
+
+    if (channel_index_find(dev, name) != NULL) {
+        ESP_LOGE(TAG, "Channel %s already exists", name);
+        return NULL;
+    }
+
+    device_channel_t* new_channel = arena_alloc(&dev->arena, sizeof(device_channel_t));
+    if (new_channel == NULL) {
+        ESP_LOGE(TAG, "No schema space for channel %s (sealed: %d)", name, dev->arena.sealed);
+        return NULL;
+    }
+
+    memset(new_channel, 0, sizeof(device_channel_t));
+    new_channel->short_id = DEVICE_CHANNEL_ID_INVALID;
+    new_channel->name = name;
+    new_channel->cmd = cmd;
+    new_channel->type = type;
+    return new_channel;
+}
+
+/* Allocate a channel and a copy of its name from the schema arena */
+static device_channel_t* device_new_channel(device_t* dev, const char* name, bool cmd, channel_type_t type) {
+    size_t mark = arena_mark(&dev->arena);
+    device_channel_t* new_channel = device_alloc_channel(dev, name, cmd, type);
+    if (new_channel == NULL)
+        return NULL;
+
+    new_channel->name = arena_strdup(&dev->arena, name);
+    if (new_channel->name == NULL) {
+        ESP_LOGE(TAG, "No schema space for channel %s (sealed: %d)", name, dev->arena.sealed);
+        arena_reset(&dev->arena, mark);
+        return NULL;
+    }
+    return new_channel;
+}
+
+/* Bump the schema version, logging the change once the server holds a version to diff against */
+static void schema_record(device_t* dev, const device_channel_t* channel, bool added) {
+    dev->schema_version++;
+    if (dev->schema_acked == 0)
+        return;
+
+    if (dev->schema_log == NULL) {
+        dev->schema_log = calloc(DEVICE_SCHEMA_LOG_SIZE, sizeof(device_schema_change_t));
+        if (dev->schema_log == NULL) {
+            dev->schema_log_base = dev->schema_version;
+            return;
         }
+    }
 
-        case CHANNEL_TYPE_STRING:
-            printf("       value: %s\n", (temp->data_value.str_val != NULL) ? temp->data_value.str_val : "null");
-            break;
+    device_schema_change_t* change = &dev->schema_log[dev->schema_version % DEVICE_SCHEMA_LOG_SIZE];
+    change->channel = channel;
+    change->added = added;
 
-        default:
-            break;
+    /* The oldest change was overwritten */
+    if (dev->schema_version - dev->schema_log_base > DEVICE_SCHEMA_LOG_SIZE)
+        dev->schema_log_base = dev->schema_version - DEVICE_SCHEMA_LOG_SIZE;
+}
+
+/* Start the version history over, nothing before version is logged */
+static void schema_rebase(device_t* dev, uint32_t version, bool acked) {
+    dev->schema_version = version;
+    dev->schema_acked = acked ? version : 0;
+    dev->schema_sent = 0;
+    dev->schema_sent_delta = false;
+    dev->schema_log_base = version;
+}
+
+/* Make room to retire count more buffers, values are locked */
+static bool retired_reserve(device_t* dev, uint16_t count) {
+    if (count == 0)
+        return true;
+
+    void** retired = realloc(dev->retired, (dev->retired_count + count) * sizeof(void*));
+    if (retired == NULL)
+        return false;
+    dev->retired = retired;
+    return true;
+}
+
+/* Keep a buffer readers may still be copying from until the device is released */
+static void retired_add(device_t* dev, void* buf, size_t size) {
+    dev->retired[dev->retired_count++] = buf;
+    dev->retired_size += size;
+}
+
+/* Open a write section, values are locked */
+static void device_write_begin(device_t* dev) {
+    __atomic_store_n(&dev->value_seq, dev->value_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void device_write_end(device_t* dev) {
+    __atomic_store_n(&dev->value_seq, dev->value_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Link a newly created channel into the device. Readers and the reporter may
+ * already be running, the index changes inside a write section. */
+static bool device_add_channel(device_t* dev, device_channel_t* new_channel) {
+    uint32_t window_ms = (new_channel->type == CHANNEL_TYPE_NUMBER) ? new_channel->prov_data.num_prov.window_ms : 0;
+    if (window_ms > 0) {
+        new_channel->aggregate = calloc(1, sizeof(device_aggregate_t));
+        if (new_channel->aggregate == NULL) {
+            ESP_LOGE(TAG, "No memory for aggregation of channel %s", new_channel->name);
+            return false;
         }
+        new_channel->aggregate->window_ms = window_ms;
+    }
 
-        printf("\n");
-        temp = temp->next;
+    device_lock();
+    device_write_begin(dev);
+    bool indexed = channel_index_insert(dev, new_channel);
+    if (indexed) {
+        if (new_channel->aggregate != NULL)
+            dev->aggregate_count++;
+
+        new_channel->next = dev->channels;
+        dev->channels = new_channel;
+        schema_record(dev, new_channel, true);
+    }
+    device_write_end(dev);
+    device_unlock();
+
+    if (!indexed) {
+        ESP_LOGE(TAG, "Failed to index channel %s (sealed: %d)", new_channel->name, dev->index_in_arena);
+        free(new_channel->aggregate);
+        new_channel->aggregate = NULL;
     }
+    return indexed;
+}
+
+/* Add a channel allocated after mark, its arena space is given back if that fails */
+static bool device_commit_channel(device_t* dev, device_channel_t* new_channel, size_t mark) {
+    if (device_add_channel(dev, new_channel))
+        return true;
+
+    arena_reset(&dev->arena, mark);
+    return false;
+}
+
+/* Tell the schema listener the board's channels changed, outside the lock */
+static void schema_changed(void) {
+    if (g_schema_listener.cb != NULL)
+        g_schema_listener.cb(g_schema_listener.ctx);
+}
+
+/* One line per channel, the options of a choice channel follow on their own lines */
+static void channel_log(esp_log_level_t level, const device_channel_t* channel) {
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        log_sink_write(level, TAG, "%10s: type %d cmd %d value %s", channel->name, channel->type, channel->cmd,
+                    (channel->data_value.bool_val) ? "true" : "false");
+        break;
+
+    case CHANNEL_TYPE_NUMBER:
+        log_sink_write(level, TAG, "%10s: type %d cmd %d min %.2f max %.2f multiof %.2f value %.2f",
+                    channel->name, channel->type, channel->cmd,
+                    channel->prov_data.num_prov.min, channel->prov_data.num_prov.max,
+                    channel->prov_data.num_prov.multipleof, channel->data_value.num_val);
+        break;
+
+    case CHANNEL_TYPE_CHOICE:
+        log_sink_write(level, TAG, "%10s: type %d cmd %d value %s", channel->name, channel->type, channel->cmd,
+                    (channel->data_value.str_val != NULL) ? channel->data_value.str_val : "null");
+        for (uint8_t i = 0; i < channel->prov_data.opts_prov.count; i++)
+            log_sink_write(level, TAG, "            enum %s", channel->prov_data.opts_prov.opts[i]);
+        break;
+
+    case CHANNEL_TYPE_STRING:
+        log_sink_write(level, TAG, "%10s: type %d cmd %d value %s", channel->name, channel->type, channel->cmd,
+                    (channel->data_value.str_val != NULL) ? channel->data_value.str_val : "null");
+        break;
+
+    default:
+        break;
+    }
+}
+
+void print_device_channels(void) {
+    if (!log_sink_enabled(ESP_LOG_INFO))
+        return;
+
+    LOG_SINK_I(TAG, "Device channels:");
+
+    device_lock();
+    for (device_channel_t* temp = g_device.channels; temp != NULL; temp = temp->next)
+        channel_log(ESP_LOG_INFO, temp);
+    device_unlock();
 }
 
 void get_device_id(char* id_buffer) {
     uint8_t eth_mac[6];
-    esp_wifi_get_mac(WIFI_IF_STA, eth_mac);
+    device_port_get_mac(eth_mac);
     sprintf(
         id_buffer,
         "%02X%02X%02X%02X%02X%02X",
@@ -69,273 +384,1598 @@ void get_device_id(char* id_buffer) {
     );
 }
 
+/* FNV-1a over the schema fields the server is told about */
+static uint32_t fingerprint_update(uint32_t hash, const void* data, size_t len) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t fingerprint_update_str(uint32_t hash, const char* str) {
+    /* Include the NUL so "ab","c" and "a","bc" differ */
+    return fingerprint_update(hash, str, strlen(str) + 1);
+}
+
+uint32_t device_get_schema_fingerprint_in(const device_t* dev) {
+    uint32_t hash = 2166136261u;
+
+    hash = fingerprint_update_str(hash, dev->name);
+
+    /* ID order, independent of list order */
+    for (uint16_t id = 0; id < dev->channel_count; id++) {
+        const device_channel_t* channel = dev->channel_table[id];
+        if (channel == NULL)
+            continue;
+
+        uint8_t header[2] = { channel->type, channel->cmd };
+        hash = fingerprint_update_str(hash, channel->name);
+        hash = fingerprint_update(hash, header, sizeof(header));
+
+        if (channel->type == CHANNEL_TYPE_NUMBER) {
+            /* The window only counts when set, schemas without one keep their fingerprint */
+            const prov_num_type_t* num_prov = &channel->prov_data.num_prov;
+            hash = fingerprint_update(hash, num_prov, offsetof(prov_num_type_t, window_ms));
+            if (num_prov->window_ms > 0)
+                hash = fingerprint_update(hash, &num_prov->window_ms, sizeof(num_prov->window_ms));
+        } else if (channel->type == CHANNEL_TYPE_CHOICE) {
+            for (uint8_t i = 0; i < channel->prov_data.opts_prov.count; i++)
+                hash = fingerprint_update_str(hash, channel->prov_data.opts_prov.opts[i]);
+        }
+    }
+
+    return hash;
+}
+
+uint32_t device_get_schema_fingerprint(void) {
+    return device_get_schema_fingerprint_in(&g_device);
+}
+
 void device_is_mqtt_provisioned(bool* provisioned) {
 
-    nvs_handle_t mqtt_prov_handle;
-    uint16_t prov_state;
-    *provisioned = false;
-    
-    nvs_open("storage", NVS_READONLY, &mqtt_prov_handle);
-    nvs_get_u16(mqtt_prov_handle, "mqtt_prov", &prov_state);    
-    if (prov_state == 0xABCD) *provisioned = true;
-    nvs_close(mqtt_prov_handle);
+    uint16_t prov_state = 0;
+    device_port_get_u16("mqtt_prov", &prov_state);
+    *provisioned = (prov_state == 0xABCD);
+
+    /* Re-provision when the schema changed since the server last saw it */
+    uint32_t schema_fp = 0;
+    device_port_get_u32("schema_fp", &schema_fp);
+    if (*provisioned && schema_fp != device_get_schema_fingerprint()) {
+        ESP_LOGI(TAG, "Schema changed (%08x -> %08x), provisioning again",
+                    (unsigned) schema_fp, (unsigned) device_get_schema_fingerprint());
+        *provisioned = false;
+    }
+
+    /* Codec and short IDs negotiated at provisioning */
+    uint8_t codec = CODEC_JSON;
+    device_port_get_u8("codec", &codec);
+    g_device.codec = (codec < CODEC_COUNT) ? codec : CODEC_JSON;
+
+    if (*provisioned)
+        device_load_short_ids_in(&g_device, "chan_ids");
+
+    /* Versions go on from the last one acknowledged, a changed schema gets a new one */
+    uint32_t schema_ver = 0;
+    device_port_get_u32("schema_ver", &schema_ver);
+    schema_rebase(&g_device, (*provisioned && schema_ver > 0) ? schema_ver : schema_ver + 1, *provisioned);
 }
 
 void device_set_provisioned(void) {
-    nvs_handle_t mqtt_prov_handle;
-    nvs_open("storage", NVS_READWRITE, &mqtt_prov_handle);
-    nvs_set_u16(mqtt_prov_handle, "mqtt_prov", 0xABCD);
-    nvs_close(mqtt_prov_handle);
+    device_port_set_u32("schema_fp", device_get_schema_fingerprint());
+    device_port_set_u32("schema_ver", g_device.schema_acked);
+    device_port_set_u8("codec", g_device.codec);
+    device_save_short_ids_in(&g_device, "chan_ids");
+    device_port_set_u16("mqtt_prov", 0xABCD);
+}
+
+/* Replace the short IDs, ids holds one per channel ID or is NULL to drop them */
+static bool device_apply_short_ids(device_t* dev, const uint16_t* ids) {
+    uint16_t* table = NULL;
+    uint16_t count = 0;
+
+    for (uint16_t id = 0; ids != NULL && id < dev->channel_count; id++) {
+        if (ids[id] != DEVICE_CHANNEL_ID_INVALID && ids[id] >= count)
+            count = ids[id] + 1;
+    }
+
+    if (count > 0) {
+        table = malloc(count * sizeof(uint16_t));
+        if (table == NULL)
+            return false;
+        memset(table, 0xFF, count * sizeof(uint16_t));
+
+        for (uint16_t id = 0; id < dev->channel_count; id++) {
+            if (ids[id] == DEVICE_CHANNEL_ID_INVALID)
+                continue;
+            if (table[ids[id]] != DEVICE_CHANNEL_ID_INVALID || dev->channel_table[id] == NULL) {
+                ESP_LOGW(TAG, "Short ID %u assigned twice", ids[id]);
+                free(table);
+                return false;
+            }
+            table[ids[id]] = id;
+        }
+    }
+
+    for (uint16_t id = 0; id < dev->channel_count; id++) {
+        if (dev->channel_table[id] != NULL)
+            dev->channel_table[id]->short_id = (count > 0) ? ids[id] : DEVICE_CHANNEL_ID_INVALID;
+    }
+
+    free(dev->short_table);
+    dev->short_table = table;
+    dev->short_count = count;
+    return true;
+}
+
+typedef struct {
+    const device_t* dev;
+    uint16_t* ids;
+    bool valid;
+} short_ids_t;
+
+static bool short_id_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    short_ids_t* map = ctx;
+    char name[CODEC_STR_MAX];
+    const device_channel_t* channel = NULL;
+
+    if (key_len < sizeof(name)) {
+        memcpy(name, key, key_len);
+        name[key_len] = '\0';
+        channel = channel_index_find(map->dev, name);
+    }
+
+    if (channel == NULL || value->type != CODEC_VALUE_NUMBER || !(value->num_val >= 0)
+                || value->num_val >= map->dev->channel_count || value->num_val != (uint16_t) value->num_val) {
+        ESP_LOGW(TAG, "Invalid short ID for channel %.*s", (int) key_len, key);
+        map->valid = false;
+        return false;
+    }
+
+    map->ids[channel->id] = (uint16_t) value->num_val;
+    return true;
 }
 
-bool device_check_prov_resp(char* resp) {
-    bool prov_status = false;
-    
-    cJSON* prov_resp = cJSON_Parse(resp);
-    cJSON* status = cJSON_GetObjectItem(prov_resp, "status");
-    if (cJSON_IsNumber(status)) {
-        ESP_LOGI(TAG, "MQTT provisioning response status: %d", (int) status->valuedouble);
-        if (status->valuedouble == 1)
-            prov_status = true;
+/* Decode a map over the current short IDs when merging, over none otherwise */
+static bool device_decode_short_ids(device_t* dev, codec_type_t codec, const void* data, size_t len, bool merge) {
+    short_ids_t map = { .dev = dev, .valid = true };
+    map.ids = malloc(dev->channel_count * sizeof(uint16_t));
+    if (map.ids == NULL)
+        return false;
+
+    for (uint16_t id = 0; id < dev->channel_count; id++) {
+        const device_channel_t* channel = dev->channel_table[id];
+        map.ids[id] = (merge && channel != NULL) ? channel->short_id : DEVICE_CHANNEL_ID_INVALID;
     }
 
-    cJSON_Delete(prov_resp);
-    return prov_status;
+    bool set = codec_decode_map(codec, data, len, short_id_member, &map) && map.valid
+                && device_apply_short_ids(dev, map.ids);
+
+    free(map.ids);
+    return set;
+}
+
+bool device_set_short_ids_in(device_t* dev, codec_type_t codec, const void* data, size_t len) {
+    if (data == NULL || dev->channel_count == 0)
+        return device_apply_short_ids(dev, NULL);
+
+    bool set = device_decode_short_ids(dev, codec, data, len, false);
+    if (!set)
+        device_apply_short_ids(dev, NULL);
+    return set;
+}
+
+bool device_merge_short_ids_in(device_t* dev, codec_type_t codec, const void* data, size_t len) {
+    if (data == NULL || dev->channel_count == 0)
+        return false;
+
+    return device_decode_short_ids(dev, codec, data, len, true);
+}
+
+/* Blob layout: u32 schema fingerprint, then the u16 short ID of each channel ID if any */
+bool device_save_short_ids_in(const device_t* dev, const char* key) {
+    uint32_t schema_fp = device_get_schema_fingerprint_in(dev);
+    size_t len = sizeof(schema_fp) + ((dev->short_count > 0) ? dev->channel_count * sizeof(uint16_t) : 0);
+
+    uint8_t* blob = malloc(len);
+    if (blob == NULL)
+        return false;
+
+    memcpy(blob, &schema_fp, sizeof(schema_fp));
+    for (uint16_t id = 0; dev->short_count > 0 && id < dev->channel_count; id++) {
+        const device_channel_t* channel = dev->channel_table[id];
+        uint16_t short_id = (channel != NULL) ? channel->short_id : DEVICE_CHANNEL_ID_INVALID;
+        memcpy(blob + sizeof(schema_fp) + id * sizeof(uint16_t), &short_id, sizeof(short_id));
+    }
+
+    bool saved = device_port_set_blob(key, blob, len);
+    free(blob);
+    return saved;
+}
+
+void device_load_short_ids_in(device_t* dev, const char* key) {
+    uint32_t schema_fp;
+    size_t len = 0;
+
+    /* Nothing saved, or saved without short IDs */
+    if (!device_port_get_blob(key, NULL, &len) || len != sizeof(schema_fp) + dev->channel_count * sizeof(uint16_t)
+                || dev->channel_count == 0)
+        return;
+
+    uint8_t* blob = malloc(len);
+    if (blob == NULL)
+        return;
+
+    if (device_port_get_blob(key, blob, &len)) {
+        memcpy(&schema_fp, blob, sizeof(schema_fp));
+        if (schema_fp == device_get_schema_fingerprint_in(dev) && device_apply_short_ids(dev, (const uint16_t*) (blob + sizeof(schema_fp))))
+            ESP_LOGI(TAG, "Device %s: %u short channel IDs", dev->id, dev->short_count);
+    }
+    free(blob);
+}
+
+const char* device_get_channel_key(const device_channel_t* channel, char* buf) {
+    uint16_t short_id = channel->short_id;
+    if (short_id == DEVICE_CHANNEL_ID_INVALID)
+        return channel->name;
+
+    /* Digits backwards from the end of buf */
+    char* pos = buf + DEVICE_CHANNEL_KEY_MAX - 1;
+    *pos = '\0';
+    do {
+        *--pos = '0' + short_id % 10;
+        short_id /= 10;
+    } while (short_id > 0);
+    return pos;
+}
+
+device_channel_t* device_find_channel_key_in(const device_t* dev, const char* key, size_t key_len) {
+
+    /* With short IDs assigned, decimal keys are short IDs */
+    if (dev->short_count > 0 && key_len > 0 && key_len < DEVICE_CHANNEL_KEY_MAX) {
+        uint32_t short_id = 0;
+        size_t i = 0;
+        while (i < key_len && key[i] >= '0' && key[i] <= '9')
+            short_id = short_id * 10 + (key[i++] - '0');
+
+        if (i == key_len) {
+            if (short_id >= dev->short_count || dev->short_table[short_id] == DEVICE_CHANNEL_ID_INVALID)
+                return NULL;
+            return dev->channel_table[dev->short_table[short_id]];
+        }
+    }
+
+    char name[CODEC_STR_MAX];
+    if (key_len >= sizeof(name))
+        return NULL;
+
+    memcpy(name, key, key_len);
+    name[key_len] = '\0';
+    return channel_index_find(dev, name);
+}
+
+typedef struct {
+    bool has_status;
+    int status;
+    codec_type_t codec;
+
+    /* Encoded "channel_ids" map, NULL if absent */
+    const char* short_ids;
+    size_t short_ids_len;
+
+    bool has_version;
+    uint32_t version;
+} prov_resp_t;
+
+static bool prov_resp_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    prov_resp_t* resp = ctx;
+
+    if (key_len == 6 && memcmp(key, "status", 6) == 0 && value->type == CODEC_VALUE_NUMBER) {
+        resp->has_status = true;
+        resp->status = (int) value->num_val;
+    } else if (key_len == 5 && memcmp(key, "codec", 5) == 0 && value->type == CODEC_VALUE_STRING) {
+        if (!codec_from_name(value->str, value->str_len, &resp->codec))
+            ESP_LOGW(TAG, "Unsupported codec %.*s, keeping %s", (int) value->str_len, value->str, codec_name(resp->codec));
+    } else if (key_len == 11 && memcmp(key, "channel_ids", 11) == 0 && value->type == CODEC_VALUE_OTHER) {
+        resp->short_ids = value->str;
+        resp->short_ids_len = value->str_len;
+    } else if (key_len == 14 && memcmp(key, "schema_version", 14) == 0 && value->type == CODEC_VALUE_NUMBER
+                && value->num_val >= 0 && value->num_val <= UINT32_MAX) {
+        resp->has_version = true;
+        resp->version = (uint32_t) value->num_val;
+    }
+    return true;
+}
+
+bool device_check_prov_resp(const char* resp, size_t len) {
+    /* Updates keep the negotiated codec unless the server names another */
+    prov_resp_t prov_resp = { .codec = (g_device.schema_acked != 0) ? g_device.codec : CODEC_JSON };
+
+    /* The response is always JSON, it is where the codec is negotiated */
+    int64_t start = metrics_now_us();
+    bool parsed = codec_decode_map(CODEC_JSON, resp, len, prov_resp_member, &prov_resp);
+    metrics_observe_since(g_metric_prov_parse, start);
+
+    if (!parsed || !prov_resp.has_status)
+        return false;
+
+    ESP_LOGI(TAG, "MQTT provisioning response status: %d", prov_resp.status);
+
+    if (prov_resp.status != 1) {
+        /* Refused, nothing is acknowledged. Changes based on a version the server
+         * does not hold cannot be applied, the full document goes next. */
+        if (prov_resp.has_version && g_device.schema_acked != 0 && prov_resp.version != g_device.schema_acked) {
+            ESP_LOGW(TAG, "Server holds schema version %u, not %u, sending all of it next",
+                        (unsigned) prov_resp.version, (unsigned) g_device.schema_acked);
+            g_device.schema_acked = 0;
+        }
+        return false;
+    }
+
+    /* Servers not versioning the schema hold whatever was sent last. Changes made
+     * after it was written are not in it, when nothing was written it is unknown. */
+    if (prov_resp.has_version)
+        device_ack_schema_in(&g_device, prov_resp.version);
+    else if (g_device.schema_sent != 0)
+        device_ack_schema_in(&g_device, g_device.schema_sent);
+
+    g_device.codec = prov_resp.codec;
+    ESP_LOGI(TAG, "Payload codec: %s", codec_name(g_device.codec));
+
+    /* Without a map the short IDs stay as they are. Answering a delta it holds the
+     * channels added, otherwise all of them and payloads keep names if it is refused. */
+    if (prov_resp.short_ids == NULL)
+        return true;
+
+    bool set = g_device.schema_sent_delta
+                ? device_merge_short_ids_in(&g_device, CODEC_JSON, prov_resp.short_ids, prov_resp.short_ids_len)
+                : device_set_short_ids_in(&g_device, CODEC_JSON, prov_resp.short_ids, prov_resp.short_ids_len);
+    if (set)
+        ESP_LOGI(TAG, "Short channel IDs: %u", g_device.short_count);
+    return true;
+}
+
+codec_type_t device_get_codec(void) {
+    return g_device.codec;
+}
+
+/* Shared by every device, the first device_init or device_create sets them up */
+static void device_common_init(void) {
+    if (g_value_lock == NULL)
+        g_value_lock = device_port_lock_create();
+
+    g_metric_set_value = metrics_histogram("device_set_us");
+    g_metric_prov_parse = metrics_histogram("prov_parse_us");
+    g_metric_prov_serialize = metrics_histogram("prov_serialize_us");
+    g_metric_read_retries = metrics_counter("device_read_retries");
+    g_metric_read_locked = metrics_counter("device_read_locked");
+}
+
+/* Release the schema, its values and the index, the arena stays */
+static void device_release(device_t* dev) {
+    while (dev->channels != NULL) {
+        if (dev->channels->type == CHANNEL_TYPE_CHOICE || dev->channels->type == CHANNEL_TYPE_STRING)
+            free(dev->channels->data_value.str_val);
+        free(dev->channels->aggregate);
+        dev->channels = dev->channels->next;
+    }
+    dev->aggregate_count = 0;
+
+    free(dev->short_table);
+    dev->short_table = NULL;
+    dev->short_count = 0;
+
+    free(dev->schema_log);
+    dev->schema_log = NULL;
+    schema_rebase(dev, 0, false);
+
+    for (uint16_t i = 0; i < dev->retired_count; i++)
+        free(dev->retired[i]);
+    free(dev->retired);
+    free(dev->report_str);
+    dev->retired = NULL;
+    dev->retired_count = 0;
+    dev->retired_size = 0;
+    dev->report_str = NULL;
+    dev->report_str_size = 0;
+
+    if (!dev->index_in_arena) {
+        free(dev->channel_table);
+        free(dev->hash_buckets);
+        free(dev->changed_bitmap);
+    }
+    dev->index_in_arena = false;
+    dev->changed_bitmap = NULL;
+    dev->channel_table = NULL;
+    dev->hash_buckets = NULL;
+    dev->channel_table_size = 0;
+    dev->channel_count = 0;
+    dev->hash_bucket_count = 0;
 }
 
 void device_init(const char* device_name) {
 
+    device_common_init();
+
+    /* Release the previous schema and its values */
+    device_release(&g_device);
+    memset(&g_device.change_stats, 0, sizeof(device_change_stats_t));
+
+    arena_deinit(&g_device.arena);
+    g_device.name = NULL;
+    g_device.id = NULL;
+    if (!arena_init(&g_device.arena, DEVICE_SCHEMA_ARENA_SIZE)) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for device schema", DEVICE_SCHEMA_ARENA_SIZE);
+        return;
+    }
+
     /* Device name */
-    g_device.name = malloc(strlen(device_name) + 1);
-    strcpy(g_device.name, device_name);
+    g_device.name = arena_strdup(&g_device.arena, device_name);
 
     /* Device ID - MAC address */
-    g_device.id = malloc(13);
+    g_device.id = arena_alloc(&g_device.arena, 13);
     get_device_id(g_device.id);
 
-    if(g_device.channels) {
-        free(g_device.channels);
-        g_device.channels = NULL;
-    }
-
     ESP_LOGI(TAG, "Device structure is created with:\n            name: %s\n            id: %s", g_device.name, g_device.id);
 }
 
 void device_add_bool_channel(const char* name, bool cmd, const char* title,
                     const char* description) {
-    
-    device_channel_t* new_channel = (device_channel_t*) malloc(sizeof(device_channel_t));
-    
-    new_channel->name = malloc(strlen(name) + 1);
-    strcpy(new_channel->name, name);
 
-    new_channel->cmd = cmd;
-    new_channel->type = CHANNEL_TYPE_BOOL;
-    memset(&new_channel->data_value, 0, sizeof(new_channel->data_value));
+    size_t mark = arena_mark(&g_device.arena);
+    device_channel_t* new_channel = device_new_channel(&g_device, name, cmd, CHANNEL_TYPE_BOOL);
+    if (new_channel == NULL)
+        return;
 
-    new_channel->next = g_device.channels;
-    g_device.channels = new_channel;
+    if (device_commit_channel(&g_device, new_channel, mark))
+        schema_changed();
 }
 
 void device_add_nummber_channel(const char* name, bool cmd, const char* title,
                     const char* description, float min, float max, float multipleof) {
-    
-    device_channel_t* new_channel = (device_channel_t*) malloc(sizeof(device_channel_t));
-    
-    new_channel->name = malloc(strlen(name) + 1);
-    strcpy(new_channel->name, name);
 
-    new_channel->cmd = cmd;
-    new_channel->type = CHANNEL_TYPE_NUMBER;
-    memset(&new_channel->data_value, 0, sizeof(new_channel->data_value));
+    device_add_aggregate_channel(name, cmd, title, description, min, max, multipleof, 0);
+}
+
+void device_add_aggregate_channel(const char* name, bool cmd, const char* title,
+                    const char* description, float min, float max, float multipleof, uint32_t window_ms) {
+
+    size_t mark = arena_mark(&g_device.arena);
+    device_channel_t* new_channel = device_new_channel(&g_device, name, cmd, CHANNEL_TYPE_NUMBER);
+    if (new_channel == NULL)
+        return;
 
     new_channel->prov_data.num_prov.min = min;
     new_channel->prov_data.num_prov.max = max;
     new_channel->prov_data.num_prov.multipleof = multipleof;
+    new_channel->prov_data.num_prov.window_ms = window_ms;
+    new_channel->deadband = multipleof;
 
-    new_channel->next = g_device.channels;
-    g_device.channels = new_channel;
+    if (device_commit_channel(&g_device, new_channel, mark))
+        schema_changed();
 }
 
 void device_add_multi_option_channel(const char* name, bool cmd, const char* title,
                     const char* description, uint8_t opt_count, ...) {
 
-    device_channel_t* new_channel = (device_channel_t*) malloc(sizeof(device_channel_t));
-    
-    new_channel->name = malloc(strlen(name) + 1);
-    strcpy(new_channel->name, name);
+    size_t mark = arena_mark(&g_device.arena);
+    device_channel_t* new_channel = device_new_channel(&g_device, name, cmd, CHANNEL_TYPE_CHOICE);
+    if (new_channel == NULL)
+        return;
+
+    /* Options are stored as one array, in the order given */
+    const char** opts = arena_alloc(&g_device.arena, opt_count * sizeof(char*));
+    if (opt_count > 0 && opts == NULL) {
+        ESP_LOGE(TAG, "No schema space for options of channel %s", name);
+        arena_reset(&g_device.arena, mark);
+        return;
+    }
 
-    new_channel->cmd = cmd;
-    new_channel->type = CHANNEL_TYPE_CHOICE;
-    memset(&new_channel->data_value, 0, sizeof(new_channel->data_value));
-
-    if (opt_count > 0) {
-        if (new_channel->prov_data.opts_prov)
-            new_channel->prov_data.opts_prov = NULL;
-
-        va_list opts_list;
-        va_start(opts_list, opt_count);
-        for (int i = 0; i < opt_count; i++) {
-            char* temp = va_arg(opts_list, char*);
-            
-            prov_opt_list_t* new_opt = (prov_opt_list_t*) malloc(sizeof(prov_opt_list_t));
-            new_opt->opt = malloc(strlen(temp) + 1);
-            strcpy(new_opt->opt, temp);
-
-            new_opt->next = new_channel->prov_data.opts_prov;
-            new_channel->prov_data.opts_prov = new_opt;
+    va_list opts_list;
+    va_start(opts_list, opt_count);
+    for (int i = 0; i < opt_count; i++) {
+        opts[i] = arena_strdup(&g_device.arena, va_arg(opts_list, char*));
+        if (opts[i] == NULL) {
+            ESP_LOGE(TAG, "No schema space for options of channel %s", name);
+            va_end(opts_list);
+            arena_reset(&g_device.arena, mark);
+            return;
         }
-        va_end(opts_list);
     }
+    va_end(opts_list);
 
-    new_channel->next = g_device.channels;
-    g_device.channels = new_channel;
+    new_channel->prov_data.opts_prov.opts = opts;
+    new_channel->prov_data.opts_prov.count = opt_count;
+
+    if (device_commit_channel(&g_device, new_channel, mark))
+        schema_changed();
 }
 
 void device_add_string_channel(const char* name, bool cmd, const char* title,
                     const char* description) {
 
-    device_channel_t* new_channel = (device_channel_t*) malloc(sizeof(device_channel_t));
-    
-    new_channel->name = malloc(strlen(name) + 1);
-    strcpy(new_channel->name, name);
+    size_t mark = arena_mark(&g_device.arena);
+    device_channel_t* new_channel = device_new_channel(&g_device, name, cmd, CHANNEL_TYPE_STRING);
+    if (new_channel == NULL)
+        return;
 
-    new_channel->cmd = cmd;
-    new_channel->type = CHANNEL_TYPE_STRING;
-    memset(&new_channel->data_value, 0, sizeof(new_channel->data_value));
+    if (device_commit_channel(&g_device, new_channel, mark))
+        schema_changed();
+}
 
-    new_channel->next = g_device.channels;
-    g_device.channels = new_channel;
+void device_add_channels_in(device_t* dev, const device_channel_def_t* defs, uint16_t count) {
+    uint16_t added = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        const device_channel_def_t* def = &defs[i];
+
+        size_t mark = arena_mark(&dev->arena);
+        device_channel_t* new_channel = device_alloc_channel(dev, def->name, def->cmd, def->type);
+        if (new_channel == NULL)
+            continue;
+
+        /* Option arrays stay in the table */
+        new_channel->prov_data = def->prov_data;
+        if (def->type == CHANNEL_TYPE_NUMBER)
+            new_channel->deadband = def->prov_data.num_prov.multipleof;
+
+        added += device_commit_channel(dev, new_channel, mark);
+    }
+
+    /* One notification for the whole table */
+    if (added > 0 && dev == &g_device)
+        schema_changed();
 }
 
-void device_remove_channel(const char* name) {
+void device_add_channels(const device_channel_def_t* defs, uint16_t count) {
+    device_add_channels_in(&g_device, defs, count);
+}
 
-    device_channel_t* temp = g_device.channels;
-    device_channel_t* prev = NULL;
-    
-    if (temp != NULL && strcmp(temp->name, name) == 0) {
-        g_device.channels = temp->next;
-        free(temp->name);
-        free(temp->data_value.str_val);
-
-        if (temp->type == CHANNEL_TYPE_CHOICE) {
-            while (temp->prov_data.opts_prov != NULL) {
-                free(temp->prov_data.opts_prov->opt);
-                temp->prov_data.opts_prov = temp->prov_data.opts_prov->next;
-            }
+/* Move the channel index next to the schema, with room for that many more channels.
+ * It no longer moves, channels added afterwards leave running readers alone. */
+static void device_seal_in(device_t* dev, uint16_t room) {
+    if (dev->index_in_arena)
+        return;
+
+    uint32_t size = (uint32_t) dev->channel_count + room;
+    if (size > DEVICE_CHANNEL_ID_INVALID)
+        size = DEVICE_CHANNEL_ID_INVALID;
+
+    uint32_t bucket_count = 1;
+    while (bucket_count < size)
+        bucket_count *= 2;
+    uint16_t words = (size + 31) / 32;
+    uint16_t used_words = (dev->channel_count + 31) / 32;
+
+    device_channel_t** table = arena_alloc(&dev->arena, size * sizeof(device_channel_t*));
+    device_channel_t** buckets = arena_alloc(&dev->arena, bucket_count * sizeof(device_channel_t*));
+    uint32_t* bitmap = arena_alloc(&dev->arena, words * sizeof(uint32_t));
+    if (table != NULL && buckets != NULL && bitmap != NULL && size > 0 && bucket_count <= UINT16_MAX) {
+        memset(buckets, 0, bucket_count * sizeof(device_channel_t*));
+        memset(bitmap, 0, words * sizeof(uint32_t));
+        if (dev->channel_count > 0) {
+            memcpy(table, dev->channel_table, dev->channel_count * sizeof(device_channel_t*));
+            memcpy(bitmap, dev->changed_bitmap, used_words * sizeof(uint32_t));
         }
+        channel_index_rehash_into(dev, buckets, bucket_count);
+
+        free(dev->channel_table);
+        free(dev->hash_buckets);
+        free(dev->changed_bitmap);
+        dev->channel_table = table;
+        dev->channel_table_size = size;
+        dev->hash_buckets = buckets;
+        dev->hash_bucket_count = bucket_count;
+        dev->changed_bitmap = bitmap;
+        dev->index_in_arena = true;
+    }
+
+    /* Nothing to keep arena space for */
+    if (room == 0)
+        arena_seal(&dev->arena);
+}
+
+void device_seal(void) {
+    device_seal_in(&g_device, DEVICE_SCHEMA_HEADROOM);
+    ESP_LOGI(TAG, "Device schema sealed: %u/%u bytes used, room for %u more channels",
+                (unsigned) g_device.arena.used, (unsigned) g_device.arena.size,
+                (unsigned) (g_device.channel_table_size - g_device.channel_count));
+}
+
+void device_get_arena_usage(size_t* used, size_t* size) {
+    *used = g_device.arena.used;
+    *size = g_device.arena.size;
+}
+
+device_t* device_get_self(void) {
+    return &g_device;
+}
+
+/* Arena bytes for name, ID, channel nodes and the sealed index of a table built device */
+static size_t device_arena_size(const char* name, const char* id, uint16_t count) {
+    const size_t align = sizeof(void*);
+    size_t node = (sizeof(device_channel_t) + align - 1) & ~(align - 1);
+
+    /* Sealing without room: a table entry per channel, buckets rounded up to a power of two */
+    size_t buckets = 1;
+    while (buckets < count)
+        buckets *= 2;
 
-        free(temp);
+    return strlen(name) + align + strlen(id) + align + count * node
+                + (count + buckets) * sizeof(device_channel_t*) + 2 * align
+                + (count + 31) / 32 * sizeof(uint32_t) + align;
+}
+
+device_t* device_create(const char* name, const char* id, const device_channel_def_t* defs, uint16_t count) {
+
+    device_common_init();
+
+    device_t* dev = calloc(1, sizeof(device_t));
+    if (dev == NULL)
+        return NULL;
+
+    /* Sized for the table, nothing is added after sealing */
+    size_t arena_size = device_arena_size(name, id, count);
+    if (!arena_init(&dev->arena, arena_size)) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for device %s schema", (unsigned) arena_size, id);
+        free(dev);
+        return NULL;
+    }
+
+    dev->name = arena_strdup(&dev->arena, name);
+    dev->id = arena_strdup(&dev->arena, id);
+    dev->codec = CODEC_JSON;
+
+    device_add_channels_in(dev, defs, count);
+    device_seal_in(dev, 0);
+
+    if (dev->channel_count != count) {
+        ESP_LOGE(TAG, "Device %s: only %u of %u channels added", id, dev->channel_count, count);
+        device_destroy(dev);
+        return NULL;
+    }
+    return dev;
+}
+
+void device_destroy(device_t* dev) {
+    if (dev == NULL || dev == &g_device)
+        return;
+
+    device_release(dev);
+    arena_deinit(&dev->arena);
+    free(dev);
+}
+
+size_t device_get_footprint_in(const device_t* dev) {
+    size_t size = sizeof(device_t) + dev->arena.size;
+    if (!dev->index_in_arena) {
+        size += (dev->channel_table_size + dev->hash_bucket_count) * sizeof(device_channel_t*);
+        size += (dev->channel_table_size + 31) / 32 * sizeof(uint32_t);
+    }
+    size += dev->retired_size + dev->retired_count * sizeof(void*) + dev->report_str_size;
+    size += dev->aggregate_count * sizeof(device_aggregate_t) + dev->short_count * sizeof(uint16_t);
+    if (dev->schema_log != NULL)
+        size += DEVICE_SCHEMA_LOG_SIZE * sizeof(device_schema_change_t);
+
+    device_lock();
+    for (const device_channel_t* temp = dev->channels; temp != NULL; temp = temp->next)
+        size += temp->str_cap;
+    device_unlock();
+
+    return size;
+}
+
+void device_remove_channel(const char* name) {
+    device_t* dev = &g_device;
+
+    device_lock();
+    device_channel_t* temp = channel_index_find(dev, name);
+    if (temp == NULL) {
+        device_unlock();
         return;
     }
-    
-    while (temp != NULL && strcmp(temp->name, name) != 0) {
-        prev = temp;
-        temp = temp->next;
+
+    /* The reporter or a reader may still hold the channel, its buffers are retired
+     * and the node stays in the arena until the next device_init */
+    bool has_str = (temp->type == CHANNEL_TYPE_CHOICE || temp->type == CHANNEL_TYPE_STRING)
+                && temp->data_value.str_val != NULL;
+    if (!retired_reserve(dev, has_str + (temp->aggregate != NULL))) {
+        device_unlock();
+        ESP_LOGE(TAG, "No memory to remove channel %s", name);
+        return;
+    }
+
+    device_write_begin(dev);
+    device_channel_t** link = &dev->channels;
+    while (*link != temp)
+        link = &(*link)->next;
+    *link = temp->next;
+
+    channel_index_remove(dev, temp);
+    schema_record(dev, temp, false);
+
+    if (temp->aggregate != NULL) {
+        retired_add(dev, temp->aggregate, sizeof(device_aggregate_t));
+        dev->aggregate_count--;
     }
- 
+    if (has_str)
+        retired_add(dev, temp->data_value.str_val, temp->str_cap);
+    device_write_end(dev);
+    device_unlock();
+
+    schema_changed();
+}
+
+uint16_t device_get_channel_id_in(const device_t* dev, const char* name) {
+    device_channel_t* temp = channel_index_find(dev, name);
+    return (temp != NULL) ? temp->id : DEVICE_CHANNEL_ID_INVALID;
+}
+
+uint16_t device_get_channel_id(const char* name) {
+    return device_get_channel_id_in(&g_device, name);
+}
+
+device_channel_t* device_get_channel_in(const device_t* dev, uint16_t id) {
+    if (id >= dev->channel_count)
+        return NULL;
+    return dev->channel_table[id];
+}
+
+device_channel_t* device_get_channel(uint16_t id) {
+    return device_get_channel_in(&g_device, id);
+}
+
+uint16_t device_get_channel_count_in(const device_t* dev) {
+    return dev->channel_count;
+}
+
+uint16_t device_get_channel_count(void) {
+    return device_get_channel_count_in(&g_device);
+}
+
+/* Copies values inside a read section, may run several times and must only read them */
+typedef size_t (*value_copy_t)(const device_t* dev, void* ctx);
+
+/* Run copy until no writer interfered, returns what the last run returned */
+static size_t device_read_values(const device_t* dev, value_copy_t copy, void* ctx) {
+    for (uint8_t attempt = 0; attempt < VALUE_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&dev->value_seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            size_t result = copy(dev, ctx);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&dev->value_seq, __ATOMIC_RELAXED) == seq)
+                return result;
+        }
+        metrics_inc(g_metric_read_retries);
+    }
+
+    /* The writer may be a lower priority task preempted on this core, wait for it */
+    metrics_inc(g_metric_read_locked);
+    device_lock();
+    size_t result = copy(dev, ctx);
+    device_unlock();
+    return result;
+}
+
+/* Copy a channel value inside a read section, a string goes to str_buf if it fits.
+ * Returns the bytes the string needs. */
+static size_t channel_read(const device_channel_t* channel, device_value_t* value, char* str_buf, size_t str_size) {
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        value->type = DEVICE_VALUE_BOOL;
+        value->value.bool_val = channel->data_value.bool_val;
+        return 0;
+
+    case CHANNEL_TYPE_NUMBER:
+        value->type = DEVICE_VALUE_NUMBER;
+        value->value.num_val = channel->data_value.num_val;
+        return 0;
+
+    case CHANNEL_TYPE_CHOICE:
+    case CHANNEL_TYPE_STRING: {
+        /* Capacity first, the buffer loaded after it is at least that large */
+        uint16_t cap = __atomic_load_n(&channel->str_cap, __ATOMIC_ACQUIRE);
+        const char* str = __atomic_load_n(&channel->data_value.str_val, __ATOMIC_RELAXED);
+
+        value->type = DEVICE_VALUE_STRING;
+        value->value.str_val = NULL;
+        if (str == NULL)
+            return 0;
+
+        size_t len = strnlen(str, cap);
+        if (len + 1 <= str_size) {
+            memcpy(str_buf, str, len);
+            str_buf[len] = '\0';
+            value->value.str_val = str_buf;
+        }
+        return len + 1;
+    }
+
+    default:
+        value->type = DEVICE_VALUE_NONE;
+        return 0;
+    }
+}
+
+typedef struct {
+    device_value_t* values;
+    uint16_t count;
+    char* str_buf;
+    size_t str_size;
+} snapshot_read_t;
+
+static size_t snapshot_copy(const device_t* dev, void* ctx) {
+    snapshot_read_t* read = ctx;
+    size_t need = 0;
+
+    for (uint16_t id = 0; id < read->count; id++) {
+        const device_channel_t* channel = __atomic_load_n(&dev->channel_table[id], __ATOMIC_RELAXED);
+        if (channel == NULL) {
+            read->values[id].type = DEVICE_VALUE_NONE;
+            continue;
+        }
+
+        size_t room = (need < read->str_size) ? read->str_size - need : 0;
+        need += channel_read(channel, &read->values[id], (room > 0) ? read->str_buf + need : NULL, room);
+    }
+    return need;
+}
+
+size_t device_snapshot_in(const device_t* dev, device_value_t* values, uint16_t count, char* str_buf, size_t str_size) {
+    snapshot_read_t read = {
+        .values = values,
+        .count = (count < dev->channel_count) ? count : dev->channel_count,
+        .str_buf = str_buf,
+        .str_size = (str_buf != NULL) ? str_size : 0,
+    };
+    return device_read_values(dev, snapshot_copy, &read);
+}
+
+size_t device_snapshot(device_value_t* values, uint16_t count, char* str_buf, size_t str_size) {
+    return device_snapshot_in(&g_device, values, count, str_buf, str_size);
+}
+
+typedef struct {
+    const device_channel_t* channel;
+    device_value_t* value;
+    char* str_buf;
+    size_t str_size;
+} channel_read_t;
+
+static size_t channel_copy(const device_t* dev, void* ctx) {
+    channel_read_t* read = ctx;
+    return channel_read(read->channel, read->value, read->str_buf, read->str_size);
+}
+
+/* Copy a value for the reporter, growing its string buffer until the value fits */
+static bool device_read_for_report(device_t* dev, const device_channel_t* channel, device_value_t* value) {
+    for (;;) {
+        channel_read_t read = { channel, value, dev->report_str, dev->report_str_size };
+        size_t need = device_read_values(dev, channel_copy, &read);
+        if (need <= dev->report_str_size)
+            return true;
+
+        char* str = realloc(dev->report_str, need);
+        if (str == NULL)
+            return false;
+        dev->report_str = str;
+        dev->report_str_size = need;
+    }
+}
+
+/* Mark a channel changed, values are locked */
+static void channel_mark_changed(device_t* dev, uint16_t id) {
+    uint32_t mask = 1u << (id % 32);
+
+    if (dev->changed_bitmap[id / 32] & mask)
+        dev->change_stats.coalesced++;
+    else
+        dev->change_stats.changes++;
+
+    /* Stored atomically, the reporter peeks at the word without the lock */
+    __atomic_store_n(&dev->changed_bitmap[id / 32], dev->changed_bitmap[id / 32] | mask, __ATOMIC_RELAXED);
+}
+
+/* Check an update against the provisioned constraints of the channel */
+static device_update_status_t channel_validate(const device_channel_t* channel, const device_update_t* update) {
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        return (update->type == DEVICE_VALUE_BOOL) ? DEVICE_UPDATE_OK : DEVICE_UPDATE_TYPE_MISMATCH;
+
+    case CHANNEL_TYPE_NUMBER: {
+        if (update->type != DEVICE_VALUE_NUMBER)
+            return DEVICE_UPDATE_TYPE_MISMATCH;
+
+        const prov_num_type_t* num_prov = &channel->prov_data.num_prov;
+        float num = update->value.num_val;
+        if (!(num >= num_prov->min && num <= num_prov->max))
+            return DEVICE_UPDATE_OUT_OF_RANGE;
+
+        /* Tolerate float rounding of the quotient */
+        if (num_prov->multipleof > 0) {
+            float quotient = num / num_prov->multipleof;
+            if (fabsf(quotient - roundf(quotient)) > 1e-4f * fmaxf(1.0f, fabsf(quotient)))
+                return DEVICE_UPDATE_NOT_MULTIPLE;
+        }
+        return DEVICE_UPDATE_OK;
+    }
+
+    case CHANNEL_TYPE_CHOICE:
+        if (update->type != DEVICE_VALUE_STRING || update->value.str_val == NULL)
+            return DEVICE_UPDATE_TYPE_MISMATCH;
+
+        for (uint8_t i = 0; i < channel->prov_data.opts_prov.count; i++) {
+            if (strcmp(channel->prov_data.opts_prov.opts[i], update->value.str_val) == 0)
+                return DEVICE_UPDATE_OK;
+        }
+        return DEVICE_UPDATE_INVALID_OPTION;
+
+    case CHANNEL_TYPE_STRING:
+        if (update->type != DEVICE_VALUE_STRING || update->value.str_val == NULL)
+            return DEVICE_UPDATE_TYPE_MISMATCH;
+        return DEVICE_UPDATE_OK;
+
+    default:
+        return DEVICE_UPDATE_TYPE_MISMATCH;
+    }
+}
+
+/* Replace the string buffer of a channel by a larger one, values are locked.
+ * Capacity doubles so a growing value leaves few buffers behind. */
+static bool channel_grow_str(device_t* dev, device_channel_t* channel, size_t size) {
+    size_t cap = (size_t) channel->str_cap * 2;
+    if (cap < size || cap > UINT16_MAX)
+        cap = size;
+
+    char* str = malloc(cap);
+    if (str == NULL)
+        return false;
+
+    char* old = channel->data_value.str_val;
+    if (old != NULL) {
+        if (!retired_reserve(dev, 1)) {
+            free(str);
+            return false;
+        }
+        retired_add(dev, old, channel->str_cap);
+    }
+
+    /* Buffer before capacity, a reader seeing the new capacity sees the new buffer */
+    str[0] = '\0';
+    __atomic_store_n(&channel->data_value.str_val, str, __ATOMIC_RELAXED);
+    __atomic_store_n(&channel->str_cap, (uint16_t) cap, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Close the open window into the ring, values are locked. False if the ring was full. */
+static bool aggregate_close(device_t* dev, device_aggregate_t* agg) {
+    uint8_t head = agg->head;
+    uint8_t tail = __atomic_load_n(&agg->tail, __ATOMIC_ACQUIRE);
+    uint32_t count = agg->count;
+    agg->count = 0;
+
+    /* The unreported windows are older, keep them */
+    if ((uint8_t) (head - tail) >= DEVICE_AGGREGATE_WINDOWS) {
+        dev->change_stats.windows_dropped++;
+        return false;
+    }
+
+    device_window_t* window = &agg->ring[head & (DEVICE_AGGREGATE_WINDOWS - 1)];
+    window->min = agg->min;
+    window->max = agg->max;
+    window->mean = agg->sum / count;
+    window->last = agg->last;
+    window->count = count;
+
+    __atomic_store_n(&agg->head, (uint8_t) (head + 1), __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool aggregate_expired(const device_aggregate_t* agg, int64_t now) {
+    return agg->count > 0 && now - agg->start_us >= (int64_t) agg->window_ms * 1000;
+}
+
+/* Add a sample, closing the window it ends. True if a window was closed. */
+static bool aggregate_add(device_t* dev, device_aggregate_t* agg, float num, int64_t now) {
+    bool closed = aggregate_expired(agg, now) && aggregate_close(dev, agg);
+
+    if (agg->count == 0) {
+        agg->start_us = now;
+        agg->min = num;
+        agg->max = num;
+        agg->sum = 0;
+    } else {
+        agg->min = fminf(agg->min, num);
+        agg->max = fmaxf(agg->max, num);
+    }
+
+    agg->sum += num;
+    agg->last = num;
+    agg->count++;
+    return closed;
+}
+
+/* Close the windows past their period even if no sample followed them */
+static void device_close_windows(device_t* dev, int64_t now) {
+    device_lock();
+    device_write_begin(dev);
+
+    for (uint16_t id = 0; id < dev->channel_count; id++) {
+        device_channel_t* channel = dev->channel_table[id];
+        if (channel != NULL && channel->aggregate != NULL && aggregate_expired(channel->aggregate, now)
+                    && aggregate_close(dev, channel->aggregate))
+            channel_mark_changed(dev, id);
+    }
+
+    device_write_end(dev);
+    device_unlock();
+}
+
+/* Copy the closed windows, oldest first, for the reporter */
+static uint8_t aggregate_peek(const device_aggregate_t* agg, device_window_t* windows) {
+    uint8_t tail = agg->tail;
+    uint8_t count = __atomic_load_n(&agg->head, __ATOMIC_ACQUIRE) - tail;
+
+    for (uint8_t i = 0; i < count; i++)
+        windows[i] = agg->ring[(uint8_t) (tail + i) & (DEVICE_AGGREGATE_WINDOWS - 1)];
+    return count;
+}
+
+static void aggregate_consume(device_aggregate_t* agg, uint8_t count) {
+    __atomic_store_n(&agg->tail, (uint8_t) (agg->tail + count), __ATOMIC_RELEASE);
+}
+
+/* Store a validated value, values are locked */
+static device_update_status_t channel_apply(device_t* dev, device_channel_t* channel, const device_update_t* update, int64_t now) {
+    bool changed = true;
+
+    /* Samples only make a change once their window closes */
+    if (channel->aggregate != NULL) {
+        channel->data_value.num_val = update->value.num_val;
+        if (aggregate_add(dev, channel->aggregate, update->value.num_val, now))
+            channel_mark_changed(dev, channel->id);
+        return DEVICE_UPDATE_OK;
+    }
+
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        changed = channel->data_value.bool_val != update->value.bool_val;
+        channel->data_value.bool_val = update->value.bool_val;
+        break;
+
+    case CHANNEL_TYPE_NUMBER: {
+        /* Against the reported value so slow drifts still get reported */
+        float num = update->value.num_val;
+        float reported;
+        __atomic_load(&channel->reported_num, &reported, __ATOMIC_RELAXED);
+        changed = num != reported && !(fabsf(num - reported) < channel->deadband);
+        channel->data_value.num_val = num;
+        break;
+    }
+
+    case CHANNEL_TYPE_CHOICE:
+    case CHANNEL_TYPE_STRING: {
+        const char* str = update->value.str_val;
+        size_t len = strlen(str);
+        changed = channel->data_value.str_val == NULL || strcmp(channel->data_value.str_val, str) != 0;
+        if (!changed)
+            break;
+
+        /* Grow only, the storage is reused in place when it fits */
+        if (len + 1 > channel->str_cap) {
+            if (len + 1 > UINT16_MAX || !channel_grow_str(dev, channel, len + 1))
+                return DEVICE_UPDATE_NO_MEMORY;
+        }
+
+        memcpy(channel->data_value.str_val, str, len + 1);
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    if (changed)
+        channel_mark_changed(dev, channel->id);
+    else
+        dev->change_stats.suppressed++;
+
+    return DEVICE_UPDATE_OK;
+}
+
+uint16_t device_update_channels_in(device_t* dev, device_update_t* updates, uint16_t count) {
+    uint16_t applied = 0;
+
+    int64_t start = metrics_now_us();
+    device_lock();
+    device_write_begin(dev);
+
+    for (uint16_t i = 0; i < count; i++) {
+        device_update_t* update = &updates[i];
+        device_channel_t* channel = device_get_channel_in(dev, update->channel_id);
+
+        update->status = (channel != NULL) ? channel_validate(channel, update) : DEVICE_UPDATE_UNKNOWN_CHANNEL;
+        if (update->status == DEVICE_UPDATE_OK)
+            update->status = channel_apply(dev, channel, update, start);
+
+        if (update->status == DEVICE_UPDATE_OK)
+            applied++;
+    }
+
+    device_write_end(dev);
+    device_unlock();
+
+    /* Listeners only follow the board's own device */
+    for (uint16_t i = 0; dev == &g_device && i < count; i++) {
+        if (updates[i].status != DEVICE_UPDATE_OK)
+            continue;
+        for (uint8_t j = 0; j < g_change_listener_count; j++)
+            g_change_listeners[j].cb(updates[i].channel_id, g_change_listeners[j].ctx);
+    }
+
+    /* Includes waiting for the lock and the listeners */
+    metrics_observe_since(g_metric_set_value, start);
+    return applied;
+}
+
+uint16_t device_update_channels(device_update_t* updates, uint16_t count) {
+    return device_update_channels_in(&g_device, updates, count);
+}
+
+const char* device_update_status_name(device_update_status_t status) {
+    switch (status) {
+    case DEVICE_UPDATE_OK:                  return "ok";
+    case DEVICE_UPDATE_UNKNOWN_CHANNEL:     return "unknown channel";
+    case DEVICE_UPDATE_TYPE_MISMATCH:       return "type mismatch";
+    case DEVICE_UPDATE_OUT_OF_RANGE:        return "out of range";
+    case DEVICE_UPDATE_NOT_MULTIPLE:        return "not a multiple";
+    case DEVICE_UPDATE_INVALID_OPTION:      return "invalid option";
+    case DEVICE_UPDATE_NO_MEMORY:           return "no memory";
+    default:                                return "unknown";
+    }
+}
+
+void device_set_channel_value_by_id(uint16_t id, void* value) {
+
+    device_channel_t* temp = device_get_channel(id);
     if (temp == NULL)
         return;
- 
-    prev->next = temp->next;
- 
-    free(temp);
+
+    device_update_t update = { .channel_id = id };
+
+    switch (temp->type) {
+    case CHANNEL_TYPE_BOOL:
+        update.type = DEVICE_VALUE_BOOL;
+        update.value.bool_val = *((bool*) value);
+        break;
+
+    case CHANNEL_TYPE_NUMBER:
+        update.type = DEVICE_VALUE_NUMBER;
+        update.value.num_val = *((float*) value);
+        break;
+
+    case CHANNEL_TYPE_CHOICE:
+    case CHANNEL_TYPE_STRING:
+        update.type = DEVICE_VALUE_STRING;
+        update.value.str_val = *((char**) value);
+        break;
+
+    default:
+        return;
+    }
+
+    if (device_update_channels(&update, 1) == 0)
+        ESP_LOGW(TAG, "Value of channel %s rejected: %s", temp->name, device_update_status_name(update.status));
 }
 
-void device_set_channel_value(const char* name, void* value) {
+void device_set_channel_deadband(uint16_t id, float deadband) {
+    device_channel_t* temp = device_get_channel(id);
+    if (temp == NULL || temp->type != CHANNEL_TYPE_NUMBER)
+        return;
 
-    device_channel_t* temp = g_device.channels;
+    device_lock();
+    temp->deadband = deadband;
+    device_unlock();
+}
 
-    while (temp != NULL) {
-        if (strcmp(temp->name, name) == 0) {
-            switch (temp->type) {
-            case CHANNEL_TYPE_BOOL:
-                temp->data_value.bool_val = *((bool*) value);
-                break;
-            
-            case CHANNEL_TYPE_NUMBER:
-                temp->data_value.num_val = *((float*) value);
-                break;
-
-            case CHANNEL_TYPE_CHOICE:
-            case CHANNEL_TYPE_STRING: {
-                char* temp_str = *((char**) value);
-
-                temp->data_value.str_val = realloc(temp->data_value.str_val, strlen(temp_str) + 1);
-
-                strcpy(temp->data_value.str_val, temp_str);
-                break;
+uint16_t device_report_changes_in(device_t* dev, device_report_cb_t cb, void* ctx) {
+    uint16_t words = (dev->channel_count + 31) / 32;
+    uint16_t visited = 0;
+    device_window_t windows[DEVICE_AGGREGATE_WINDOWS];
+
+    if (dev->aggregate_count > 0)
+        device_close_windows(dev, metrics_now_us());
+
+    for (uint16_t word = 0; word < words; word++) {
+        if (__atomic_load_n(&dev->changed_bitmap[word], __ATOMIC_RELAXED) == 0)
+            continue;
+
+        /* Take the word's changes, a channel set from here on is marked again */
+        device_lock();
+        uint32_t bits = __atomic_exchange_n(&dev->changed_bitmap[word], 0, __ATOMIC_RELAXED);
+        device_unlock();
+
+        while (bits != 0) {
+            device_channel_t* channel = __atomic_load_n(&dev->channel_table[word * 32 + __builtin_ctz(bits)], __ATOMIC_RELAXED);
+            device_value_t value;
+            bool read;
+
+            /* Removed after its change was taken */
+            if (channel == NULL) {
+                bits &= bits - 1;
+                continue;
             }
-            
-            default:
-                break;
+
+            if (channel->aggregate != NULL) {
+                value.type = DEVICE_VALUE_WINDOWS;
+                value.value.window_val.windows = windows;
+                value.value.window_val.count = aggregate_peek(channel->aggregate, windows);
+                channel->aggregate->reported = value.value.window_val.count;
+                read = true;
+
+                /* Marked again after its windows were reported */
+                if (value.value.window_val.count == 0) {
+                    bits &= bits - 1;
+                    continue;
+                }
+            } else {
+                read = device_read_for_report(dev, channel, &value);
             }
 
-            break;
+            if (!read || !cb(channel, &value, ctx)) {
+                /* Put back the channels not reported */
+                device_lock();
+                __atomic_fetch_or(&dev->changed_bitmap[word], bits, __ATOMIC_RELAXED);
+                device_unlock();
+                return visited;
+            }
+
+            if (value.type == DEVICE_VALUE_NUMBER)
+                __atomic_store(&channel->reported_num, &value.value.num_val, __ATOMIC_RELAXED);
+            bits &= bits - 1;
+            visited++;
         }
+    }
 
-        temp = temp->next;
+    return visited;
+}
+
+uint16_t device_report_changes(device_report_cb_t cb, void* ctx) {
+    return device_report_changes_in(&g_device, cb, ctx);
+}
+
+void device_report_sent_in(device_t* dev, uint16_t id) {
+    device_channel_t* channel = device_get_channel_in(dev, id);
+    if (channel == NULL || channel->aggregate == NULL)
+        return;
+
+    aggregate_consume(channel->aggregate, channel->aggregate->reported);
+    channel->aggregate->reported = 0;
+}
+
+void device_report_sent(uint16_t id) {
+    device_report_sent_in(&g_device, id);
+}
+
+void device_mark_channel_changed_in(device_t* dev, uint16_t id) {
+    if (device_get_channel_in(dev, id) == NULL)
+        return;
+
+    device_lock();
+    channel_mark_changed(dev, id);
+    device_unlock();
+}
+
+void device_mark_channel_changed(uint16_t id) {
+    device_mark_channel_changed_in(&g_device, id);
+}
+
+void device_get_change_stats_in(const device_t* dev, device_change_stats_t* stats) {
+    device_lock();
+    *stats = dev->change_stats;
+    device_unlock();
+}
+
+void device_get_change_stats(device_change_stats_t* stats) {
+    device_get_change_stats_in(&g_device, stats);
+}
+
+bool device_add_change_listener(device_change_cb_t cb, void* ctx) {
+    if (g_change_listener_count >= DEVICE_MAX_CHANGE_LISTENERS)
+        return false;
+
+    g_change_listeners[g_change_listener_count].cb = cb;
+    g_change_listeners[g_change_listener_count].ctx = ctx;
+    g_change_listener_count++;
+    return true;
+}
+
+void device_set_schema_listener(device_schema_cb_t cb, void* ctx) {
+    g_schema_listener.ctx = ctx;
+    g_schema_listener.cb = cb;
+}
+
+void device_lock(void) {
+    device_port_lock(g_value_lock);
+}
+
+void device_unlock(void) {
+    device_port_unlock(g_value_lock);
+}
+
+void device_set_channel_value(const char* name, void* value) {
+
+    uint16_t id = device_get_channel_id(name);
+    device_set_channel_value_by_id(id, value);
+
+    if (!log_sink_enabled(ESP_LOG_DEBUG))
+        return;
+
+    device_channel_t* temp = device_get_channel(id);
+    if (temp != NULL) {
+        device_lock();
+        channel_log(ESP_LOG_DEBUG, temp);
+        device_unlock();
+    }
+}
+
+/* Provisioning fields of one channel, as a map */
+static void channel_write_schema(codec_writer_t* writer, const device_channel_t* channel) {
+    codec_write_map_begin(writer);
+
+    codec_write_key(writer, "command");
+    codec_write_bool(writer, channel->cmd);
+
+    switch (channel->type) {
+    case CHANNEL_TYPE_BOOL:
+        codec_write_key(writer, "type");
+        codec_write_string(writer, "boolean");
+        break;
+
+    case CHANNEL_TYPE_NUMBER:
+        codec_write_key(writer, "type");
+        codec_write_string(writer, "number");
+        codec_write_key(writer, "min");
+        codec_write_number(writer, channel->prov_data.num_prov.min);
+        codec_write_key(writer, "max");
+        codec_write_number(writer, channel->prov_data.num_prov.max);
+        codec_write_key(writer, "multipleof");
+        codec_write_number(writer, channel->prov_data.num_prov.multipleof);
+
+        /* Telemetry carries an array of these per window instead of the value */
+        if (channel->aggregate != NULL) {
+            codec_write_key(writer, "window_ms");
+            codec_write_number(writer, channel->prov_data.num_prov.window_ms);
+            codec_write_key(writer, "aggregate");
+            codec_write_array_begin(writer);
+            codec_write_string(writer, "min");
+            codec_write_string(writer, "max");
+            codec_write_string(writer, "mean");
+            codec_write_string(writer, "last");
+            codec_write_string(writer, "count");
+            codec_write_array_end(writer);
+        }
+        break;
+
+    case CHANNEL_TYPE_CHOICE:
+        codec_write_key(writer, "enum");
+        codec_write_array_begin(writer);
+        for (uint8_t i = 0; i < channel->prov_data.opts_prov.count; i++)
+            codec_write_string(writer, channel->prov_data.opts_prov.opts[i]);
+        codec_write_array_end(writer);
+        break;
+
+    case CHANNEL_TYPE_STRING:
+        codec_write_key(writer, "type");
+        codec_write_string(writer, "string");
+        break;
+
+    default:
+        break;
     }
 
-    print_device_channels();
+    codec_write_map_end(writer);
 }
 
-char* device_get_mqtt_provision_json_data(void) {
+size_t device_write_mqtt_provision_in(const device_t* dev, codec_type_t codec, void* buf, size_t size) {
+
+    codec_writer_t writer;
+    codec_writer_init(&writer, codec, buf, size);
+    codec_write_map_begin(&writer);
 
-    cJSON* device = cJSON_CreateObject();
-    
     /* Device name */
-    cJSON_AddStringToObject(device, "device_name", g_device.name);
-    
+    codec_write_key(&writer, "device_name");
+    codec_write_string(&writer, dev->name);
+
     /* Device ID - MAC address */
-    cJSON_AddStringToObject(device, "device_id", g_device.id);
+    codec_write_key(&writer, "device_id");
+    codec_write_string(&writer, dev->id);
+
+    codec_write_key(&writer, "schema_version");
+    codec_write_number(&writer, dev->schema_version);
+
+    /* Payload codecs the device can use after provisioning */
+    codec_write_key(&writer, "codecs");
+    codec_write_array_begin(&writer);
+    for (int i = 0; i < CODEC_COUNT; i++)
+        codec_write_string(&writer, codec_name(i));
+    codec_write_array_end(&writer);
 
     /* Device Channels */
-    cJSON* channels = cJSON_AddObjectToObject(device, "channels");
-    device_channel_t* temp = g_device.channels;
+    codec_write_key(&writer, "channels");
+    codec_write_map_begin(&writer);
+
+    device_channel_t* temp = dev->channels;
     while (temp != NULL) {
+        codec_write_key(&writer, temp->name);
+        channel_write_schema(&writer, temp);
+        temp = temp->next;
+    }
 
-        cJSON* channel_temp = cJSON_AddObjectToObject(channels, temp->name);
+    codec_write_map_end(&writer);
+    codec_write_map_end(&writer);
+    return codec_writer_finish(&writer);
+}
 
-        cJSON_AddBoolToObject(channel_temp, "command", temp->cmd);
+size_t device_write_mqtt_provision(codec_type_t codec, void* buf, size_t size) {
+    return device_write_mqtt_provision_in(&g_device, codec, buf, size);
+}
 
-        switch (temp->type) {
-        case CHANNEL_TYPE_BOOL:
-            cJSON_AddStringToObject(channel_temp, "type", "boolean");
-            break;
-        
-        case CHANNEL_TYPE_NUMBER:
-            cJSON_AddStringToObject(channel_temp, "type", "number");
-            cJSON_AddNumberToObject(channel_temp, "min", temp->prov_data.num_prov.min);
-            cJSON_AddNumberToObject(channel_temp, "max", temp->prov_data.num_prov.max);
-            cJSON_AddNumberToObject(channel_temp, "multipleof", temp->prov_data.num_prov.multipleof);
-            break;
+size_t device_write_mqtt_provision_json(char* buf, size_t size) {
+    return device_write_mqtt_provision(CODEC_JSON, buf, size);
+}
 
-        case CHANNEL_TYPE_CHOICE: {
-            cJSON* temp_options = cJSON_AddArrayToObject(channel_temp, "enum");
-            prov_opt_list_t* temp_opt = temp->prov_data.opts_prov;
+bool device_schema_pending_in(const device_t* dev) {
+    return dev->schema_acked != dev->schema_version;
+}
 
-            while (temp_opt != NULL) {
-                cJSON_AddItemToArray(temp_options, cJSON_CreateString(temp_opt->opt));
-                temp_opt = temp_opt->next;
-            }
-            break;
-        }
+bool device_schema_pending(void) {
+    return device_schema_pending_in(&g_device);
+}
 
-        case CHANNEL_TYPE_STRING:
-            cJSON_AddStringToObject(channel_temp, "type", "string");
-            break;
-        default:
-            break;
-        }
+bool device_schema_has_delta_in(const device_t* dev) {
+    return dev->schema_acked != 0 && dev->schema_acked >= dev->schema_log_base
+                && dev->schema_acked <= dev->schema_version && dev->schema_log != NULL;
+}
 
-        temp = temp->next;
+bool device_schema_has_delta(void) {
+    return device_schema_has_delta_in(&g_device);
+}
+
+/* Change that produced the given version, see device_schema_has_delta_in */
+static const device_schema_change_t* schema_change(const device_t* dev, uint32_t version) {
+    return &dev->schema_log[version % DEVICE_SCHEMA_LOG_SIZE];
+}
+
+/* Channel added by one of the changes after the acknowledged version */
+static bool schema_added_since_ack(const device_t* dev, const device_channel_t* channel) {
+    for (uint32_t version = dev->schema_acked + 1; version <= dev->schema_version; version++) {
+        const device_schema_change_t* change = schema_change(dev, version);
+        if (change->added && change->channel == channel)
+            return true;
+    }
+    return false;
+}
+
+/* Net changes since the acknowledged version: a channel added then removed in
+ * between is left out, one removed and added again under the same name is in
+ * both and the server applies "removed" first */
+static size_t device_write_schema_delta(const device_t* dev, codec_type_t codec, void* buf, size_t size) {
+
+    codec_writer_t writer;
+    codec_writer_init(&writer, codec, buf, size);
+    codec_write_map_begin(&writer);
+
+    codec_write_key(&writer, "device_id");
+    codec_write_string(&writer, dev->id);
+
+    codec_write_key(&writer, "schema_version");
+    codec_write_number(&writer, dev->schema_version);
+
+    codec_write_key(&writer, "base_version");
+    codec_write_number(&writer, dev->schema_acked);
+
+    codec_write_key(&writer, "removed");
+    codec_write_array_begin(&writer);
+    for (uint32_t version = dev->schema_acked + 1; version <= dev->schema_version; version++) {
+        const device_schema_change_t* change = schema_change(dev, version);
+        if (!change->added && !schema_added_since_ack(dev, change->channel))
+            codec_write_string(&writer, change->channel->name);
+    }
+    codec_write_array_end(&writer);
+
+    codec_write_key(&writer, "added");
+    codec_write_map_begin(&writer);
+    for (uint32_t version = dev->schema_acked + 1; version <= dev->schema_version; version++) {
+        const device_schema_change_t* change = schema_change(dev, version);
+        if (!change->added || dev->channel_table[change->channel->id] != change->channel)
+            continue;
+
+        codec_write_key(&writer, change->channel->name);
+        channel_write_schema(&writer, change->channel);
+    }
+    codec_write_map_end(&writer);
+
+    codec_write_map_end(&writer);
+    return codec_writer_finish(&writer);
+}
+
+size_t device_write_schema_update_in(const device_t* dev, codec_type_t codec, void* buf, size_t size) {
+    if (device_schema_has_delta_in(dev))
+        return device_write_schema_delta(dev, codec, buf, size);
+
+    return device_write_mqtt_provision_in(dev, codec, buf, size);
+}
+
+size_t device_write_schema_update(codec_type_t codec, void* buf, size_t size) {
+    return device_write_schema_update_in(&g_device, codec, buf, size);
+}
+
+char* device_get_schema_update_json(size_t* len, bool* delta) {
+    /* Version and document from the same schema */
+    device_lock();
+    if (!device_schema_pending_in(&g_device)) {
+        device_unlock();
+        return NULL;
+    }
+
+    *delta = device_schema_has_delta_in(&g_device);
+    *len = device_write_schema_update_in(&g_device, CODEC_JSON, NULL, 0);
+    char* doc = malloc(*len + 1);
+    if (doc != NULL) {
+        device_write_schema_update_in(&g_device, CODEC_JSON, doc, *len + 1);
+        g_device.schema_sent = g_device.schema_version;
+        g_device.schema_sent_delta = *delta;
+    }
+    device_unlock();
+
+    if (doc == NULL)
+        ESP_LOGE(TAG, "No memory for %u bytes of schema update", (unsigned) (*len + 1));
+    return doc;
+}
+
+void device_ack_schema_in(device_t* dev, uint32_t version) {
+    if (version == dev->schema_version) {
+        /* Logging starts with the first version the server holds */
+        if (dev->schema_acked == 0)
+            dev->schema_log_base = version;
+        dev->schema_acked = version;
+        return;
     }
 
-    char* output_buf = cJSON_PrintUnformatted(device);
+    bool logged = dev->schema_acked != 0 && dev->schema_log != NULL
+                && version >= dev->schema_log_base && version < dev->schema_version;
+    ESP_LOGW(TAG, "Device %s: server holds schema version %u, ours is %u, sending %s next", dev->id,
+                (unsigned) version, (unsigned) dev->schema_version, logged ? "the changes" : "all of it");
+    dev->schema_acked = logged ? version : 0;
+}
 
-    ESP_LOGI(TAG, "Device Provision JSON data:\n%s", cJSON_Print(device));
-    
-    cJSON_Delete(device);
+char* device_get_mqtt_provision_json_data(void) {
+
+    int64_t start = metrics_now_us();
+
+    /* Measure first so the buffer is allocated exactly once, channels added
+     * meanwhile would not fit */
+    device_lock();
+    size_t len = device_write_mqtt_provision_json(NULL, 0);
+
+    char* output_buf = malloc(len + 1);
+    if (output_buf == NULL) {
+        device_unlock();
+        ESP_LOGE(TAG, "No memory for %u bytes of provision data", (unsigned) (len + 1));
+        return NULL;
+    }
+
+    device_write_mqtt_provision_json(output_buf, len + 1);
+    g_device.schema_sent = g_device.schema_version;
+    g_device.schema_sent_delta = false;
+    device_unlock();
+    metrics_observe_since(g_metric_prov_serialize, start);
+
+    /* Long documents are cut at LOG_SINK_LINE_MAX */
+    LOG_SINK_I(TAG, "Device provision JSON data (%u bytes)", (unsigned) len);
+    LOG_SINK_D(TAG, "%s", output_buf);
     return output_buf;
-}
\ No newline at end of file
+}
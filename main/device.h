@@ -1,5 +1,41 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "codec.h"
+
+/* Size of the block holding the device schema */
+#ifndef DEVICE_SCHEMA_ARENA_SIZE
+#define DEVICE_SCHEMA_ARENA_SIZE        4096
+#endif
+
+/* Invalid channel ID, returned when a channel name is not found */
+#define DEVICE_CHANNEL_ID_INVALID       0xFFFF
+
+/* Longest channel key written for a short ID, including NUL */
+#define DEVICE_CHANNEL_KEY_MAX          6
+
+/* Maximum number of channel value change listeners */
+#define DEVICE_MAX_CHANGE_LISTENERS     4
+
+/* Channels the board's device can still add once sealed */
+#ifndef DEVICE_SCHEMA_HEADROOM
+#define DEVICE_SCHEMA_HEADROOM          8
+#endif
+
+/* Schema changes kept for a delta against the version the server acknowledged */
+#ifndef DEVICE_SCHEMA_LOG_SIZE
+#define DEVICE_SCHEMA_LOG_SIZE          16
+#endif
+
+/* Closed aggregation windows kept per channel until reported, power of two */
+#ifndef DEVICE_AGGREGATE_WINDOWS
+#define DEVICE_AGGREGATE_WINDOWS        4
+#endif
+
 /* Channel data type */
 typedef enum {
     CHANNEL_TYPE_BOOL,
@@ -8,27 +44,51 @@ typedef enum {
     CHANNEL_TYPE_STRING,
 } channel_type_t;
 
-typedef struct prov_opt_list_t {
-    struct prov_opt_list_t* next;
-    char* opt;
+typedef struct {
+    const char* const* opts;
+    uint8_t count;
 } prov_opt_list_t;
 
 typedef struct {
     float min;
     float max;
     float multipleof;
+
+    /* Aggregation window, 0 to report every value */
+    uint32_t window_ms;
 } prov_num_type_t;
 
+typedef union {
+    prov_num_type_t num_prov;
+    prov_opt_list_t opts_prov;
+} prov_data_t;
+
+/* One closed aggregation window of a number channel */
+typedef struct {
+    float min;
+    float max;
+    float mean;
+    float last;
+    uint32_t count;
+} device_window_t;
+
+/* Open window and closed ones waiting to be reported, see device.c */
+typedef struct device_aggregate_t device_aggregate_t;
+
 typedef struct device_channel_t {
     struct device_channel_t* next;
-    char* name;
+    struct device_channel_t* hash_next;
+    const char* name;
+    uint16_t id;
+    uint16_t short_id;          /* assigned by the server, DEVICE_CHANNEL_ID_INVALID if none */
     bool cmd;
     channel_type_t type;
 
-    union {
-        prov_num_type_t num_prov;
-        prov_opt_list_t* opts_prov;
-    } prov_data;
+    /* Number channels: smallest change worth reporting and the last value reported */
+    float deadband;
+    float reported_num;
+
+    prov_data_t prov_data;
 
     union {
         bool bool_val;
@@ -36,27 +96,220 @@ typedef struct device_channel_t {
         char* str_val;
     } data_value;
 
+    /* Bytes allocated for str_val */
+    uint16_t str_cap;
+
+    /* Number channels with a window: samples are aggregated, windows are reported */
+    device_aggregate_t* aggregate;
+
 } device_channel_t;
 
+/* Channel schema known at compile time, kept in flash with the strings it points to */
+typedef struct {
+    const char* name;
+    channel_type_t type;
+    bool cmd;
+    prov_data_t prov_data;
+} device_channel_def_t;
+
+#define DEVICE_BOOL_CHANNEL(name, cmd) \
+    { (name), CHANNEL_TYPE_BOOL, (cmd), { .num_prov = { 0 } } }
+
+#define DEVICE_NUMBER_CHANNEL(name, cmd, min, max, multipleof) \
+    { (name), CHANNEL_TYPE_NUMBER, (cmd), { .num_prov = { (min), (max), (multipleof), 0 } } }
+
+/* Number channel reported as min/max/mean/last/count over windows of window_ms */
+#define DEVICE_AGGREGATE_CHANNEL(name, cmd, min, max, multipleof, window_ms) \
+    { (name), CHANNEL_TYPE_NUMBER, (cmd), { .num_prov = { (min), (max), (multipleof), (window_ms) } } }
+
+#define DEVICE_CHOICE_CHANNEL(name, cmd, ...) \
+    { (name), CHANNEL_TYPE_CHOICE, (cmd), { .opts_prov = { \
+        .opts = (const char* const[]) { __VA_ARGS__ }, \
+        .count = sizeof((const char* const[]) { __VA_ARGS__ }) / sizeof(const char*) } } }
+
+#define DEVICE_STRING_CHANNEL(name, cmd) \
+    { (name), CHANNEL_TYPE_STRING, (cmd), { .num_prov = { 0 } } }
+
+/* Channel added or removed, the change that produced one schema version */
+typedef struct {
+    const device_channel_t* channel;    /* removed channels stay in the arena */
+    bool added;
+} device_schema_change_t;
+
+typedef struct {
+    uint32_t changes;           /* channels marked changed */
+    uint32_t coalesced;         /* changes to a channel already marked */
+    uint32_t suppressed;        /* sets within the deadband or to the same value */
+    uint32_t windows_dropped;   /* aggregation windows closed with none free */
+} device_change_stats_t;
+
 typedef struct {
     char* name;
     char* id;
     device_channel_t* channels;
+
+    /* Payload codec negotiated at MQTT provisioning */
+    codec_type_t codec;
+
+    /* Schema storage: names, options and channel nodes */
+    arena_t arena;
+
+    /* Channel index: ID table and name hash buckets */
+    device_channel_t** channel_table;
+    uint16_t channel_table_size;
+    uint16_t channel_count;
+    device_channel_t** hash_buckets;
+    uint16_t hash_bucket_count;
+
+    /* Channel index and changed bitmap were moved into the schema arena by sealing, they no longer grow */
+    bool index_in_arena;
+
+    /* Short IDs assigned at provisioning, channel ID by short ID */
+    uint16_t* short_table;
+    uint16_t short_count;
+
+    /* Schema version, bumped by every channel added or removed, and the one the
+     * server acknowledged, 0 while it needs the full document */
+    uint32_t schema_version;
+    uint32_t schema_acked;
+
+    /* Version of the last document or update written for the server, 0 when none,
+     * and whether it held only the changes */
+    uint32_t schema_sent;
+    bool schema_sent_delta;
+
+    /* Changes after schema_log_base, the one to version v at v % DEVICE_SCHEMA_LOG_SIZE */
+    device_schema_change_t* schema_log;
+    uint32_t schema_log_base;
+
+    /* Channels changed since last reported, indexed by channel ID */
+    uint32_t* changed_bitmap;
+    uint16_t aggregate_count;
+    device_change_stats_t change_stats;
+
+    /* Odd while a writer changes values, readers retry when it moved */
+    uint32_t value_seq;
+
+    /* String buffers outgrown by their values and the buffers of removed channels,
+     * kept until the device is released since a reader may still be copying from them */
+    void** retired;
+    uint16_t retired_count;
+    size_t retired_size;
+
+    /* String value being reported, owned by the reporting task */
+    char* report_str;
+    size_t report_str_size;
 } device_t;
 
+/* Value carried by a channel update, choice and string channels take strings */
+typedef enum {
+    DEVICE_VALUE_BOOL,
+    DEVICE_VALUE_NUMBER,
+    DEVICE_VALUE_STRING,
+    DEVICE_VALUE_WINDOWS,               /* in reports, closed windows of an aggregated channel */
+    DEVICE_VALUE_NONE,                  /* in snapshots, no channel has this ID */
+} device_value_type_t;
+
+typedef enum {
+    DEVICE_UPDATE_OK,
+    DEVICE_UPDATE_UNKNOWN_CHANNEL,
+    DEVICE_UPDATE_TYPE_MISMATCH,
+    DEVICE_UPDATE_OUT_OF_RANGE,         /* below min or above max */
+    DEVICE_UPDATE_NOT_MULTIPLE,         /* not a multiple of multipleof */
+    DEVICE_UPDATE_INVALID_OPTION,       /* not in the choice enum */
+    DEVICE_UPDATE_NO_MEMORY,
+} device_update_status_t;
+
+typedef struct {
+    uint16_t channel_id;
+    device_value_type_t type;
+
+    union {
+        bool bool_val;
+        float num_val;
+        const char* str_val;            /* copied, only needs to last the call */
+    } value;
+
+    /* Set by device_update_channels */
+    device_update_status_t status;
+} device_update_t;
+
+/* Copy of a channel value, strings point into the reader's buffer */
+typedef struct {
+    device_value_type_t type;
+
+    union {
+        bool bool_val;
+        float num_val;
+        const char* str_val;            /* NULL if unset or it did not fit */
+
+        struct {
+            const device_window_t* windows;     /* oldest first */
+            uint8_t count;
+        } window_val;
+    } value;
+} device_value_t;
+
+/* Called after a channel value is set, from the setting task */
+typedef void (*device_change_cb_t)(uint16_t channel_id, void* ctx);
+
+/* Called after channels were added to or removed from the board's device, from that task */
+typedef void (*device_schema_cb_t)(void* ctx);
+
+/* Called for each changed channel with a copy of its value, return false to stop */
+typedef bool (*device_report_cb_t)(const device_channel_t* channel, const device_value_t* value, void* ctx);
+
 /* Get device MAC address */
 void get_device_id(char* id_buffer);
 
-/* Check for MQTT provision status */
+/* Check for MQTT provision status, false if the schema changed since */
 void device_is_mqtt_provisioned(bool* provisioned);
 
 
+/* Stable hash of the channel schema, compared against the provisioned one */
+uint32_t device_get_schema_fingerprint(void);
+
+
 /* Set MQTT provision status */
 void device_set_provisioned(void);
 
 
-/* Check the provisioning response */
-bool device_check_prov_resp(char* resp);
+/* Check the provisioning response. On success its "schema_version" is the version
+ * the server holds, the next schema update is a delta from it when possible.
+ * Without one the last document or update written for the server is acknowledged,
+ * nothing if none was. A refusal acknowledges nothing. Short IDs change only when
+ * it carries a "channel_ids" map, merged into the others when it answers a delta. */
+bool device_check_prov_resp(const char* resp, size_t len);
+
+
+/* Channels were added or removed since the server acknowledged the schema */
+bool device_schema_pending(void);
+
+
+/* The changes since the acknowledged version are still in the change log */
+bool device_schema_has_delta(void);
+
+
+/* Write the schema update for the server: the channels added and removed since
+ * the version it acknowledged, or the full provisioning data when the change log
+ * no longer covers it. Returns the full length, buf may be NULL to only measure. */
+size_t device_write_schema_update(codec_type_t codec, void* buf, size_t size);
+
+
+/* Allocate and write the JSON schema update, NUL terminated, noting its version
+ * for a response without one. delta tells whether it holds only the changes.
+ * NULL when nothing is pending or on failure. */
+char* device_get_schema_update_json(size_t* len, bool* delta);
+
+
+/* Get the payload codec for telemetry and commands */
+codec_type_t device_get_codec(void);
+
+
+/* Key of a channel in telemetry and commands: its short ID in decimal once the
+ * server assigned one, its name otherwise. buf holds DEVICE_CHANNEL_KEY_MAX bytes.
+ * Channels named with digits only are refused so the two cannot collide. */
+const char* device_get_channel_key(const device_channel_t* channel, char* buf);
 
 
 /* Create device structure */
@@ -70,6 +323,10 @@ void device_add_bool_channel(const char* name, bool cmd, const char* title,
 void device_add_nummber_channel(const char* name, bool cmd, const char* title,
                     const char* description, float min, float max, float multipleof);
 
+/* Number channel whose samples are aggregated over windows of window_ms */
+void device_add_aggregate_channel(const char* name, bool cmd, const char* title,
+                    const char* description, float min, float max, float multipleof, uint32_t window_ms);
+
 void device_add_multi_option_channel(const char* name, bool cmd, const char* title,
                     const char* description, uint8_t opt_count, ...);
 
@@ -77,17 +334,181 @@ void device_add_string_channel(const char* name, bool cmd, const char* title,
                     const char* description);
 
 
+/* Add channels from a table, in order. Names and options are not copied,
+ * the table and its strings must outlive the device (static const). */
+void device_add_channels(const device_channel_def_t* defs, uint16_t count);
+
+
+/* Seal the device schema: the channel index moves into the schema arena with room
+ * for DEVICE_SCHEMA_HEADROOM more channels, whose nodes and names take the arena
+ * space left. Past that no channel can be added. */
+void device_seal(void);
+
+
+/* Get schema arena usage in bytes */
+void device_get_arena_usage(size_t* used, size_t* size);
+
+
 /* Remove channel from device */
 void device_remove_channel(const char* name);
 
 
-/* Set channel value */
+/* Get channel ID by name, DEVICE_CHANNEL_ID_INVALID if not found */
+uint16_t device_get_channel_id(const char* name);
+
+
+/* Get channel by ID, NULL if not found */
+device_channel_t* device_get_channel(uint16_t id);
+
+
+/* Get the number of channel IDs issued, every ID is below it */
+uint16_t device_get_channel_count(void);
+
+
+/* Set channel value, checked like device_update_channels */
 void device_set_channel_value(const char* name, void* value);
 
+void device_set_channel_value_by_id(uint16_t id, void* value);
+
+
+/* Validate and apply updates in one locked pass, each one gets its status.
+ * Invalid updates are skipped, the others still apply. Returns the number applied. */
+uint16_t device_update_channels(device_update_t* updates, uint16_t count);
+
+const char* device_update_status_name(device_update_status_t status);
+
+
+/* Register a channel value change listener */
+bool device_add_change_listener(device_change_cb_t cb, void* ctx);
+
+
+/* Set the listener for channels added or removed at runtime, NULL to clear */
+void device_set_schema_listener(device_schema_cb_t cb, void* ctx);
+
+
+/* Set the smallest change of a number channel that is reported, defaults to its multipleof */
+void device_set_channel_deadband(uint16_t id, float deadband);
+
+
+/* Visit the channels changed since last reported and clear them, without holding
+ * writers off while the callback runs. A channel set again meanwhile is reported
+ * again next time. The channel the callback stops at stays changed. One reporter
+ * per device at a time. Returns the number visited.
+ * Aggregated channels are visited with their closed windows, windows past their
+ * period are closed first. Windows visited stay until device_report_sent, a
+ * channel marked changed again before that is visited with them again. */
+uint16_t device_report_changes(device_report_cb_t cb, void* ctx);
+
+
+/* Drop what the last report visited of a channel once it was sent: the closed
+ * windows of an aggregated channel, nothing for the others */
+void device_report_sent(uint16_t id);
+
+
+/* Mark a channel changed again, e.g. when its report could not be sent */
+void device_mark_channel_changed(uint16_t id);
+
+
+/* Get change tracking counters */
+void device_get_change_stats(device_change_stats_t* stats);
+
+
+/* Copy every channel value, indexed by channel ID, as one consistent set without
+ * blocking writers. Strings are copied into str_buf, those that do not fit get NULL.
+ * Returns the string bytes all of them need, str_buf may be NULL to only measure. */
+size_t device_snapshot(device_value_t* values, uint16_t count, char* str_buf, size_t str_size);
+
+
+/* Writer lock, held while values change. Readers use device_snapshot instead. */
+void device_lock(void);
+
+void device_unlock(void);
+
 
 /* Get the JSON provisioning data */
 char* device_get_mqtt_provision_json_data(void);
 
+/* Write the JSON provisioning data into buf without allocating.
+ * Returns the full length like snprintf, buf may be NULL to only measure. */
+size_t device_write_mqtt_provision_json(char* buf, size_t size);
+
+/* Same as above in any codec */
+size_t device_write_mqtt_provision(codec_type_t codec, void* buf, size_t size);
+
 
 /* Print device created channels */
-void print_device_channels(void);
\ No newline at end of file
+void print_device_channels(void);
+
+
+/* Devices other than the board itself, e.g. the sub-devices of a gateway.
+ * Every call below has a device_ variant acting on the board's own device,
+ * writers of all devices share one lock and change listeners only follow
+ * the board's own device. */
+
+/* The board's own device */
+device_t* device_get_self(void);
+
+
+/* Create a sealed device from a channel table, sized to fit it exactly.
+ * name and id are copied, the table must outlive the device. NULL on failure. */
+device_t* device_create(const char* name, const char* id, const device_channel_def_t* defs, uint16_t count);
+
+void device_destroy(device_t* dev);
+
+
+/* Heap bytes held by the device: structure, schema, index and string values */
+size_t device_get_footprint_in(const device_t* dev);
+
+
+void device_add_channels_in(device_t* dev, const device_channel_def_t* defs, uint16_t count);
+
+uint16_t device_get_channel_id_in(const device_t* dev, const char* name);
+
+/* Find a channel by its key in a payload, a short ID or a name, key need not be
+ * NUL-terminated. NULL if not found. */
+device_channel_t* device_find_channel_key_in(const device_t* dev, const char* key, size_t key_len);
+
+device_channel_t* device_get_channel_in(const device_t* dev, uint16_t id);
+
+uint16_t device_get_channel_count_in(const device_t* dev);
+
+uint16_t device_update_channels_in(device_t* dev, device_update_t* updates, uint16_t count);
+
+uint16_t device_report_changes_in(device_t* dev, device_report_cb_t cb, void* ctx);
+
+void device_report_sent_in(device_t* dev, uint16_t id);
+
+size_t device_snapshot_in(const device_t* dev, device_value_t* values, uint16_t count, char* str_buf, size_t str_size);
+
+void device_mark_channel_changed_in(device_t* dev, uint16_t id);
+
+void device_get_change_stats_in(const device_t* dev, device_change_stats_t* stats);
+
+uint32_t device_get_schema_fingerprint_in(const device_t* dev);
+
+size_t device_write_mqtt_provision_in(const device_t* dev, codec_type_t codec, void* buf, size_t size);
+
+bool device_schema_pending_in(const device_t* dev);
+
+bool device_schema_has_delta_in(const device_t* dev);
+
+size_t device_write_schema_update_in(const device_t* dev, codec_type_t codec, void* buf, size_t size);
+
+/* Record the schema version the server holds. An older version still in the
+ * change log is kept for a delta, any other forces the full document. */
+void device_ack_schema_in(device_t* dev, uint32_t version);
+
+
+/* Short IDs from the "channel_ids" map of a provisioning response, channel name
+ * to an ID below the channel count. The whole map is refused if an entry is not,
+ * leaving channels keyed by name. data NULL drops the short IDs. */
+bool device_set_short_ids_in(device_t* dev, codec_type_t codec, const void* data, size_t len);
+
+/* Short IDs from the map answering a schema delta, for the channels it added. The
+ * others keep theirs, all are kept if the map is refused. */
+bool device_merge_short_ids_in(device_t* dev, codec_type_t codec, const void* data, size_t len);
+
+/* Keep the short IDs in NVS under key, loaded only for the same schema */
+bool device_save_short_ids_in(const device_t* dev, const char* key);
+
+void device_load_short_ids_in(device_t* dev, const char* key);
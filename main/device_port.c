@@ -0,0 +1,77 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_wifi.h>
+#include <nvs.h>
+
+#include "device_port.h"
+
+#define DEVICE_PORT_NVS_NAMESPACE       "storage"
+
+/* Opened on first use and kept open */
+static nvs_handle_t nvs_storage;
+static bool nvs_storage_open;
+
+static bool device_port_nvs(nvs_handle_t* handle) {
+    if (!nvs_storage_open)
+        nvs_storage_open = (nvs_open(DEVICE_PORT_NVS_NAMESPACE, NVS_READWRITE, &nvs_storage) == ESP_OK);
+
+    *handle = nvs_storage;
+    return nvs_storage_open;
+}
+
+void device_port_get_mac(uint8_t mac[6]) {
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+}
+
+bool device_port_get_u8(const char* key, uint8_t* val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_get_u8(handle, key, val) == ESP_OK;
+}
+
+bool device_port_set_u8(const char* key, uint8_t val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_set_u8(handle, key, val) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+bool device_port_get_u16(const char* key, uint16_t* val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_get_u16(handle, key, val) == ESP_OK;
+}
+
+bool device_port_set_u16(const char* key, uint16_t val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_set_u16(handle, key, val) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+bool device_port_get_u32(const char* key, uint32_t* val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_get_u32(handle, key, val) == ESP_OK;
+}
+
+bool device_port_set_u32(const char* key, uint32_t val) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_set_u32(handle, key, val) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+bool device_port_get_blob(const char* key, void* buf, size_t* len) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_get_blob(handle, key, buf, len) == ESP_OK;
+}
+
+bool device_port_set_blob(const char* key, const void* buf, size_t len) {
+    nvs_handle_t handle;
+    return device_port_nvs(&handle) && nvs_set_blob(handle, key, buf, len) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+void* device_port_lock_create(void) {
+    return xSemaphoreCreateMutex();
+}
+
+void device_port_lock(void* lock) {
+    xSemaphoreTake((SemaphoreHandle_t) lock, portMAX_DELAY);
+}
+
+void device_port_unlock(void* lock) {
+    xSemaphoreGive((SemaphoreHandle_t) lock);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Platform services used by the device model.
+ * device_port.c implements them on ESP-IDF; a host build of device.c
+ * links its own implementation instead. */
+
+/* Station MAC address */
+void device_port_get_mac(uint8_t mac[6]);
+
+
+/* Persistent key-value storage, false if the key is missing or on error.
+ * Every set is committed to flash. */
+bool device_port_get_u8(const char* key, uint8_t* val);
+
+bool device_port_set_u8(const char* key, uint8_t val);
+
+bool device_port_get_u16(const char* key, uint16_t* val);
+
+bool device_port_set_u16(const char* key, uint16_t val);
+
+bool device_port_get_u32(const char* key, uint32_t* val);
+
+bool device_port_set_u32(const char* key, uint32_t val);
+
+/* buf may be NULL to get the stored length */
+bool device_port_get_blob(const char* key, void* buf, size_t* len);
+
+bool device_port_set_blob(const char* key, const void* buf, size_t len);
+
+
+/* Mutex guarding channel values */
+void* device_port_lock_create(void);
+
+void device_port_lock(void* lock);
+
+void device_port_unlock(void* lock);
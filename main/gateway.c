@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+
+#include "codec.h"
+#include "command_pipeline.h"
+#include "device.h"
+#include "device_port.h"
+#include "gateway.h"
+#include "log_sink.h"
+#include "telemetry.h"
+#include "topic_router.h"
+
+static const char* TAG = "gateway";
+
+typedef struct {
+    device_t* device;
+    uint32_t fingerprint;       /* schema fingerprint, stored once the server acknowledged it */
+    bool provisioned;
+} gateway_device_t;
+
+/* Entries never move, g_device_count is published after the entry is filled */
+static gateway_device_t g_devices[GATEWAY_MAX_DEVICES];
+static uint16_t g_device_count;
+
+/* Open addressing over sub-device IDs, entry index + 1, 0 when empty */
+static uint16_t g_id_slots[GATEWAY_HASH_SIZE];
+
+static gateway_topics_t g_topics;
+static char* command_filter;
+static char* provision_filter;
+
+static gateway_publish_t provision_publish;
+static uint32_t gateway_interval_ms;
+
+static gateway_stats_t g_stats;
+
+/* FNV-1a hash of the sub-device ID */
+static uint32_t gateway_id_hash(const char* id, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static gateway_device_t* gateway_find_entry(const char* id, size_t id_len) {
+    if (id_len == 0 || id_len >= GATEWAY_DEVICE_ID_MAX)
+        return NULL;
+
+    uint16_t slot = gateway_id_hash(id, id_len) & (GATEWAY_HASH_SIZE - 1);
+    for (;;) {
+        uint16_t index = __atomic_load_n(&g_id_slots[slot], __ATOMIC_ACQUIRE);
+        if (index == 0)
+            return NULL;
+
+        gateway_device_t* entry = &g_devices[index - 1];
+        if (strncmp(entry->device->id, id, id_len) == 0 && entry->device->id[id_len] == '\0')
+            return entry;
+
+        slot = (slot + 1) & (GATEWAY_HASH_SIZE - 1);
+    }
+}
+
+device_t* gateway_find_device(const char* id, size_t id_len) {
+    gateway_device_t* entry = gateway_find_entry(id, id_len);
+    return (entry != NULL) ? entry->device : NULL;
+}
+
+uint16_t gateway_get_device_count(void) {
+    return __atomic_load_n(&g_device_count, __ATOMIC_ACQUIRE);
+}
+
+/* NVS key holding the provisioned fingerprint, IDs are longer than NVS keys allow */
+static void gateway_nvs_key(const char* id, char* key) {
+    sprintf(key, "gw%08x", (unsigned) gateway_id_hash(id, strlen(id)));
+}
+
+/* NVS key holding the short channel IDs */
+static void gateway_ids_key(const char* id, char* key) {
+    sprintf(key, "gi%08x", (unsigned) gateway_id_hash(id, strlen(id)));
+}
+
+/* IDs become a topic level, so no separators or wildcards */
+static bool gateway_id_valid(const char* id) {
+    size_t len = strlen(id);
+    return len > 0 && len < GATEWAY_DEVICE_ID_MAX && strpbrk(id, "/+#") == NULL;
+}
+
+device_t* gateway_add_device(const char* name, const char* id, const device_channel_def_t* defs, uint16_t count) {
+    uint16_t index = g_device_count;
+
+    if (!gateway_id_valid(id)) {
+        ESP_LOGE(TAG, "Invalid sub-device ID %s", id);
+        return NULL;
+    }
+    if (gateway_find_entry(id, strlen(id)) != NULL) {
+        ESP_LOGE(TAG, "Sub-device %s already exists", id);
+        return NULL;
+    }
+    if (index >= GATEWAY_MAX_DEVICES) {
+        ESP_LOGE(TAG, "No room for sub-device %s", id);
+        return NULL;
+    }
+
+    device_t* dev = device_create(name, id, defs, count);
+    if (dev == NULL)
+        return NULL;
+
+    gateway_device_t* entry = &g_devices[index];
+    entry->device = dev;
+    entry->fingerprint = device_get_schema_fingerprint_in(dev);
+
+    /* Already provisioned with this schema before the last reset */
+    char key[16];
+    uint32_t stored = 0;
+    gateway_nvs_key(id, key);
+    entry->provisioned = device_port_get_u32(key, &stored) && stored == entry->fingerprint;
+    if (entry->provisioned) {
+        gateway_ids_key(id, key);
+        device_load_short_ids_in(dev, key);
+    }
+
+    uint16_t slot = gateway_id_hash(id, strlen(id)) & (GATEWAY_HASH_SIZE - 1);
+    while (g_id_slots[slot] != 0)
+        slot = (slot + 1) & (GATEWAY_HASH_SIZE - 1);
+
+    __atomic_store_n(&g_device_count, index + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_id_slots[slot], index + 1, __ATOMIC_RELEASE);
+
+    ESP_LOGI(TAG, "Sub-device %s (%s): %u channels, %u bytes", id, name, count,
+                (unsigned) device_get_footprint_in(dev));
+    return dev;
+}
+
+/* Sub-device addressed by the last level of the topic */
+static gateway_device_t* gateway_topic_entry(const char* topic, size_t topic_len) {
+    size_t start = topic_len;
+    while (start > 0 && topic[start - 1] != '/')
+        start--;
+
+    gateway_device_t* entry = gateway_find_entry(topic + start, topic_len - start);
+    if (entry == NULL) {
+        __atomic_fetch_add(&g_stats.unknown, 1, __ATOMIC_RELAXED);
+        LOG_SINK_W(TAG, "No sub-device for topic %.*s", (int) topic_len, topic);
+    }
+    return entry;
+}
+
+static void gateway_command_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    gateway_device_t* entry = gateway_topic_entry(topic, topic_len);
+    if (entry == NULL)
+        return;
+
+    /* Parsed here, applied by the command task like the gateway's own commands */
+    int queued = command_pipeline_submit_to(entry->device, data, data_len);
+    __atomic_fetch_add(&g_stats.commands, 1, __ATOMIC_RELAXED);
+    LOG_SINK_D(TAG, "Command for %s, %d channel updates queued", entry->device->id, queued);
+}
+
+typedef struct {
+    int status;
+    const char* short_ids;
+    size_t short_ids_len;
+} gateway_prov_resp_t;
+
+static bool prov_status_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    gateway_prov_resp_t* resp = ctx;
+    if (key_len == 6 && memcmp(key, "status", 6) == 0 && value->type == CODEC_VALUE_NUMBER) {
+        resp->status = (int) value->num_val;
+    } else if (key_len == 11 && memcmp(key, "channel_ids", 11) == 0 && value->type == CODEC_VALUE_OTHER) {
+        resp->short_ids = value->str;
+        resp->short_ids_len = value->str_len;
+    }
+    return true;
+}
+
+static void gateway_prov_resp_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    gateway_device_t* entry = gateway_topic_entry(topic, topic_len);
+    if (entry == NULL || __atomic_load_n(&entry->provisioned, __ATOMIC_ACQUIRE))
+        return;
+
+    /* Sub-devices use the codec negotiated by the gateway, only the status and short IDs matter */
+    gateway_prov_resp_t resp = { 0 };
+    if (!codec_decode_map(CODEC_JSON, data, data_len, prov_status_member, &resp) || resp.status != 1) {
+        LOG_SINK_W(TAG, "Provisioning of %s refused", entry->device->id);
+        return;
+    }
+
+    char key[16];
+    device_set_short_ids_in(entry->device, CODEC_JSON, resp.short_ids, resp.short_ids_len);
+    gateway_ids_key(entry->device->id, key);
+    device_save_short_ids_in(entry->device, key);
+
+    gateway_nvs_key(entry->device->id, key);
+    device_port_set_u32(key, entry->fingerprint);
+
+    /* Short IDs are in place before the gateway task sees the flag */
+    __atomic_store_n(&entry->provisioned, true, __ATOMIC_RELEASE);
+    LOG_SINK_I(TAG, "Sub-device %s is provisioned", entry->device->id);
+}
+
+static char* gateway_filter(const char* topic) {
+    char* filter = malloc(strlen(topic) + 3);
+    if (filter != NULL)
+        sprintf(filter, "%s/+", topic);
+    return filter;
+}
+
+bool gateway_init(const gateway_topics_t* topics, topic_router_t* router) {
+    g_topics = *topics;
+
+    command_filter = gateway_filter(topics->command_topic);
+    provision_filter = gateway_filter(topics->prov_downstream_topic);
+    if (command_filter == NULL || provision_filter == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate topic filters");
+        return false;
+    }
+
+    /* One wildcard route each, the sub-device is looked up from the topic */
+    return topic_router_add(router, command_filter, gateway_command_handle, NULL)
+                && topic_router_add(router, provision_filter, gateway_prov_resp_handle, NULL);
+}
+
+const char* gateway_get_command_filter(void) {
+    return command_filter;
+}
+
+const char* gateway_get_provision_filter(void) {
+    return provision_filter;
+}
+
+/* Publish the provisioning document of a sub-device, always JSON */
+static void gateway_provision(const gateway_device_t* entry, char* topic) {
+    size_t len = device_write_mqtt_provision_in(entry->device, CODEC_JSON, NULL, 0);
+
+    char* doc = malloc(len + 1);
+    if (doc == NULL) {
+        ESP_LOGE(TAG, "No memory for %u bytes of provision data", (unsigned) (len + 1));
+        return;
+    }
+
+    device_write_mqtt_provision_in(entry->device, CODEC_JSON, doc, len + 1);
+    snprintf(topic, GATEWAY_TOPIC_MAX, "%s/%s", g_topics.prov_upstream_topic, entry->device->id);
+    if (provision_publish(topic, doc, len) >= 0)
+        __atomic_fetch_add(&g_stats.prov_sent, 1, __ATOMIC_RELAXED);
+    free(doc);
+}
+
+static void gateway_task(void* arg) {
+    char topic[GATEWAY_TOPIC_MAX];
+    TickType_t next_provision = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(gateway_interval_ms));
+
+        TickType_t now = xTaskGetTickCount();
+        bool provision = (int32_t) (now - next_provision) >= 0;
+        if (provision)
+            next_provision = now + pdMS_TO_TICKS(GATEWAY_PROVISION_RETRY_MS);
+
+        uint16_t count = gateway_get_device_count();
+        for (uint16_t i = 0; i < count; i++) {
+            const gateway_device_t* entry = &g_devices[i];
+
+            /* Changes wait in the device until the server knows its schema */
+            if (!__atomic_load_n(&entry->provisioned, __ATOMIC_ACQUIRE)) {
+                if (provision)
+                    gateway_provision(entry, topic);
+                continue;
+            }
+
+            snprintf(topic, GATEWAY_TOPIC_MAX, "%s/%s", g_topics.telemetry_topic, entry->device->id);
+            telemetry_flush_device(entry->device, topic);
+        }
+    }
+}
+
+bool gateway_start(uint32_t flush_interval_ms, gateway_publish_t publish) {
+    provision_publish = publish;
+    gateway_interval_ms = flush_interval_ms;
+
+    if (xTaskCreate(gateway_task, "gateway", GATEWAY_TASK_STACK_SIZE, NULL,
+                    GATEWAY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create gateway task");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%u sub-devices, flushed every %u ms", gateway_get_device_count(), (unsigned) flush_interval_ms);
+    return true;
+}
+
+void gateway_get_stats(gateway_stats_t* stats) {
+    /* Counters are bumped from the MQTT and gateway tasks */
+    stats->commands = __atomic_load_n(&g_stats.commands, __ATOMIC_RELAXED);
+    stats->unknown = __atomic_load_n(&g_stats.unknown, __ATOMIC_RELAXED);
+    stats->prov_sent = __atomic_load_n(&g_stats.prov_sent, __ATOMIC_RELAXED);
+
+    stats->devices = gateway_get_device_count();
+    stats->provisioned = 0;
+    stats->memory = 0;
+    for (uint16_t i = 0; i < stats->devices; i++) {
+        stats->provisioned += __atomic_load_n(&g_devices[i].provisioned, __ATOMIC_RELAXED);
+        stats->memory += device_get_footprint_in(g_devices[i].device);
+    }
+}
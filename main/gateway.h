@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+#include "topic_router.h"
+
+/* Maximum number of sub-devices behind the gateway */
+#ifndef GATEWAY_MAX_DEVICES
+#define GATEWAY_MAX_DEVICES             64
+#endif
+
+/* Sub-device ID hash slots, power of two at least twice GATEWAY_MAX_DEVICES */
+#ifndef GATEWAY_HASH_SIZE
+#define GATEWAY_HASH_SIZE               128
+#endif
+
+/* Longest sub-device ID, including NUL */
+#define GATEWAY_DEVICE_ID_MAX           24
+
+/* Longest sub-device topic, including NUL */
+#define GATEWAY_TOPIC_MAX               64
+
+/* Provisioning documents of sub-devices not acknowledged yet are sent again after this */
+#define GATEWAY_PROVISION_RETRY_MS      30000
+
+#define GATEWAY_TASK_STACK_SIZE         3072
+#define GATEWAY_TASK_PRIORITY           3
+
+/* Publish a message, returns a negative value on failure */
+typedef int (*gateway_publish_t)(const char* topic, const char* data, size_t len);
+
+/* Topics of the gateway itself, each sub-device gets "<topic>/<device ID>" */
+typedef struct {
+    const char* command_topic;
+    const char* telemetry_topic;
+    const char* prov_upstream_topic;
+    const char* prov_downstream_topic;
+} gateway_topics_t;
+
+typedef struct {
+    uint16_t devices;
+    uint16_t provisioned;
+    uint32_t commands;          /* command messages queued for a sub-device */
+    uint32_t unknown;           /* messages for a sub-device ID not in the table */
+    uint32_t prov_sent;
+    size_t memory;              /* heap held by all sub-devices */
+} gateway_stats_t;
+
+/* Set the topic namespace and add the sub-device routes to the shared router.
+ * The topics must outlive the gateway. */
+bool gateway_init(const gateway_topics_t* topics, topic_router_t* router);
+
+
+/* Add a sub-device with its own schema, see device_create. Add sub-devices from
+ * one task, they are never removed. NULL if the ID is invalid or already used. */
+device_t* gateway_add_device(const char* name, const char* id, const device_channel_def_t* defs, uint16_t count);
+
+
+/* Find a sub-device by ID, id need not be NUL-terminated. NULL if not found. */
+device_t* gateway_find_device(const char* id, size_t id_len);
+
+
+/* Number of sub-devices */
+uint16_t gateway_get_device_count(void);
+
+
+/* Topic filters to subscribe for sub-device commands and provisioning responses */
+const char* gateway_get_command_filter(void);
+
+const char* gateway_get_provision_filter(void);
+
+
+/* Provision the sub-devices and flush their pending changes every interval,
+ * call after telemetry_start. Provisioning documents go through publish. */
+bool gateway_start(uint32_t flush_interval_ms, gateway_publish_t publish);
+
+
+/* Get gateway counters */
+void gateway_get_stats(gateway_stats_t* stats);
@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_reader.h"
+
+/* Longest number token json_token_number converts */
+#define JSON_NUMBER_MAX_LEN     32
+
+typedef struct {
+    const char* js;
+    size_t len;
+    size_t pos;
+    json_token_t* tokens;
+    uint16_t max_tokens;
+    uint16_t count;
+
+    /* Walking an object: values below its members share one token slot, each
+     * member goes to member_cb and its tokens are reused for the next one */
+    bool walk;
+    bool skipping;
+    bool stopped;
+    json_member_cb_t member_cb;
+    void* ctx;
+} json_parser_t;
+
+static int json_parse_value(json_parser_t* parser, int depth);
+
+static void json_skip_ws(json_parser_t* parser) {
+    while (parser->pos < parser->len) {
+        char c = parser->js[parser->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        parser->pos++;
+    }
+}
+
+static bool json_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool json_is_hex(char c) {
+    return json_is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int json_new_token(json_parser_t* parser, json_token_type_t type, size_t start) {
+    if (parser->count >= parser->max_tokens)
+        return JSON_READER_ERROR_NOMEM;
+
+    json_token_t* token = &parser->tokens[parser->count];
+    token->type = type;
+    token->escaped = false;
+    token->start = start;
+    token->end = start;
+    token->size = 0;
+    token->next = parser->count + 1;
+
+    /* Checked but not kept */
+    if (parser->skipping)
+        return parser->count;
+    return parser->count++;
+}
+
+static int json_parse_string(json_parser_t* parser) {
+    int index = json_new_token(parser, JSON_TOKEN_STRING, ++parser->pos);
+    if (index < 0)
+        return index;
+
+    while (parser->pos < parser->len) {
+        unsigned char c = parser->js[parser->pos];
+
+        if (c == '"') {
+            parser->tokens[index].end = parser->pos++;
+            return index;
+        }
+
+        if (c < 0x20)
+            return JSON_READER_ERROR_INVAL;
+
+        if (c == '\\') {
+            parser->tokens[index].escaped = true;
+            if (++parser->pos >= parser->len)
+                return JSON_READER_ERROR_INVAL;
+
+            switch (parser->js[parser->pos]) {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n': case 'r': case 't':
+                break;
+            case 'u':
+                if (parser->len - parser->pos <= 4)
+                    return JSON_READER_ERROR_INVAL;
+                for (int i = 1; i <= 4; i++) {
+                    if (!json_is_hex(parser->js[parser->pos + i]))
+                        return JSON_READER_ERROR_INVAL;
+                }
+                parser->pos += 4;
+                break;
+            default:
+                return JSON_READER_ERROR_INVAL;
+            }
+        }
+
+        parser->pos++;
+    }
+
+    return JSON_READER_ERROR_INVAL;
+}
+
+static int json_parse_number(json_parser_t* parser) {
+    const char* js = parser->js;
+    size_t start = parser->pos, pos = parser->pos, len = parser->len;
+
+    if (pos < len && js[pos] == '-')
+        pos++;
+
+    if (pos < len && js[pos] == '0') {
+        pos++;
+    } else if (pos < len && json_is_digit(js[pos])) {
+        while (pos < len && json_is_digit(js[pos]))
+            pos++;
+    } else {
+        return JSON_READER_ERROR_INVAL;
+    }
+
+    if (pos < len && js[pos] == '.') {
+        if (++pos >= len || !json_is_digit(js[pos]))
+            return JSON_READER_ERROR_INVAL;
+        while (pos < len && json_is_digit(js[pos]))
+            pos++;
+    }
+
+    if (pos < len && (js[pos] == 'e' || js[pos] == 'E')) {
+        pos++;
+        if (pos < len && (js[pos] == '+' || js[pos] == '-'))
+            pos++;
+        if (pos >= len || !json_is_digit(js[pos]))
+            return JSON_READER_ERROR_INVAL;
+        while (pos < len && json_is_digit(js[pos]))
+            pos++;
+    }
+
+    int index = json_new_token(parser, JSON_TOKEN_NUMBER, start);
+    if (index >= 0)
+        parser->tokens[index].end = pos;
+    parser->pos = pos;
+    return index;
+}
+
+static int json_parse_literal(json_parser_t* parser, const char* literal, json_token_type_t type) {
+    size_t literal_len = strlen(literal);
+
+    if (parser->len - parser->pos < literal_len || memcmp(parser->js + parser->pos, literal, literal_len) != 0)
+        return JSON_READER_ERROR_INVAL;
+
+    int index = json_new_token(parser, type, parser->pos);
+    parser->pos += literal_len;
+    if (index >= 0)
+        parser->tokens[index].end = parser->pos;
+    return index;
+}
+
+/* Object or array, after the opening bracket */
+static int json_parse_container(json_parser_t* parser, bool object, int depth) {
+    if (depth >= JSON_READER_MAX_DEPTH)
+        return JSON_READER_ERROR_INVAL;
+
+    int index = json_new_token(parser, object ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY, parser->pos++);
+    if (index < 0)
+        return index;
+
+    /* Member value of the walked object, what it holds is checked but not kept */
+    bool skip = parser->walk && depth == 1;
+    if (skip)
+        parser->skipping = true;
+
+    char close = object ? '}' : ']';
+    json_skip_ws(parser);
+    if (parser->pos < parser->len && parser->js[parser->pos] == close) {
+        parser->pos++;
+        if (skip)
+            parser->skipping = false;
+        parser->tokens[index].end = parser->pos;
+        parser->tokens[index].next = parser->count;
+        return index;
+    }
+
+    for (;;) {
+        int ret;
+
+        if (object) {
+            json_skip_ws(parser);
+            if (parser->pos >= parser->len || parser->js[parser->pos] != '"')
+                return JSON_READER_ERROR_INVAL;
+            if ((ret = json_parse_string(parser)) < 0)
+                return ret;
+
+            json_skip_ws(parser);
+            if (parser->pos >= parser->len || parser->js[parser->pos] != ':')
+                return JSON_READER_ERROR_INVAL;
+            parser->pos++;
+        }
+
+        if ((ret = json_parse_value(parser, depth + 1)) < 0)
+            return ret;
+        parser->tokens[index].size++;
+
+        /* Member of the walked object, its key and value tokens are free again after */
+        if (parser->walk && depth == 0) {
+            if (parser->member_cb != NULL && !parser->stopped
+                        && !parser->member_cb(parser->js, &parser->tokens[index + 1], &parser->tokens[index + 2], parser->ctx))
+                parser->stopped = true;
+            parser->count = index + 1;
+        }
+
+        json_skip_ws(parser);
+        if (parser->pos >= parser->len)
+            return JSON_READER_ERROR_INVAL;
+
+        char c = parser->js[parser->pos++];
+        if (c == close)
+            break;
+        if (c != ',')
+            return JSON_READER_ERROR_INVAL;
+    }
+
+    if (skip)
+        parser->skipping = false;
+    parser->tokens[index].end = parser->pos;
+    parser->tokens[index].next = parser->count;
+    return index;
+}
+
+static int json_parse_value(json_parser_t* parser, int depth) {
+    json_skip_ws(parser);
+    if (parser->pos >= parser->len)
+        return JSON_READER_ERROR_INVAL;
+
+    switch (parser->js[parser->pos]) {
+    case '{':
+        return json_parse_container(parser, true, depth);
+    case '[':
+        return json_parse_container(parser, false, depth);
+    case '"':
+        return json_parse_string(parser);
+    case 't':
+        return json_parse_literal(parser, "true", JSON_TOKEN_TRUE);
+    case 'f':
+        return json_parse_literal(parser, "false", JSON_TOKEN_FALSE);
+    case 'n':
+        return json_parse_literal(parser, "null", JSON_TOKEN_NULL);
+    default:
+        return json_parse_number(parser);
+    }
+}
+
+int json_reader_parse(const char* js, size_t len, json_token_t* tokens, uint16_t max_tokens) {
+    json_parser_t parser = {
+        .js = js,
+        .len = len,
+        .tokens = tokens,
+        .max_tokens = max_tokens,
+    };
+
+    /* Token offsets are 16 bit */
+    if (len > UINT16_MAX)
+        return JSON_READER_ERROR_INVAL;
+
+    int ret = json_parse_value(&parser, 0);
+    if (ret < 0)
+        return ret;
+
+    /* Nothing but whitespace may follow */
+    json_skip_ws(&parser);
+    if (parser.pos != len)
+        return JSON_READER_ERROR_INVAL;
+
+    return parser.count;
+}
+
+bool json_reader_walk_object(const char* js, size_t len, json_member_cb_t cb, void* ctx) {
+    /* Object, key, value and the slot shared below it */
+    json_token_t tokens[4];
+
+    if (len > UINT16_MAX)
+        return false;
+
+    /* Checked whole first, then walked */
+    for (int pass = 0; pass < 2; pass++) {
+        json_parser_t parser = {
+            .js = js,
+            .len = len,
+            .tokens = tokens,
+            .max_tokens = sizeof(tokens) / sizeof(tokens[0]),
+            .walk = true,
+            .member_cb = (pass == 1) ? cb : NULL,
+            .ctx = ctx,
+        };
+
+        json_skip_ws(&parser);
+        if (parser.pos >= len || js[parser.pos] != '{' || json_parse_value(&parser, 0) < 0)
+            return false;
+
+        json_skip_ws(&parser);
+        if (parser.pos != len)
+            return false;
+    }
+
+    return true;
+}
+
+bool json_token_equal(const char* js, const json_token_t* token, const char* str) {
+    size_t len = token->end - token->start;
+    return token->type == JSON_TOKEN_STRING && !token->escaped &&
+                    strlen(str) == len && memcmp(js + token->start, str, len) == 0;
+}
+
+static uint16_t json_hex4(const char* hex) {
+    uint16_t val = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = hex[i];
+        val = (val << 4) | (json_is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return val;
+}
+
+int json_token_unescape(const char* js, const json_token_t* token, char* out, size_t size) {
+    size_t len = 0;
+
+    for (size_t pos = token->start; pos < token->end; pos++) {
+        char utf8[3];
+        size_t utf8_len = 1;
+        utf8[0] = js[pos];
+
+        if (js[pos] == '\\') {
+            switch (js[++pos]) {
+            case 'b': utf8[0] = '\b'; break;
+            case 'f': utf8[0] = '\f'; break;
+            case 'n': utf8[0] = '\n'; break;
+            case 'r': utf8[0] = '\r'; break;
+            case 't': utf8[0] = '\t'; break;
+            case 'u': {
+                /* Basic multilingual plane only, surrogates become '?' */
+                uint16_t code = json_hex4(js + pos + 1);
+                pos += 4;
+                if (code < 0x80) {
+                    utf8[0] = code;
+                } else if (code < 0x800) {
+                    utf8[0] = 0xC0 | (code >> 6);
+                    utf8[1] = 0x80 | (code & 0x3F);
+                    utf8_len = 2;
+                } else if (code >= 0xD800 && code <= 0xDFFF) {
+                    utf8[0] = '?';
+                } else {
+                    utf8[0] = 0xE0 | (code >> 12);
+                    utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+                    utf8[2] = 0x80 | (code & 0x3F);
+                    utf8_len = 3;
+                }
+                break;
+            }
+            default:
+                utf8[0] = js[pos];
+                break;
+            }
+        }
+
+        if (len + utf8_len >= size)
+            return -1;
+        memcpy(out + len, utf8, utf8_len);
+        len += utf8_len;
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+bool json_token_number(const char* js, const json_token_t* token, double* num) {
+    char temp[JSON_NUMBER_MAX_LEN + 1];
+    size_t len = token->end - token->start;
+
+    if (token->type != JSON_TOKEN_NUMBER || len > JSON_NUMBER_MAX_LEN)
+        return false;
+
+    /* The input is not NUL terminated */
+    memcpy(temp, js + token->start, len);
+    temp[len] = '\0';
+    *num = strtod(temp, NULL);
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum nesting of objects and arrays */
+#define JSON_READER_MAX_DEPTH           8
+
+/* Parse errors */
+#define JSON_READER_ERROR_INVAL         -1      /* malformed or truncated input */
+#define JSON_READER_ERROR_NOMEM         -2      /* not enough tokens */
+
+typedef enum {
+    JSON_TOKEN_OBJECT,
+    JSON_TOKEN_ARRAY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL,
+} json_token_type_t;
+
+/* Token over the input, nothing is copied.
+ * Object members are a key STRING token followed by the value tokens. */
+typedef struct {
+    json_token_type_t type;
+    bool escaped;                   /* STRING contains escape sequences */
+    uint16_t start;                 /* byte range, strings without quotes */
+    uint16_t end;
+    uint16_t size;                  /* OBJECT members, ARRAY elements */
+    uint16_t next;                  /* index of the first token after this one's children */
+} json_token_t;
+
+/* Tokenize a complete JSON document into a caller supplied token array.
+ * Returns the number of tokens or a negative JSON_READER_ERROR_* value. */
+int json_reader_parse(const char* js, size_t len, json_token_t* tokens, uint16_t max_tokens);
+
+
+/* Called for each member of a walked object, return false to stop */
+typedef bool (*json_member_cb_t)(const char* js, const json_token_t* key, const json_token_t* value, void* ctx);
+
+/* Walk the members of a top-level object in order, with no limit on their number.
+ * A nested object or array comes as one token with its byte range and size, its
+ * contents are checked but get no tokens. The whole document is checked before
+ * the first call. False if it is malformed or not an object. */
+bool json_reader_walk_object(const char* js, size_t len, json_member_cb_t cb, void* ctx);
+
+
+/* Compare a STRING token with a NUL terminated string */
+bool json_token_equal(const char* js, const json_token_t* token, const char* str);
+
+
+/* Decode a STRING token into out with a NUL terminator.
+ * Returns the decoded length or -1 if it does not fit. */
+int json_token_unescape(const char* js, const json_token_t* token, char* out, size_t size);
+
+
+/* Get the value of a NUMBER token */
+bool json_token_number(const char* js, const json_token_t* token, double* num);
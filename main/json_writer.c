@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "json_writer.h"
+
+static void json_put(json_writer_t* writer, const char* data, size_t len) {
+    if (writer->len < writer->size) {
+        size_t room = writer->size - writer->len;
+        memcpy(writer->buf + writer->len, data, (len < room) ? len : room);
+    }
+    writer->len += len;
+}
+
+static void json_putc(json_writer_t* writer, char c) {
+    if (writer->len < writer->size)
+        writer->buf[writer->len] = c;
+    writer->len++;
+}
+
+/* Emit the separator before a key or value */
+static void json_separate(json_writer_t* writer) {
+    if (writer->after_key) {
+        writer->after_key = false;
+        return;
+    }
+
+    uint32_t mask = 1u << writer->depth;
+    if (writer->has_items & mask)
+        json_putc(writer, ',');
+    writer->has_items |= mask;
+}
+
+static void json_open(json_writer_t* writer, char c) {
+    json_separate(writer);
+    json_putc(writer, c);
+    if (writer->depth < JSON_WRITER_MAX_DEPTH)
+        writer->depth++;
+    writer->has_items &= ~(1u << writer->depth);
+}
+
+static void json_close(json_writer_t* writer, char c) {
+    if (writer->depth > 0)
+        writer->depth--;
+    json_putc(writer, c);
+}
+
+static void json_put_escaped(json_writer_t* writer, const char* str) {
+    json_putc(writer, '"');
+    for (; *str; str++) {
+        unsigned char c = (unsigned char) *str;
+        switch (c) {
+        case '"':  json_put(writer, "\\\"", 2); break;
+        case '\\': json_put(writer, "\\\\", 2); break;
+        case '\b': json_put(writer, "\\b", 2); break;
+        case '\f': json_put(writer, "\\f", 2); break;
+        case '\n': json_put(writer, "\\n", 2); break;
+        case '\r': json_put(writer, "\\r", 2); break;
+        case '\t': json_put(writer, "\\t", 2); break;
+        default:
+            if (c < 0x20) {
+                char esc[7];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                json_put(writer, esc, 6);
+            } else {
+                json_putc(writer, c);
+            }
+            break;
+        }
+    }
+    json_putc(writer, '"');
+}
+
+void json_writer_init(json_writer_t* writer, char* buf, size_t size) {
+    writer->buf = buf;
+    writer->size = (buf != NULL) ? size : 0;
+    writer->len = 0;
+    writer->depth = 0;
+    writer->has_items = 0;
+    writer->after_key = false;
+}
+
+size_t json_writer_finish(json_writer_t* writer) {
+    if (writer->size > 0)
+        writer->buf[(writer->len < writer->size) ? writer->len : writer->size - 1] = '\0';
+    return writer->len;
+}
+
+void json_write_object_begin(json_writer_t* writer) {
+    json_open(writer, '{');
+}
+
+void json_write_object_end(json_writer_t* writer) {
+    json_close(writer, '}');
+}
+
+void json_write_array_begin(json_writer_t* writer) {
+    json_open(writer, '[');
+}
+
+void json_write_array_end(json_writer_t* writer) {
+    json_close(writer, ']');
+}
+
+void json_write_key(json_writer_t* writer, const char* key) {
+    json_separate(writer);
+    json_put_escaped(writer, key);
+    json_putc(writer, ':');
+    writer->after_key = true;
+}
+
+void json_write_string(json_writer_t* writer, const char* str) {
+    json_separate(writer);
+    json_put_escaped(writer, str);
+}
+
+void json_write_number(json_writer_t* writer, double num) {
+    char temp[26];
+    int len;
+
+    json_separate(writer);
+
+    /* Same formatting as cJSON */
+    if (isnan(num) || isinf(num)) {
+        json_put(writer, "null", 4);
+        return;
+    }
+
+    len = snprintf(temp, sizeof(temp), "%1.15g", num);
+    if (strtod(temp, NULL) != num)
+        len = snprintf(temp, sizeof(temp), "%1.17g", num);
+
+    json_put(writer, temp, len);
+}
+
+void json_write_bool(json_writer_t* writer, bool val) {
+    json_separate(writer);
+    if (val)
+        json_put(writer, "true", 4);
+    else
+        json_put(writer, "false", 5);
+}
+
+void json_write_null(json_writer_t* writer) {
+    json_separate(writer);
+    json_put(writer, "null", 4);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum nesting of objects and arrays */
+#define JSON_WRITER_MAX_DEPTH           31
+
+/* Single pass JSON writer into a fixed buffer.
+ * Like snprintf, it keeps counting once the buffer is full, so a pass with
+ * a NULL buffer gives the exact size needed. */
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    uint8_t depth;
+    uint32_t has_items;
+    bool after_key;
+} json_writer_t;
+
+/* Start writing into buf, which may be NULL to only measure */
+void json_writer_init(json_writer_t* writer, char* buf, size_t size);
+
+
+/* NUL terminate the output and return its length, excluding the NUL */
+size_t json_writer_finish(json_writer_t* writer);
+
+
+/* Structure */
+void json_write_object_begin(json_writer_t* writer);
+
+void json_write_object_end(json_writer_t* writer);
+
+void json_write_array_begin(json_writer_t* writer);
+
+void json_write_array_end(json_writer_t* writer);
+
+void json_write_key(json_writer_t* writer, const char* key);
+
+
+/* Values */
+void json_write_string(json_writer_t* writer, const char* str);
+
+void json_write_number(json_writer_t* writer, double num);
+
+void json_write_bool(json_writer_t* writer, bool val);
+
+void json_write_null(json_writer_t* writer);
@@ -0,0 +1,208 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "log_sink.h"
+
+#define LOG_RING_MASK           (LOG_SINK_BUFFER_SIZE - 1)
+
+_Static_assert((LOG_SINK_BUFFER_SIZE & LOG_RING_MASK) == 0, "LOG_SINK_BUFFER_SIZE must be a power of two");
+
+static const char* TAG = "log_sink";
+
+/* Stored in front of the line text, the text is not NUL-terminated */
+typedef struct {
+    uint32_t time_ms;
+    uint16_t len;
+    uint8_t level;
+    uint8_t reserved;
+} log_record_t;
+
+/* Positions only grow, the ring offset is the position masked */
+static uint8_t ring[LOG_SINK_BUFFER_SIZE];
+static uint32_t ring_head;              /* where the next line goes */
+static uint32_t ring_tail;              /* oldest line retained */
+static uint32_t console_pos;            /* next line for the console */
+static portMUX_TYPE ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_log_level_t sink_level = LOG_SINK_DEFAULT_LEVEL;
+static uint32_t sink_interval_ms;
+
+static log_sink_stats_t g_stats;
+
+static void ring_put(uint32_t pos, const void* data, size_t len) {
+    uint32_t offset = pos & LOG_RING_MASK;
+    size_t first = LOG_SINK_BUFFER_SIZE - offset;
+    if (first > len)
+        first = len;
+
+    memcpy(&ring[offset], data, first);
+    memcpy(ring, (const uint8_t*) data + first, len - first);
+}
+
+static void ring_get(uint32_t pos, void* data, size_t len) {
+    uint32_t offset = pos & LOG_RING_MASK;
+    size_t first = LOG_SINK_BUFFER_SIZE - offset;
+    if (first > len)
+        first = len;
+
+    memcpy(data, &ring[offset], first);
+    memcpy((uint8_t*) data + first, ring, len - first);
+}
+
+/* Copy the line at *pos out of the ring and advance *pos, false when there is none.
+ * A position already overwritten restarts at the oldest line. */
+static bool ring_take(uint32_t* pos, log_record_t* record, char* text) {
+    bool found = false;
+
+    portENTER_CRITICAL(&ring_mux);
+    if ((int32_t) (*pos - ring_tail) < 0)
+        *pos = ring_tail;
+
+    if (*pos != ring_head) {
+        ring_get(*pos, record, sizeof(log_record_t));
+        ring_get(*pos + sizeof(log_record_t), text, record->len);
+        *pos += sizeof(log_record_t) + record->len;
+        found = true;
+    }
+    portEXIT_CRITICAL(&ring_mux);
+
+    return found;
+}
+
+static char level_letter(uint8_t level) {
+    static const char letters[] = "NEWIDV";
+    return (level < sizeof(letters) - 1) ? letters[level] : '?';
+}
+
+bool log_sink_enabled(esp_log_level_t level) {
+    return level != ESP_LOG_NONE && level <= sink_level;
+}
+
+void log_sink_set_level(esp_log_level_t level) {
+    sink_level = level;
+}
+
+void log_sink_write(esp_log_level_t level, const char* tag, const char* fmt, ...) {
+    if (!log_sink_enabled(level))
+        return;
+
+    /* Formatted outside the lock */
+    char line[LOG_SINK_LINE_MAX];
+    int prefix = snprintf(line, sizeof(line), "%s: ", tag);
+    if (prefix < 0)
+        return;
+    if ((size_t) prefix >= sizeof(line))
+        prefix = sizeof(line) - 1;
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line + prefix, sizeof(line) - prefix, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+
+    size_t total = prefix + len;
+    bool truncated = total >= sizeof(line);
+    if (truncated)
+        total = sizeof(line) - 1;
+
+    log_record_t record = {
+        .time_ms = esp_timer_get_time() / 1000,
+        .len = total,
+        .level = level,
+    };
+    uint32_t size = sizeof(record) + total;
+
+    portENTER_CRITICAL(&ring_mux);
+
+    /* Make room by dropping the oldest lines */
+    while (ring_head + size - ring_tail > LOG_SINK_BUFFER_SIZE) {
+        log_record_t oldest;
+        ring_get(ring_tail, &oldest, sizeof(oldest));
+        if (console_pos == ring_tail) {
+            console_pos += sizeof(oldest) + oldest.len;
+            g_stats.lost++;
+        }
+        ring_tail += sizeof(oldest) + oldest.len;
+        g_stats.overwritten++;
+    }
+
+    ring_put(ring_head, &record, sizeof(record));
+    ring_put(ring_head + sizeof(record), line, total);
+    ring_head += size;
+
+    g_stats.written++;
+    if (truncated)
+        g_stats.truncated++;
+
+    portEXIT_CRITICAL(&ring_mux);
+}
+
+uint32_t log_sink_drain(void) {
+    log_record_t record;
+    char text[LOG_SINK_LINE_MAX];
+    uint32_t count = 0;
+
+    while (ring_take(&console_pos, &record, text)) {
+        printf("%c (%u) %.*s\n", level_letter(record.level), (unsigned) record.time_ms, (int) record.len, text);
+        count++;
+    }
+
+    return count;
+}
+
+size_t log_sink_read(char* buf, size_t size) {
+    log_record_t record;
+    char text[LOG_SINK_LINE_MAX];
+    size_t len = 0;
+
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+
+    uint32_t pos = ring_tail;
+    while (ring_take(&pos, &record, text)) {
+        int line = snprintf(buf + len, size - len, "%c (%u) %.*s\n",
+                    level_letter(record.level), (unsigned) record.time_ms, (int) record.len, text);
+        if (line < 0 || (size_t) line >= size - len) {
+            /* Drop the partial line */
+            buf[len] = '\0';
+            break;
+        }
+        len += line;
+    }
+
+    return len;
+}
+
+static void log_sink_task(void* arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(sink_interval_ms));
+        log_sink_drain();
+    }
+}
+
+bool log_sink_start(uint32_t drain_interval_ms) {
+    sink_interval_ms = drain_interval_ms;
+
+    if (xTaskCreate(log_sink_task, "log_sink", LOG_SINK_TASK_STACK_SIZE, NULL,
+                    LOG_SINK_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create log sink task");
+        return false;
+    }
+
+    return true;
+}
+
+void log_sink_get_stats(log_sink_stats_t* stats) {
+    portENTER_CRITICAL(&ring_mux);
+    *stats = g_stats;
+    portEXIT_CRITICAL(&ring_mux);
+}
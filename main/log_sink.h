@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_log.h>
+
+/* RAM kept for log lines, a power of two, oldest lines are overwritten */
+#ifndef LOG_SINK_BUFFER_SIZE
+#define LOG_SINK_BUFFER_SIZE            4096
+#endif
+
+/* Longest line kept, including the tag, longer ones are truncated */
+#define LOG_SINK_LINE_MAX               192
+
+/* Level recorded until log_sink_set_level */
+#define LOG_SINK_DEFAULT_LEVEL          ESP_LOG_INFO
+
+#define LOG_SINK_DRAIN_INTERVAL_MS      200
+
+#define LOG_SINK_TASK_STACK_SIZE        2560
+#define LOG_SINK_TASK_PRIORITY          1
+
+#define LOG_SINK_E(tag, fmt, ...)       log_sink_write(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define LOG_SINK_W(tag, fmt, ...)       log_sink_write(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define LOG_SINK_I(tag, fmt, ...)       log_sink_write(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define LOG_SINK_D(tag, fmt, ...)       log_sink_write(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+typedef struct {
+    uint32_t written;           /* lines recorded */
+    uint32_t truncated;         /* lines cut at LOG_SINK_LINE_MAX */
+    uint32_t overwritten;       /* lines pushed out of the buffer */
+    uint32_t lost;              /* lines overwritten before reaching the console */
+} log_sink_stats_t;
+
+/* Record a line without waiting on the console, not from an ISR.
+ * Lines less important than the sink level are ignored. */
+void log_sink_write(esp_log_level_t level, const char* tag, const char* fmt, ...)
+                    __attribute__((format(printf, 3, 4)));
+
+
+/* Check the level before building a costly message */
+bool log_sink_enabled(esp_log_level_t level);
+
+
+/* Set the most verbose level recorded */
+void log_sink_set_level(esp_log_level_t level);
+
+
+/* Start the task printing recorded lines on the console */
+bool log_sink_start(uint32_t drain_interval_ms);
+
+
+/* Print the lines not printed yet on the console, returns the number printed */
+uint32_t log_sink_drain(void);
+
+
+/* Copy the retained lines, oldest first, as text into buf without consuming them.
+ * Only whole lines are copied. Returns the length written, buf is NUL-terminated. */
+size_t log_sink_read(char* buf, size_t size);
+
+
+/* Get log sink counters */
+void log_sink_get_stats(log_sink_stats_t* stats);
@@ -1,10 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
 #include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 
 #include <driver/gpio.h>
 
@@ -20,7 +22,17 @@
 
 #include <mqtt_client.h>
 
+#include "command_pipeline.h"
+#include "conn_manager.h"
 #include "device.h"
+#include "gateway.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "mqtt_rx.h"
+#include "outbox.h"
+#include "state_store.h"
+#include "telemetry.h"
+#include "topic_router.h"
 
 #define PROV_MAX_RETRY                  3
 
@@ -33,16 +45,26 @@
 ESP_EVENT_DECLARE_BASE(MQTT_EVENTS);
 
 #define MQTT_SERVER_URL                 "mqtt://172.29.5.56"
+#define MQTT_RX_MAX_MESSAGE_SIZE        4096
 #define PROV_DOWNSTREAM_TOPIC           "down/provision/"
 #define PROV_UPSTREAM_TOPIC             "up/provision/"
 #define SERVER_COMMAND_TOPIC            "down/command/"
 #define DEVICE_TELEMETRY_TOPIC          "up/telemetry/"
+#define SERVER_DIAGNOSTICS_TOPIC        "down/diagnostics/"
+#define DEVICE_DIAGNOSTICS_TOPIC        "up/diagnostics/"
+#define DEVICE_METRICS_TOPIC            "up/metrics/"
+
+/* Example sub-devices behind the gateway, "sensor1" to "sensorN" */
+#define EXAMPLE_SUB_DEVICE_COUNT        0
 
 static char* device_mac_addr            = NULL;
 static char* prov_upstream_topic        = NULL;
 static char* prov_downstream_topic      = NULL;
 static char* server_command_topic       = NULL;
 static char* device_telemetry_topic     = NULL;
+static char* server_diagnostics_topic   = NULL;
+static char* device_diagnostics_topic   = NULL;
+static char* device_metrics_topic       = NULL;
 
 static const char *TAG = "app";
 
@@ -51,14 +73,82 @@ static EventGroupHandle_t mqtt_event_group, mqtt_prov_event_group;
 
 /* MQTT client handle */
 static esp_mqtt_client_handle_t mqtt_client;
+static bool mqtt_started;
 
 /* Indicator LED timer handle */
 esp_timer_handle_t indicator_led_timer;
 
-static void mqtt_data_handle(char* topic, char* data);
+/* Reassembles messages split over several MQTT_EVENT_DATA */
+static mqtt_rx_t mqtt_rx;
+
+/* Example device schema, stays in flash */
+static const device_channel_def_t device_channels[] = {
+    DEVICE_BOOL_CHANNEL("power", true),
+    DEVICE_NUMBER_CHANNEL("temp", true, 20, 30, 1),
+    DEVICE_CHOICE_CHANNEL("mode", true, "mode1", "mode2", "mode3"),
+};
+
+/* Example sub-device schema, shared by every example sub-device */
+static const device_channel_def_t sensor_channels[] = {
+    DEVICE_AGGREGATE_CHANNEL("temp", false, -40, 85, 0.1, 10000),
+    DEVICE_NUMBER_CHANNEL("humidity", false, 0, 100, 1),
+    DEVICE_BOOL_CHANNEL("relay", true),
+};
+
+/* The last schema update published was a delta, a refused one is sent again once,
+ * as the full document when the server does not hold the version it was based on */
+static bool schema_delta_sent;
+static bool schema_retried;
+
+/* Serializes schema updates from the MQTT task and the tasks changing channels */
+static SemaphoreHandle_t schema_lock;
+
+/* Downstream topic dispatch, built in device_specific_data_cfg */
+static topic_router_t mqtt_router;
+
+/* Application metrics, registered in device_specific_data_cfg */
+static struct {
+    metric_t* wifi_disconnects;
+    metric_t* mqtt_connects;
+    metric_t* mqtt_disconnects;
+    metric_t* mqtt_errors;
+    metric_t* mqtt_messages;
+    metric_t* mqtt_unrouted;
+    metric_t* mqtt_rx_us;
+    metric_t* mqtt_dispatch_us;
+    metric_t* heap_free;
+    metric_t* heap_min;
+    metric_t* cmd_depth_max;
+    metric_t* cmd_latency_max_us;
+    metric_t* log_lost;
+    metric_t* outbox_pending;
+    metric_t* outbox_dropped;
+    metric_t* gateway_devices;
+    metric_t* gateway_memory;
+} app_metrics;
+
+static void mqtt_data_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx);
+
+static void prov_resp_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx);
+
+static bool schema_publish(bool retry);
+
+static void schema_change_handle(void* ctx);
+
+static void server_command_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx);
+
+static void server_diagnostics_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx);
 
 static void device_specific_data_cfg(void);
 
+static void metrics_sample(void);
+
+static int mqtt_publish(const char* topic, const char* data, size_t len);
+
+static void mqtt_connect(void);
+
+static void mqtt_stop(void);
+
 static void IRAM_ATTR gpio_isr_handler(void* arg) {
     uint32_t gpio_num = (uint32_t) arg;
     if (gpio_num == RESET_PROV_BUTTON_GPIO) {
@@ -120,14 +210,18 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
     else if (event_base == WIFI_EVENT) {
         switch (event_id) {
         case WIFI_EVENT_STA_START:
-            esp_wifi_connect();
+            conn_manager_post(CONN_EVENT_START);
             break;
-        case WIFI_EVENT_STA_CONNECTED:
+        case WIFI_EVENT_STA_CONNECTED: {
+            wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
             ESP_LOGI(TAG, "Wifi STA Connected");
+            conn_manager_wifi_connected(event->bssid, event->channel);
             break;
+        }
         case WIFI_EVENT_STA_DISCONNECTED:
-            ESP_LOGI(TAG, "Disconnected. Connecting to the AP again...");
-            esp_wifi_connect();
+            metrics_inc(app_metrics.wifi_disconnects);
+            ESP_LOGI(TAG, "Disconnected");
+            conn_manager_post(CONN_EVENT_WIFI_DISCONNECTED);
             break;
         default:
             break;
@@ -140,11 +234,17 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         switch (event->event_id) {
         case MQTT_EVENT_CONNECTED: {
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+            metrics_inc(app_metrics.mqtt_connects);
+            outbox_set_online(true);
             xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_EVENT);
+            conn_manager_post(CONN_EVENT_MQTT_CONNECTED);
             break;
         }
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            metrics_inc(app_metrics.mqtt_disconnects);
+            outbox_set_online(false);
+            conn_manager_post(CONN_EVENT_MQTT_DISCONNECTED);
             break;
         case MQTT_EVENT_SUBSCRIBED: {
             ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED");
@@ -157,25 +257,17 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED");
             break;
         case MQTT_EVENT_DATA: {
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-            
-            /* Allocate memory for data */
-            char* topic = malloc(event->topic_len + 1);
-            char* data = malloc(event->data_len + 1);
-
-            sprintf(topic, "%.*s", event->topic_len, event->topic);
-            sprintf(data, "%.*s", event->data_len, event->data);
-            
-            /* Handle received data */
-            mqtt_data_handle(topic, data);
-
-            /* Free memory after handling data */
-            free(topic);
-            free(data);
+            /* Receive to handled, including reassembly */
+            int64_t start = metrics_now_us();
+            LOG_SINK_D(TAG, "MQTT_EVENT_DATA");
+            mqtt_rx_feed(&mqtt_rx, event->topic, event->topic_len, event->data, event->data_len,
+                        event->current_data_offset, event->total_data_len);
+            metrics_observe_since(app_metrics.mqtt_rx_us, start);
             break;
         }
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            metrics_inc(app_metrics.mqtt_errors);
             break;
         default:
             ESP_LOGI(TAG, "Other event id:%d", event->event_id);
@@ -188,14 +280,30 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
 
-        /* Start MQTT Connection */
-        esp_mqtt_client_start(mqtt_client);
+        /* MQTT is connected by the connection manager */
+        conn_manager_post(CONN_EVENT_GOT_IP);
     }
 }
 
+/* Connection manager actions, run from its task */
+void mqtt_connect(void) {
+    if (!mqtt_started)
+        mqtt_started = esp_mqtt_client_start(mqtt_client) == ESP_OK;
+    else
+        esp_mqtt_client_reconnect(mqtt_client);
+}
+
+void mqtt_stop(void) {
+    if (mqtt_started)
+        esp_mqtt_client_stop(mqtt_client);
+    mqtt_started = false;
+}
+
 static void mqtt_client_init(void) {
     esp_mqtt_client_config_t mqtt_cfg = {
         .uri = MQTT_SERVER_URL,
+        /* Retries are paced by the connection manager */
+        .disable_auto_reconnect = true,
     };
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, event_handler, mqtt_client);
@@ -288,6 +396,9 @@ void indicator_led_on(void) {
 
 void app_main(void) {
 
+    /* Deferred logging, keeps the console off the MQTT and command paths */
+    log_sink_start(LOG_SINK_DRAIN_INTERVAL_MS);
+
     ESP_ERROR_CHECK(nvs_flash_init());
 
     /* Initialize TCP/IP */
@@ -297,6 +408,7 @@ void app_main(void) {
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     mqtt_event_group = xEventGroupCreate();
     mqtt_prov_event_group = xEventGroupCreate();
+    schema_lock = xSemaphoreCreateMutex();
 
     /* Register our event handler for Wi-Fi, IP and Provisioning related events */
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
@@ -311,6 +423,9 @@ void app_main(void) {
     /* MQTT Client Initialize */
     mqtt_client_init();
 
+    /* Wi-Fi and MQTT reconnects, before Wi-Fi starts */
+    conn_manager_start(mqtt_connect, mqtt_stop);
+
     /* Enable reset button */
     reset_provision_button_init();
 
@@ -334,6 +449,9 @@ void app_main(void) {
     bool mqtt_provisioned = false;
     device_is_mqtt_provisioned(&mqtt_provisioned);
 
+    /* Restore channel values saved before the last reset */
+    state_store_start(STATE_STORE_FLUSH_INTERVAL_MS);
+
     /* Indicator LED */
     indicator_led_start();
     if (wifi_provisioned && mqtt_provisioned)
@@ -419,15 +537,16 @@ void app_main(void) {
     /* Wait for MQTT connection */
     xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED_EVENT, false, true, portMAX_DELAY);
 
+    /* Also carries the acknowledgements of schema updates after provisioning */
+    ESP_LOGI(TAG, "Subscribing TOPIC: %s", prov_downstream_topic);
+    esp_mqtt_client_subscribe(mqtt_client, prov_downstream_topic, 0);
+
     if (mqtt_provisioned) {
         ESP_LOGI(TAG, "Already provisioned (MQTT)");
         xEventGroupSetBits(mqtt_prov_event_group, MQTT_PROV_EVENT);
     } else {
         ESP_LOGI(TAG, "Starting provisioning (MQTT)");
 
-        ESP_LOGI(TAG, "Subscribing TOPIC: %s", prov_downstream_topic);
-        esp_mqtt_client_subscribe(mqtt_client, prov_downstream_topic, 0);
-
         ESP_LOGI(TAG, "Publishing TOPIC: %s", prov_upstream_topic);
         char* mqtt_prov_data = device_get_mqtt_provision_json_data();
         esp_mqtt_client_publish(mqtt_client, prov_upstream_topic, mqtt_prov_data, 0, 2, 0);
@@ -441,9 +560,36 @@ void app_main(void) {
         free(mqtt_prov_data);
     }
 
+    /* Command task applies received commands to the device */
+    command_pipeline_start();
+
     ESP_LOGI(TAG, "Subscribing TOPIC: %s", server_command_topic);
     esp_mqtt_client_subscribe(mqtt_client, server_command_topic, 0);
 
+    ESP_LOGI(TAG, "Subscribing TOPIC: %s", server_diagnostics_topic);
+    esp_mqtt_client_subscribe(mqtt_client, server_diagnostics_topic, 0);
+
+    ESP_LOGI(TAG, "Subscribing TOPIC: %s", gateway_get_command_filter());
+    esp_mqtt_client_subscribe(mqtt_client, gateway_get_command_filter(), 0);
+
+    ESP_LOGI(TAG, "Subscribing TOPIC: %s", gateway_get_provision_filter());
+    esp_mqtt_client_subscribe(mqtt_client, gateway_get_provision_filter(), 0);
+
+    /* Telemetry published while offline is kept in flash and replayed */
+    outbox_start(mqtt_publish);
+
+    /* Batched channel value reports */
+    telemetry_start(device_telemetry_topic, TELEMETRY_FLUSH_INTERVAL_MS, outbox_publish);
+
+    /* Sub-device provisioning and telemetry */
+    gateway_start(TELEMETRY_FLUSH_INTERVAL_MS, mqtt_publish);
+
+    /* Periodic metrics report */
+    metrics_start(device_metrics_topic, METRICS_PUBLISH_INTERVAL_MS, metrics_sample, mqtt_publish);
+
+    /* Channels added or removed from now on reach the server as schema updates */
+    device_set_schema_listener(schema_change_handle, NULL);
+
     /* Start application here */
     
     
@@ -460,38 +606,178 @@ void device_specific_data_cfg(void) {
     prov_downstream_topic  = malloc(strlen(PROV_DOWNSTREAM_TOPIC) + strlen(device_mac_addr) + 1);
     server_command_topic   = malloc(strlen(SERVER_COMMAND_TOPIC) + strlen(device_mac_addr) + 1);
     device_telemetry_topic = malloc(strlen(DEVICE_TELEMETRY_TOPIC) + strlen(device_mac_addr) + 1);;
+    server_diagnostics_topic = malloc(strlen(SERVER_DIAGNOSTICS_TOPIC) + strlen(device_mac_addr) + 1);
+    device_diagnostics_topic = malloc(strlen(DEVICE_DIAGNOSTICS_TOPIC) + strlen(device_mac_addr) + 1);
+    device_metrics_topic     = malloc(strlen(DEVICE_METRICS_TOPIC) + strlen(device_mac_addr) + 1);
     
     sprintf(prov_upstream_topic, "%s%s", PROV_UPSTREAM_TOPIC, device_mac_addr);
     sprintf(prov_downstream_topic, "%s%s", PROV_DOWNSTREAM_TOPIC, device_mac_addr);
     sprintf(server_command_topic, "%s%s", SERVER_COMMAND_TOPIC, device_mac_addr);
     sprintf(device_telemetry_topic, "%s%s", DEVICE_TELEMETRY_TOPIC, device_mac_addr);
+    sprintf(server_diagnostics_topic, "%s%s", SERVER_DIAGNOSTICS_TOPIC, device_mac_addr);
+    sprintf(device_diagnostics_topic, "%s%s", DEVICE_DIAGNOSTICS_TOPIC, device_mac_addr);
+    sprintf(device_metrics_topic, "%s%s", DEVICE_METRICS_TOPIC, device_mac_addr);
+
+    /* Metrics published on device_metrics_topic */
+    app_metrics.wifi_disconnects   = metrics_counter("wifi_disconnects");
+    app_metrics.mqtt_connects      = metrics_counter("mqtt_connects");
+    app_metrics.mqtt_disconnects   = metrics_counter("mqtt_disconnects");
+    app_metrics.mqtt_errors        = metrics_counter("mqtt_errors");
+    app_metrics.mqtt_messages      = metrics_counter("mqtt_messages");
+    app_metrics.mqtt_unrouted      = metrics_counter("mqtt_unrouted");
+    app_metrics.mqtt_rx_us         = metrics_histogram("mqtt_rx_us");
+    app_metrics.mqtt_dispatch_us   = metrics_histogram("mqtt_dispatch_us");
+    app_metrics.heap_free          = metrics_gauge("heap_free");
+    app_metrics.heap_min           = metrics_gauge("heap_min");
+    app_metrics.cmd_depth_max      = metrics_gauge("cmd_depth_max");
+    app_metrics.cmd_latency_max_us = metrics_gauge("cmd_latency_max_us");
+    app_metrics.log_lost           = metrics_gauge("log_lost");
+    app_metrics.outbox_pending     = metrics_gauge("outbox_pending");
+    app_metrics.outbox_dropped     = metrics_gauge("outbox_dropped");
+    app_metrics.gateway_devices    = metrics_gauge("gateway_devices");
+    app_metrics.gateway_memory     = metrics_gauge("gateway_memory");
+
+    /* Downstream topic routes */
+    mqtt_rx_init(&mqtt_rx, MQTT_RX_MAX_MESSAGE_SIZE, mqtt_data_handle, NULL);
+    topic_router_init(&mqtt_router);
+    topic_router_add(&mqtt_router, prov_downstream_topic, prov_resp_handle, NULL);
+    topic_router_add(&mqtt_router, server_command_topic, server_command_handle, NULL);
+    topic_router_add(&mqtt_router, server_diagnostics_topic, server_diagnostics_handle, NULL);
+
+    /* Sub-devices live under the gateway's own topics, sharing its connection */
+    const gateway_topics_t gateway_topics = {
+        .command_topic = server_command_topic,
+        .telemetry_topic = device_telemetry_topic,
+        .prov_upstream_topic = prov_upstream_topic,
+        .prov_downstream_topic = prov_downstream_topic,
+    };
+    gateway_init(&gateway_topics, &mqtt_router);
 
     /* Example of device specific data */
     device_init("air conditioner");
-    device_add_bool_channel("power", true, "", "");
-    device_add_nummber_channel("temp", true, "", "", 20, 30, 1);
-    device_add_multi_option_channel(
-        "mode",
-        true,
-        "",
-        "",
-        3,
-        "mode1", "mode2", "mode3"
-    );
+    device_add_channels(device_channels, sizeof(device_channels) / sizeof(device_channels[0]));
+
+    /* Schema is complete, a few channels can still come and go at runtime */
+    device_seal();
+
+    /* Example sub-devices, e.g. peripherals found on a field bus */
+    for (int i = 1; i <= EXAMPLE_SUB_DEVICE_COUNT; i++) {
+        char sub_id[GATEWAY_DEVICE_ID_MAX];
+        snprintf(sub_id, sizeof(sub_id), "sensor%d", i);
+        gateway_add_device("sensor", sub_id, sensor_channels, sizeof(sensor_channels) / sizeof(sensor_channels[0]));
+    }
 }
 
-void mqtt_data_handle(char* topic, char* data) {
-    ESP_LOGI(TAG, "Data received from topic %s: %s", topic, data);
+void mqtt_data_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    int64_t start = metrics_now_us();
+    metrics_inc(app_metrics.mqtt_messages);
+
+    LOG_SINK_D(TAG, "Data received from topic %.*s: %.*s", (int) topic_len, topic, (int) data_len, data);
 
     /* Received data handle */
-    if (strcmp(topic, prov_downstream_topic) == 0) {
-        if (device_check_prov_resp(data)) {
-            ESP_LOGI(TAG, "Device is provisioned");
-            device_set_provisioned();
+    if (topic_router_dispatch(&mqtt_router, topic, topic_len, data, data_len) == 0) {
+        metrics_inc(app_metrics.mqtt_unrouted);
+        LOG_SINK_I(TAG, "No handler for topic %.*s", (int) topic_len, topic);
+    }
+
+    metrics_observe_since(app_metrics.mqtt_dispatch_us, start);
+}
+
+void prov_resp_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    bool provisioned = (xEventGroupGetBits(mqtt_prov_event_group) & MQTT_PROV_EVENT) != 0;
+
+    if (device_check_prov_resp(data, data_len)) {
+        ESP_LOGI(TAG, "Device is provisioned");
+        device_set_provisioned();
+        if (!provisioned) {
             indicator_led_on();
             xEventGroupSetBits(mqtt_prov_event_group, MQTT_PROV_EVENT);
-        } else {
-            ESP_LOGI(TAG, "Unknown data");
         }
+    } else if (provisioned && schema_publish(true)) {
+        /* Nothing was acknowledged, sent again in the form the server can apply */
+        ESP_LOGI(TAG, "Schema update refused, sent again");
+    } else {
+        ESP_LOGI(TAG, "Unknown data");
+    }
+}
+
+/* Publish the channels added or removed since the server acknowledged the schema,
+ * the full document when the change log no longer reaches back to its version.
+ * A retry goes only once after a refused delta. False if nothing was published. */
+bool schema_publish(bool retry) {
+    size_t len;
+    bool delta;
+    char* doc = NULL;
+
+    xSemaphoreTake(schema_lock, portMAX_DELAY);
+
+    if (!retry || (__atomic_load_n(&schema_delta_sent, __ATOMIC_RELAXED)
+                && !__atomic_load_n(&schema_retried, __ATOMIC_RELAXED))) {
+        /* Notes the version a response without one acknowledges */
+        doc = device_get_schema_update_json(&len, &delta);
+    }
+
+    bool published = doc != NULL;
+    if (published) {
+        __atomic_store_n(&schema_delta_sent, delta, __ATOMIC_RELAXED);
+        __atomic_store_n(&schema_retried, retry, __ATOMIC_RELAXED);
+        ESP_LOGI(TAG, "Publishing schema %s (%u bytes)", delta ? "changes" : "document", (unsigned) len);
+        esp_mqtt_client_publish(mqtt_client, prov_upstream_topic, doc, len, 1, 0);
+        free(doc);
     }
-}
\ No newline at end of file
+
+    xSemaphoreGive(schema_lock);
+    return published;
+}
+
+void schema_change_handle(void* ctx) {
+    schema_publish(false);
+}
+
+void server_command_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    /* Parsed here, applied by the command task */
+    int queued = command_pipeline_submit(data, data_len);
+    LOG_SINK_I(TAG, "Command received, %d channel updates queued", queued);
+}
+
+void server_diagnostics_handle(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    /* Recent log lines, on request */
+    char* logs = malloc(LOG_SINK_BUFFER_SIZE);
+    if (logs == NULL) {
+        ESP_LOGE(TAG, "No memory for diagnostics");
+        return;
+    }
+
+    size_t len = log_sink_read(logs, LOG_SINK_BUFFER_SIZE);
+    esp_mqtt_client_publish(mqtt_client, device_diagnostics_topic, logs, len, 0, 0);
+    free(logs);
+}
+
+void metrics_sample(void) {
+    metrics_set(app_metrics.heap_free, esp_get_free_heap_size());
+    metrics_set(app_metrics.heap_min, esp_get_minimum_free_heap_size());
+
+    command_pipeline_stats_t cmd_stats;
+    command_pipeline_get_stats(&cmd_stats);
+    metrics_set(app_metrics.cmd_depth_max, cmd_stats.depth_max);
+    metrics_set(app_metrics.cmd_latency_max_us, cmd_stats.latency_max_us);
+
+    log_sink_stats_t log_stats;
+    log_sink_get_stats(&log_stats);
+    metrics_set(app_metrics.log_lost, log_stats.lost);
+
+    outbox_stats_t outbox_stats;
+    uint32_t outbox_pending;
+    outbox_get_stats(&outbox_stats, &outbox_pending);
+    metrics_set(app_metrics.outbox_pending, outbox_pending);
+    metrics_set(app_metrics.outbox_dropped, outbox_stats.dropped);
+
+    gateway_stats_t gateway_stats;
+    gateway_get_stats(&gateway_stats);
+    metrics_set(app_metrics.gateway_devices, gateway_stats.devices);
+    metrics_set(app_metrics.gateway_memory, gateway_stats.memory);
+}
+
+int mqtt_publish(const char* topic, const char* data, size_t len) {
+    return esp_mqtt_client_publish(mqtt_client, topic, data, len, 0, 0);
+}
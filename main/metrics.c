@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+#include "codec.h"
+#include "device.h"
+#include "metrics.h"
+
+#ifdef ESP_PLATFORM
+static const char* TAG = "metrics";
+#endif
+
+static metric_t g_metrics[METRICS_MAX];
+static uint16_t g_metric_count;
+
+static const uint32_t histogram_bounds_us[METRICS_HISTOGRAM_BUCKETS - 1] = METRICS_HISTOGRAM_BOUNDS_US;
+
+/* Registration happens at start-up, updates are atomic */
+static metric_t* metrics_register(const char* name, metric_type_t type) {
+    for (uint16_t i = 0; i < g_metric_count; i++) {
+        if (strcmp(g_metrics[i].name, name) == 0)
+            return (g_metrics[i].type == type) ? &g_metrics[i] : NULL;
+    }
+
+    if (g_metric_count >= METRICS_MAX)
+        return NULL;
+
+    metric_t* metric = &g_metrics[g_metric_count];
+    memset(metric, 0, sizeof(metric_t));
+    metric->name = name;
+    metric->type = type;
+    g_metric_count++;
+    return metric;
+}
+
+metric_t* metrics_counter(const char* name) {
+    return metrics_register(name, METRIC_COUNTER);
+}
+
+metric_t* metrics_gauge(const char* name) {
+    return metrics_register(name, METRIC_GAUGE);
+}
+
+metric_t* metrics_histogram(const char* name) {
+    return metrics_register(name, METRIC_HISTOGRAM);
+}
+
+void metrics_inc(metric_t* metric) {
+    metrics_add(metric, 1);
+}
+
+void metrics_add(metric_t* metric, uint32_t value) {
+    if (metric != NULL)
+        __atomic_fetch_add(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_set(metric_t* metric, uint32_t value) {
+    if (metric != NULL)
+        __atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_observe_us(metric_t* metric, uint32_t us) {
+    if (metric == NULL)
+        return;
+
+    uint8_t bucket = 0;
+    while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && us > histogram_bounds_us[bucket])
+        bucket++;
+
+    __atomic_fetch_add(&metric->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->sum_us, us, __ATOMIC_RELAXED);
+
+    uint32_t max = __atomic_load_n(&metric->max_us, __ATOMIC_RELAXED);
+    while (us > max && !__atomic_compare_exchange_n(&metric->max_us, &max, us, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+int64_t metrics_now_us(void) {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void metrics_observe_since(metric_t* metric, int64_t start) {
+    int64_t elapsed = metrics_now_us() - start;
+    metrics_observe_us(metric, (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t) elapsed);
+}
+
+void metrics_write(codec_writer_t* writer) {
+    codec_write_map_begin(writer);
+
+    for (uint16_t i = 0; i < g_metric_count; i++) {
+        const metric_t* metric = &g_metrics[i];
+        codec_write_key(writer, metric->name);
+
+        if (metric->type != METRIC_HISTOGRAM) {
+            codec_write_number(writer, __atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+            continue;
+        }
+
+        codec_write_array_begin(writer);
+        codec_write_number(writer, __atomic_load_n(&metric->count, __ATOMIC_RELAXED));
+        codec_write_number(writer, __atomic_load_n(&metric->sum_us, __ATOMIC_RELAXED));
+        codec_write_number(writer, __atomic_load_n(&metric->max_us, __ATOMIC_RELAXED));
+        for (uint8_t bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++)
+            codec_write_number(writer, __atomic_load_n(&metric->buckets[bucket], __ATOMIC_RELAXED));
+        codec_write_array_end(writer);
+    }
+
+    codec_write_map_end(writer);
+}
+
+#ifdef ESP_PLATFORM
+static const char* metrics_topic;
+static metrics_sample_t metrics_sample;
+static metrics_publish_t metrics_publish;
+static uint32_t metrics_interval_ms;
+
+static void metrics_task(void* arg) {
+    uint8_t* buf = arg;
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(metrics_interval_ms));
+
+        if (metrics_sample != NULL)
+            metrics_sample();
+
+        codec_writer_t writer;
+        codec_writer_init(&writer, device_get_codec(), buf, METRICS_MAX_PAYLOAD);
+        metrics_write(&writer);
+        size_t len = codec_writer_finish(&writer);
+
+        if (len >= METRICS_MAX_PAYLOAD) {
+            ESP_LOGW(TAG, "Metrics need %u bytes, not published", (unsigned) len + 1);
+            continue;
+        }
+        metrics_publish(metrics_topic, (const char*) buf, len);
+    }
+}
+
+bool metrics_start(const char* topic, uint32_t interval_ms, metrics_sample_t sample, metrics_publish_t publish) {
+    metrics_topic = topic;
+    metrics_sample = sample;
+    metrics_publish = publish;
+    metrics_interval_ms = interval_ms;
+
+    uint8_t* buf = malloc(METRICS_MAX_PAYLOAD);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate metrics buffer");
+        return false;
+    }
+
+    if (xTaskCreate(metrics_task, "metrics", METRICS_TASK_STACK_SIZE, buf,
+                    METRICS_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create metrics task");
+        free(buf);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Publishing on %s every %u ms", topic, (unsigned) interval_ms);
+    return true;
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Maximum number of registered metrics */
+#define METRICS_MAX                     32
+
+/* Histogram bucket upper bounds in microseconds, the last bucket takes the rest */
+#define METRICS_HISTOGRAM_BOUNDS_US     { 100, 300, 1000, 3000, 10000, 30000, 100000 }
+#define METRICS_HISTOGRAM_BUCKETS       8
+
+#define METRICS_PUBLISH_INTERVAL_MS     60000
+
+/* Maximum metrics message size */
+#define METRICS_MAX_PAYLOAD             1024
+
+#define METRICS_TASK_STACK_SIZE         3072
+#define METRICS_TASK_PRIORITY           1
+
+typedef enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+} metric_type_t;
+
+typedef struct {
+    const char* name;
+    metric_type_t type;
+
+    /* Counter or gauge */
+    uint32_t value;
+
+    /* Histogram */
+    uint32_t count;
+    uint32_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} metric_t;
+
+/* Refresh gauges right before they are published */
+typedef void (*metrics_sample_t)(void);
+
+/* Publish a metrics message, returns a negative value on failure */
+typedef int (*metrics_publish_t)(const char* topic, const char* data, size_t len);
+
+/* Register a metric, or get the one already registered under that name.
+ * name must outlive the registry. NULL when the registry is full, every
+ * update below accepts NULL and does nothing. */
+metric_t* metrics_counter(const char* name);
+
+metric_t* metrics_gauge(const char* name);
+
+metric_t* metrics_histogram(const char* name);
+
+
+/* Update a metric, safe from any task */
+void metrics_inc(metric_t* metric);
+
+void metrics_add(metric_t* metric, uint32_t value);
+
+void metrics_set(metric_t* metric, uint32_t value);
+
+void metrics_observe_us(metric_t* metric, uint32_t us);
+
+
+/* Monotonic time, esp_timer on the device and clock_gettime on a host */
+int64_t metrics_now_us(void);
+
+/* Observe the time elapsed since start, from metrics_now_us */
+void metrics_observe_since(metric_t* metric, int64_t start);
+
+
+/* Write every metric as one map: counters and gauges as numbers,
+ * histograms as [count, sum_us, max_us, buckets...] */
+void metrics_write(codec_writer_t* writer);
+
+
+/* Publish the metrics every interval in the negotiated codec, ESP-IDF only */
+bool metrics_start(const char* topic, uint32_t interval_ms, metrics_sample_t sample, metrics_publish_t publish);
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "mqtt_rx.h"
+
+static const char* TAG = "mqtt_rx";
+
+void mqtt_rx_init(mqtt_rx_t* rx, size_t max_size, mqtt_rx_handler_t handler, void* ctx) {
+    memset(rx, 0, sizeof(mqtt_rx_t));
+    rx->max_size = max_size;
+    rx->handler = handler;
+    rx->ctx = ctx;
+}
+
+void mqtt_rx_deinit(mqtt_rx_t* rx) {
+    free(rx->buf);
+    rx->buf = NULL;
+    rx->size = 0;
+    rx->active = false;
+}
+
+/* First fragment carries the topic, reserve room for the whole message */
+static bool mqtt_rx_start(mqtt_rx_t* rx, const char* topic, size_t topic_len, size_t total_data_len) {
+    size_t needed = topic_len + total_data_len;
+
+    if (needed > rx->max_size) {
+        ESP_LOGW(TAG, "Dropping %u byte message, too large", (unsigned) total_data_len);
+        rx->stats.oversize++;
+        return false;
+    }
+
+    if (needed > rx->size) {
+        char* buf = realloc(rx->buf, needed);
+        if (buf == NULL) {
+            ESP_LOGE(TAG, "No memory to reassemble %u byte message", (unsigned) total_data_len);
+            return false;
+        }
+        rx->buf = buf;
+        rx->size = needed;
+    }
+
+    memcpy(rx->buf, topic, topic_len);
+    rx->topic_len = topic_len;
+    rx->total_data_len = total_data_len;
+    rx->received = 0;
+    rx->active = true;
+    return true;
+}
+
+void mqtt_rx_feed(mqtt_rx_t* rx, const char* topic, int topic_len, const char* data, int data_len,
+                    int data_offset, int total_data_len) {
+    if (topic_len < 0 || data_len < 0 || data_offset < 0 || total_data_len < 0)
+        return;
+
+    /* Whole message in one event: hand the client's buffers over as they are */
+    if (data_offset == 0 && data_len == total_data_len) {
+        rx->active = false;
+        rx->stats.whole++;
+        rx->handler(topic, topic_len, data, data_len, rx->ctx);
+        return;
+    }
+
+    if (data_offset == 0) {
+        rx->active = false;
+        if (!mqtt_rx_start(rx, topic, topic_len, total_data_len))
+            return;
+    } else if (!rx->active) {
+        return;
+    }
+
+    /* Only the fragment starting where the last one ended, within the message */
+    if ((size_t) data_offset != rx->received || (size_t) data_len > rx->total_data_len - rx->received ||
+                (size_t) total_data_len != rx->total_data_len) {
+        ESP_LOGW(TAG, "Fragment at %d of %u byte message out of sequence, dropping it",
+                    data_offset, (unsigned) rx->total_data_len);
+        rx->active = false;
+        rx->stats.broken++;
+        return;
+    }
+
+    memcpy(rx->buf + rx->topic_len + rx->received, data, data_len);
+    rx->received += data_len;
+
+    /* Last fragment */
+    if (rx->received == rx->total_data_len) {
+        rx->active = false;
+        rx->stats.reassembled++;
+        rx->handler(rx->buf, rx->topic_len, rx->buf + rx->topic_len, rx->total_data_len, rx->ctx);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Message handler, topic and data are not NUL terminated */
+typedef void (*mqtt_rx_handler_t)(const char* topic, size_t topic_len,
+                    const char* data, size_t data_len, void* ctx);
+
+typedef struct {
+    uint32_t whole;             /* messages passed on as they came */
+    uint32_t reassembled;       /* messages put together from fragments */
+    uint32_t oversize;          /* messages over the size limit */
+    uint32_t broken;            /* fragments out of sequence, their message dropped */
+} mqtt_rx_stats_t;
+
+/* Reassembles messages the MQTT client splits over several MQTT_EVENT_DATA.
+ * The buffer grows to the largest message seen, up to max_size with the topic. */
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t max_size;
+    size_t topic_len;
+    size_t total_data_len;
+    size_t received;            /* data bytes so far, where the next fragment starts */
+    bool active;
+    mqtt_rx_handler_t handler;
+    void* ctx;
+    mqtt_rx_stats_t stats;
+} mqtt_rx_t;
+
+/* Set up without a buffer, it is allocated by the first fragmented message */
+void mqtt_rx_init(mqtt_rx_t* rx, size_t max_size, mqtt_rx_handler_t handler, void* ctx);
+
+
+/* Free the buffer */
+void mqtt_rx_deinit(mqtt_rx_t* rx);
+
+
+/* Pass on one MQTT_EVENT_DATA, as the client reports it. Fragments must follow
+ * each other, one that does not drops its message. */
+void mqtt_rx_feed(mqtt_rx_t* rx, const char* topic, int topic_len, const char* data, int data_len,
+                    int data_offset, int total_data_len);
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#endif
+
+#include "outbox.h"
+
+/* "OBX1", first word of every sector in use */
+#define OUTBOX_MAGIC            0x3158424F
+
+/* Record states, each one only clears bits of the previous */
+#define OUTBOX_STATE_PENDING    0xFE
+#define OUTBOX_STATE_SENT       0xFC
+
+#define OUTBOX_LEN_FREE         0xFFFF
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} sector_header_t;
+
+/* Followed by the topic and the data, padded to 4 bytes */
+typedef struct {
+    uint16_t len;               /* topic + data */
+    uint8_t topic_len;
+    uint8_t state;
+    uint32_t crc;               /* over len, topic_len, topic and data */
+} record_header_t;
+
+#define RECORD_SIZE(len)        ((sizeof(record_header_t) + (len) + 3) & ~3u)
+
+typedef enum {
+    RECORD_FREE,
+    RECORD_CORRUPT,
+    RECORD_VALID,
+} record_status_t;
+
+static uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* bytes = data;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *bytes++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const record_header_t* header, const char* topic, const char* data, size_t data_len) {
+    uint32_t crc = crc32_update(0, &header->len, sizeof(header->len));
+    crc = crc32_update(crc, &header->topic_len, sizeof(header->topic_len));
+    crc = crc32_update(crc, topic, header->topic_len);
+    return crc32_update(crc, data, data_len);
+}
+
+static uint32_t sector_addr(uint16_t sector) {
+    return (uint32_t) sector * OUTBOX_SECTOR_SIZE;
+}
+
+static bool sector_in_use(outbox_t* box, uint16_t sector, uint32_t* seq) {
+    sector_header_t header;
+    if (!box->flash->read(box->flash->ctx, sector_addr(sector), &header, sizeof(header)))
+        return false;
+
+    *seq = header.seq;
+    return header.magic == OUTBOX_MAGIC;
+}
+
+/* Check the record header at off, the payload is checked when read */
+static record_status_t record_header_read(outbox_t* box, uint16_t sector, uint16_t off, record_header_t* header) {
+    if (off + sizeof(record_header_t) > OUTBOX_SECTOR_SIZE)
+        return RECORD_FREE;
+
+    if (!box->flash->read(box->flash->ctx, sector_addr(sector) + off, header, sizeof(record_header_t)))
+        return RECORD_CORRUPT;
+
+    if (header->len == OUTBOX_LEN_FREE)
+        return RECORD_FREE;
+
+    /* A torn header leaves bytes erased, the state catches most of it */
+    if (header->topic_len > header->len || header->len > OUTBOX_RECORD_MAX ||
+                off + RECORD_SIZE(header->len) > OUTBOX_SECTOR_SIZE ||
+                (header->state != OUTBOX_STATE_PENDING && header->state != OUTBOX_STATE_SENT))
+        return RECORD_CORRUPT;
+
+    return RECORD_VALID;
+}
+
+static bool record_set_state(outbox_t* box, uint16_t sector, uint16_t off, uint8_t state) {
+    return box->flash->write(box->flash->ctx, sector_addr(sector) + off + offsetof(record_header_t, state), &state, 1);
+}
+
+/* Find where the records of a sector end and count the unsent ones */
+static uint16_t sector_scan(outbox_t* box, uint16_t sector, uint32_t* pending) {
+    uint16_t off = sizeof(sector_header_t);
+    record_header_t header;
+
+    for (;;) {
+        switch (record_header_read(box, sector, off, &header)) {
+        case RECORD_FREE:
+            return off;
+
+        case RECORD_CORRUPT:
+            /* Nothing more is written after a torn record */
+            return OUTBOX_SECTOR_SIZE;
+
+        case RECORD_VALID:
+            if (header.state == OUTBOX_STATE_PENDING)
+                (*pending)++;
+            off += RECORD_SIZE(header.len);
+            break;
+        }
+    }
+}
+
+bool outbox_mount(outbox_t* box, const outbox_flash_t* flash) {
+    memset(box, 0, sizeof(outbox_t));
+    box->flash = flash;
+    box->sector_count = flash->size / OUTBOX_SECTOR_SIZE;
+    if (box->sector_count < 2)
+        return false;
+
+    /* Sectors are used in turn, the ones in use run from the oldest to the newest.
+     * Sequence numbers are compared by their difference, they may wrap. */
+    uint16_t head = 0, oldest = 0;
+    uint32_t head_seq = 0, oldest_seq = 0;
+    for (uint16_t sector = 0; sector < box->sector_count; sector++) {
+        uint32_t seq;
+        if (!sector_in_use(box, sector, &seq))
+            continue;
+
+        if (!box->opened || (int32_t) (seq - head_seq) > 0) {
+            head = sector;
+            head_seq = seq;
+        }
+        if (!box->opened || (int32_t) (seq - oldest_seq) < 0) {
+            oldest = sector;
+            oldest_seq = seq;
+        }
+        box->opened = true;
+    }
+
+    if (!box->opened)
+        return true;
+
+    for (uint16_t sector = oldest; ; sector = (sector + 1) % box->sector_count) {
+        uint16_t end = sector_scan(box, sector, &box->pending);
+        if (sector == head) {
+            box->write_off = end;
+            break;
+        }
+    }
+
+    box->seq = head_seq;
+    box->write_sector = head;
+    box->read_sector = oldest;
+    box->read_off = sizeof(sector_header_t);
+    return true;
+}
+
+/* Start the next sector, erasing the oldest one and its unsent records when full */
+static bool outbox_open_sector(outbox_t* box) {
+    uint16_t next = box->opened ? (box->write_sector + 1) % box->sector_count : 0;
+
+    uint32_t seq;
+    if (box->opened && sector_in_use(box, next, &seq)) {
+        uint32_t lost = 0;
+        sector_scan(box, next, &lost);
+        box->pending -= lost;
+        box->stats.dropped += lost;
+
+        if (box->read_sector == next) {
+            box->read_sector = (next + 1) % box->sector_count;
+            box->read_off = sizeof(sector_header_t);
+        }
+    }
+
+    if (!box->flash->erase_sector(box->flash->ctx, sector_addr(next)))
+        return false;
+    box->stats.erases++;
+
+    sector_header_t header = { .magic = OUTBOX_MAGIC, .seq = box->seq + 1 };
+    if (!box->flash->write(box->flash->ctx, sector_addr(next), &header, sizeof(header)))
+        return false;
+
+    if (!box->opened) {
+        box->read_sector = next;
+        box->read_off = sizeof(sector_header_t);
+    }
+
+    box->seq = header.seq;
+    box->write_sector = next;
+    box->write_off = sizeof(sector_header_t);
+    box->opened = true;
+    return true;
+}
+
+bool outbox_append(outbox_t* box, const char* topic, const char* data, size_t len) {
+    size_t topic_len = strlen(topic);
+
+    /* Room for the topic NUL when read back */
+    if (topic_len > UINT8_MAX || topic_len + len > OUTBOX_RECORD_MAX) {
+        box->stats.rejected++;
+        return false;
+    }
+
+    record_header_t header = {
+        .len = topic_len + len,
+        .topic_len = topic_len,
+        .state = OUTBOX_STATE_PENDING,
+    };
+    header.crc = record_crc(&header, topic, data, len);
+
+    if (!box->opened || box->write_off + RECORD_SIZE(header.len) > OUTBOX_SECTOR_SIZE) {
+        if (!outbox_open_sector(box)) {
+            box->stats.rejected++;
+            return false;
+        }
+    }
+
+    /* Header first, a torn payload then fails its CRC */
+    uint32_t addr = sector_addr(box->write_sector) + box->write_off;
+    if (!box->flash->write(box->flash->ctx, addr, &header, sizeof(header)) ||
+                !box->flash->write(box->flash->ctx, addr + sizeof(header), topic, topic_len) ||
+                !box->flash->write(box->flash->ctx, addr + sizeof(header) + topic_len, data, len)) {
+        box->write_off = OUTBOX_SECTOR_SIZE;
+        box->stats.rejected++;
+        return false;
+    }
+
+    box->write_off += RECORD_SIZE(header.len);
+    box->pending++;
+    box->stats.appended++;
+    return true;
+}
+
+bool outbox_peek(outbox_t* box, outbox_entry_t* entry, char* buf) {
+    record_header_t header;
+
+    while (box->opened) {
+        if (box->read_sector == box->write_sector && box->read_off >= box->write_off)
+            return false;
+
+        if (record_header_read(box, box->read_sector, box->read_off, &header) != RECORD_VALID) {
+            /* End of this sector */
+            if (box->read_sector == box->write_sector) {
+                box->read_off = box->write_off;
+                return false;
+            }
+            box->read_sector = (box->read_sector + 1) % box->sector_count;
+            box->read_off = sizeof(sector_header_t);
+            continue;
+        }
+
+        uint16_t size = RECORD_SIZE(header.len);
+        if (header.state == OUTBOX_STATE_SENT) {
+            box->read_off += size;
+            continue;
+        }
+
+        /* Topic, its NUL, then the data */
+        uint32_t addr = sector_addr(box->read_sector) + box->read_off + sizeof(header);
+        size_t data_len = header.len - header.topic_len;
+        char* data = buf + header.topic_len + 1;
+        bool read = box->flash->read(box->flash->ctx, addr, buf, header.topic_len) &&
+                    box->flash->read(box->flash->ctx, addr + header.topic_len, data, data_len);
+
+        if (!read || record_crc(&header, buf, data, data_len) != header.crc) {
+            record_set_state(box, box->read_sector, box->read_off, OUTBOX_STATE_SENT);
+            box->read_off += size;
+            box->pending--;
+            box->stats.corrupt++;
+            continue;
+        }
+
+        buf[header.topic_len] = '\0';
+        entry->topic = buf;
+        entry->data = data;
+        entry->len = data_len;
+        entry->sector = box->read_sector;
+        entry->off = box->read_off;
+        entry->size = size;
+        return true;
+    }
+
+    return false;
+}
+
+void outbox_pop(outbox_t* box, const outbox_entry_t* entry) {
+    if (entry->sector != box->read_sector || entry->off != box->read_off)
+        return;
+
+    record_set_state(box, entry->sector, entry->off, OUTBOX_STATE_SENT);
+    box->read_off += entry->size;
+    box->pending--;
+    box->stats.replayed++;
+}
+
+uint32_t outbox_pending(const outbox_t* box) {
+    return box->pending;
+}
+
+#ifdef ESP_PLATFORM
+static const char* TAG = "outbox";
+
+static outbox_t g_outbox;
+static outbox_flash_t g_partition_flash;
+static SemaphoreHandle_t g_outbox_lock;
+static outbox_publish_t g_publish;
+static bool g_outbox_ready;
+static volatile bool g_online;
+
+static bool partition_read(void* ctx, uint32_t addr, void* buf, size_t len) {
+    return esp_partition_read(ctx, addr, buf, len) == ESP_OK;
+}
+
+static bool partition_write(void* ctx, uint32_t addr, const void* buf, size_t len) {
+    return esp_partition_write(ctx, addr, buf, len) == ESP_OK;
+}
+
+static bool partition_erase_sector(void* ctx, uint32_t addr) {
+    return esp_partition_erase_range(ctx, addr, OUTBOX_SECTOR_SIZE) == ESP_OK;
+}
+
+static void outbox_task(void* arg) {
+    char* buf = arg;
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(OUTBOX_REPLAY_INTERVAL_MS));
+
+        /* Rate limited so a long backlog does not starve live traffic.
+         * Each record is sent under the lock, a direct publish cannot pass it. */
+        for (uint8_t i = 0; i < OUTBOX_REPLAY_BATCH && g_online; i++) {
+            outbox_entry_t entry;
+
+            xSemaphoreTake(g_outbox_lock, portMAX_DELAY);
+            bool sent = outbox_peek(&g_outbox, &entry, buf) && g_publish(entry.topic, entry.data, entry.len) >= 0;
+            if (sent)
+                outbox_pop(&g_outbox, &entry);
+            xSemaphoreGive(g_outbox_lock);
+
+            if (!sent)
+                break;
+        }
+    }
+}
+
+bool outbox_start(outbox_publish_t publish) {
+    g_publish = publish;
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                    OUTBOX_PARTITION_SUBTYPE, OUTBOX_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "No %s partition, messages are not kept while offline", OUTBOX_PARTITION_LABEL);
+        return false;
+    }
+
+    g_partition_flash.read = partition_read;
+    g_partition_flash.write = partition_write;
+    g_partition_flash.erase_sector = partition_erase_sector;
+    g_partition_flash.ctx = (void*) partition;
+    g_partition_flash.size = partition->size - partition->size % OUTBOX_SECTOR_SIZE;
+
+    g_outbox_lock = xSemaphoreCreateMutex();
+    char* buf = malloc(OUTBOX_RECORD_MAX + 1);
+    if (g_outbox_lock == NULL || buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate outbox buffers");
+        free(buf);
+        return false;
+    }
+
+    if (!outbox_mount(&g_outbox, &g_partition_flash)) {
+        ESP_LOGE(TAG, "Failed to mount outbox");
+        free(buf);
+        return false;
+    }
+
+    if (xTaskCreate(outbox_task, "outbox", OUTBOX_TASK_STACK_SIZE, buf,
+                    OUTBOX_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create outbox task");
+        free(buf);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%u records waiting in %u sectors", (unsigned) g_outbox.pending, g_outbox.sector_count);
+    g_outbox_ready = true;
+    return true;
+}
+
+void outbox_set_online(bool online) {
+    g_online = online;
+}
+
+int outbox_publish(const char* topic, const char* data, size_t len) {
+    if (!g_outbox_ready)
+        return (g_publish != NULL) ? g_publish(topic, data, len) : -1;
+
+    /* Queued records go first to keep the order: while any wait for replay new ones
+     * queue behind them, and the lock is held over a direct publish so a replayed
+     * record cannot be sent in between */
+    xSemaphoreTake(g_outbox_lock, portMAX_DELAY);
+    if (g_online && outbox_pending(&g_outbox) == 0) {
+        int ret = g_publish(topic, data, len);
+        if (ret >= 0) {
+            xSemaphoreGive(g_outbox_lock);
+            return ret;
+        }
+    }
+
+    bool stored = outbox_append(&g_outbox, topic, data, len);
+    xSemaphoreGive(g_outbox_lock);
+
+    return stored ? 0 : -1;
+}
+
+void outbox_get_stats(outbox_stats_t* stats, uint32_t* pending) {
+    if (!g_outbox_ready) {
+        memset(stats, 0, sizeof(outbox_stats_t));
+        *pending = 0;
+        return;
+    }
+
+    xSemaphoreTake(g_outbox_lock, portMAX_DELAY);
+    *stats = g_outbox.stats;
+    *pending = g_outbox.pending;
+    xSemaphoreGive(g_outbox_lock);
+}
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Erase unit, records never cross it */
+#define OUTBOX_SECTOR_SIZE              4096
+
+/* Largest topic plus data stored in one record */
+#define OUTBOX_RECORD_MAX               1280
+
+#define OUTBOX_PARTITION_LABEL          "outbox"
+#define OUTBOX_PARTITION_SUBTYPE        0x40
+
+/* Replay rate once connected: records per interval */
+#define OUTBOX_REPLAY_BATCH             10
+#define OUTBOX_REPLAY_INTERVAL_MS       100
+
+#define OUTBOX_TASK_STACK_SIZE          3072
+#define OUTBOX_TASK_PRIORITY            2
+
+/* Flash access, addresses are relative to the outbox area.
+ * Erased flash reads 0xFF and writes only clear bits. */
+typedef struct {
+    bool (*read)(void* ctx, uint32_t addr, void* buf, size_t len);
+    bool (*write)(void* ctx, uint32_t addr, const void* buf, size_t len);
+    bool (*erase_sector)(void* ctx, uint32_t addr);
+    void* ctx;
+    uint32_t size;              /* multiple of OUTBOX_SECTOR_SIZE, at least two sectors */
+} outbox_flash_t;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t replayed;
+    uint32_t dropped;           /* unsent records overwritten by newer ones */
+    uint32_t rejected;          /* too large or flash errors */
+    uint32_t corrupt;           /* torn records skipped */
+    uint32_t erases;
+} outbox_stats_t;
+
+/* Circular record log over flash sectors, oldest sector is reused when full */
+typedef struct {
+    const outbox_flash_t* flash;
+    uint16_t sector_count;
+    uint32_t seq;               /* sequence number of the write sector */
+    bool opened;                /* a write sector exists */
+
+    uint16_t write_sector;
+    uint16_t write_off;         /* OUTBOX_SECTOR_SIZE when the sector is closed */
+    uint16_t read_sector;
+    uint16_t read_off;
+
+    uint32_t pending;
+    outbox_stats_t stats;
+} outbox_t;
+
+/* Oldest unsent record, topic is NUL-terminated, both point into the peek buffer */
+typedef struct {
+    const char* topic;
+    const char* data;
+    size_t len;
+
+    uint16_t sector;
+    uint16_t off;
+    uint16_t size;
+} outbox_entry_t;
+
+/* Publish a message, returns a negative value on failure */
+typedef int (*outbox_publish_t)(const char* topic, const char* data, size_t len);
+
+/* Recover the log from flash, false if the flash area is unusable */
+bool outbox_mount(outbox_t* box, const outbox_flash_t* flash);
+
+
+/* Append a record, overwriting the oldest sector when full */
+bool outbox_append(outbox_t* box, const char* topic, const char* data, size_t len);
+
+
+/* Read the oldest unsent record into buf, which holds OUTBOX_RECORD_MAX + 1 bytes.
+ * False when every record was sent. */
+bool outbox_peek(outbox_t* box, outbox_entry_t* entry, char* buf);
+
+
+/* Mark the peeked record sent, ignored if it was overwritten since */
+void outbox_pop(outbox_t* box, const outbox_entry_t* entry);
+
+
+/* Records not sent yet */
+uint32_t outbox_pending(const outbox_t* box);
+
+
+/* ESP-IDF binding over the outbox partition, one shared log */
+
+/* Open the outbox partition and start replaying stored records when online.
+ * Messages go straight to publish when the partition is missing. */
+bool outbox_start(outbox_publish_t publish);
+
+
+/* Called on MQTT connect and disconnect */
+void outbox_set_online(bool online);
+
+
+/* Publish now when online with nothing queued, otherwise store for replay */
+int outbox_publish(const char* topic, const char* data, size_t len);
+
+
+/* Get outbox counters and the number of records waiting */
+void outbox_get_stats(outbox_stats_t* stats, uint32_t* pending);
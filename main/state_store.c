@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "device_port.h"
+#include "state_store.h"
+
+#define STATE_STORE_KEY         "chan_state"
+#define STATE_STORE_VERSION     1
+
+/* Blob layout, little endian as stored by the CPU:
+ *   header, then per channel: u16 id, u8 type, value
+ *   value: bool u8, number f32, string u8 length + bytes */
+typedef struct {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t count;
+    uint32_t schema_fp;
+} state_header_t;
+
+static const char* TAG = "state";
+
+static uint32_t flush_interval_ms;
+static volatile bool state_dirty;
+static SemaphoreHandle_t flush_lock;
+
+/* Hash of the last blob in flash, identical state is not written again */
+static uint32_t last_blob_hash;
+
+static state_store_stats_t g_stats;
+
+static uint32_t blob_hash(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void state_put(uint8_t* buf, size_t size, size_t* len, const void* data, size_t data_len) {
+    if (buf != NULL && *len + data_len <= size)
+        memcpy(buf + *len, data, data_len);
+    *len += data_len;
+}
+
+/* Serialize a snapshot of every channel value, buf may be NULL to only measure */
+static size_t state_serialize(const device_value_t* values, uint16_t count, uint8_t* buf, size_t size) {
+    state_header_t header = {
+        .version = STATE_STORE_VERSION,
+        .schema_fp = device_get_schema_fingerprint(),
+    };
+    size_t len = sizeof(header);
+
+    for (uint16_t id = 0; id < count; id++) {
+        const device_channel_t* channel = device_get_channel(id);
+        const device_value_t* value = &values[id];
+        if (channel == NULL || value->type == DEVICE_VALUE_NONE)
+            continue;
+
+        uint8_t type = channel->type;
+        state_put(buf, size, &len, &id, sizeof(id));
+        state_put(buf, size, &len, &type, sizeof(type));
+
+        switch (channel->type) {
+        case CHANNEL_TYPE_BOOL: {
+            uint8_t val = value->value.bool_val;
+            state_put(buf, size, &len, &val, sizeof(val));
+            break;
+        }
+        case CHANNEL_TYPE_NUMBER:
+            state_put(buf, size, &len, &value->value.num_val, sizeof(float));
+            break;
+        case CHANNEL_TYPE_CHOICE:
+        case CHANNEL_TYPE_STRING: {
+            const char* str = value->value.str_val ? value->value.str_val : "";
+            size_t str_len = strlen(str);
+            uint8_t str_len8 = (str_len > STATE_STORE_STR_MAX) ? STATE_STORE_STR_MAX : str_len;
+            state_put(buf, size, &len, &str_len8, sizeof(str_len8));
+            state_put(buf, size, &len, str, str_len8);
+            break;
+        }
+        default:
+            break;
+        }
+
+        header.count++;
+    }
+
+    if (buf != NULL && sizeof(header) <= size)
+        memcpy(buf, &header, sizeof(header));
+    return len;
+}
+
+/* Apply a saved blob, only if it was written for the same schema */
+static void state_restore(const uint8_t* buf, size_t len) {
+    state_header_t header;
+    size_t pos = sizeof(header);
+
+    if (len < sizeof(header))
+        return;
+
+    memcpy(&header, buf, sizeof(header));
+    if (header.version != STATE_STORE_VERSION || header.schema_fp != device_get_schema_fingerprint()) {
+        ESP_LOGI(TAG, "Saved state is for another schema, ignoring it");
+        return;
+    }
+
+    for (uint16_t i = 0; i < header.count; i++) {
+        uint16_t id;
+        uint8_t type;
+
+        if (pos + sizeof(id) + sizeof(type) > len)
+            return;
+        memcpy(&id, buf + pos, sizeof(id));
+        type = buf[pos + sizeof(id)];
+        pos += sizeof(id) + sizeof(type);
+
+        const device_channel_t* channel = device_get_channel(id);
+        if (channel == NULL || channel->type != type)
+            return;
+
+        switch (type) {
+        case CHANNEL_TYPE_BOOL: {
+            if (pos + 1 > len)
+                return;
+            bool val = buf[pos++];
+            device_set_channel_value_by_id(id, &val);
+            break;
+        }
+        case CHANNEL_TYPE_NUMBER: {
+            float val;
+            if (pos + sizeof(val) > len)
+                return;
+            memcpy(&val, buf + pos, sizeof(val));
+            pos += sizeof(val);
+            device_set_channel_value_by_id(id, &val);
+            break;
+        }
+        case CHANNEL_TYPE_CHOICE:
+        case CHANNEL_TYPE_STRING: {
+            char str[STATE_STORE_STR_MAX + 1];
+            if (pos + 1 > len || pos + 1 + buf[pos] > len)
+                return;
+            memcpy(str, buf + pos + 1, buf[pos]);
+            str[buf[pos]] = '\0';
+            pos += 1 + buf[pos];
+
+            char* val = str;
+            device_set_channel_value_by_id(id, &val);
+            break;
+        }
+        default:
+            return;
+        }
+
+        g_stats.restored++;
+    }
+}
+
+static void state_on_change(uint16_t channel_id, void* ctx) {
+    state_dirty = true;
+    /* Listeners run on whichever task changed the value */
+    __atomic_fetch_add(&g_stats.changes, 1, __ATOMIC_RELAXED);
+}
+
+void state_store_flush(void) {
+    if (flush_lock == NULL || !state_dirty)
+        return;
+
+    xSemaphoreTake(flush_lock, portMAX_DELAY);
+    state_dirty = false;
+    g_stats.flushes++;
+
+    /* Serialized from one snapshot, commands keep applying meanwhile */
+    uint8_t* buf = NULL;
+    size_t len = 0;
+    uint16_t count = device_get_channel_count();
+    device_value_t* values = malloc(count * sizeof(device_value_t));
+    char* strs = NULL;
+    size_t str_size = 0;
+
+    if (values != NULL || count == 0) {
+        /* Strings may outgrow the measured size before they are copied, measure again */
+        size_t need = device_snapshot(values, count, NULL, 0);
+        while (need > str_size) {
+            char* grown = realloc(strs, need);
+            if (grown == NULL)
+                break;
+            strs = grown;
+            str_size = need;
+            need = device_snapshot(values, count, strs, str_size);
+        }
+
+        if (need <= str_size) {
+            len = state_serialize(values, count, NULL, 0);
+            buf = malloc(len);
+            if (buf != NULL)
+                state_serialize(values, count, buf, len);
+        }
+    }
+    free(values);
+    free(strs);
+
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "No memory for %u byte state", (unsigned) len);
+        state_dirty = true;
+        xSemaphoreGive(flush_lock);
+        return;
+    }
+
+    uint32_t hash = blob_hash(buf, len);
+    if (hash == last_blob_hash) {
+        g_stats.skipped++;
+    } else if (device_port_set_blob(STATE_STORE_KEY, buf, len)) {
+        last_blob_hash = hash;
+        g_stats.flash_writes++;
+        g_stats.bytes_written += len;
+    } else {
+        ESP_LOGE(TAG, "Failed to save channel state");
+        state_dirty = true;
+    }
+
+    free(buf);
+    xSemaphoreGive(flush_lock);
+}
+
+static void state_store_task(void* arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(flush_interval_ms));
+        state_store_flush();
+    }
+}
+
+bool state_store_start(uint32_t interval_ms) {
+    flush_interval_ms = interval_ms;
+
+    /* Restore first, before our listener sees the restored values as changes */
+    size_t len = 0;
+    if (device_port_get_blob(STATE_STORE_KEY, NULL, &len) && len > 0) {
+        uint8_t* buf = malloc(len);
+        if (buf != NULL && device_port_get_blob(STATE_STORE_KEY, buf, &len)) {
+            state_restore(buf, len);
+            last_blob_hash = blob_hash(buf, len);
+        }
+        free(buf);
+        ESP_LOGI(TAG, "Restored %u channel values", (unsigned) g_stats.restored);
+    }
+
+    flush_lock = xSemaphoreCreateMutex();
+    if (flush_lock == NULL || !device_add_change_listener(state_on_change, NULL)) {
+        ESP_LOGE(TAG, "Failed to start state store");
+        return false;
+    }
+
+    if (xTaskCreate(state_store_task, "state", STATE_STORE_TASK_STACK_SIZE, NULL,
+                    STATE_STORE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create state store task");
+        return false;
+    }
+
+    return true;
+}
+
+void state_store_get_stats(state_store_stats_t* stats) {
+    *stats = g_stats;
+    stats->changes = __atomic_load_n(&g_stats.changes, __ATOMIC_RELAXED);
+}
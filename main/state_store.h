@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Default interval between state commits, changes within it share one write */
+#define STATE_STORE_FLUSH_INTERVAL_MS   30000
+
+/* Longest string/choice value persisted, longer values are truncated */
+#define STATE_STORE_STR_MAX             255
+
+#define STATE_STORE_TASK_STACK_SIZE     3072
+#define STATE_STORE_TASK_PRIORITY       2
+
+typedef struct {
+    uint32_t changes;           /* channel value changes seen */
+    uint32_t flushes;           /* flush intervals with pending changes */
+    uint32_t skipped;           /* flushes whose state matched flash */
+    uint32_t flash_writes;      /* blob commits */
+    uint32_t bytes_written;
+    uint32_t restored;          /* channels restored at start */
+} state_store_stats_t;
+
+/* Restore saved channel values and start persisting changes.
+ * Call after the device schema is sealed, before other change listeners start. */
+bool state_store_start(uint32_t flush_interval_ms);
+
+
+/* Commit pending changes now */
+void state_store_flush(void);
+
+
+/* Get state store counters */
+void state_store_get_stats(state_store_stats_t* stats);
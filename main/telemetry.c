@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "codec.h"
+#include "device.h"
+#include "telemetry.h"
+
+static const char* TAG = "telemetry";
+
+static const char* telemetry_topic;
+static telemetry_publish_t telemetry_publish;
+static uint32_t telemetry_interval_ms;
+
+/* Channels in the message being sent, marked changed again if it fails */
+static uint32_t* message_bitmap;
+static uint16_t bitmap_words;
+
+/* Serializes flushes from the task and from telemetry_flush */
+static SemaphoreHandle_t flush_lock;
+static uint8_t* payload_buf;
+
+static telemetry_stats_t g_stats;
+static int64_t start_time;
+
+static void telemetry_write_value(codec_writer_t* writer, const device_channel_t* channel, const device_value_t* value) {
+    char key[DEVICE_CHANNEL_KEY_MAX];
+    codec_write_key(writer, device_get_channel_key(channel, key));
+
+    switch (value->type) {
+    case DEVICE_VALUE_BOOL:
+        codec_write_bool(writer, value->value.bool_val);
+        break;
+
+    case DEVICE_VALUE_NUMBER:
+        codec_write_number(writer, value->value.num_val);
+        break;
+
+    case DEVICE_VALUE_STRING:
+        if (value->value.str_val != NULL)
+            codec_write_string(writer, value->value.str_val);
+        else
+            codec_write_null(writer);
+        break;
+
+    case DEVICE_VALUE_WINDOWS:
+        codec_write_array_begin(writer);
+        for (uint8_t i = 0; i < value->value.window_val.count; i++) {
+            const device_window_t* window = &value->value.window_val.windows[i];
+            codec_write_map_begin(writer);
+            codec_write_key(writer, "min");
+            codec_write_number(writer, window->min);
+            codec_write_key(writer, "max");
+            codec_write_number(writer, window->max);
+            codec_write_key(writer, "mean");
+            codec_write_number(writer, window->mean);
+            codec_write_key(writer, "last");
+            codec_write_number(writer, window->last);
+            codec_write_key(writer, "count");
+            codec_write_number(writer, window->count);
+            codec_write_map_end(writer);
+        }
+        codec_write_array_end(writer);
+        break;
+
+    default:
+        codec_write_null(writer);
+        break;
+    }
+}
+
+typedef struct {
+    device_t* device;
+    codec_writer_t writer;
+    uint16_t channel_count;
+} telemetry_message_t;
+
+static bool telemetry_add_channel(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    telemetry_message_t* message = ctx;
+
+    codec_writer_t saved = message->writer;
+    telemetry_write_value(&message->writer, channel, value);
+
+    /* Keep room for the map end and NUL */
+    if (codec_writer_len(&message->writer) + 2 > TELEMETRY_MAX_PAYLOAD) {
+        message->writer = saved;
+        if (message->channel_count > 0)
+            return false;
+
+        /* Would never fit, do not let it block the others */
+        ESP_LOGW(TAG, "Value of channel %s too large for telemetry", channel->name);
+        device_report_sent_in(message->device, channel->id);
+        return true;
+    }
+
+    /* Added after the bitmap was sized, it goes with the next message */
+    if (channel->id >= bitmap_words * 32) {
+        message->writer = saved;
+        return false;
+    }
+
+    message_bitmap[channel->id / 32] |= 1u << (channel->id % 32);
+    message->channel_count++;
+    return true;
+}
+
+/* Build one message from the changed channels, the channels written go in message_bitmap */
+static size_t telemetry_build(device_t* dev, uint16_t* channel_count) {
+    telemetry_message_t message = { .device = dev, .channel_count = 0 };
+    codec_writer_init(&message.writer, device_get_codec(), payload_buf, TELEMETRY_MAX_PAYLOAD);
+    codec_write_map_begin(&message.writer);
+    memset(message_bitmap, 0, bitmap_words * sizeof(uint32_t));
+
+    device_report_changes_in(dev, telemetry_add_channel, &message);
+
+    *channel_count = message.channel_count;
+    codec_write_map_end(&message.writer);
+    return codec_writer_finish(&message.writer);
+}
+
+/* Put the channels of a failed message back, they go with the next flush */
+static void telemetry_requeue(device_t* dev) {
+    for (uint16_t word = 0; word < bitmap_words; word++) {
+        uint32_t bits = message_bitmap[word];
+        while (bits != 0) {
+            device_mark_channel_changed_in(dev, word * 32 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+/* The message went out, drop the aggregation windows it carried */
+static void telemetry_sent(device_t* dev) {
+    for (uint16_t word = 0; word < bitmap_words; word++) {
+        uint32_t bits = message_bitmap[word];
+        while (bits != 0) {
+            device_report_sent_in(dev, word * 32 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+/* Grow message_bitmap to cover every channel of the device, flush_lock held */
+static bool telemetry_reserve(const device_t* dev) {
+    uint16_t words = (device_get_channel_count_in(dev) + 31) / 32;
+    if (words <= bitmap_words)
+        return true;
+
+    uint32_t* bitmap = realloc(message_bitmap, words * sizeof(uint32_t));
+    if (bitmap == NULL)
+        return false;
+
+    message_bitmap = bitmap;
+    bitmap_words = words;
+    return true;
+}
+
+void telemetry_flush_device(device_t* dev, const char* topic) {
+    if (payload_buf == NULL)
+        return;
+
+    xSemaphoreTake(flush_lock, portMAX_DELAY);
+
+    for (;;) {
+        /* Channels may be added between messages */
+        if (!telemetry_reserve(dev)) {
+            ESP_LOGE(TAG, "No memory to flush %u channels", device_get_channel_count_in(dev));
+            break;
+        }
+
+        uint16_t channel_count;
+        size_t len = telemetry_build(dev, &channel_count);
+        if (channel_count == 0)
+            break;
+
+        if (telemetry_publish(topic, (const char*) payload_buf, len) < 0) {
+            telemetry_requeue(dev);
+            g_stats.failed++;
+            break;
+        }
+
+        telemetry_sent(dev);
+        g_stats.publishes++;
+        g_stats.channels_sent += channel_count;
+        g_stats.bytes_sent += len;
+    }
+
+    xSemaphoreGive(flush_lock);
+}
+
+void telemetry_flush(void) {
+    telemetry_flush_device(device_get_self(), telemetry_topic);
+}
+
+static void telemetry_task(void* arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(telemetry_interval_ms));
+        telemetry_flush();
+    }
+}
+
+bool telemetry_start(const char* topic, uint32_t flush_interval_ms, telemetry_publish_t publish) {
+    telemetry_topic = topic;
+    telemetry_publish = publish;
+    telemetry_interval_ms = flush_interval_ms;
+
+    bitmap_words = (device_get_channel_count() + 31) / 32;
+    message_bitmap = calloc(bitmap_words ? bitmap_words : 1, sizeof(uint32_t));
+    flush_lock = xSemaphoreCreateMutex();
+    uint8_t* buf = malloc(TELEMETRY_MAX_PAYLOAD);
+
+    if (message_bitmap == NULL || flush_lock == NULL || buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate telemetry buffers");
+        free(buf);
+        return false;
+    }
+
+    start_time = esp_timer_get_time();
+    payload_buf = buf;
+
+    if (xTaskCreate(telemetry_task, "telemetry", TELEMETRY_TASK_STACK_SIZE, NULL,
+                    TELEMETRY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create telemetry task");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Publishing on %s every %u ms", topic, (unsigned) flush_interval_ms);
+    return true;
+}
+
+void telemetry_get_stats(telemetry_stats_t* stats) {
+    *stats = g_stats;
+
+    device_change_stats_t changes;
+    device_get_change_stats(&changes);
+    stats->updates = changes.changes + changes.coalesced;
+    stats->coalesced = changes.coalesced;
+    stats->suppressed = changes.suppressed;
+
+    float elapsed = (esp_timer_get_time() - start_time) / 1000000.0f;
+    if (elapsed > 0) {
+        stats->publish_rate = stats->publishes / elapsed;
+        stats->bytes_per_second = stats->bytes_sent / elapsed;
+    }
+    if (stats->publishes > 0)
+        stats->batch_size = (float) stats->channels_sent / stats->publishes;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/* Default flush interval, changes within one interval are coalesced */
+#define TELEMETRY_FLUSH_INTERVAL_MS     1000
+
+/* Maximum telemetry message size, remaining changes go in the next flush */
+#define TELEMETRY_MAX_PAYLOAD           1024
+
+#define TELEMETRY_TASK_STACK_SIZE       3072
+#define TELEMETRY_TASK_PRIORITY         3
+
+/* Publish a telemetry message, returns a negative value on failure */
+typedef int (*telemetry_publish_t)(const char* topic, const char* data, size_t len);
+
+typedef struct {
+    uint32_t updates;           /* channel value changes seen */
+    uint32_t coalesced;         /* changes merged into an already pending one */
+    uint32_t suppressed;        /* sets within the deadband, not reported */
+    uint32_t publishes;
+    uint32_t failed;
+    uint32_t channels_sent;
+    uint32_t bytes_sent;
+
+    /* Derived since telemetry_start */
+    float publish_rate;         /* messages per second */
+    float batch_size;           /* channels per message */
+    float bytes_per_second;
+} telemetry_stats_t;
+
+/* Start collecting channel changes, call after the device schema is sealed */
+bool telemetry_start(const char* topic, uint32_t flush_interval_ms, telemetry_publish_t publish);
+
+
+/* Publish pending changes now */
+void telemetry_flush(void);
+
+
+/* Publish pending changes of another device on its own topic, e.g. a gateway sub-device */
+void telemetry_flush_device(device_t* dev, const char* topic);
+
+
+/* Get telemetry counters */
+void telemetry_get_stats(telemetry_stats_t* stats);
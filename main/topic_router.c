@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "topic_router.h"
+
+/* Slot values are route index + 1, 0 marks an empty slot */
+#define TOPIC_SLOT_EMPTY        0
+
+/* FNV-1a hash of the topic */
+static uint32_t topic_hash(const char* topic, size_t topic_len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < topic_len; i++) {
+        hash ^= (uint8_t) topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* MQTT wildcard match of a topic against a pattern */
+static bool topic_match(const char* pattern, size_t pattern_len, const char* topic, size_t topic_len) {
+    size_t p = 0, t = 0;
+
+    /* Wildcards never match topics starting with '$' */
+    if (topic_len > 0 && topic[0] == '$' && pattern_len > 0 && (pattern[0] == '+' || pattern[0] == '#'))
+        return false;
+
+    while (p < pattern_len) {
+        if (pattern[p] == '#')
+            return true;
+
+        if (pattern[p] == '+') {
+            while (t < topic_len && topic[t] != '/')
+                t++;
+            p++;
+        } else {
+            if (t >= topic_len || pattern[p] != topic[t])
+                return false;
+            p++;
+            t++;
+        }
+
+        /* "a/#" also matches "a" */
+        if (t == topic_len && p + 2 == pattern_len && pattern[p] == '/' && pattern[p + 1] == '#')
+            return true;
+    }
+
+    return t == topic_len;
+}
+
+void topic_router_init(topic_router_t* router) {
+    memset(router, 0, sizeof(topic_router_t));
+}
+
+bool topic_router_add(topic_router_t* router, const char* pattern, topic_handler_t handler, void* ctx) {
+    if (router->route_count >= TOPIC_ROUTER_MAX_ROUTES)
+        return false;
+
+    uint8_t index = router->route_count++;
+    topic_route_t* route = &router->routes[index];
+    route->pattern = pattern;
+    route->pattern_len = strlen(pattern);
+    route->handler = handler;
+    route->ctx = ctx;
+
+    if (strpbrk(pattern, "+#") != NULL) {
+        router->wildcard_routes[router->wildcard_count++] = index;
+        return true;
+    }
+
+    uint32_t slot = topic_hash(pattern, route->pattern_len) & (TOPIC_ROUTER_HASH_SIZE - 1);
+    while (router->exact_slots[slot] != TOPIC_SLOT_EMPTY)
+        slot = (slot + 1) & (TOPIC_ROUTER_HASH_SIZE - 1);
+    router->exact_slots[slot] = index + 1;
+    return true;
+}
+
+int topic_router_dispatch(const topic_router_t* router, const char* topic, size_t topic_len,
+                    const char* data, size_t data_len) {
+    int handled = 0;
+
+    /* Exact routes, several handlers may share a topic */
+    uint32_t slot = topic_hash(topic, topic_len) & (TOPIC_ROUTER_HASH_SIZE - 1);
+    while (router->exact_slots[slot] != TOPIC_SLOT_EMPTY) {
+        const topic_route_t* route = &router->routes[router->exact_slots[slot] - 1];
+        if (route->pattern_len == topic_len && memcmp(route->pattern, topic, topic_len) == 0) {
+            route->handler(topic, topic_len, data, data_len, route->ctx);
+            handled++;
+        }
+        slot = (slot + 1) & (TOPIC_ROUTER_HASH_SIZE - 1);
+    }
+
+    /* Wildcard routes */
+    for (uint8_t i = 0; i < router->wildcard_count; i++) {
+        const topic_route_t* route = &router->routes[router->wildcard_routes[i]];
+        if (topic_match(route->pattern, route->pattern_len, topic, topic_len)) {
+            route->handler(topic, topic_len, data, data_len, route->ctx);
+            handled++;
+        }
+    }
+
+    return handled;
+}
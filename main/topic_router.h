@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum number of registered topic patterns */
+#define TOPIC_ROUTER_MAX_ROUTES         16
+
+/* Exact topic hash slots, power of two larger than TOPIC_ROUTER_MAX_ROUTES */
+#define TOPIC_ROUTER_HASH_SIZE          32
+
+/* Topic handler, topic and data are not NUL terminated */
+typedef void (*topic_handler_t)(const char* topic, size_t topic_len,
+                    const char* data, size_t data_len, void* ctx);
+
+typedef struct {
+    const char* pattern;
+    uint16_t pattern_len;
+    topic_handler_t handler;
+    void* ctx;
+} topic_route_t;
+
+/* Exact patterns are dispatched through an open addressing hash table,
+ * patterns with '+' or '#' wildcards are matched level by level */
+typedef struct {
+    topic_route_t routes[TOPIC_ROUTER_MAX_ROUTES];
+    uint8_t route_count;
+    uint8_t exact_slots[TOPIC_ROUTER_HASH_SIZE];
+    uint8_t wildcard_routes[TOPIC_ROUTER_MAX_ROUTES];
+    uint8_t wildcard_count;
+} topic_router_t;
+
+/* Clear all routes */
+void topic_router_init(topic_router_t* router);
+
+
+/* Register a handler for a topic pattern, the pattern must outlive the router */
+bool topic_router_add(topic_router_t* router, const char* pattern, topic_handler_t handler, void* ctx);
+
+
+/* Call every handler matching the topic, returns the number of handlers called */
+int topic_router_dispatch(const topic_router_t* router, const char* topic, size_t topic_len,
+                    const char* data, size_t data_len);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_port.h"
+
+/* Benchmark timing and heap counting. Each measurement prints one line:
+ * name, ns/op, allocations/op and bytes allocated/op.
+ * With --quick (as run by ctest) iterations are cut down to a smoke test. */
+
+typedef struct {
+    int64_t start_ns;
+    host_alloc_stats_t start_alloc;
+} bench_t;
+
+static int bench_quick;
+
+static inline void bench_init(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0)
+            bench_quick = 1;
+    }
+    printf("%-44s %12s %10s %10s\n", "benchmark", "ns/op", "allocs/op", "bytes/op");
+}
+
+/* Iterations to run, a hundredth of them in quick mode */
+static inline uint32_t bench_iterations(uint32_t iterations) {
+    return (bench_quick && iterations >= 100) ? iterations / 100 : iterations;
+}
+
+static inline int64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void bench_start(bench_t* bench) {
+    host_alloc_get_stats(&bench->start_alloc);
+    bench->start_ns = bench_now_ns();
+}
+
+/* Report ops operations since bench_start, returns ns per operation */
+static inline double bench_stop(bench_t* bench, const char* name, uint64_t ops) {
+    int64_t elapsed = bench_now_ns() - bench->start_ns;
+
+    host_alloc_stats_t alloc;
+    host_alloc_get_stats(&alloc);
+
+    double ns = (double) elapsed / ops;
+    printf("%-44s %12.1f %10.2f %10.1f\n", name, ns,
+                (double) (alloc.allocs + alloc.reallocs - bench->start_alloc.allocs - bench->start_alloc.reallocs) / ops,
+                (double) (alloc.bytes - bench->start_alloc.bytes) / ops);
+    return ns;
+}
+
+/* Keep the compiler from dropping a result */
+static inline void bench_use(const void* ptr) {
+    __asm__ volatile("" : : "g"(ptr) : "memory");
+}
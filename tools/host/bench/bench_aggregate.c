@@ -0,0 +1,96 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Sample ingest on aggregated number channels: one sample per call and one
+ * sample per channel in a batch, against plain number channels, then with
+ * windows closing and a reporter draining them. The ns/op of each line is the
+ * cost of one sample, the per-channel rate it allows is printed below it. */
+
+#define BENCH_CHANNELS                  64
+#define BENCH_SAMPLES                   2000000
+
+enum { PLAIN, AGGREGATED, AGGREGATED_SHORT };
+
+static device_update_t g_updates[BENCH_CHANNELS];
+
+/* Windows of the short channels close every millisecond */
+static const uint32_t g_window_ms[] = { 0, 10000, 1 };
+
+static uint16_t g_windows;
+
+static bool drain(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    if (value->type == DEVICE_VALUE_WINDOWS)
+        g_windows += value->value.window_val.count;
+    device_report_sent(channel->id);
+    return true;
+}
+
+static void build_device(int kind) {
+    char name[16];
+
+    device_init("bench");
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        snprintf(name, sizeof(name), "ch%d", i);
+        if (kind == PLAIN)
+            device_add_nummber_channel(name, false, NULL, NULL, 0, 1000, 0);
+        else
+            device_add_aggregate_channel(name, false, NULL, NULL, 0, 1000, 0, g_window_ms[kind]);
+        g_updates[i].channel_id = i;
+        g_updates[i].type = DEVICE_VALUE_NUMBER;
+    }
+    device_seal();
+}
+
+static void report_rate(double ns) {
+    printf("  %.0f samples/s on one channel\n", 1e9 / ns);
+}
+
+static void bench_kind(int kind, const char* label) {
+    bench_t bench;
+    char name[48];
+    uint32_t iterations = bench_iterations(BENCH_SAMPLES);
+
+    build_device(kind);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float sample = i % 1000;
+        device_set_channel_value_by_id(i % BENCH_CHANNELS, &sample);
+
+        /* The telemetry task would take the closed windows every so often */
+        if (kind == AGGREGATED_SHORT && i % 4096 == 0)
+            device_report_changes(drain, NULL);
+    }
+    snprintf(name, sizeof(name), "%s, single samples", label);
+    report_rate(bench_stop(&bench, name, iterations));
+
+    uint32_t batches = iterations / BENCH_CHANNELS;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < batches; i++) {
+        for (int j = 0; j < BENCH_CHANNELS; j++)
+            g_updates[j].value.num_val = (i + j) % 1000;
+        device_update_channels(g_updates, BENCH_CHANNELS);
+
+        if (kind == AGGREGATED_SHORT && i % 64 == 0)
+            device_report_changes(drain, NULL);
+    }
+    snprintf(name, sizeof(name), "%s, batches of %d", label, BENCH_CHANNELS);
+    report_rate(bench_stop(&bench, name, (uint64_t) batches * BENCH_CHANNELS));
+
+    device_change_stats_t stats;
+    device_get_change_stats(&stats);
+    if (kind == AGGREGATED_SHORT)
+        printf("  %u windows reported, %u dropped on a full ring\n", g_windows, stats.windows_dropped);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+    printf("%d number channels\n", BENCH_CHANNELS);
+
+    bench_kind(PLAIN, "plain");
+    bench_kind(AGGREGATED, "aggregated, 10 s windows");
+    bench_kind(AGGREGATED_SHORT, "aggregated, 1 ms windows");
+    return 0;
+}
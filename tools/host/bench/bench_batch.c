@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* A command setting several channels: one device_update_channels batch against
+ * repeated single sets, for a bool, a number and a choice channel and for a
+ * batch of 16. ns/op is per command. */
+
+#define BENCH_BATCH                     16
+
+static const char* const g_modes[] = { "mode1", "mode2", "mode3" };
+
+static void bench_three(void) {
+    bench_t bench;
+    uint32_t iterations = bench_iterations(1000000);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        bool power = i & 1;
+        float temp = 20 + (i % 10);
+        const char* mode = g_modes[i % 3];
+        device_set_channel_value_by_id(0, &power);
+        device_set_channel_value_by_id(1, &temp);
+        device_set_channel_value_by_id(2, &mode);
+    }
+    bench_stop(&bench, "3 channels, single sets", iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        device_update_t updates[] = {
+            { .channel_id = 0, .type = DEVICE_VALUE_BOOL, .value.bool_val = i & 1 },
+            { .channel_id = 1, .type = DEVICE_VALUE_NUMBER, .value.num_val = 20 + (i % 10) },
+            { .channel_id = 2, .type = DEVICE_VALUE_STRING, .value.str_val = g_modes[i % 3] },
+        };
+        device_update_channels(updates, 3);
+    }
+    bench_stop(&bench, "3 channels, one batch", iterations);
+}
+
+static void bench_many(void) {
+    bench_t bench;
+    device_update_t updates[BENCH_BATCH];
+    char label[64];
+    uint32_t iterations = bench_iterations(200000);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint16_t id = 0; id < BENCH_BATCH; id++) {
+            float val = (i + id) % 100;
+            device_set_channel_value_by_id(3 + id, &val);
+        }
+    }
+    snprintf(label, sizeof(label), "%d channels, single sets", BENCH_BATCH);
+    bench_stop(&bench, label, iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint16_t id = 0; id < BENCH_BATCH; id++) {
+            updates[id].channel_id = 3 + id;
+            updates[id].type = DEVICE_VALUE_NUMBER;
+            updates[id].value.num_val = (i + id) % 100;
+        }
+        device_update_channels(updates, BENCH_BATCH);
+    }
+    snprintf(label, sizeof(label), "%d channels, one batch", BENCH_BATCH);
+    bench_stop(&bench, label, iterations);
+}
+
+int main(int argc, char** argv) {
+    static char names[BENCH_BATCH][12];
+
+    bench_init(argc, argv);
+
+    device_init("bench");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 1);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "mode1", "mode2", "mode3");
+    for (int i = 0; i < BENCH_BATCH; i++) {
+        snprintf(names[i], sizeof(names[i]), "level%d", i);
+        device_add_nummber_channel(names[i], true, NULL, NULL, 0, 100, 1);
+    }
+    device_seal();
+
+    bench_three();
+    bench_many();
+    return 0;
+}
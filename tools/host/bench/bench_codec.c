@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "codec.h"
+#include "device.h"
+
+/* JSON against CBOR on the payloads the device exchanges: telemetry and command
+ * maps both ways, the provisioning document it only encodes. Sizes are printed
+ * with each label. */
+
+#define BENCH_CHANNELS                  100
+
+static char g_names[BENCH_CHANNELS][16];
+static device_channel_def_t g_defs[BENCH_CHANNELS];
+static const char* const g_modes[] = { "auto", "cool", "dry", "fan" };
+
+static const char* const g_codec_names[CODEC_COUNT] = { "json", "cbor" };
+
+static size_t encode_telemetry(codec_type_t type, uint8_t* buf, size_t size) {
+    codec_writer_t writer;
+    codec_writer_init(&writer, type, buf, size);
+    codec_write_map_begin(&writer);
+    codec_write_key(&writer, "power");
+    codec_write_bool(&writer, true);
+    codec_write_key(&writer, "temp");
+    codec_write_number(&writer, 22.5);
+    codec_write_key(&writer, "humidity");
+    codec_write_number(&writer, 48);
+    codec_write_key(&writer, "mode");
+    codec_write_string(&writer, "cool");
+    codec_write_key(&writer, "fan");
+    codec_write_string(&writer, "auto");
+    codec_write_key(&writer, "status");
+    codec_write_string(&writer, "running");
+    codec_write_key(&writer, "flow");
+    codec_write_array_begin(&writer);
+    codec_write_map_begin(&writer);
+    codec_write_key(&writer, "min");
+    codec_write_number(&writer, 1.25);
+    codec_write_key(&writer, "max");
+    codec_write_number(&writer, 4.75);
+    codec_write_key(&writer, "count");
+    codec_write_number(&writer, 100);
+    codec_write_map_end(&writer);
+    codec_write_array_end(&writer);
+    codec_write_map_end(&writer);
+    return codec_writer_finish(&writer);
+}
+
+static bool count_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    (*(uint32_t*) ctx)++;
+    return true;
+}
+
+static void bench_messages(codec_type_t type) {
+    bench_t bench;
+    char label[64];
+    uint8_t buf[512];
+    uint32_t iterations = bench_iterations(1000000);
+
+    size_t len = encode_telemetry(type, buf, sizeof(buf));
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        encode_telemetry(type, buf, sizeof(buf));
+    snprintf(label, sizeof(label), "%s telemetry encode (%u bytes)", g_codec_names[type], (unsigned) len);
+    bench_stop(&bench, label, iterations);
+
+    uint32_t members = 0;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        codec_decode_map(type, buf, len, count_member, &members);
+    snprintf(label, sizeof(label), "%s telemetry decode", g_codec_names[type]);
+    bench_stop(&bench, label, iterations);
+    bench_use(&members);
+}
+
+static void bench_provision(device_t* dev, codec_type_t type) {
+    bench_t bench;
+    char label[64];
+    static uint8_t buf[16384];
+    uint32_t iterations = bench_iterations(20000);
+
+    size_t len = device_write_mqtt_provision_in(dev, type, buf, sizeof(buf));
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_write_mqtt_provision_in(dev, type, buf, sizeof(buf));
+    snprintf(label, sizeof(label), "%s provisioning encode (%u bytes)", g_codec_names[type], (unsigned) len);
+    bench_stop(&bench, label, iterations);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        snprintf(g_names[i], sizeof(g_names[i]), "channel_%d", i);
+        switch (i % 3) {
+        case 0:
+            g_defs[i] = (device_channel_def_t) DEVICE_BOOL_CHANNEL(g_names[i], true);
+            break;
+        case 1:
+            g_defs[i] = (device_channel_def_t) DEVICE_NUMBER_CHANNEL(g_names[i], true, -40, 125, 0.1f);
+            break;
+        default:
+            g_defs[i] = (device_channel_def_t) { g_names[i], CHANNEL_TYPE_CHOICE, true,
+                                { .opts_prov = { .opts = g_modes, .count = 4 } } };
+            break;
+        }
+    }
+
+    device_t* dev = device_create("bench", "020000000001", g_defs, BENCH_CHANNELS);
+    if (dev == NULL)
+        return 1;
+
+    for (codec_type_t type = CODEC_JSON; type < CODEC_COUNT; type++) {
+        bench_messages(type);
+        bench_provision(dev, type);
+    }
+
+    device_destroy(dev);
+    return 0;
+}
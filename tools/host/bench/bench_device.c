@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Device model operations the firmware runs at start-up and on every command:
+ * channel add, remove and set, provisioning document generation and parsing
+ * the provisioning response. */
+
+#define BENCH_CHANNELS                  200
+
+static char g_names[BENCH_CHANNELS][12];
+
+/* Board device with count channels of every type in turn */
+static void build_device(uint16_t count) {
+    device_init("bench");
+    for (uint16_t i = 0; i < count; i++) {
+        switch (i % 4) {
+        case 0:
+            device_add_bool_channel(g_names[i], true, NULL, NULL);
+            break;
+        case 1:
+            device_add_nummber_channel(g_names[i], true, NULL, NULL, 0, 1000, 0.5f);
+            break;
+        case 2:
+            device_add_multi_option_channel(g_names[i], true, NULL, NULL, 3, "low", "mid", "high");
+            break;
+        default:
+            device_add_string_channel(g_names[i], false, NULL, NULL);
+            break;
+        }
+    }
+}
+
+static void bench_add_remove(void) {
+    bench_t bench;
+    uint32_t rounds = bench_iterations(2000);
+    char label[64];
+
+    bench_start(&bench);
+    for (uint32_t r = 0; r < rounds; r++)
+        build_device(BENCH_CHANNELS);
+    snprintf(label, sizeof(label), "channel add (%u channels)", BENCH_CHANNELS);
+    bench_stop(&bench, label, (uint64_t) rounds * BENCH_CHANNELS);
+
+    uint64_t ops = 0;
+    int64_t removing = 0;
+    host_alloc_stats_t before, after, removed = { 0 };
+    for (uint32_t r = 0; r < rounds; r++) {
+        build_device(BENCH_CHANNELS);
+
+        host_alloc_get_stats(&before);
+        int64_t start = bench_now_ns();
+        for (uint16_t i = 0; i < BENCH_CHANNELS; i++)
+            device_remove_channel(g_names[i]);
+        removing += bench_now_ns() - start;
+        host_alloc_get_stats(&after);
+
+        removed.allocs += after.allocs + after.reallocs - before.allocs - before.reallocs;
+        removed.bytes += after.bytes - before.bytes;
+        ops += BENCH_CHANNELS;
+    }
+    printf("%-44s %12.1f %10.2f %10.1f\n", "channel remove", (double) removing / ops,
+                (double) removed.allocs / ops, (double) removed.bytes / ops);
+}
+
+static void bench_set(void) {
+    bench_t bench;
+    uint32_t iterations = bench_iterations(2000000);
+
+    build_device(BENCH_CHANNELS);
+    device_seal();
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        bool val = i & 1;
+        device_set_channel_value_by_id((i * 4) % BENCH_CHANNELS, &val);
+    }
+    bench_stop(&bench, "set bool by ID", iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float val = (float) (i % 2000) / 2;
+        device_set_channel_value(g_names[(i * 4 + 1) % BENCH_CHANNELS], &val);
+    }
+    bench_stop(&bench, "set number by name", iterations);
+
+    static const char* const opts[] = { "low", "mid", "high" };
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        const char* val = opts[i % 3];
+        device_set_channel_value_by_id((i * 4 + 2) % BENCH_CHANNELS, &val);
+    }
+    bench_stop(&bench, "set choice by ID", iterations);
+
+    static const char* const strs[] = { "idle", "running since boot", "fault: sensor 3 open" };
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        const char* val = strs[i % 3];
+        device_set_channel_value_by_id((i * 4 + 3) % BENCH_CHANNELS, &val);
+    }
+    bench_stop(&bench, "set string by ID", iterations);
+}
+
+static void bench_provision(void) {
+    bench_t bench;
+    uint32_t iterations = bench_iterations(20000);
+    char label[64];
+
+    build_device(BENCH_CHANNELS);
+    device_seal();
+
+    size_t len = device_write_mqtt_provision_json(NULL, 0);
+    char* buf = malloc(len + 1);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_write_mqtt_provision_json(buf, len + 1);
+    snprintf(label, sizeof(label), "provision JSON into buffer (%u bytes)", (unsigned) len);
+    bench_stop(&bench, label, iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        free(device_get_mqtt_provision_json_data());
+    bench_stop(&bench, "provision JSON allocated", iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_write_mqtt_provision(CODEC_CBOR, buf, len + 1);
+    snprintf(label, sizeof(label), "provision CBOR into buffer (%u bytes)",
+                (unsigned) device_write_mqtt_provision(CODEC_CBOR, NULL, 0));
+    bench_stop(&bench, label, iterations);
+
+    free(buf);
+}
+
+static void bench_response(void) {
+    static const char resp[] = "{\"status\":1,\"codec\":\"cbor\",\"server\":\"bench\",\"retry_s\":30}";
+    bench_t bench;
+    uint32_t iterations = bench_iterations(2000000);
+
+    build_device(8);
+    device_seal();
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_check_prov_resp(resp, sizeof(resp) - 1);
+    bench_stop(&bench, "provisioning response parse", iterations);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+
+    for (int i = 0; i < BENCH_CHANNELS; i++)
+        snprintf(g_names[i], sizeof(g_names[i]), "ch%d", i);
+
+    bench_add_remove();
+    bench_set();
+    bench_provision();
+    bench_response();
+    return 0;
+}
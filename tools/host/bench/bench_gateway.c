@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "bench.h"
+#include "command_pipeline.h"
+#include "device.h"
+#include "gateway.h"
+#include "topic_router.h"
+
+/* Sub-devices behind one gateway: heap and footprint per sub-device as the
+ * table grows, and command topics routed through the shared router to the
+ * sub-device they address. The host build raises GATEWAY_MAX_DEVICES so the
+ * table reaches the hundreds. */
+
+#define BENCH_DEVICES                   GATEWAY_MAX_DEVICES
+#define BENCH_COMMANDS                  1000000
+
+static const device_channel_def_t g_sensor_channels[] = {
+    DEVICE_AGGREGATE_CHANNEL("temp", false, -40, 85, 0.1, 10000),
+    DEVICE_NUMBER_CHANNEL("humidity", false, 0, 100, 1),
+    DEVICE_BOOL_CHANNEL("relay", true),
+};
+
+static const gateway_topics_t g_gateway_topics = {
+    .command_topic = "down/command/020000000001",
+    .telemetry_topic = "up/telemetry/020000000001",
+    .prov_upstream_topic = "up/provision/020000000001",
+    .prov_downstream_topic = "down/provision/020000000001",
+};
+
+static char g_topics[BENCH_DEVICES][GATEWAY_TOPIC_MAX];
+static size_t g_topic_lens[BENCH_DEVICES];
+
+int main(int argc, char** argv) {
+    bench_t bench;
+    topic_router_t router;
+    host_alloc_stats_t before, after;
+    static const char command[] = "{\"relay\":true}";
+
+    bench_init(argc, argv);
+    host_log_level = ESP_LOG_NONE;
+
+    topic_router_init(&router);
+    if (!gateway_init(&g_gateway_topics, &router) || !command_pipeline_start())
+        return 1;
+
+    /* Memory at a few table sizes, each step adds to the same table */
+    static const uint16_t steps[] = { 1, 10, 100, BENCH_DEVICES };
+    uint16_t added = 0;
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        host_alloc_get_stats(&before);
+        bench_start(&bench);
+        for (; added < steps[s]; added++) {
+            char id[GATEWAY_DEVICE_ID_MAX];
+            snprintf(id, sizeof(id), "sensor%u", added);
+            if (gateway_add_device("sensor", id, g_sensor_channels, 3) == NULL) {
+                printf("failed to add sub-device %s\n", id);
+                return 1;
+            }
+        }
+        host_alloc_get_stats(&after);
+
+        char name[48];
+        snprintf(name, sizeof(name), "add sub-devices, %u total", added);
+        uint16_t count = steps[s] - (s > 0 ? steps[s - 1] : 0);
+        bench_stop(&bench, name, count);
+
+        gateway_stats_t stats;
+        gateway_get_stats(&stats);
+        printf("  %u sub-devices: %u bytes held, %.1f bytes and %.1f heap calls per sub-device\n",
+                    stats.devices, (unsigned) stats.memory, (double) stats.memory / stats.devices,
+                    (double) (after.allocs - before.allocs) / count);
+    }
+
+    for (uint16_t i = 0; i < BENCH_DEVICES; i++) {
+        snprintf(g_topics[i], sizeof(g_topics[i]), "%s/sensor%u", g_gateway_topics.command_topic, i);
+        g_topic_lens[i] = strlen(g_topics[i]);
+    }
+
+    uint32_t iterations = bench_iterations(BENCH_COMMANDS);
+    char name[48];
+
+    /* Lookup only, the hash on the sub-device ID */
+    size_t id_start = strlen(g_gateway_topics.command_topic) + 1;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t n = (i * 2654435761u) % BENCH_DEVICES;
+        bench_use(gateway_find_device(g_topics[n] + id_start, g_topic_lens[n] - id_start));
+    }
+    snprintf(name, sizeof(name), "find sub-device, %u devices", BENCH_DEVICES);
+    bench_stop(&bench, name, iterations);
+
+    /* Router, lookup and command decode, queued for the command task or dropped when full */
+    command_pipeline_stats_t pipeline_before, pipeline_after;
+    command_pipeline_get_stats(&pipeline_before);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t n = (i * 2654435761u) % BENCH_DEVICES;
+        topic_router_dispatch(&router, g_topics[n], g_topic_lens[n], command, sizeof(command) - 1);
+    }
+    snprintf(name, sizeof(name), "route command, %u devices", BENCH_DEVICES);
+    bench_stop(&bench, name, iterations);
+    command_pipeline_get_stats(&pipeline_after);
+
+    gateway_stats_t stats;
+    gateway_get_stats(&stats);
+    if (stats.commands != iterations || stats.unknown != 0) {
+        printf("routed %u commands, %u unknown, expected %u\n", stats.commands, stats.unknown, iterations);
+        return 1;
+    }
+    printf("  %u queued, %u dropped on a full queue\n",
+                pipeline_after.enqueued - pipeline_before.enqueued,
+                pipeline_after.dropped - pipeline_before.dropped);
+
+    /* Sub-device IDs that are not in the table */
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        topic_router_dispatch(&router, "down/command/020000000001/missing", 33, command, sizeof(command) - 1);
+    bench_stop(&bench, "route command, unknown sub-device", iterations);
+
+    return 0;
+}
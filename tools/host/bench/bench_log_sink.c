@@ -0,0 +1,94 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "device.h"
+#include "log_sink.h"
+
+/* Command apply latency with the schema dump each update used to print, and with
+ * logging through the sink. The old dump is written synchronously to /dev/null
+ * here, on the device it went to a 115200 baud UART; that time is computed from
+ * the bytes written and printed separately. */
+
+#define UART_BAUD                       115200
+
+/* The dump device_set_channel_value printed after every update */
+static int sync_dump(FILE* out) {
+    int bytes = fprintf(out, "Device channels:\n");
+    for (const device_channel_t* ch = device_get_self()->channels; ch != NULL; ch = ch->next) {
+        switch (ch->type) {
+        case CHANNEL_TYPE_BOOL:
+            bytes += fprintf(out, "%10s: type %d cmd %d value %s\n", ch->name, ch->type, ch->cmd,
+                        ch->data_value.bool_val ? "true" : "false");
+            break;
+        case CHANNEL_TYPE_NUMBER:
+            bytes += fprintf(out, "%10s: type %d cmd %d min %.2f max %.2f multiof %.2f value %.2f\n",
+                        ch->name, ch->type, ch->cmd, ch->prov_data.num_prov.min, ch->prov_data.num_prov.max,
+                        ch->prov_data.num_prov.multipleof, ch->data_value.num_val);
+            break;
+        default:
+            bytes += fprintf(out, "%10s: type %d cmd %d value %s\n", ch->name, ch->type, ch->cmd,
+                        ch->data_value.str_val != NULL ? ch->data_value.str_val : "null");
+            for (uint8_t i = 0; ch->type == CHANNEL_TYPE_CHOICE && i < ch->prov_data.opts_prov.count; i++)
+                bytes += fprintf(out, "            enum %s\n", ch->prov_data.opts_prov.opts[i]);
+            break;
+        }
+    }
+    return bytes;
+}
+
+int main(int argc, char** argv) {
+    bench_t bench;
+    uint32_t iterations = bench_iterations(200000);
+
+    bench_init(argc, argv);
+
+    FILE* null_out = fopen("/dev/null", "w");
+    if (null_out == NULL)
+        return 1;
+
+    /* The example schema of device_specific_data_cfg */
+    device_init("ESP32 Device");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "mode1", "mode2", "mode3");
+    device_seal();
+
+    uint64_t dump_bytes = 0;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float temp = 16 + (i % 28) * 0.5f;
+        device_set_channel_value("temp", &temp);
+        dump_bytes += sync_dump(null_out);
+    }
+    bench_stop(&bench, "apply + synchronous dump", iterations);
+    printf("  %.0f bytes per dump, %.1f ms at %u baud\n", (double) dump_bytes / iterations,
+                (double) dump_bytes / iterations * 10 * 1000 / UART_BAUD, UART_BAUD);
+
+    log_sink_set_level(ESP_LOG_INFO);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float temp = 16 + (i % 28) * 0.5f;
+        device_set_channel_value("temp", &temp);
+        print_device_channels();
+    }
+    bench_stop(&bench, "apply + dump into the sink", iterations);
+
+    log_sink_set_level(ESP_LOG_DEBUG);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float temp = 16 + (i % 28) * 0.5f;
+        device_set_channel_value("temp", &temp);
+    }
+    bench_stop(&bench, "apply, debug line in the sink", iterations);
+
+    log_sink_set_level(ESP_LOG_INFO);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        float temp = 16 + (i % 28) * 0.5f;
+        device_set_channel_value("temp", &temp);
+    }
+    bench_stop(&bench, "apply, sink at info", iterations);
+
+    fclose(null_out);
+    return 0;
+}
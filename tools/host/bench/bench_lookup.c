@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Channel name lookup through the index against the linked list walk it replaced,
+ * at the schema sizes of a small device, a gateway and a large gateway. */
+
+#define BENCH_MAX_CHANNELS              1000
+
+static char g_names[BENCH_MAX_CHANNELS][16];
+static device_channel_def_t g_defs[BENCH_MAX_CHANNELS];
+
+/* Lookup as device_set_channel_value did it before the index */
+static device_channel_t* list_find(const device_t* dev, const char* name) {
+    for (device_channel_t* channel = dev->channels; channel != NULL; channel = channel->next) {
+        if (strcmp(channel->name, name) == 0)
+            return channel;
+    }
+    return NULL;
+}
+
+static void bench_size(uint16_t count) {
+    bench_t bench;
+    char label[64];
+    uint32_t iterations = bench_iterations(2000000);
+    uint32_t found = 0;
+
+    device_t* dev = device_create("bench", "bench", g_defs, count);
+    if (dev == NULL) {
+        printf("device_create failed for %u channels\n", count);
+        return;
+    }
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        found += device_get_channel_id_in(dev, g_names[(i * 7919) % count]) != DEVICE_CHANNEL_ID_INVALID;
+    snprintf(label, sizeof(label), "index lookup (%u channels)", count);
+    bench_stop(&bench, label, iterations);
+
+    /* The walk is O(n), keep the large sizes within a few seconds */
+    uint32_t walks = iterations / (count / 10 + 1);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < walks; i++)
+        found += list_find(dev, g_names[(i * 7919) % count]) != NULL;
+    snprintf(label, sizeof(label), "list walk (%u channels)", count);
+    bench_stop(&bench, label, walks);
+
+    bench_use(&found);
+    device_destroy(dev);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+
+    for (int i = 0; i < BENCH_MAX_CHANNELS; i++) {
+        snprintf(g_names[i], sizeof(g_names[i]), "sensor_%d", i);
+        g_defs[i] = (device_channel_def_t) DEVICE_NUMBER_CHANNEL(g_names[i], false, 0, 100, 1);
+    }
+
+    bench_size(10);
+    bench_size(100);
+    bench_size(1000);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Provisioning document serialization on growing schemas: into a caller buffer,
+ * measured first then written, and allocated by device_get_mqtt_provision_json_data.
+ * The cJSON path it replaced is no longer in the tree; it built one heap node per
+ * key and value and printed the tree twice, the allocated path here is the one
+ * call that replaced it. */
+
+#define BENCH_MAX_CHANNELS              500
+
+static char g_names[BENCH_MAX_CHANNELS][16];
+static device_channel_def_t g_defs[BENCH_MAX_CHANNELS];
+static const char* const g_modes[] = { "auto", "cool", "dry", "fan" };
+
+static void bench_size(uint16_t count) {
+    bench_t bench;
+    uint32_t iterations = bench_iterations(2000000 / count);
+
+    device_init("bench");
+    device_add_channels(g_defs, count);
+    device_seal();
+
+    size_t len = device_write_mqtt_provision_json(NULL, 0);
+    char* buf = malloc(len + 1);
+    printf("%u channels, %u byte document\n", count, (unsigned) len);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_write_mqtt_provision_json(buf, len + 1);
+    bench_stop(&bench, "  into buffer", iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        size_t need = device_write_mqtt_provision_json(NULL, 0);
+        device_write_mqtt_provision_json(buf, need + 1);
+    }
+    bench_stop(&bench, "  measured then written", iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        free(device_get_mqtt_provision_json_data());
+    bench_stop(&bench, "  allocated", iterations);
+
+    free(buf);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+
+    for (int i = 0; i < BENCH_MAX_CHANNELS; i++) {
+        snprintf(g_names[i], sizeof(g_names[i]), "channel_%d", i);
+        switch (i % 4) {
+        case 0:
+            g_defs[i] = (device_channel_def_t) DEVICE_BOOL_CHANNEL(g_names[i], true);
+            break;
+        case 1:
+            g_defs[i] = (device_channel_def_t) DEVICE_NUMBER_CHANNEL(g_names[i], true, -40, 125, 0.1f);
+            break;
+        case 2:
+            g_defs[i] = (device_channel_def_t) { g_names[i], CHANNEL_TYPE_CHOICE, true,
+                                { .opts_prov = { .opts = g_modes, .count = 4 } } };
+            break;
+        default:
+            g_defs[i] = (device_channel_def_t) DEVICE_STRING_CHANNEL(g_names[i], false);
+            break;
+        }
+    }
+
+    bench_size(10);
+    bench_size(100);
+    bench_size(500);
+    return 0;
+}
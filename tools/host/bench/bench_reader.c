@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "bench.h"
+#include "codec.h"
+#include "device.h"
+#include "json_reader.h"
+
+/* In-place JSON reading of the downstream payloads: tokenizing, typed command
+ * extraction and the provisioning response. cJSON, which these replaced, is not
+ * part of the tree any more; every cJSON_Parse made one heap node per value,
+ * allocs/op here is what is left of that. */
+
+static const char g_prov_resp[] =
+    "{\"status\":1,\"codec\":\"cbor\",\"schema_version\":7,"
+    "\"channel_ids\":{\"power\":0,\"temp\":1,\"mode\":2,\"fan\":3,\"status\":4}}";
+
+static const char g_command[] =
+    "{\"power\":true,\"temp\":22.5,\"mode\":\"cool\",\"fan\":\"auto\"}";
+
+static const char g_command_escaped[] =
+    "{\"status\":\"caf\\u00e9 \\\"open\\\"\",\"mode\":\"dry\"}";
+
+static bool extract_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    const device_channel_t* channel = device_find_channel_key_in(device_get_self(), key, key_len);
+    if (channel != NULL)
+        (*(uint32_t*) ctx) += value->type;
+    return true;
+}
+
+static void bench_payload(const char* name, const char* payload) {
+    bench_t bench;
+    char label[64];
+    json_token_t tokens[CODEC_JSON_MAX_TOKENS];
+    size_t len = strlen(payload);
+    uint32_t iterations = bench_iterations(2000000);
+    uint32_t sum = 0;
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += json_reader_parse(payload, len, tokens, CODEC_JSON_MAX_TOKENS);
+    snprintf(label, sizeof(label), "tokenize %s (%u bytes)", name, (unsigned) len);
+    bench_stop(&bench, label, iterations);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        codec_decode_map(CODEC_JSON, payload, len, extract_member, &sum);
+    snprintf(label, sizeof(label), "decode %s by channel", name);
+    bench_stop(&bench, label, iterations);
+    bench_use(&sum);
+}
+
+int main(int argc, char** argv) {
+    bench_t bench;
+
+    bench_init(argc, argv);
+    host_log_level = ESP_LOG_NONE;
+
+    device_init("bench");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+    device_add_multi_option_channel("fan", true, NULL, NULL, 3, "auto", "low", "high");
+    device_add_string_channel("status", true, NULL, NULL);
+    device_seal();
+
+    bench_payload("command", g_command);
+    bench_payload("escaped command", g_command_escaped);
+
+    uint32_t iterations = bench_iterations(1000000);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        device_check_prov_resp(g_prov_resp, sizeof(g_prov_resp) - 1);
+    bench_stop(&bench, "provisioning response with channel IDs", iterations);
+    return 0;
+}
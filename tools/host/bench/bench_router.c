@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "topic_router.h"
+
+/* Dispatch of synthetic topics through the routes the firmware registers, the
+ * gateway's wildcard routes, and topics that match nothing. The strcmp chain
+ * the router replaced is run on the same topics for comparison. */
+
+#define BENCH_TOPICS                    1000000
+#define BENCH_TOPIC_POOL                1024
+
+static const char* const g_patterns[] = {
+    "down/provision/020000000001",
+    "down/command/020000000001",
+    "down/diagnostics/020000000001",
+    "down/command/020000000001/+",
+    "gw/020000000001/+/command/#",
+};
+
+#define BENCH_PATTERNS                  (sizeof(g_patterns) / sizeof(g_patterns[0]))
+
+static char g_topics[BENCH_TOPIC_POOL][64];
+static size_t g_topic_lens[BENCH_TOPIC_POOL];
+static uint32_t g_handled;
+
+static void count_handler(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    g_handled++;
+}
+
+/* Exact topics compared one by one, as mqtt_data_handle did */
+static int strcmp_dispatch(const char* topic) {
+    int handled = 0;
+    for (size_t i = 0; i < 3; i++) {
+        if (strcmp(topic, g_patterns[i]) == 0)
+            handled++;
+    }
+    return handled;
+}
+
+int main(int argc, char** argv) {
+    bench_t bench;
+    topic_router_t router;
+    uint32_t iterations = bench_iterations(BENCH_TOPICS);
+
+    bench_init(argc, argv);
+
+    topic_router_init(&router);
+    for (size_t i = 0; i < BENCH_PATTERNS; i++)
+        topic_router_add(&router, g_patterns[i], count_handler, NULL);
+
+    /* A mix of exact hits, wildcard hits and misses */
+    for (int i = 0; i < BENCH_TOPIC_POOL; i++) {
+        switch (i % 4) {
+        case 0:
+            snprintf(g_topics[i], sizeof(g_topics[i]), "%s", g_patterns[i % 3]);
+            break;
+        case 1:
+            snprintf(g_topics[i], sizeof(g_topics[i]), "down/command/020000000001/ch%d", i);
+            break;
+        case 2:
+            snprintf(g_topics[i], sizeof(g_topics[i]), "gw/020000000001/%08x/command/ch%d", i * 2654435761u, i);
+            break;
+        default:
+            snprintf(g_topics[i], sizeof(g_topics[i]), "down/command/%012x", i);
+            break;
+        }
+        g_topic_lens[i] = strlen(g_topics[i]);
+    }
+
+    g_handled = 0;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t n = i % BENCH_TOPIC_POOL;
+        topic_router_dispatch(&router, g_topics[n], g_topic_lens[n], "1", 1);
+    }
+    bench_stop(&bench, "router, mixed topics", iterations);
+
+    /* Every topic but the misses has one handler */
+    uint32_t expected = (iterations / BENCH_TOPIC_POOL) * (BENCH_TOPIC_POOL / 4 * 3);
+    if (g_handled < expected) {
+        printf("handled %u topics, expected at least %u\n", g_handled, expected);
+        return 1;
+    }
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        topic_router_dispatch(&router, g_topics[0], g_topic_lens[0], "1", 1);
+    bench_stop(&bench, "router, exact topic", iterations);
+
+    int handled = 0;
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        handled += strcmp_dispatch(g_topics[(i % (BENCH_TOPIC_POOL / 4)) * 4]);
+    bench_stop(&bench, "strcmp chain, exact topics", iterations);
+
+    bench_use(&handled);
+    return 0;
+}
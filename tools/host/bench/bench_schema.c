@@ -0,0 +1,64 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Schema construction at run time with device_add_* against a const table with
+ * device_add_channels, on 200 channels, half numbers and half 3-option choices.
+ * Arena bytes are the schema RAM; the table's names and options stay in .rodata. */
+
+#define BENCH_CHANNELS                  200
+
+static char g_names[BENCH_CHANNELS][16];
+static device_channel_def_t g_defs[BENCH_CHANNELS];
+static const char* const g_modes[] = { "mode1", "mode2", "mode3" };
+
+static void build_runtime(void) {
+    device_init("bench");
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        if (i % 2 == 0)
+            device_add_nummber_channel(g_names[i], true, NULL, NULL, 0, 100, 1);
+        else
+            device_add_multi_option_channel(g_names[i], true, NULL, NULL, 3, "mode1", "mode2", "mode3");
+    }
+    device_seal();
+}
+
+static void build_table(void) {
+    device_init("bench");
+    device_add_channels(g_defs, BENCH_CHANNELS);
+    device_seal();
+}
+
+static void bench_build(const char* name, void (*build)(void)) {
+    bench_t bench;
+    char label[64];
+    size_t used, size;
+    uint32_t iterations = bench_iterations(5000);
+
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++)
+        build();
+    snprintf(label, sizeof(label), "%s construction", name);
+    bench_stop(&bench, label, iterations);
+
+    device_get_arena_usage(&used, &size);
+    printf("  %u arena bytes, %.1f per channel\n", (unsigned) used, (double) used / BENCH_CHANNELS);
+}
+
+int main(int argc, char** argv) {
+    bench_init(argc, argv);
+
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        snprintf(g_names[i], sizeof(g_names[i]), "channel_%d", i);
+        if (i % 2 == 0)
+            g_defs[i] = (device_channel_def_t) DEVICE_NUMBER_CHANNEL(g_names[i], true, 0, 100, 1);
+        else
+            g_defs[i] = (device_channel_def_t) { g_names[i], CHANNEL_TYPE_CHOICE, true,
+                                { .opts_prov = { .opts = g_modes, .count = 3 } } };
+    }
+
+    bench_build("runtime", build_runtime);
+    bench_build("table", build_table);
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "device.h"
+
+/* Snapshot reads against writers on other threads, lock-free through the seqlock
+ * and under the writer lock as a mutex-based store would read. Then batch
+ * writes against the same two kinds of readers. */
+
+#define BENCH_CHANNELS                  32
+#define BENCH_SNAPSHOTS                 1000000
+#define BENCH_BATCHES                   1000000
+
+typedef enum {
+    LOAD_WRITER,
+    LOAD_READER,
+    LOAD_LOCKED_READER,
+} load_t;
+
+static int g_stop;
+static device_update_t g_updates[BENCH_CHANNELS];
+
+static void snapshot_locked(device_value_t* values, char* strs, size_t size) {
+    device_lock();
+    device_snapshot(values, BENCH_CHANNELS, strs, size);
+    device_unlock();
+}
+
+static void* load_thread(void* arg) {
+    load_t load = (load_t) (uintptr_t) arg;
+    device_update_t updates[BENCH_CHANNELS];
+    device_value_t values[BENCH_CHANNELS];
+    char strs[64];
+
+    memcpy(updates, g_updates, sizeof(updates));
+    for (uint32_t k = 0; !__atomic_load_n(&g_stop, __ATOMIC_RELAXED); k++) {
+        switch (load) {
+        case LOAD_WRITER:
+            for (int i = 0; i < BENCH_CHANNELS; i++)
+                updates[i].value.num_val = k % 1000;
+            device_update_channels(updates, BENCH_CHANNELS);
+            break;
+
+        case LOAD_READER:
+            device_snapshot(values, BENCH_CHANNELS, strs, sizeof(strs));
+            break;
+
+        case LOAD_LOCKED_READER:
+            snapshot_locked(values, strs, sizeof(strs));
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Start count threads running load until load_stop */
+static void load_start(pthread_t* threads, int count, load_t load) {
+    __atomic_store_n(&g_stop, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++)
+        pthread_create(&threads[i], NULL, load_thread, (void*) (uintptr_t) load);
+}
+
+static void load_stop(pthread_t* threads, int count) {
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static void bench_reads(int writers, bool locked) {
+    bench_t bench;
+    pthread_t threads[2];
+    device_value_t values[BENCH_CHANNELS];
+    char strs[64];
+    char name[48];
+    uint32_t iterations = bench_iterations(BENCH_SNAPSHOTS);
+
+    load_start(threads, writers, LOAD_WRITER);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (locked)
+            snapshot_locked(values, strs, sizeof(strs));
+        else
+            device_snapshot(values, BENCH_CHANNELS, strs, sizeof(strs));
+        bench_use(values);
+    }
+    snprintf(name, sizeof(name), "snapshot%s, %d writers", locked ? " under lock" : "", writers);
+    bench_stop(&bench, name, iterations);
+    load_stop(threads, writers);
+}
+
+static void bench_writes(int readers, load_t load) {
+    bench_t bench;
+    pthread_t threads[2];
+    char name[48];
+    uint32_t iterations = bench_iterations(BENCH_BATCHES);
+
+    load_start(threads, readers, load);
+    bench_start(&bench);
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (int j = 0; j < BENCH_CHANNELS; j++)
+            g_updates[j].value.num_val = i % 1000;
+        device_update_channels(g_updates, BENCH_CHANNELS);
+    }
+    snprintf(name, sizeof(name), "batch write, %d %sreaders", readers, load == LOAD_LOCKED_READER ? "locked " : "");
+    bench_stop(&bench, name, iterations);
+    load_stop(threads, readers);
+}
+
+int main(int argc, char** argv) {
+    char name[16];
+
+    bench_init(argc, argv);
+
+    device_init("bench");
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        snprintf(name, sizeof(name), "num%d", i);
+        device_add_nummber_channel(name, false, NULL, NULL, 0, 1000, 0);
+        g_updates[i].channel_id = i;
+        g_updates[i].type = DEVICE_VALUE_NUMBER;
+    }
+    device_seal();
+
+    printf("%d number channels\n", BENCH_CHANNELS);
+    for (int writers = 0; writers <= 2; writers++) {
+        bench_reads(writers, false);
+        bench_reads(writers, true);
+    }
+
+    bench_writes(0, LOAD_READER);
+    bench_writes(2, LOAD_READER);
+    bench_writes(2, LOAD_LOCKED_READER);
+
+    device_change_stats_t stats;
+    device_get_change_stats(&stats);
+    bench_use(&stats);
+    return 0;
+}
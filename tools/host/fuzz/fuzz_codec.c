@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "codec.h"
+#include "device.h"
+#include "json_reader.h"
+
+/* Fuzz target for everything that reads downstream payloads: the JSON tokenizer,
+ * map decoding in both codecs with nested maps, channel key lookup as commands
+ * do it, and the provisioning response.
+ *
+ * Built with -DHOST_LIBFUZZER and -fsanitize=fuzzer it is a libFuzzer target.
+ * Otherwise main replays the files given, or mutates built-in seeds for a fixed
+ * number of runs so ctest exercises it; build with HOST_SANITIZE to catch more. */
+
+#define FUZZ_RUNS                       200000
+#define FUZZ_MAX_INPUT                  512
+
+static bool g_device_ready;
+
+static bool fuzz_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    codec_type_t type = *(codec_type_t*) ctx;
+    volatile size_t sink = 0;
+
+    device_find_channel_key_in(device_get_self(), key, key_len);
+    if (value->type == CODEC_VALUE_STRING) {
+        for (size_t i = 0; i < value->str_len; i++)
+            sink += (uint8_t) value->str[i];
+    } else if (value->type == CODEC_VALUE_OTHER && value->str != NULL) {
+        codec_decode_map(type, value->str, value->str_len, fuzz_member, ctx);
+    }
+    return true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    json_token_t tokens[CODEC_JSON_MAX_TOKENS];
+
+    if (!g_device_ready) {
+        device_init("fuzz");
+        device_add_bool_channel("power", true, NULL, NULL);
+        device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+        device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+        device_add_string_channel("status", false, NULL, NULL);
+        device_seal();
+        g_device_ready = true;
+    }
+
+    json_reader_parse((const char*) data, size, tokens, CODEC_JSON_MAX_TOKENS);
+
+    for (codec_type_t type = CODEC_JSON; type < CODEC_COUNT; type++)
+        codec_decode_map(type, data, size, fuzz_member, &type);
+
+    device_check_prov_resp((const char*) data, size);
+    return 0;
+}
+
+#ifndef HOST_LIBFUZZER
+
+static const char* const g_json_seeds[] = {
+    "{\"status\":1,\"codec\":\"cbor\",\"schema_version\":3,\"channel_ids\":{\"power\":0,\"temp\":1,\"mode\":2}}",
+    "{\"power\":true,\"temp\":22.5,\"mode\":\"cool\",\"status\":\"a\\u00e9\\n\"}",
+    "{\"0\":false,\"1\":-1e3,\"2\":\"dry\",\"x\":[1,[2,{\"y\":null}]]}",
+    "{\"status\":0,\"retry_s\":30,\"server\":\"\\\"quoted\\\"\"}",
+};
+
+/* {"power": true, "temp": 22.5, "ids": {"mode": 2}, "list": [1, "a"]} */
+static const uint8_t g_cbor_seed[] = {
+    0xA4, 0x65, 'p', 'o', 'w', 'e', 'r', 0xF5,
+    0x64, 't', 'e', 'm', 'p', 0xF9, 0x4D, 0xA0,
+    0x63, 'i', 'd', 's', 0xA1, 0x64, 'm', 'o', 'd', 'e', 0x02,
+    0x64, 'l', 'i', 's', 't', 0x9F, 0x01, 0x61, 'a', 0xFF,
+};
+
+static uint32_t g_rand = 2463534242u;
+
+static uint32_t fuzz_rand(void) {
+    g_rand ^= g_rand << 13;
+    g_rand ^= g_rand >> 17;
+    g_rand ^= g_rand << 5;
+    return g_rand;
+}
+
+/* Flip, replace, insert, delete or truncate a few bytes */
+static size_t fuzz_mutate(uint8_t* buf, size_t len) {
+    static const uint8_t interesting[] = { '{', '}', '[', ']', '"', '\\', ',', ':', '0', 'e', '-',
+                0x00, 0x1F, 0x7F, 0x80, 0x9F, 0xA0, 0xBF, 0xF9, 0xFB, 0xFF };
+
+    for (uint32_t n = 1 + fuzz_rand() % 4; n > 0 && len > 0; n--) {
+        size_t pos = fuzz_rand() % len;
+        switch (fuzz_rand() % 5) {
+        case 0:
+            buf[pos] ^= 1u << (fuzz_rand() % 8);
+            break;
+        case 1:
+            buf[pos] = interesting[fuzz_rand() % sizeof(interesting)];
+            break;
+        case 2:
+            if (len < FUZZ_MAX_INPUT) {
+                memmove(buf + pos + 1, buf + pos, len - pos);
+                buf[pos] = interesting[fuzz_rand() % sizeof(interesting)];
+                len++;
+            }
+            break;
+        case 3:
+            memmove(buf + pos, buf + pos + 1, len - pos - 1);
+            len--;
+            break;
+        default:
+            len = pos;
+            break;
+        }
+    }
+    return len;
+}
+
+static int fuzz_file(const char* path) {
+    uint8_t buf[65536];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    size_t len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+    LLVMFuzzerTestOneInput(buf, len);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    uint8_t buf[FUZZ_MAX_INPUT];
+    size_t seed_count = sizeof(g_json_seeds) / sizeof(g_json_seeds[0]) + 1;
+
+    host_log_level = ESP_LOG_NONE;
+
+    if (argc > 1) {
+        int failed = 0;
+        for (int i = 1; i < argc; i++)
+            failed |= fuzz_file(argv[i]);
+        return failed;
+    }
+
+    for (uint32_t run = 0; run < FUZZ_RUNS; run++) {
+        size_t seed = run % seed_count;
+        size_t len;
+
+        if (seed < seed_count - 1) {
+            len = strlen(g_json_seeds[seed]);
+            memcpy(buf, g_json_seeds[seed], len);
+        } else {
+            len = sizeof(g_cbor_seed);
+            memcpy(buf, g_cbor_seed, len);
+        }
+
+        len = fuzz_mutate(buf, len);
+
+        /* An exact-size heap copy lets the sanitizers see reads past the end */
+        uint8_t* input = malloc(len ? len : 1);
+        memcpy(input, buf, len);
+        LLVMFuzzerTestOneInput(input, len);
+        free(input);
+    }
+
+    printf("%u runs\n", FUZZ_RUNS);
+    return 0;
+}
+
+#endif
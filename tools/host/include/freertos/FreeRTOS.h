@@ -0,0 +1,23 @@
+#pragma once
+
+/* Host stand-in for the FreeRTOS pieces the device model uses, on pthreads */
+
+#include <pthread.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE                          1
+#define pdFALSE                         0
+#define pdPASS                          1
+#define pdFAIL                          0
+#define pdMS_TO_TICKS(ms)               ((TickType_t) (ms))
+#define portMAX_DELAY                   ((TickType_t) 0xFFFFFFFF)
+
+typedef pthread_mutex_t portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux)         pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)          pthread_mutex_unlock(mux)
@@ -0,0 +1,18 @@
+#pragma once
+
+/* Queues of fixed-size items on a mutex and two condition variables, see freertos_host.c.
+ * Ticks are milliseconds, 0 never waits and portMAX_DELAY waits forever. */
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+
+void vQueueDelete(QueueHandle_t queue);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
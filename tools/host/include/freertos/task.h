@@ -0,0 +1,52 @@
+#pragma once
+
+/* Tasks run as detached threads, ticks are milliseconds */
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void* arg);
+typedef void* TaskHandle_t;
+
+typedef struct {
+    TaskFunction_t fn;
+    void* arg;
+} host_task_t;
+
+static inline void* host_task_entry(void* arg) {
+    host_task_t task = *(host_task_t*) arg;
+    free(arg);
+    task.fn(task.arg);
+    return NULL;
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_size,
+                    void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+    pthread_t thread;
+    host_task_t* task = malloc(sizeof(host_task_t));
+    if (task == NULL)
+        return pdFAIL;
+
+    task->fn = fn;
+    task->arg = arg;
+    if (pthread_create(&thread, NULL, host_task_entry, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+static inline void vTaskDelay(TickType_t ticks) {
+    usleep(ticks * 1000);
+}
+
+static inline TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
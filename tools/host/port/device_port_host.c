@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "device_port.h"
+#include "host_port.h"
+
+/* Host implementation of the device model services. Storage is a small
+ * in-memory key-value table, nothing is kept between runs. */
+
+/* Keys stored at once, NVS keys are at most 15 characters */
+#define HOST_NVS_KEYS                   64
+#define HOST_NVS_KEY_MAX                16
+
+typedef struct {
+    char key[HOST_NVS_KEY_MAX];
+    void* data;
+    size_t len;
+} host_nvs_entry_t;
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+static uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static host_nvs_entry_t host_nvs[HOST_NVS_KEYS];
+static uint32_t host_nvs_write_count;
+static pthread_mutex_t host_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void host_port_set_mac(const uint8_t mac[6]) {
+    memcpy(host_mac, mac, sizeof(host_mac));
+}
+
+void device_port_get_mac(uint8_t mac[6]) {
+    memcpy(mac, host_mac, sizeof(host_mac));
+}
+
+void host_nvs_erase(void) {
+    pthread_mutex_lock(&host_nvs_lock);
+    for (int i = 0; i < HOST_NVS_KEYS; i++) {
+        free(host_nvs[i].data);
+        memset(&host_nvs[i], 0, sizeof(host_nvs_entry_t));
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+}
+
+uint32_t host_nvs_writes(void) {
+    return __atomic_load_n(&host_nvs_write_count, __ATOMIC_RELAXED);
+}
+
+/* Entry holding key, or a free one when create. Called with the lock held. */
+static host_nvs_entry_t* host_nvs_find(const char* key, bool create) {
+    host_nvs_entry_t* free_entry = NULL;
+    for (int i = 0; i < HOST_NVS_KEYS; i++) {
+        if (host_nvs[i].key[0] == '\0') {
+            if (free_entry == NULL)
+                free_entry = &host_nvs[i];
+        } else if (strcmp(host_nvs[i].key, key) == 0) {
+            return &host_nvs[i];
+        }
+    }
+
+    if (!create || free_entry == NULL || strlen(key) >= HOST_NVS_KEY_MAX)
+        return NULL;
+
+    strcpy(free_entry->key, key);
+    return free_entry;
+}
+
+static bool host_nvs_get(const char* key, void* buf, size_t* len, bool exact) {
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_entry_t* entry = host_nvs_find(key, false);
+    bool found = entry != NULL && (exact ? entry->len == *len : (buf == NULL || entry->len <= *len));
+    if (found) {
+        if (buf != NULL)
+            memcpy(buf, entry->data, entry->len);
+        *len = entry->len;
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+    return found;
+}
+
+static bool host_nvs_set(const char* key, const void* buf, size_t len) {
+    void* data = malloc(len > 0 ? len : 1);
+    if (data == NULL)
+        return false;
+    memcpy(data, buf, len);
+
+    pthread_mutex_lock(&host_nvs_lock);
+    host_nvs_entry_t* entry = host_nvs_find(key, true);
+    if (entry != NULL) {
+        free(entry->data);
+        entry->data = data;
+        entry->len = len;
+        host_nvs_write_count++;
+    }
+    pthread_mutex_unlock(&host_nvs_lock);
+
+    if (entry == NULL)
+        free(data);
+    return entry != NULL;
+}
+
+bool device_port_get_u8(const char* key, uint8_t* val) {
+    size_t len = sizeof(*val);
+    return host_nvs_get(key, val, &len, true);
+}
+
+bool device_port_set_u8(const char* key, uint8_t val) {
+    return host_nvs_set(key, &val, sizeof(val));
+}
+
+bool device_port_get_u16(const char* key, uint16_t* val) {
+    size_t len = sizeof(*val);
+    return host_nvs_get(key, val, &len, true);
+}
+
+bool device_port_set_u16(const char* key, uint16_t val) {
+    return host_nvs_set(key, &val, sizeof(val));
+}
+
+bool device_port_get_u32(const char* key, uint32_t* val) {
+    size_t len = sizeof(*val);
+    return host_nvs_get(key, val, &len, true);
+}
+
+bool device_port_set_u32(const char* key, uint32_t val) {
+    return host_nvs_set(key, &val, sizeof(val));
+}
+
+bool device_port_get_blob(const char* key, void* buf, size_t* len) {
+    return host_nvs_get(key, buf, len, false);
+}
+
+bool device_port_set_blob(const char* key, const void* buf, size_t len) {
+    return host_nvs_set(key, buf, len);
+}
+
+void* device_port_lock_create(void) {
+    pthread_mutex_t* lock = malloc(sizeof(pthread_mutex_t));
+    if (lock != NULL)
+        pthread_mutex_init(lock, NULL);
+    return lock;
+}
+
+void device_port_lock(void* lock) {
+    pthread_mutex_lock(lock);
+}
+
+void device_port_unlock(void* lock) {
+    pthread_mutex_unlock(lock);
+}
@@ -0,0 +1,48 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "host_port.h"
+
+/* Heap call counting. Programs are linked with --wrap for malloc, calloc,
+ * realloc and free, so every call from the device model lands here first;
+ * calls made inside the C library are not counted. */
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static host_alloc_stats_t host_alloc_stats;
+
+static void host_alloc_count(uint64_t* counter, size_t bytes) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&host_alloc_stats.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t size) {
+    host_alloc_count(&host_alloc_stats.allocs, size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    host_alloc_count(&host_alloc_stats.allocs, count * size);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    host_alloc_count((ptr == NULL) ? &host_alloc_stats.allocs : &host_alloc_stats.reallocs, size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr != NULL)
+        __atomic_fetch_add(&host_alloc_stats.frees, 1, __ATOMIC_RELAXED);
+    __real_free(ptr);
+}
+
+void host_alloc_get_stats(host_alloc_stats_t* stats) {
+    stats->allocs = __atomic_load_n(&host_alloc_stats.allocs, __ATOMIC_RELAXED);
+    stats->reallocs = __atomic_load_n(&host_alloc_stats.reallocs, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&host_alloc_stats.frees, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&host_alloc_stats.bytes, __ATOMIC_RELAXED);
+}
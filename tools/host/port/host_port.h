@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Host services around the device model, for tests and benchmarks */
+
+/* MAC returned by device_port_get_mac */
+void host_port_set_mac(const uint8_t mac[6]);
+
+
+/* Forget every stored key, like an erased NVS partition */
+void host_nvs_erase(void);
+
+
+/* Keys written since start, each one a flash commit on the device */
+uint32_t host_nvs_writes(void);
+
+
+/* Heap calls made through malloc, calloc, realloc and free, see host_alloc.c */
+typedef struct {
+    uint64_t allocs;            /* malloc, calloc, and realloc of NULL */
+    uint64_t reallocs;
+    uint64_t frees;             /* of non-NULL pointers */
+    uint64_t bytes;             /* requested by allocs and reallocs */
+} host_alloc_stats_t;
+
+void host_alloc_get_stats(host_alloc_stats_t* stats);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+
+/* Minimal checks for the host tests, a failed check is reported and the test goes on.
+ * main returns HOST_TEST_RESULT() so ctest sees the failures. */
+
+static int host_test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(fn) do { \
+        int failures = host_test_failures; \
+        fn(); \
+        printf("%-40s %s\n", #fn, (host_test_failures == failures) ? "ok" : "FAILED"); \
+    } while (0)
+
+#define HOST_TEST_RESULT()              (host_test_failures == 0 ? 0 : 1)
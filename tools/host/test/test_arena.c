@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "device.h"
+#include "host_port.h"
+#include "host_test.h"
+
+/* The schema lives in one arena block: adding channels only allocates when the
+ * channel index grows. Sealing fixes the index with room for a few channels,
+ * added from the arena alone, and a created device is sealed without room. */
+
+static uint64_t heap_calls(void) {
+    host_alloc_stats_t stats;
+    host_alloc_get_stats(&stats);
+    return stats.allocs + stats.reallocs;
+}
+
+static void test_arena_alloc(void) {
+    arena_t arena;
+    CHECK(arena_init(&arena, 64));
+
+    char* a = arena_alloc(&arena, 3);
+    void* b = arena_alloc(&arena, 8);
+    CHECK(a != NULL && b != NULL);
+    CHECK((uintptr_t) b % sizeof(void*) == 0);
+    CHECK(arena_alloc(&arena, 64) == NULL);
+
+    char* s = arena_strdup(&arena, "temp");
+    CHECK(s != NULL && s[4] == '\0');
+
+    /* Everything after a mark is given back, what came before stays */
+    size_t mark = arena_mark(&arena);
+    CHECK(arena_alloc(&arena, 16) != NULL);
+    arena_reset(&arena, mark);
+    CHECK(arena_mark(&arena) == mark);
+    CHECK(arena_strdup(&arena, "temp") == s + 8);
+
+    arena_seal(&arena);
+    CHECK(arena_alloc(&arena, 1) == NULL);
+    CHECK(arena_strdup(&arena, "x") == NULL);
+    arena_deinit(&arena);
+}
+
+static void test_channels_do_not_allocate(void) {
+    device_init("arena");
+
+    /* The first add sizes the index for 16 channels */
+    device_add_bool_channel("power", true, NULL, NULL);
+
+    uint64_t before = heap_calls();
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+    device_add_multi_option_channel("fan", true, NULL, NULL, 8, "1", "2", "3", "4", "5", "6", "7", "8");
+    device_add_string_channel("status", false, NULL, NULL);
+    CHECK(heap_calls() == before);
+    CHECK(device_get_channel_count() == 5);
+
+    /* Past that only the index grows: table, changed bitmap and buckets per doubling */
+    before = heap_calls();
+    char names[200][12];
+    for (int i = 0; i < 200; i++) {
+        snprintf(names[i], sizeof(names[i]), "ch%d", i);
+        device_add_multi_option_channel(names[i], false, NULL, NULL, 2, "off", "on");
+    }
+    CHECK(device_get_channel_count() == 205);
+    CHECK(heap_calls() - before <= 3 * 4);
+}
+
+static void test_seal(void) {
+    size_t used, size;
+
+    device_init("arena");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+
+    uint64_t before = heap_calls();
+    device_seal();
+    CHECK(heap_calls() == before);
+
+    device_get_arena_usage(&used, &size);
+    CHECK(used > 0 && used <= size);
+
+    /* Options that do not fit give back the space taken for the node and name */
+    static char huge[DEVICE_SCHEMA_ARENA_SIZE];
+    memset(huge, 'o', sizeof(huge) - 1);
+    device_add_multi_option_channel("huge", true, NULL, NULL, 2, "off", huge);
+    CHECK(device_get_channel_id("huge") == DEVICE_CHANNEL_ID_INVALID);
+    size_t now;
+    device_get_arena_usage(&now, &size);
+    CHECK(now == used);
+
+    /* Channels added within the room left take only arena space */
+    char names[DEVICE_SCHEMA_HEADROOM][12];
+    for (int i = 0; i < DEVICE_SCHEMA_HEADROOM; i++) {
+        snprintf(names[i], sizeof(names[i]), "late%d", i);
+        device_add_bool_channel(names[i], true, NULL, NULL);
+    }
+    CHECK(heap_calls() == before);
+    CHECK(device_get_channel_id("late0") == 2);
+    CHECK(device_get_channel_id("temp") == 1);
+
+    size_t after;
+    device_get_arena_usage(&after, &size);
+    CHECK(after > used);
+
+    /* Past the room nothing is added, nor kept in the arena */
+    device_add_bool_channel("too_late", true, NULL, NULL);
+    CHECK(device_get_channel_id("too_late") == DEVICE_CHANNEL_ID_INVALID);
+    device_get_arena_usage(&now, &size);
+    CHECK(now == after);
+    CHECK(device_get_channel_count() == 2 + DEVICE_SCHEMA_HEADROOM);
+    CHECK(device_get_channel_id(names[DEVICE_SCHEMA_HEADROOM - 1]) == 1 + DEVICE_SCHEMA_HEADROOM);
+}
+
+static void test_created_device_sealed(void) {
+    static const device_channel_def_t defs[] = {
+        DEVICE_BOOL_CHANNEL("power", true),
+        DEVICE_NUMBER_CHANNEL("temp", false, 0, 50, 0.5f),
+    };
+    static const device_channel_def_t late[] = {
+        DEVICE_BOOL_CHANNEL("late", true),
+    };
+
+    device_t* dev = device_create("sensor", "sub1", defs, 2);
+    CHECK(dev != NULL);
+    if (dev == NULL)
+        return;
+
+    /* Sized to fit its table exactly, without room */
+    CHECK(dev->channel_table_size == 2);
+    device_add_channels_in(dev, late, 1);
+    CHECK(device_get_channel_count_in(dev) == 2);
+    CHECK(device_get_channel_id_in(dev, "temp") == 1);
+    device_destroy(dev);
+}
+
+int main(void) {
+    RUN_TEST(test_arena_alloc);
+    RUN_TEST(test_channels_do_not_allocate);
+    RUN_TEST(test_seal);
+    RUN_TEST(test_created_device_sealed);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "codec.h"
+#include "host_test.h"
+
+/* Both codecs encode the same map and decode it back to the same members */
+
+typedef struct {
+    int count;
+    codec_value_t values[8];
+    char keys[8][16];
+    char strs[8][16];                   /* unescaped strings only last the callback */
+} members_t;
+
+static bool collect(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    members_t* members = ctx;
+    if (members->count == 8 || key_len >= sizeof(members->keys[0]))
+        return false;
+
+    memcpy(members->keys[members->count], key, key_len);
+    members->keys[members->count][key_len] = '\0';
+    members->values[members->count] = *value;
+    if (value->type == CODEC_VALUE_STRING && value->str_len <= sizeof(members->strs[0])) {
+        memcpy(members->strs[members->count], value->str, value->str_len);
+        members->values[members->count].str = members->strs[members->count];
+    }
+    members->count++;
+    return true;
+}
+
+static size_t encode(codec_type_t type, uint8_t* buf, size_t size) {
+    codec_writer_t writer;
+    codec_writer_init(&writer, type, buf, size);
+    codec_write_map_begin(&writer);
+    codec_write_key(&writer, "power");
+    codec_write_bool(&writer, true);
+    codec_write_key(&writer, "temp");
+    codec_write_number(&writer, -22.5);
+    codec_write_key(&writer, "count");
+    codec_write_number(&writer, 70000);
+    codec_write_key(&writer, "mode");
+    codec_write_string(&writer, "cool \"quoted\"");
+    codec_write_key(&writer, "none");
+    codec_write_null(&writer);
+    codec_write_key(&writer, "ids");
+    codec_write_map_begin(&writer);
+    codec_write_key(&writer, "power");
+    codec_write_number(&writer, 0);
+    codec_write_map_end(&writer);
+    codec_write_map_end(&writer);
+    return codec_writer_finish(&writer);
+}
+
+static void check_round_trip(codec_type_t type) {
+    uint8_t buf[256];
+    members_t members = { .count = 0 };
+
+    size_t len = encode(type, buf, sizeof(buf));
+    CHECK(len > 0 && len < sizeof(buf));
+    CHECK(encode(type, NULL, 0) == len);
+    CHECK(codec_decode_map(type, buf, len, collect, &members));
+    CHECK(members.count == 6);
+    if (members.count != 6)
+        return;
+
+    CHECK(strcmp(members.keys[0], "power") == 0);
+    CHECK(members.values[0].type == CODEC_VALUE_BOOL && members.values[0].bool_val);
+    CHECK(members.values[1].type == CODEC_VALUE_NUMBER && members.values[1].num_val == -22.5);
+    CHECK(members.values[2].type == CODEC_VALUE_NUMBER && members.values[2].num_val == 70000);
+    CHECK(members.values[3].type == CODEC_VALUE_STRING && members.values[3].str_len == 13
+                && memcmp(members.values[3].str, "cool \"quoted\"", 13) == 0);
+    CHECK(members.values[4].type == CODEC_VALUE_NULL);
+
+    /* The nested map comes back encoded and decodes on its own */
+    const codec_value_t* ids = &members.values[5];
+    members_t nested = { .count = 0 };
+    CHECK(ids->type == CODEC_VALUE_OTHER && ids->str != NULL);
+    CHECK(codec_decode_map(type, ids->str, ids->str_len, collect, &nested));
+    CHECK(nested.count == 1 && strcmp(nested.keys[0], "power") == 0 && nested.values[0].num_val == 0);
+}
+
+static void test_json_round_trip(void) {
+    check_round_trip(CODEC_JSON);
+}
+
+static void test_cbor_round_trip(void) {
+    check_round_trip(CODEC_CBOR);
+}
+
+static void test_cbor_smaller(void) {
+    uint8_t buf[256];
+    CHECK(encode(CODEC_CBOR, buf, sizeof(buf)) < encode(CODEC_JSON, buf, sizeof(buf)));
+}
+
+/* No member of a truncated payload is handed out, whatever the cut */
+static void check_truncated(codec_type_t type) {
+    uint8_t buf[256];
+    size_t len = encode(type, buf, sizeof(buf));
+
+    for (size_t cut = 0; cut < len; cut++) {
+        members_t members = { .count = 0 };
+        CHECK(!codec_decode_map(type, buf, cut, collect, &members));
+        CHECK(members.count == 0);
+    }
+}
+
+static void test_json_truncated(void) {
+    check_truncated(CODEC_JSON);
+}
+
+static void test_cbor_truncated(void) {
+    check_truncated(CODEC_CBOR);
+}
+
+static void test_not_a_map(void) {
+    static const uint8_t cbor_array[] = { 0x82, 0x01, 0x02 };
+    static const uint8_t cbor_int_key[] = { 0xA1, 0x01, 0x02 };
+    members_t members = { .count = 0 };
+
+    CHECK(!codec_decode_map(CODEC_JSON, "[1,2]", 5, collect, &members));
+    CHECK(!codec_decode_map(CODEC_CBOR, cbor_array, sizeof(cbor_array), collect, &members));
+    CHECK(!codec_decode_map(CODEC_CBOR, cbor_int_key, sizeof(cbor_int_key), collect, &members));
+    CHECK(members.count == 0);
+}
+
+int main(void) {
+    RUN_TEST(test_json_round_trip);
+    RUN_TEST(test_cbor_round_trip);
+    RUN_TEST(test_cbor_smaller);
+    RUN_TEST(test_json_truncated);
+    RUN_TEST(test_cbor_truncated);
+    RUN_TEST(test_not_a_map);
+    return HOST_TEST_RESULT();
+}
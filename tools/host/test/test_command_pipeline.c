@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command_pipeline.h"
+#include "device.h"
+#include "host_test.h"
+
+/* Commands through the queue and worker task, on the pthread FreeRTOS shim */
+
+#define SUBMIT_THREADS                  2
+#define SUBMITS_PER_THREAD              2000
+
+static command_pipeline_stats_t stats(void) {
+    command_pipeline_stats_t s;
+    command_pipeline_get_stats(&s);
+    return s;
+}
+
+/* Wait until count more commands were applied or rejected since before */
+static bool wait_done(const command_pipeline_stats_t* before, uint32_t count) {
+    for (int i = 0; i < 2000; i++) {
+        command_pipeline_stats_t s = stats();
+        if (s.applied + s.rejected - before->applied - before->rejected >= count)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+/* Channel values as the reporting side reads them */
+static device_value_t g_values[4];
+static char g_strs[64];
+
+static const device_value_t* value(const char* name) {
+    device_snapshot(g_values, 4, g_strs, sizeof(g_strs));
+    return &g_values[device_get_channel_id(name)];
+}
+
+static void test_apply(void) {
+    static const char payload[] = "{\"power\":true,\"temp\":22.5,\"mode\":\"cool\"}";
+    command_pipeline_stats_t before = stats();
+
+    CHECK(command_pipeline_submit(payload, sizeof(payload) - 1) == 3);
+    CHECK(wait_done(&before, 3));
+
+    command_pipeline_stats_t after = stats();
+    CHECK(after.enqueued - before.enqueued == 3);
+    CHECK(after.applied - before.applied == 3);
+    CHECK(after.batches > before.batches);
+    CHECK(value("power")->value.bool_val);
+    CHECK(value("temp")->value.num_val == 22.5f);
+    CHECK(strcmp(value("mode")->value.str_val, "cool") == 0);
+}
+
+static void test_reject(void) {
+    static const char not_commands[] = "{\"status\":\"x\",\"nope\":1,\"temp\":\"hot\"}";
+    static const char out_of_range[] = "{\"temp\":99}";
+    static const char truncated[] = "{\"power\":";
+    command_pipeline_stats_t before = stats();
+
+    CHECK(command_pipeline_submit(not_commands, sizeof(not_commands) - 1) == 0);
+    CHECK(command_pipeline_submit(truncated, sizeof(truncated) - 1) == 0);
+
+    /* Queued, then refused by the device when applied */
+    CHECK(command_pipeline_submit(out_of_range, sizeof(out_of_range) - 1) == 1);
+    CHECK(wait_done(&before, 5));
+
+    command_pipeline_stats_t after = stats();
+    CHECK(after.rejected - before.rejected == 5);
+    CHECK(after.applied == before.applied);
+    CHECK(value("temp")->value.num_val == 22.5f);
+}
+
+static void test_drop_when_full(void) {
+    static const char payload[] = "{\"power\":false,\"power\":true,\"power\":false,\"power\":true,"
+                "\"power\":false,\"power\":true,\"power\":false,\"power\":true,\"power\":false,\"power\":true}";
+    command_pipeline_stats_t before = stats();
+
+    /* The worker blocks on the writer lock with at most one batch taken */
+    device_lock();
+    int queued = 0;
+    for (int i = 0; i < 5; i++)
+        queued += command_pipeline_submit(payload, sizeof(payload) - 1);
+    device_unlock();
+    CHECK(wait_done(&before, queued));
+
+    command_pipeline_stats_t after = stats();
+    CHECK(queued <= COMMAND_QUEUE_LENGTH + COMMAND_BATCH_SIZE);
+    CHECK(after.dropped - before.dropped == 50 - (uint32_t) queued);
+    CHECK(after.depth_max == COMMAND_QUEUE_LENGTH);
+    CHECK(after.applied - before.applied == (uint32_t) queued);
+}
+
+static void* submit_thread(void* arg) {
+    static const char payload[] = "{\"power\":true}";
+    for (int i = 0; i < SUBMITS_PER_THREAD; i++)
+        command_pipeline_submit(payload, sizeof(payload) - 1);
+    return NULL;
+}
+
+/* Counters updated from the submitting tasks and the worker add up */
+static void test_concurrent_stats(void) {
+    pthread_t threads[SUBMIT_THREADS];
+    command_pipeline_stats_t before = stats();
+
+    for (int i = 0; i < SUBMIT_THREADS; i++)
+        pthread_create(&threads[i], NULL, submit_thread, NULL);
+    for (int i = 0; i < SUBMIT_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    command_pipeline_stats_t after = stats();
+    CHECK(wait_done(&before, after.enqueued - before.enqueued));
+    after = stats();
+    uint32_t total = SUBMIT_THREADS * SUBMITS_PER_THREAD;
+    CHECK(after.enqueued - before.enqueued + after.dropped - before.dropped == total);
+    CHECK(after.applied - before.applied == after.enqueued - before.enqueued);
+}
+
+int main(void) {
+    device_init("pipeline");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+    device_add_string_channel("status", false, NULL, NULL);
+    device_seal();
+
+    if (!command_pipeline_start())
+        return 1;
+
+    RUN_TEST(test_apply);
+    RUN_TEST(test_reject);
+    RUN_TEST(test_drop_when_full);
+    RUN_TEST(test_concurrent_stats);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,215 @@
+#include <string.h>
+
+#include "conn_manager.h"
+#include "host_test.h"
+#include "metrics.h"
+
+/* The connection state machine against a simulated link: the ops record what
+ * the manager asked for and the test plays the Wi-Fi and MQTT events back. */
+
+typedef struct {
+    int64_t now_us;
+    uint32_t random;
+    uint32_t timer_ms;              /* last timer set, 0 when none */
+    int wifi_connects;
+    int fast_connects;
+    int mqtt_connects;
+    int mqtt_stops;
+} sim_link_t;
+
+static sim_link_t g_link;
+
+static void sim_wifi_connect(void* ctx, bool fast) {
+    sim_link_t* link = ctx;
+    link->wifi_connects++;
+    link->fast_connects += fast;
+}
+
+static void sim_mqtt_connect(void* ctx) {
+    ((sim_link_t*) ctx)->mqtt_connects++;
+}
+
+static void sim_mqtt_stop(void* ctx) {
+    ((sim_link_t*) ctx)->mqtt_stops++;
+}
+
+static void sim_set_timer(void* ctx, uint32_t ms) {
+    ((sim_link_t*) ctx)->timer_ms = ms;
+}
+
+static uint32_t sim_random(void* ctx) {
+    return ((sim_link_t*) ctx)->random;
+}
+
+static int64_t sim_now_us(void* ctx) {
+    return ((sim_link_t*) ctx)->now_us;
+}
+
+static const conn_ops_t g_ops = {
+    .wifi_connect = sim_wifi_connect,
+    .mqtt_connect = sim_mqtt_connect,
+    .mqtt_stop = sim_mqtt_stop,
+    .set_timer = sim_set_timer,
+    .random = sim_random,
+    .now_us = sim_now_us,
+    .ctx = &g_link,
+};
+
+/* Fresh link and state machine, time starts at 1 s so 0 stays "not down" */
+static void sim_init(conn_t* conn, bool ap_known) {
+    memset(&g_link, 0, sizeof(g_link));
+    g_link.now_us = 1000000;
+    conn_init(conn, &g_ops, ap_known);
+}
+
+/* Wi-Fi associates and gets an address, MQTT connects, each after delay_us */
+static void sim_connect(conn_t* conn, int64_t delay_us) {
+    g_link.now_us += delay_us;
+    conn_handle(conn, CONN_EVENT_WIFI_CONNECTED);
+    conn_handle(conn, CONN_EVENT_GOT_IP);
+    g_link.now_us += delay_us;
+    conn_handle(conn, CONN_EVENT_MQTT_CONNECTED);
+}
+
+static void test_boot(void) {
+    conn_t conn;
+    sim_init(&conn, false);
+
+    conn_handle(&conn, CONN_EVENT_START);
+    CHECK(conn.state == CONN_STATE_WIFI_CONNECTING);
+    CHECK(g_link.wifi_connects == 1 && g_link.fast_connects == 0);
+
+    sim_connect(&conn, 1000);
+    CHECK(conn.state == CONN_STATE_CONNECTED);
+    CHECK(g_link.mqtt_connects == 1);
+    CHECK(conn.ap_known);
+
+    /* A second start while running does nothing */
+    conn_handle(&conn, CONN_EVENT_START);
+    CHECK(g_link.wifi_connects == 1);
+}
+
+static void test_backoff(void) {
+    conn_t conn;
+    sim_init(&conn, false);
+
+    /* Doubles from the base up to the cap, jitter only over the upper half */
+    CHECK(conn_backoff_ms(&conn, 0) == CONN_BACKOFF_BASE_MS / 2);
+    CHECK(conn_backoff_ms(&conn, 1) == CONN_BACKOFF_BASE_MS);
+    CHECK(conn_backoff_ms(&conn, 20) == CONN_BACKOFF_MAX_MS / 2);
+
+    g_link.random = CONN_BACKOFF_BASE_MS / 2;
+    CHECK(conn_backoff_ms(&conn, 0) == CONN_BACKOFF_BASE_MS);
+    g_link.random = UINT32_MAX;
+    for (uint16_t attempt = 0; attempt < 40; attempt++) {
+        uint32_t delay = conn_backoff_ms(&conn, attempt);
+        CHECK(delay >= CONN_BACKOFF_BASE_MS / 2 && delay <= CONN_BACKOFF_MAX_MS);
+    }
+}
+
+static void test_wifi_loss(void) {
+    conn_t conn;
+    sim_init(&conn, true);
+
+    conn_handle(&conn, CONN_EVENT_START);
+    CHECK(g_link.fast_connects == 1);
+    sim_connect(&conn, 1000);
+
+    /* Loss while connected stops MQTT and retries the known access point first */
+    conn_handle(&conn, CONN_EVENT_WIFI_DISCONNECTED);
+    CHECK(conn.state == CONN_STATE_WIFI_BACKOFF);
+    CHECK(g_link.mqtt_stops == 1);
+    CHECK(conn.stats.wifi_losses == 1);
+    CHECK(g_link.timer_ms == conn_backoff_ms(&conn, 0));
+
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    CHECK(conn.state == CONN_STATE_WIFI_CONNECTING);
+    CHECK(g_link.fast_connects == 2);
+
+    /* The fast attempt failed, the next one scans after a longer delay */
+    conn_handle(&conn, CONN_EVENT_WIFI_DISCONNECTED);
+    CHECK(conn.stats.fast_failures == 1);
+    CHECK(conn.stats.wifi_losses == 1);
+    CHECK(g_link.timer_ms == conn_backoff_ms(&conn, 1));
+
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    CHECK(g_link.wifi_connects == 3 && g_link.fast_connects == 2);
+
+    /* MQTT disconnect events while Wi-Fi is down are expected and ignored */
+    conn_handle(&conn, CONN_EVENT_MQTT_DISCONNECTED);
+    CHECK(conn.state == CONN_STATE_WIFI_CONNECTING);
+
+    sim_connect(&conn, 1000);
+    CHECK(conn.state == CONN_STATE_CONNECTED);
+    CHECK(conn.attempts == 0);
+}
+
+static void test_mqtt_loss(void) {
+    conn_t conn;
+    sim_init(&conn, true);
+
+    conn_handle(&conn, CONN_EVENT_START);
+    sim_connect(&conn, 1000);
+
+    conn_handle(&conn, CONN_EVENT_MQTT_DISCONNECTED);
+    CHECK(conn.state == CONN_STATE_MQTT_BACKOFF);
+    CHECK(conn.stats.mqtt_losses == 1);
+    CHECK(g_link.mqtt_stops == 0);
+
+    /* Failed attempts back off further, Wi-Fi is left alone */
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    CHECK(conn.state == CONN_STATE_MQTT_CONNECTING);
+    conn_handle(&conn, CONN_EVENT_MQTT_DISCONNECTED);
+    CHECK(conn.stats.mqtt_losses == 1);
+    CHECK(g_link.timer_ms == conn_backoff_ms(&conn, 1));
+
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    conn_handle(&conn, CONN_EVENT_MQTT_CONNECTED);
+    CHECK(conn.state == CONN_STATE_CONNECTED);
+    CHECK(g_link.wifi_connects == 1);
+    CHECK(g_link.mqtt_connects == 3);
+}
+
+static void test_reconnect_time(void) {
+    conn_t conn;
+    sim_init(&conn, true);
+
+    metric_t* wifi = metrics_histogram("wifi_reconnect");
+    metric_t* mqtt = metrics_histogram("mqtt_reconnect");
+    uint32_t wifi_count = wifi->count;
+    uint32_t mqtt_count = mqtt->count;
+
+    conn_handle(&conn, CONN_EVENT_START);
+    sim_connect(&conn, 250000);
+    CHECK(wifi->count == wifi_count + 1);
+    CHECK(mqtt->count == mqtt_count + 1);
+
+    /* Recorded in microseconds: 2.5 s to an address, 3 s until MQTT is back */
+    conn_handle(&conn, CONN_EVENT_WIFI_DISCONNECTED);
+    g_link.now_us += 2000000;
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    sim_connect(&conn, 500000);
+
+    CHECK(wifi->count == wifi_count + 2);
+    CHECK(wifi->max_us == 2500000);
+    CHECK(mqtt->max_us == 3000000);
+    CHECK(mqtt->buckets[METRICS_HISTOGRAM_BUCKETS - 1] >= 1);
+
+    /* An MQTT-only loss leaves the Wi-Fi histogram alone */
+    conn_handle(&conn, CONN_EVENT_MQTT_DISCONNECTED);
+    g_link.now_us += 4000000;
+    conn_handle(&conn, CONN_EVENT_TIMER);
+    conn_handle(&conn, CONN_EVENT_MQTT_CONNECTED);
+    CHECK(wifi->count == wifi_count + 2);
+    CHECK(mqtt->count == mqtt_count + 3);
+    CHECK(mqtt->max_us == 4000000);
+}
+
+int main(void) {
+    RUN_TEST(test_boot);
+    RUN_TEST(test_backoff);
+    RUN_TEST(test_wifi_loss);
+    RUN_TEST(test_mqtt_loss);
+    RUN_TEST(test_reconnect_time);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "host_port.h"
+#include "host_test.h"
+
+/* Change tracking of the board's device: only changed channels are reported,
+ * in ID order, and number channels only past their deadband. Batch updates:
+ * validation and status per item, string storage reused in place. */
+
+enum { POWER, TEMP, MODE, LEVEL, STATUS, CHANNEL_COUNT };
+
+typedef struct {
+    uint16_t ids[CHANNEL_COUNT];
+    device_value_t values[CHANNEL_COUNT];
+    char strs[CHANNEL_COUNT][16];       /* string values only last the callback */
+    int count;
+    int stop_after;
+} report_t;
+
+static bool collect(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    report_t* report = ctx;
+    if (report->count == report->stop_after)
+        return false;
+
+    report->ids[report->count] = channel->id;
+    report->values[report->count] = *value;
+    if (value->type == DEVICE_VALUE_STRING && value->value.str_val != NULL) {
+        strncpy(report->strs[report->count], value->value.str_val, sizeof(report->strs[0]) - 1);
+        report->values[report->count].value.str_val = report->strs[report->count];
+    }
+    report->count++;
+    return true;
+}
+
+static report_t report(void) {
+    report_t r = { .count = 0, .stop_after = -1 };
+    device_report_changes(collect, &r);
+    return r;
+}
+
+static void set_bool(uint16_t id, bool val) {
+    device_set_channel_value_by_id(id, &val);
+}
+
+static void set_number(uint16_t id, float val) {
+    device_set_channel_value_by_id(id, &val);
+}
+
+static void set_string(uint16_t id, const char* val) {
+    device_set_channel_value_by_id(id, &val);
+}
+
+static void build_device(void) {
+    device_init("changes");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+    device_add_nummber_channel("level", true, NULL, NULL, 0, 100, 0);
+    device_add_string_channel("status", false, NULL, NULL);
+    device_seal();
+}
+
+static void test_only_changed_reported(void) {
+    build_device();
+    CHECK(report().count == 0);
+
+    set_string(STATUS, "ok");
+    set_bool(POWER, true);
+    set_string(MODE, "dry");
+
+    report_t r = report();
+    CHECK(r.count == 3);
+    CHECK(r.ids[0] == POWER && r.ids[1] == MODE && r.ids[2] == STATUS);
+    CHECK(r.values[0].type == DEVICE_VALUE_BOOL && r.values[0].value.bool_val);
+    CHECK(r.values[1].type == DEVICE_VALUE_STRING && strcmp(r.values[1].value.str_val, "dry") == 0);
+
+    /* Cleared by the report */
+    CHECK(report().count == 0);
+}
+
+static void test_same_value_suppressed(void) {
+    device_change_stats_t before, after;
+    device_get_change_stats(&before);
+
+    set_bool(POWER, true);
+    set_string(MODE, "dry");
+    CHECK(report().count == 0);
+
+    /* Two changes before a report make one */
+    set_bool(POWER, false);
+    set_bool(POWER, true);
+    set_bool(POWER, false);
+    CHECK(report().count == 1);
+
+    device_get_change_stats(&after);
+    CHECK(after.suppressed - before.suppressed == 2);
+    CHECK(after.changes - before.changes == 1);
+    CHECK(after.coalesced - before.coalesced == 2);
+}
+
+static void test_deadband(void) {
+    set_number(TEMP, 20);
+    CHECK(report().count == 1);
+
+    /* Defaults to multipleof */
+    set_number(TEMP, 20.5f);
+    report_t r = report();
+    CHECK(r.count == 1 && r.values[0].value.num_val == 20.5f);
+
+    device_set_channel_deadband(LEVEL, 5);
+    set_number(LEVEL, 50);
+    CHECK(report().count == 1);
+
+    /* Measured from the last value reported, not the last one set */
+    set_number(LEVEL, 53);
+    CHECK(report().count == 0);
+    set_number(LEVEL, 54.5f);
+    CHECK(report().count == 0);
+    set_number(LEVEL, 55);
+    r = report();
+    CHECK(r.count == 1 && r.values[0].value.num_val == 55);
+}
+
+static void test_stop_keeps_rest(void) {
+    set_bool(POWER, true);
+    set_number(TEMP, 25);
+    set_string(STATUS, "busy");
+
+    report_t r = { .count = 0, .stop_after = 1 };
+    CHECK(device_report_changes(collect, &r) == 1);
+    CHECK(r.ids[0] == POWER);
+
+    /* The channel stopped at and those after it are still changed */
+    r = report();
+    CHECK(r.count == 2 && r.ids[0] == TEMP && r.ids[1] == STATUS);
+}
+
+static void test_mark_changed(void) {
+    device_mark_channel_changed(MODE);
+    device_mark_channel_changed(CHANNEL_COUNT);
+
+    report_t r = report();
+    CHECK(r.count == 1 && r.ids[0] == MODE);
+}
+
+static void test_batch_status(void) {
+    device_update_t updates[] = {
+        { .channel_id = POWER, .type = DEVICE_VALUE_BOOL, .value.bool_val = false },
+        { .channel_id = TEMP, .type = DEVICE_VALUE_NUMBER, .value.num_val = 31 },
+        { .channel_id = TEMP, .type = DEVICE_VALUE_NUMBER, .value.num_val = 20.25f },
+        { .channel_id = TEMP, .type = DEVICE_VALUE_BOOL, .value.bool_val = true },
+        { .channel_id = MODE, .type = DEVICE_VALUE_STRING, .value.str_val = "heat" },
+        { .channel_id = MODE, .type = DEVICE_VALUE_STRING, .value.str_val = "cool" },
+        { .channel_id = CHANNEL_COUNT, .type = DEVICE_VALUE_BOOL, .value.bool_val = true },
+        { .channel_id = TEMP, .type = DEVICE_VALUE_NUMBER, .value.num_val = 29.5f },
+    };
+
+    report();
+    CHECK(device_update_channels(updates, 8) == 3);
+    CHECK(updates[0].status == DEVICE_UPDATE_OK);
+    CHECK(updates[1].status == DEVICE_UPDATE_OUT_OF_RANGE);
+    CHECK(updates[2].status == DEVICE_UPDATE_NOT_MULTIPLE);
+    CHECK(updates[3].status == DEVICE_UPDATE_TYPE_MISMATCH);
+    CHECK(updates[4].status == DEVICE_UPDATE_INVALID_OPTION);
+    CHECK(updates[5].status == DEVICE_UPDATE_OK);
+    CHECK(updates[6].status == DEVICE_UPDATE_UNKNOWN_CHANNEL);
+    CHECK(updates[7].status == DEVICE_UPDATE_OK);
+
+    /* The invalid ones did not stop the others */
+    report_t r = report();
+    CHECK(r.count == 3);
+    CHECK(r.values[0].value.bool_val == false);
+    CHECK(r.values[1].value.num_val == 29.5f);
+    CHECK(strcmp(r.values[2].value.str_val, "cool") == 0);
+}
+
+static void test_string_reused_in_place(void) {
+    host_alloc_stats_t before, after;
+
+    set_string(STATUS, "a fairly long status line");
+
+    host_alloc_get_stats(&before);
+    set_string(STATUS, "short");
+    set_string(STATUS, "a fairly long status line");
+    set_string(STATUS, "a fairly long status line");
+    host_alloc_get_stats(&after);
+    CHECK(after.allocs == before.allocs && after.reallocs == before.reallocs);
+
+    /* Only a longer value takes a new buffer, the old one is retired */
+    set_string(STATUS, "a status line longer than any before it");
+    host_alloc_get_stats(&after);
+    CHECK(after.allocs > before.allocs);
+    CHECK(after.frees == before.frees);
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    RUN_TEST(test_only_changed_reported);
+    RUN_TEST(test_same_value_suppressed);
+    RUN_TEST(test_deadband);
+    RUN_TEST(test_stop_keeps_rest);
+    RUN_TEST(test_mark_changed);
+    RUN_TEST(test_batch_status);
+    RUN_TEST(test_string_reused_in_place);
+    return HOST_TEST_RESULT();
+}
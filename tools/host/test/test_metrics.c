@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "codec.h"
+#include "device.h"
+#include "host_test.h"
+#include "metrics.h"
+
+/* Registry, histogram buckets, the compact message and updates from several threads.
+ * The registry cannot be cleared, so tests run in order and the full one comes last. */
+
+#define INC_THREADS                     4
+#define INCS_PER_THREAD                 100000
+
+static metric_t* g_shared;
+
+static void test_register_once(void) {
+    metric_t* counter = metrics_counter("test_counter");
+    CHECK(counter != NULL && counter->type == METRIC_COUNTER);
+    CHECK(metrics_counter("test_counter") == counter);
+
+    metrics_inc(counter);
+    metrics_add(counter, 4);
+    CHECK(counter->value == 5);
+
+    metric_t* gauge = metrics_gauge("test_gauge");
+    metrics_set(gauge, 7);
+    metrics_set(gauge, 3);
+    CHECK(gauge->value == 3);
+}
+
+static void test_histogram_buckets(void) {
+    metric_t* hist = metrics_histogram("test_us");
+
+    /* Bounds are inclusive, past the last one goes in the last bucket */
+    metrics_observe_us(hist, 0);
+    metrics_observe_us(hist, 100);
+    metrics_observe_us(hist, 101);
+    metrics_observe_us(hist, 100000);
+    metrics_observe_us(hist, 5000000);
+
+    CHECK(hist->count == 5);
+    CHECK(hist->sum_us == 5100201);
+    CHECK(hist->max_us == 5000000);
+    CHECK(hist->buckets[0] == 2 && hist->buckets[1] == 1);
+    CHECK(hist->buckets[METRICS_HISTOGRAM_BUCKETS - 2] == 1);
+    CHECK(hist->buckets[METRICS_HISTOGRAM_BUCKETS - 1] == 1);
+}
+
+static void test_write(void) {
+    char buf[METRICS_MAX_PAYLOAD];
+    codec_writer_t writer;
+
+    codec_writer_init(&writer, CODEC_JSON, buf, sizeof(buf));
+    metrics_write(&writer);
+    CHECK(codec_writer_finish(&writer) < sizeof(buf));
+
+    CHECK(strstr(buf, "\"test_counter\":5,\"test_gauge\":3,") != NULL);
+    CHECK(strstr(buf, "\"test_us\":[5,5100201,5000000,2,1,0,0,0,0,1,1]") != NULL);
+}
+
+/* The device model registers its own and feeds them */
+static void test_device_instrumented(void) {
+    device_init("metrics");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_seal();
+
+    metric_t* set_us = metrics_histogram("device_set_us");
+    metric_t* parse_us = metrics_histogram("prov_parse_us");
+    uint32_t sets = set_us->count, parses = parse_us->count;
+
+    bool on = true;
+    device_set_channel_value("power", &on);
+    device_check_prov_resp("{\"status\":1}", 12);
+
+    CHECK(set_us->count == sets + 1);
+    CHECK(parse_us->count == parses + 1);
+}
+
+static void* inc_thread(void* arg) {
+    for (int i = 0; i < INCS_PER_THREAD; i++) {
+        metrics_inc(g_shared);
+        metrics_observe_us((metric_t*) arg, i % 200);
+    }
+    return NULL;
+}
+
+static void test_concurrent_updates(void) {
+    pthread_t threads[INC_THREADS];
+    metric_t* hist = metrics_histogram("test_concurrent_us");
+    g_shared = metrics_counter("test_concurrent");
+
+    for (int i = 0; i < INC_THREADS; i++)
+        pthread_create(&threads[i], NULL, inc_thread, hist);
+    for (int i = 0; i < INC_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    CHECK(g_shared->value == INC_THREADS * INCS_PER_THREAD);
+    CHECK(hist->count == INC_THREADS * INCS_PER_THREAD);
+    CHECK(hist->max_us == 199);
+    CHECK(hist->buckets[0] + hist->buckets[1] == hist->count);
+}
+
+static void test_registry_full(void) {
+    static char names[METRICS_MAX][16];
+    metric_t* last = NULL;
+
+    for (int i = 0; i < METRICS_MAX; i++) {
+        snprintf(names[i], sizeof(names[i]), "fill_%d", i);
+        last = metrics_counter(names[i]);
+    }
+    CHECK(last == NULL);
+
+    /* Updates of a metric that could not be registered do nothing */
+    metrics_inc(last);
+    metrics_set(last, 1);
+    metrics_observe_us(last, 1);
+}
+
+int main(void) {
+    RUN_TEST(test_register_once);
+    RUN_TEST(test_histogram_buckets);
+    RUN_TEST(test_write);
+    RUN_TEST(test_device_instrumented);
+    RUN_TEST(test_concurrent_updates);
+    RUN_TEST(test_registry_full);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "host_test.h"
+#include "mqtt_rx.h"
+
+/* MQTT_EVENT_DATA reassembly: whole messages pass through, fragments that follow
+ * each other are joined, and anything out of sequence or too large is dropped
+ * without touching memory past the message. */
+
+#define RX_MAX_SIZE                     64
+
+static const char g_topic[] = "down/command/dev";
+#define TOPIC_LEN                       ((int) sizeof(g_topic) - 1)
+
+static struct {
+    int calls;
+    char topic[RX_MAX_SIZE];
+    size_t topic_len;
+    char data[RX_MAX_SIZE];
+    size_t data_len;
+} g_got;
+
+static void handler(const char* topic, size_t topic_len, const char* data, size_t data_len, void* ctx) {
+    g_got.calls++;
+    memcpy(g_got.topic, topic, topic_len);
+    g_got.topic_len = topic_len;
+    memcpy(g_got.data, data, data_len);
+    g_got.data_len = data_len;
+}
+
+static void reset(mqtt_rx_t* rx) {
+    memset(&g_got, 0, sizeof(g_got));
+    mqtt_rx_init(rx, RX_MAX_SIZE, handler, NULL);
+}
+
+/* One event of msg, as the client reports it: the topic only with the first fragment */
+static void feed(mqtt_rx_t* rx, const char* msg, int offset, int len) {
+    int total = strlen(msg);
+    mqtt_rx_feed(rx, (offset == 0) ? g_topic : NULL, (offset == 0) ? TOPIC_LEN : 0,
+                msg + offset, len, offset, total);
+}
+
+static bool got(const char* msg) {
+    return g_got.calls == 1 && g_got.topic_len == TOPIC_LEN && memcmp(g_got.topic, g_topic, TOPIC_LEN) == 0 &&
+                g_got.data_len == strlen(msg) && memcmp(g_got.data, msg, g_got.data_len) == 0;
+}
+
+static void test_whole_message(void) {
+    mqtt_rx_t rx;
+    reset(&rx);
+
+    /* Handed over without a copy, no buffer is allocated */
+    feed(&rx, "{\"power\":true}", 0, 14);
+    CHECK(got("{\"power\":true}"));
+    CHECK(rx.buf == NULL && rx.stats.whole == 1);
+    mqtt_rx_deinit(&rx);
+}
+
+static void test_fragments(void) {
+    static const char msg[] = "{\"power\":true,\"temp\":22.5,\"mode\":\"cool\"}";
+    mqtt_rx_t rx;
+
+    /* Every split into three fragments */
+    for (int a = 1; a < (int) sizeof(msg) - 2; a++) {
+        for (int b = a + 1; b < (int) sizeof(msg) - 1; b++) {
+            reset(&rx);
+            feed(&rx, msg, 0, a);
+            feed(&rx, msg, a, b - a);
+            CHECK(g_got.calls == 0);
+            feed(&rx, msg, b, sizeof(msg) - 1 - b);
+            CHECK(got(msg));
+            CHECK(rx.stats.reassembled == 1 && !rx.active);
+            mqtt_rx_deinit(&rx);
+        }
+    }
+
+    /* The buffer is kept for the next message */
+    reset(&rx);
+    feed(&rx, msg, 0, 10);
+    feed(&rx, msg, 10, sizeof(msg) - 11);
+    char* buf = rx.buf;
+    g_got.calls = 0;
+    feed(&rx, "{\"power\":false}", 0, 5);
+    feed(&rx, "{\"power\":false}", 5, 10);
+    CHECK(got("{\"power\":false}") && rx.buf == buf);
+    mqtt_rx_deinit(&rx);
+}
+
+static void test_out_of_sequence(void) {
+    static const char msg[] = "0123456789abcdefghij";
+    mqtt_rx_t rx;
+
+    /* Skipping a fragment drops the message, the rest of it is ignored */
+    reset(&rx);
+    feed(&rx, msg, 0, 5);
+    feed(&rx, msg, 10, 10);
+    feed(&rx, msg, 5, 5);
+    CHECK(g_got.calls == 0 && rx.stats.broken == 1);
+
+    /* So does a fragment seen twice */
+    mqtt_rx_deinit(&rx);
+    reset(&rx);
+    feed(&rx, msg, 0, 5);
+    feed(&rx, msg, 5, 5);
+    feed(&rx, msg, 5, 5);
+    feed(&rx, msg, 10, 10);
+    CHECK(g_got.calls == 0 && rx.stats.broken == 1);
+
+    /* A fragment reaching past the message, or of another length */
+    mqtt_rx_deinit(&rx);
+    reset(&rx);
+    feed(&rx, msg, 0, 5);
+    mqtt_rx_feed(&rx, NULL, 0, msg + 5, 20, 5, 20);
+    CHECK(g_got.calls == 0 && !rx.active);
+    feed(&rx, msg, 0, 5);
+    mqtt_rx_feed(&rx, NULL, 0, msg + 5, 15, 5, 25);
+    CHECK(g_got.calls == 0 && rx.stats.broken == 2);
+
+    /* Fragments without a first one */
+    mqtt_rx_deinit(&rx);
+    reset(&rx);
+    feed(&rx, msg, 5, 5);
+    feed(&rx, msg, 10, 10);
+    CHECK(g_got.calls == 0 && rx.buf == NULL);
+
+    /* A new first fragment restarts, the message after a dropped one arrives */
+    feed(&rx, msg, 0, 5);
+    feed(&rx, msg, 0, 5);
+    feed(&rx, msg, 5, 15);
+    CHECK(got(msg));
+    mqtt_rx_deinit(&rx);
+}
+
+static void test_oversize(void) {
+    char msg[RX_MAX_SIZE + 16];
+    mqtt_rx_t rx;
+
+    memset(msg, 'x', sizeof(msg) - 1);
+    msg[sizeof(msg) - 1] = '\0';
+
+    /* Over the limit with the topic: no buffer, none of it delivered */
+    reset(&rx);
+    feed(&rx, msg, 0, 32);
+    feed(&rx, msg, 32, 32);
+    feed(&rx, msg, 64, sizeof(msg) - 1 - 64);
+    CHECK(g_got.calls == 0 && rx.buf == NULL && rx.stats.oversize == 1);
+
+    /* Just fitting is reassembled */
+    msg[RX_MAX_SIZE - TOPIC_LEN] = '\0';
+    feed(&rx, msg, 0, 20);
+    feed(&rx, msg, 20, RX_MAX_SIZE - TOPIC_LEN - 20);
+    CHECK(got(msg) && rx.size == RX_MAX_SIZE);
+    mqtt_rx_deinit(&rx);
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    RUN_TEST(test_whole_message);
+    RUN_TEST(test_fragments);
+    RUN_TEST(test_out_of_sequence);
+    RUN_TEST(test_oversize);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "outbox.h"
+
+/* Outbox record log on a file-backed flash emulator. Like NOR flash, erased
+ * bytes read 0xFF and a write only clears bits; writes that would need to set
+ * one are counted as misuse. A write budget cuts the power mid-write. */
+
+typedef struct {
+    FILE* file;
+    long budget;                /* bytes written before the power goes, -1 for none */
+    uint32_t misuse;
+} flash_file_t;
+
+static bool flash_read(void* ctx, uint32_t addr, void* buf, size_t len) {
+    flash_file_t* flash = ctx;
+    return fseek(flash->file, addr, SEEK_SET) == 0 && fread(buf, 1, len, flash->file) == len;
+}
+
+static bool flash_write(void* ctx, uint32_t addr, const void* buf, size_t len) {
+    flash_file_t* flash = ctx;
+    uint8_t old[OUTBOX_SECTOR_SIZE];
+    const uint8_t* bytes = buf;
+
+    if (len > sizeof(old) || !flash_read(ctx, addr, old, len))
+        return false;
+
+    size_t written = len;
+    if (flash->budget >= 0 && (long) len > flash->budget)
+        written = flash->budget;
+
+    for (size_t i = 0; i < written; i++) {
+        if ((old[i] & bytes[i]) != bytes[i])
+            flash->misuse++;
+        old[i] &= bytes[i];
+    }
+
+    if (fseek(flash->file, addr, SEEK_SET) != 0 || fwrite(old, 1, written, flash->file) != written)
+        return false;
+    if (flash->budget >= 0)
+        flash->budget -= written;
+    return written == len;
+}
+
+static bool flash_erase_sector(void* ctx, uint32_t addr) {
+    flash_file_t* flash = ctx;
+    uint8_t erased[OUTBOX_SECTOR_SIZE];
+
+    if (flash->budget == 0)
+        return false;
+
+    memset(erased, 0xFF, sizeof(erased));
+    return fseek(flash->file, addr, SEEK_SET) == 0 && fwrite(erased, 1, sizeof(erased), flash->file) == sizeof(erased);
+}
+
+static flash_file_t g_file;
+static outbox_flash_t g_flash = {
+    .read = flash_read,
+    .write = flash_write,
+    .erase_sector = flash_erase_sector,
+    .ctx = &g_file,
+};
+
+/* A new erased flash area of sectors sectors */
+static void flash_reset(uint16_t sectors) {
+    if (g_file.file != NULL)
+        fclose(g_file.file);
+
+    g_file.file = tmpfile();
+    g_file.budget = -1;
+    g_file.misuse = 0;
+    g_flash.size = sectors * OUTBOX_SECTOR_SIZE;
+    for (uint16_t i = 0; i < sectors; i++)
+        flash_erase_sector(&g_file, i * OUTBOX_SECTOR_SIZE);
+}
+
+static bool append_numbered(outbox_t* box, int n, size_t len) {
+    char data[OUTBOX_RECORD_MAX];
+    memset(data, 'x', len);
+    int head = snprintf(data, sizeof(data), "%d;", n);
+    return outbox_append(box, "up/telemetry/test", data, (size_t) head > len ? (size_t) head : len);
+}
+
+/* Number at the start of the oldest unsent record, -1 if none */
+static int peek_numbered(outbox_t* box, outbox_entry_t* entry, char* buf) {
+    int n = -1;
+    if (outbox_peek(box, entry, buf))
+        sscanf(entry->data, "%d;", &n);
+    return n;
+}
+
+static void test_replay_in_order(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+
+    flash_reset(4);
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(!outbox_peek(&box, &entry, buf));
+
+    for (int i = 0; i < 5; i++)
+        CHECK(append_numbered(&box, i, 100));
+    CHECK(outbox_pending(&box) == 5);
+
+    for (int i = 0; i < 5; i++) {
+        CHECK(peek_numbered(&box, &entry, buf) == i);
+        CHECK(strcmp(entry.topic, "up/telemetry/test") == 0 && entry.len == 100);
+        outbox_pop(&box, &entry);
+    }
+    CHECK(outbox_pending(&box) == 0);
+    CHECK(!outbox_peek(&box, &entry, buf));
+    CHECK(box.stats.appended == 5 && box.stats.replayed == 5);
+    CHECK(g_file.misuse == 0);
+}
+
+static void test_remount_keeps_unsent(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+
+    flash_reset(4);
+    CHECK(outbox_mount(&box, &g_flash));
+    for (int i = 0; i < 12; i++)
+        CHECK(append_numbered(&box, i, 500));
+
+    for (int i = 0; i < 3; i++) {
+        CHECK(peek_numbered(&box, &entry, buf) == i);
+        outbox_pop(&box, &entry);
+    }
+
+    /* Reboot */
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(outbox_pending(&box) == 9);
+    CHECK(peek_numbered(&box, &entry, buf) == 3);
+
+    /* Appends go on after the recovered records */
+    CHECK(append_numbered(&box, 12, 500));
+    for (int i = 3; i <= 12; i++) {
+        CHECK(peek_numbered(&box, &entry, buf) == i);
+        outbox_pop(&box, &entry);
+    }
+    CHECK(g_file.misuse == 0);
+}
+
+static void test_full_drops_oldest(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+    const int count = 40;
+
+    flash_reset(3);
+    CHECK(outbox_mount(&box, &g_flash));
+    for (int i = 0; i < count; i++)
+        CHECK(append_numbered(&box, i, 1000));
+
+    CHECK(box.stats.dropped > 0);
+    CHECK(outbox_pending(&box) == count - box.stats.dropped);
+
+    /* What is left is the newest records, in order */
+    int first = peek_numbered(&box, &entry, buf);
+    CHECK(first == (int) box.stats.dropped);
+    for (int i = first; i < count; i++) {
+        CHECK(peek_numbered(&box, &entry, buf) == i);
+        outbox_pop(&box, &entry);
+    }
+    CHECK(g_file.misuse == 0);
+}
+
+static void test_power_cut_mid_record(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+
+    flash_reset(4);
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(append_numbered(&box, 0, 200));
+
+    /* Header and part of the payload make it */
+    g_file.budget = 100;
+    CHECK(!append_numbered(&box, 1, 200));
+    g_file.budget = -1;
+
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(append_numbered(&box, 2, 200));
+
+    CHECK(peek_numbered(&box, &entry, buf) == 0);
+    outbox_pop(&box, &entry);
+    CHECK(peek_numbered(&box, &entry, buf) == 2);
+    outbox_pop(&box, &entry);
+    CHECK(!outbox_peek(&box, &entry, buf));
+    CHECK(box.stats.corrupt == 1);
+    CHECK(g_file.misuse == 0);
+}
+
+static void test_reject_too_large(void) {
+    outbox_t box;
+    char data[OUTBOX_RECORD_MAX + 1] = { 0 };
+
+    flash_reset(2);
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(!outbox_append(&box, "t", data, OUTBOX_RECORD_MAX));
+    CHECK(outbox_append(&box, "t", data, OUTBOX_RECORD_MAX - 1));
+    CHECK(box.stats.rejected == 1 && outbox_pending(&box) == 1);
+}
+
+static void test_pop_after_overwrite_ignored(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+
+    flash_reset(2);
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(append_numbered(&box, 0, 1000));
+    CHECK(peek_numbered(&box, &entry, buf) == 0);
+
+    /* Two sectors of newer records push it out before it is popped */
+    for (int i = 1; i <= 8; i++)
+        CHECK(append_numbered(&box, i, 1000));
+
+    uint32_t pending = outbox_pending(&box);
+    outbox_pop(&box, &entry);
+    CHECK(outbox_pending(&box) == pending);
+    CHECK(peek_numbered(&box, &entry, buf) > 0);
+}
+
+static void test_seq_wraps(void) {
+    outbox_t box;
+    outbox_entry_t entry;
+    char buf[OUTBOX_RECORD_MAX + 1];
+
+    /* Sectors numbered across the wrap, the newest is the smallest number */
+    flash_reset(4);
+    CHECK(outbox_mount(&box, &g_flash));
+    box.seq = UINT32_MAX - 1;
+    for (int i = 0; i < 9; i++)
+        CHECK(append_numbered(&box, i, 1000));
+    CHECK(box.seq == 1);
+
+    CHECK(outbox_mount(&box, &g_flash));
+    CHECK(box.seq == 1 && box.stats.dropped == 0);
+    CHECK(append_numbered(&box, 9, 1000));
+    for (int i = 0; i <= 9; i++) {
+        CHECK(peek_numbered(&box, &entry, buf) == i);
+        outbox_pop(&box, &entry);
+    }
+    CHECK(!outbox_peek(&box, &entry, buf));
+    CHECK(g_file.misuse == 0);
+}
+
+int main(void) {
+    RUN_TEST(test_replay_in_order);
+    RUN_TEST(test_remount_keeps_unsent);
+    RUN_TEST(test_full_drops_oldest);
+    RUN_TEST(test_power_cut_mid_record);
+    RUN_TEST(test_reject_too_large);
+    RUN_TEST(test_pop_after_overwrite_ignored);
+    RUN_TEST(test_seq_wraps);
+
+    fclose(g_file.file);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "host_port.h"
+#include "host_test.h"
+
+/* Boot to operational with and without a schema fingerprint hit. On the device
+ * the miss also waits for the server, here that round trip is answered at once,
+ * so the times printed are the device side of the difference only. */
+
+#define BOOT_CHANNELS                   150
+
+static char g_names[BOOT_CHANNELS][16];
+static uint32_t g_publishes;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* device_specific_data_cfg and the MQTT provisioning step of app_main */
+static void boot(uint16_t channel_count) {
+    device_init("boot");
+    for (uint16_t i = 0; i < channel_count; i++)
+        device_add_nummber_channel(g_names[i], true, NULL, NULL, 0, 100, 1);
+    device_seal();
+
+    bool provisioned = false;
+    device_is_mqtt_provisioned(&provisioned);
+    if (provisioned)
+        return;
+
+    char* doc = device_get_mqtt_provision_json_data();
+    g_publishes++;
+    free(doc);
+
+    static const char resp[] = "{\"status\":1}";
+    if (device_check_prov_resp(resp, sizeof(resp) - 1))
+        device_set_provisioned();
+}
+
+static int64_t timed_boot(uint16_t channel_count) {
+    int64_t start = now_ns();
+    boot(channel_count);
+    return now_ns() - start;
+}
+
+static void test_first_boot_provisions(void) {
+    host_nvs_erase();
+    g_publishes = 0;
+
+    boot(BOOT_CHANNELS);
+    CHECK(g_publishes == 1);
+}
+
+static void test_unchanged_schema_skips(void) {
+    uint32_t writes = host_nvs_writes();
+    g_publishes = 0;
+
+    boot(BOOT_CHANNELS);
+    CHECK(g_publishes == 0);
+    CHECK(host_nvs_writes() == writes);
+}
+
+static void test_changed_schema_provisions(void) {
+    g_publishes = 0;
+
+    boot(BOOT_CHANNELS - 1);
+    CHECK(g_publishes == 1);
+
+    boot(BOOT_CHANNELS - 1);
+    CHECK(g_publishes == 1);
+}
+
+static void test_startup_timing(void) {
+    int64_t hit = 0, miss = 0;
+    const int rounds = 50;
+
+    for (int i = 0; i < rounds; i++) {
+        host_nvs_erase();
+        miss += timed_boot(BOOT_CHANNELS);
+        hit += timed_boot(BOOT_CHANNELS);
+    }
+
+    printf("boot with %u channels: %.1f us on a fingerprint hit, %.1f us on a miss\n",
+                BOOT_CHANNELS, hit / 1000.0 / rounds, miss / 1000.0 / rounds);
+    CHECK(hit < miss);
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    for (int i = 0; i < BOOT_CHANNELS; i++)
+        snprintf(g_names[i], sizeof(g_names[i]), "channel_%d", i);
+
+    RUN_TEST(test_first_boot_provisions);
+    RUN_TEST(test_unchanged_schema_skips);
+    RUN_TEST(test_changed_schema_provisions);
+    RUN_TEST(test_startup_timing);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "host_port.h"
+#include "host_test.h"
+
+/* Provisioning document written by the streaming writer. Channels come newest
+ * first as in the cJSON document, choice options in the order they were given. */
+
+static const char g_expected[] =
+    "{\"device_name\":\"AC\",\"device_id\":\"020000000001\",\"schema_version\":4,"
+    "\"codecs\":[\"json\",\"cbor\"],\"channels\":{"
+    "\"status\":{\"command\":false,\"type\":\"string\"},"
+    "\"mode\":{\"command\":true,\"enum\":[\"auto\",\"cool\",\"dry\"]},"
+    "\"temp\":{\"command\":true,\"type\":\"number\",\"min\":16,\"max\":30,\"multipleof\":0.5},"
+    "\"power\":{\"command\":true,\"type\":\"boolean\"}}}";
+
+static void build_device(void) {
+    device_init("AC");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    device_add_multi_option_channel("mode", true, NULL, NULL, 3, "auto", "cool", "dry");
+    device_add_string_channel("status", false, NULL, NULL);
+    device_seal();
+}
+
+static void test_document(void) {
+    char* json = device_get_mqtt_provision_json_data();
+    CHECK(json != NULL && strcmp(json, g_expected) == 0);
+    free(json);
+}
+
+static void test_measure_and_truncate(void) {
+    size_t len = strlen(g_expected);
+    char buf[sizeof(g_expected)];
+
+    CHECK(device_write_mqtt_provision_json(NULL, 0) == len);
+
+    /* Like snprintf: the full length back and a terminated prefix */
+    memset(buf, 'x', sizeof(buf));
+    CHECK(device_write_mqtt_provision_json(buf, 10) == len);
+    CHECK(buf[9] == '\0' && memcmp(buf, g_expected, 9) == 0);
+
+    CHECK(device_write_mqtt_provision_json(buf, sizeof(buf)) == len);
+    CHECK(strcmp(buf, g_expected) == 0);
+}
+
+static void test_single_allocation(void) {
+    host_alloc_stats_t before, after;
+
+    host_alloc_get_stats(&before);
+    char* json = device_get_mqtt_provision_json_data();
+    host_alloc_get_stats(&after);
+
+    CHECK(after.allocs - before.allocs == 1 && after.reallocs == before.reallocs);
+    CHECK(after.bytes - before.bytes == sizeof(g_expected));
+    free(json);
+}
+
+int main(void) {
+    build_device();
+
+    RUN_TEST(test_document);
+    RUN_TEST(test_measure_and_truncate);
+    RUN_TEST(test_single_allocation);
+    return HOST_TEST_RESULT();
+}
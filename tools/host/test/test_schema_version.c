@@ -0,0 +1,291 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "host_test.h"
+
+/* Channels added and removed after provisioning: the schema listener hears of
+ * each change, the update sent is the delta from the version the server holds,
+ * the short IDs answering it join the others, and a channel removed while other
+ * tasks read values leaves them a valid copy. */
+
+#define READER_THREADS                  2
+#define STRING_CHANNELS                 8
+
+static const device_channel_def_t g_defs[] = {
+    DEVICE_BOOL_CHANNEL("power", true),
+    DEVICE_NUMBER_CHANNEL("temp", true, 16, 30, 0.5f),
+    DEVICE_STRING_CHANNEL("status", false),
+};
+
+static const device_channel_def_t g_extra_defs[] = {
+    DEVICE_BOOL_CHANNEL("light", true),
+    DEVICE_BOOL_CHANNEL("buzzer", true),
+};
+
+static uint32_t g_notified;
+static char g_doc[2048];
+static int g_stop;
+
+static void schema_listener(void* ctx) {
+    g_notified++;
+}
+
+static bool answer(int status, uint32_t version) {
+    char resp[64];
+    int len = snprintf(resp, sizeof(resp), "{\"status\":%d,\"schema_version\":%u}", status, (unsigned) version);
+    return device_check_prov_resp(resp, len);
+}
+
+/* Sealed and provisioned at its current version, the listener set as app_main does */
+static void build_provisioned(void) {
+    device_init("schema");
+    device_add_channels(g_defs, sizeof(g_defs) / sizeof(g_defs[0]));
+    device_seal();
+    CHECK(answer(1, device_get_self()->schema_version));
+
+    g_notified = 0;
+    device_set_schema_listener(schema_listener, NULL);
+}
+
+static const char* write_update(void) {
+    size_t len = device_write_schema_update(CODEC_JSON, g_doc, sizeof(g_doc));
+    CHECK(len < sizeof(g_doc));
+    return g_doc;
+}
+
+static void test_runtime_add_and_remove(void) {
+    build_provisioned();
+    const device_t* dev = device_get_self();
+    uint32_t base = dev->schema_version;
+    char expected[64];
+
+    device_add_nummber_channel("humidity", false, NULL, NULL, 0, 100, 1);
+    CHECK(g_notified == 1);
+    CHECK(device_get_channel_id("humidity") == 3);
+    CHECK(device_schema_pending() && device_schema_has_delta());
+
+    device_remove_channel("status");
+    CHECK(g_notified == 2);
+    CHECK(device_get_channel_id("status") == DEVICE_CHANNEL_ID_INVALID);
+
+    /* Both changes against the acknowledged version */
+    const char* doc = write_update();
+    snprintf(expected, sizeof(expected), "\"base_version\":%u", (unsigned) base);
+    CHECK(strstr(doc, expected) != NULL);
+    CHECK(strstr(doc, "\"removed\":[\"status\"]") != NULL);
+    CHECK(strstr(doc, "\"humidity\":{") != NULL);
+    CHECK(strstr(doc, "\"power\"") == NULL);
+
+    /* Nothing to remove, nothing to tell */
+    device_remove_channel("status");
+    CHECK(g_notified == 2);
+
+    CHECK(answer(1, dev->schema_version));
+    CHECK(!device_schema_pending());
+    device_set_schema_listener(NULL, NULL);
+}
+
+static void test_table_notifies_once(void) {
+    build_provisioned();
+
+    device_add_channels(g_extra_defs, sizeof(g_extra_defs) / sizeof(g_extra_defs[0]));
+    CHECK(g_notified == 1);
+    CHECK(device_get_channel_id("buzzer") == 4);
+
+    /* A channel added then removed since the acknowledged version is left out */
+    device_remove_channel("light");
+    const char* doc = write_update();
+    CHECK(strstr(doc, "\"light\"") == NULL);
+    CHECK(strstr(doc, "\"buzzer\":{") != NULL);
+    device_set_schema_listener(NULL, NULL);
+}
+
+static void test_refused_delta(void) {
+    build_provisioned();
+    const device_t* dev = device_get_self();
+    uint32_t base = dev->schema_version;
+
+    device_add_bool_channel("light", true, NULL, NULL);
+
+    /* Refused while holding our base: the same delta is sent again */
+    CHECK(!answer(0, base));
+    CHECK(device_schema_pending() && device_schema_has_delta());
+
+    /* Refused holding something else: the full document goes next */
+    CHECK(!answer(0, base + 7));
+    CHECK(device_schema_pending() && !device_schema_has_delta());
+    const char* doc = write_update();
+    CHECK(strstr(doc, "\"base_version\"") == NULL);
+    CHECK(strstr(doc, "\"power\"") != NULL && strstr(doc, "\"light\"") != NULL);
+
+    CHECK(answer(1, dev->schema_version));
+    CHECK(!device_schema_pending());
+    device_set_schema_listener(NULL, NULL);
+}
+
+static void test_ack_without_version(void) {
+    build_provisioned();
+    size_t len;
+    bool delta;
+
+    /* Nothing written since provisioning, a bare acknowledgement names nothing */
+    device_add_bool_channel("light", true, NULL, NULL);
+    CHECK(device_check_prov_resp("{\"status\":1}", 12));
+    CHECK(device_schema_pending());
+
+    char* doc = device_get_schema_update_json(&len, &delta);
+    CHECK(doc != NULL && delta && strlen(doc) == len);
+    free(doc);
+
+    /* Added after the update went out, it stays pending */
+    device_add_bool_channel("buzzer", true, NULL, NULL);
+    CHECK(device_check_prov_resp("{\"status\":1}", 12));
+    CHECK(device_schema_pending() && device_schema_has_delta());
+    const char* update = write_update();
+    CHECK(strstr(update, "\"buzzer\":{") != NULL);
+    CHECK(strstr(update, "\"light\"") == NULL);
+
+    doc = device_get_schema_update_json(&len, &delta);
+    free(doc);
+    CHECK(device_check_prov_resp("{\"status\":1}", 12));
+    CHECK(!device_schema_pending());
+    CHECK(device_get_schema_update_json(&len, &delta) == NULL);
+    device_set_schema_listener(NULL, NULL);
+}
+
+static uint16_t short_id(const char* name) {
+    const device_channel_t* channel = device_get_channel(device_get_channel_id(name));
+    return (channel != NULL) ? channel->short_id : DEVICE_CHANNEL_ID_INVALID;
+}
+
+/* Publish the pending update and answer it with resp, a printf format taking its version */
+static bool publish_and_answer(const char* resp_fmt) {
+    char resp[160];
+    size_t len;
+    bool delta;
+
+    free(device_get_schema_update_json(&len, &delta));
+    int resp_len = snprintf(resp, sizeof(resp), resp_fmt, (unsigned) device_get_self()->schema_version);
+    return device_check_prov_resp(resp, resp_len);
+}
+
+static void test_short_ids_across_delta(void) {
+    const device_t* dev = device_get_self();
+
+    device_init("schema");
+    device_add_channels(g_defs, sizeof(g_defs) / sizeof(g_defs[0]));
+    device_seal();
+    free(device_get_mqtt_provision_json_data());
+    static const char resp[] = "{\"status\":1,\"channel_ids\":{\"power\":2,\"temp\":1,\"status\":0}}";
+    CHECK(device_check_prov_resp(resp, sizeof(resp) - 1));
+    CHECK(dev->short_count == 3 && short_id("power") == 2);
+
+    /* A delta acknowledged without a map leaves the IDs alone */
+    device_add_bool_channel("humidity", false, NULL, NULL);
+    CHECK(publish_and_answer("{\"status\":1,\"schema_version\":%u}"));
+    CHECK(dev->short_count == 3 && short_id("power") == 2 && short_id("status") == 0);
+    CHECK(short_id("humidity") == DEVICE_CHANNEL_ID_INVALID);
+
+    /* One with a map adds the IDs of the channels it names */
+    device_add_bool_channel("light", true, NULL, NULL);
+    CHECK(publish_and_answer("{\"status\":1,\"schema_version\":%u,\"channel_ids\":{\"light\":4}}"));
+    CHECK(dev->short_count == 5);
+    CHECK(short_id("light") == 4 && short_id("power") == 2 && short_id("temp") == 1);
+    CHECK(device_find_channel_key_in(dev, "4", 1) == device_get_channel(device_get_channel_id("light")));
+
+    /* An ID already taken refuses the map, the others stay */
+    device_add_bool_channel("buzzer", true, NULL, NULL);
+    CHECK(publish_and_answer("{\"status\":1,\"schema_version\":%u,\"channel_ids\":{\"buzzer\":2}}"));
+    CHECK(short_id("buzzer") == DEVICE_CHANNEL_ID_INVALID);
+    CHECK(short_id("power") == 2 && short_id("light") == 4);
+}
+
+static void* reader_thread(void* arg) {
+    device_value_t values[3 + STRING_CHANNELS];
+    char strs[STRING_CHANNELS * 64];
+
+    while (!__atomic_load_n(&g_stop, __ATOMIC_ACQUIRE))
+        device_snapshot(values, 3 + STRING_CHANNELS, strs, sizeof(strs));
+    return NULL;
+}
+
+static bool report_channel(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    if (value->type == DEVICE_VALUE_STRING)
+        CHECK(value->value.str_val == NULL || strncmp(value->value.str_val, "value ", 6) == 0);
+    return true;
+}
+
+static void* reporter_thread(void* arg) {
+    while (!__atomic_load_n(&g_stop, __ATOMIC_ACQUIRE))
+        device_report_changes(report_channel, NULL);
+    return NULL;
+}
+
+static void test_remove_while_reading(void) {
+    pthread_t readers[READER_THREADS];
+    pthread_t reporter;
+    char names[STRING_CHANNELS][16];
+    device_update_t updates[STRING_CHANNELS];
+    char str[64];
+
+    build_provisioned();
+    for (int i = 0; i < STRING_CHANNELS; i++) {
+        snprintf(names[i], sizeof(names[i]), "text%d", i);
+        device_add_string_channel(names[i], false, NULL, NULL);
+    }
+    CHECK(g_notified == STRING_CHANNELS);
+
+    __atomic_store_n(&g_stop, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < READER_THREADS; i++)
+        pthread_create(&readers[i], NULL, reader_thread, NULL);
+    pthread_create(&reporter, NULL, reporter_thread, NULL);
+
+    /* Values keep changing, growing their buffers, while channels go away one by one */
+    for (int i = 0; i < STRING_CHANNELS; i++) {
+        for (int k = 0; k < 2000; k++) {
+            int len = snprintf(str, sizeof(str), "value %d ", k);
+            memset(str + len, 'x', k % 40);
+            str[len + k % 40] = '\0';
+            for (int j = i; j < STRING_CHANNELS; j++) {
+                updates[j].channel_id = 3 + j;
+                updates[j].type = DEVICE_VALUE_STRING;
+                updates[j].value.str_val = str;
+            }
+            CHECK(device_update_channels(&updates[i], STRING_CHANNELS - i) == STRING_CHANNELS - i);
+        }
+        device_remove_channel(names[i]);
+    }
+
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < READER_THREADS; i++)
+        pthread_join(readers[i], NULL);
+    pthread_join(reporter, NULL);
+
+    CHECK(g_notified == 2 * STRING_CHANNELS);
+    CHECK(device_get_channel_id(names[STRING_CHANNELS - 1]) == DEVICE_CHANNEL_ID_INVALID);
+
+    /* Removed IDs read as no channel, the others are untouched */
+    device_value_t values[3 + STRING_CHANNELS];
+    device_snapshot(values, 3 + STRING_CHANNELS, NULL, 0);
+    CHECK(values[3].type == DEVICE_VALUE_NONE);
+    CHECK(values[3 + STRING_CHANNELS - 1].type == DEVICE_VALUE_NONE);
+    CHECK(values[1].type == DEVICE_VALUE_NUMBER);
+    device_set_schema_listener(NULL, NULL);
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    RUN_TEST(test_runtime_add_and_remove);
+    RUN_TEST(test_table_notifies_once);
+    RUN_TEST(test_refused_delta);
+    RUN_TEST(test_ack_without_version);
+    RUN_TEST(test_short_ids_across_delta);
+    RUN_TEST(test_remove_while_reading);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,174 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "host_test.h"
+#include "metrics.h"
+
+/* Snapshots and reports read while several threads write. Every batch sets all
+ * number channels to one value and the string channels to its decimal form,
+ * padded to a varying length so string buffers are outgrown along the way.
+ * A snapshot that mixes two batches is torn. */
+
+#define NUMBER_CHANNELS                 8
+#define STRING_CHANNELS                 2
+#define CHANNEL_COUNT                   (NUMBER_CHANNELS + STRING_CHANNELS)
+
+#define WRITER_THREADS                  2
+#define READER_THREADS                  2
+#define BATCHES_PER_WRITER              100000
+
+static int g_writers_done;
+static uint32_t g_snapshots;
+static uint32_t g_torn;
+static uint32_t g_reported;
+
+static void build_device(void) {
+    char name[16];
+
+    device_init("seqlock");
+    for (int i = 0; i < NUMBER_CHANNELS; i++) {
+        snprintf(name, sizeof(name), "num%d", i);
+        device_add_nummber_channel(name, false, NULL, NULL, 0, 1000000, 0);
+    }
+    for (int i = 0; i < STRING_CHANNELS; i++) {
+        snprintf(name, sizeof(name), "str%d", i);
+        device_add_string_channel(name, false, NULL, NULL);
+    }
+    device_seal();
+}
+
+static void* writer_thread(void* arg) {
+    uint32_t writer = (uint32_t) (uintptr_t) arg;
+    device_update_t updates[CHANNEL_COUNT];
+    char str[64];
+
+    for (uint32_t k = 0; k < BATCHES_PER_WRITER; k++) {
+        uint32_t value = k * WRITER_THREADS + writer;
+
+        /* Decimal value, then up to 40 bytes of padding */
+        int len = snprintf(str, sizeof(str), "%u ", value);
+        memset(str + len, 'x', (k % 5) * 10);
+        str[len + (k % 5) * 10] = '\0';
+
+        for (uint16_t id = 0; id < CHANNEL_COUNT; id++) {
+            updates[id].channel_id = id;
+            if (id < NUMBER_CHANNELS) {
+                updates[id].type = DEVICE_VALUE_NUMBER;
+                updates[id].value.num_val = value;
+            } else {
+                updates[id].type = DEVICE_VALUE_STRING;
+                updates[id].value.str_val = str;
+            }
+        }
+        device_update_channels(updates, CHANNEL_COUNT);
+    }
+    return NULL;
+}
+
+/* All channels of one snapshot carry the same batch */
+static bool snapshot_consistent(const device_value_t* values) {
+    float value = values[0].value.num_val;
+    for (uint16_t id = 0; id < CHANNEL_COUNT; id++) {
+        if (id < NUMBER_CHANNELS) {
+            if (values[id].type != DEVICE_VALUE_NUMBER || values[id].value.num_val != value)
+                return false;
+        } else {
+            const char* str = values[id].value.str_val;
+            if (values[id].type != DEVICE_VALUE_STRING || str == NULL || strtof(str, NULL) != value)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void* reader_thread(void* arg) {
+    device_value_t values[CHANNEL_COUNT];
+    char strs[STRING_CHANNELS * 64];
+
+    while (!__atomic_load_n(&g_writers_done, __ATOMIC_ACQUIRE)) {
+        device_snapshot(values, CHANNEL_COUNT, strs, sizeof(strs));
+
+        /* Nothing written yet */
+        if (values[NUMBER_CHANNELS].value.str_val == NULL)
+            continue;
+
+        __atomic_fetch_add(&g_snapshots, 1, __ATOMIC_RELAXED);
+        if (!snapshot_consistent(values))
+            __atomic_fetch_add(&g_torn, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* Each reported value on its own must be whole: a string is the padded decimal it was set to */
+static bool check_reported(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    if (value->type == DEVICE_VALUE_STRING) {
+        char* end;
+        const char* str = value->value.str_val;
+        strtoul(str, &end, 10);
+        if (*end != ' ' || strspn(end + 1, "x") != strlen(end + 1) || strlen(end + 1) % 10 != 0)
+            __atomic_fetch_add(&g_torn, 1, __ATOMIC_RELAXED);
+    }
+    g_reported++;
+    return true;
+}
+
+static void* reporter_thread(void* arg) {
+    while (!__atomic_load_n(&g_writers_done, __ATOMIC_ACQUIRE))
+        device_report_changes(check_reported, NULL);
+    return NULL;
+}
+
+static void test_concurrent_snapshots(void) {
+    pthread_t writers[WRITER_THREADS];
+    pthread_t readers[READER_THREADS];
+    pthread_t reporter;
+
+    build_device();
+
+    for (int i = 0; i < READER_THREADS; i++)
+        pthread_create(&readers[i], NULL, reader_thread, NULL);
+    pthread_create(&reporter, NULL, reporter_thread, NULL);
+    for (int i = 0; i < WRITER_THREADS; i++)
+        pthread_create(&writers[i], NULL, writer_thread, (void*) (uintptr_t) i);
+
+    for (int i = 0; i < WRITER_THREADS; i++)
+        pthread_join(writers[i], NULL);
+    __atomic_store_n(&g_writers_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < READER_THREADS; i++)
+        pthread_join(readers[i], NULL);
+    pthread_join(reporter, NULL);
+
+    printf("%u snapshots, %u values reported, %u retries, %u locked reads\n", g_snapshots, g_reported,
+                metrics_counter("device_read_retries")->value, metrics_counter("device_read_locked")->value);
+    CHECK(g_snapshots > 0);
+    CHECK(g_torn == 0);
+
+    /* The last batch of either writer is what stays */
+    device_value_t values[CHANNEL_COUNT];
+    char strs[STRING_CHANNELS * 64];
+    device_snapshot(values, CHANNEL_COUNT, strs, sizeof(strs));
+    CHECK(snapshot_consistent(values));
+    CHECK(values[0].value.num_val >= (BATCHES_PER_WRITER - 1) * WRITER_THREADS);
+}
+
+static void test_snapshot_short_buffer(void) {
+    device_value_t values[CHANNEL_COUNT];
+    char strs[4];
+
+    /* Strings that do not fit come back NULL, the size needed is still returned */
+    size_t need = device_snapshot(values, CHANNEL_COUNT, NULL, 0);
+    CHECK(need > sizeof(strs));
+    CHECK(device_snapshot(values, CHANNEL_COUNT, strs, sizeof(strs)) == need);
+    CHECK(values[NUMBER_CHANNELS].type == DEVICE_VALUE_STRING);
+    CHECK(values[NUMBER_CHANNELS].value.str_val == NULL);
+    CHECK(values[0].type == DEVICE_VALUE_NUMBER);
+}
+
+int main(void) {
+    RUN_TEST(test_concurrent_snapshots);
+    RUN_TEST(test_snapshot_short_buffer);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "gateway.h"
+#include "host_port.h"
+#include "host_test.h"
+#include "topic_router.h"
+
+/* Short channel IDs from the provisioning response, for channel counts well past
+ * what one token array holds, on the board's device and on a gateway sub-device.
+ * The server assigns them in reverse so they differ from the channel IDs. */
+
+#define BOARD_CHANNELS                  150
+#define SUB_CHANNELS                    40
+
+static char g_names[BOARD_CHANNELS][16];
+static device_channel_def_t g_defs[SUB_CHANNELS];
+static char g_resp[8192];
+
+/* Provisioning response assigning short IDs to the first count channels */
+static size_t write_resp(int status, uint16_t count, const char* first_name) {
+    size_t len = snprintf(g_resp, sizeof(g_resp), "{\"status\":%d,\"codec\":\"json\",\"channel_ids\":{", status);
+    for (uint16_t i = 0; i < count; i++) {
+        len += snprintf(g_resp + len, sizeof(g_resp) - len, "%s\"%s\":%u", (i > 0) ? "," : "",
+                    (i == 0 && first_name != NULL) ? first_name : g_names[i], count - 1 - i);
+    }
+    len += snprintf(g_resp + len, sizeof(g_resp) - len, "}}");
+    return len;
+}
+
+static void build_board(void) {
+    device_init("short ids");
+    for (uint16_t i = 0; i < BOARD_CHANNELS; i++)
+        device_add_nummber_channel(g_names[i], true, NULL, NULL, 0, 100, 1);
+    device_seal();
+}
+
+/* Channel found by its short ID, and the key it is sent under */
+static bool keyed_by_short_id(const device_t* dev, uint16_t id, uint16_t short_id) {
+    char key[DEVICE_CHANNEL_KEY_MAX], buf[DEVICE_CHANNEL_KEY_MAX];
+    int len = snprintf(key, sizeof(key), "%u", short_id);
+    const device_channel_t* channel = device_find_channel_key_in(dev, key, len);
+    return channel != NULL && channel->id == id && strcmp(device_get_channel_key(channel, buf), key) == 0;
+}
+
+static void test_board_many_channels(void) {
+    build_board();
+
+    size_t len = write_resp(1, BOARD_CHANNELS, NULL);
+    CHECK(device_check_prov_resp(g_resp, len));
+
+    const device_t* dev = device_get_self();
+    CHECK(dev->short_count == BOARD_CHANNELS);
+    CHECK(keyed_by_short_id(dev, 0, BOARD_CHANNELS - 1));
+    CHECK(keyed_by_short_id(dev, BOARD_CHANNELS - 1, 0));
+    CHECK(keyed_by_short_id(dev, 100, BOARD_CHANNELS - 101));
+}
+
+static void test_invalid_map_keeps_names(void) {
+    build_board();
+
+    /* A name the device does not have: provisioned, keyed by name */
+    size_t len = write_resp(1, BOARD_CHANNELS, "no_such_channel");
+    CHECK(device_check_prov_resp(g_resp, len));
+
+    const device_t* dev = device_get_self();
+    char key[DEVICE_CHANNEL_KEY_MAX];
+    CHECK(dev->short_count == 0);
+    CHECK(strcmp(device_get_channel_key(dev->channel_table[5], key), g_names[5]) == 0);
+    CHECK(device_find_channel_key_in(dev, g_names[5], strlen(g_names[5])) == dev->channel_table[5]);
+}
+
+static void test_refusal_acknowledges_nothing(void) {
+    build_board();
+    const device_t* dev = device_get_self();
+    char resp[96];
+
+    /* Refused while naming our own version */
+    int len = snprintf(resp, sizeof(resp), "{\"status\":0,\"schema_version\":%u}", (unsigned) dev->schema_version);
+    CHECK(!device_check_prov_resp(resp, len));
+    CHECK(device_schema_pending());
+    CHECK(dev->short_count == 0);
+
+    len = snprintf(resp, sizeof(resp), "{\"status\":1,\"schema_version\":%u}", (unsigned) dev->schema_version);
+    CHECK(device_check_prov_resp(resp, len));
+    CHECK(!device_schema_pending());
+}
+
+static void test_numeric_names_refused(void) {
+    static const device_channel_def_t defs[] = {
+        DEVICE_BOOL_CHANNEL("power", true),
+        DEVICE_BOOL_CHANNEL("1", true),
+    };
+
+    /* "1" would read as a short ID, "1a" cannot */
+    device_init("numeric");
+    device_add_bool_channel("1", true, NULL, NULL);
+    device_add_bool_channel("", true, NULL, NULL);
+    device_add_bool_channel("1a", true, NULL, NULL);
+    CHECK(device_get_channel_count() == 1);
+    CHECK(device_get_channel_id("1a") == 0);
+
+    static const char resp[] = "{\"status\":1,\"channel_ids\":{\"1a\":0}}";
+    CHECK(device_check_prov_resp(resp, sizeof(resp) - 1));
+    const device_t* dev = device_get_self();
+    CHECK(device_find_channel_key_in(dev, "0", 1) == dev->channel_table[0]);
+    CHECK(device_find_channel_key_in(dev, "1a", 2) == dev->channel_table[0]);
+
+    CHECK(device_create("sensor", "numeric", defs, 2) == NULL);
+}
+
+static void test_gateway_many_channels(void) {
+    static const gateway_topics_t topics = {
+        .command_topic = "down/command/020000000001",
+        .telemetry_topic = "up/telemetry/020000000001",
+        .prov_upstream_topic = "up/provision/020000000001",
+        .prov_downstream_topic = "down/provision/020000000001",
+    };
+    topic_router_t router;
+
+    host_nvs_erase();
+    topic_router_init(&router);
+    CHECK(gateway_init(&topics, &router));
+
+    device_t* dev = gateway_add_device("sensor", "sub1", g_defs, SUB_CHANNELS);
+    CHECK(dev != NULL);
+    if (dev == NULL)
+        return;
+
+    static const char topic[] = "down/provision/020000000001/sub1";
+    size_t len = write_resp(1, SUB_CHANNELS, NULL);
+    topic_router_dispatch(&router, topic, sizeof(topic) - 1, g_resp, len);
+
+    gateway_stats_t stats;
+    gateway_get_stats(&stats);
+    CHECK(stats.provisioned == 1);
+    CHECK(dev->short_count == SUB_CHANNELS);
+    CHECK(keyed_by_short_id(dev, 0, SUB_CHANNELS - 1));
+    CHECK(keyed_by_short_id(dev, SUB_CHANNELS - 1, 0));
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    for (int i = 0; i < BOARD_CHANNELS; i++)
+        snprintf(g_names[i], sizeof(g_names[i]), "channel_%d", i);
+    for (int i = 0; i < SUB_CHANNELS; i++)
+        g_defs[i] = (device_channel_def_t) DEVICE_NUMBER_CHANNEL(g_names[i], false, 0, 100, 1);
+
+    RUN_TEST(test_board_many_channels);
+    RUN_TEST(test_invalid_map_keeps_names);
+    RUN_TEST(test_refusal_acknowledges_nothing);
+    RUN_TEST(test_numeric_names_refused);
+    RUN_TEST(test_gateway_many_channels);
+    return HOST_TEST_RESULT();
+}
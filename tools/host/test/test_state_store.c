@@ -0,0 +1,188 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+#include "device.h"
+#include "device_port.h"
+#include "host_port.h"
+#include "host_test.h"
+#include "state_store.h"
+
+/* Channel values saved to NVS and restored at the next start. The store starts
+ * once per boot, so each start runs in a child process of its own; the blob one
+ * child saved reaches the next through shared memory. */
+
+#define STATE_KEY                       "chan_state"
+#define STATE_HEADER_SIZE               8
+#define STATE_BLOB_MAX                  256
+
+static const device_channel_def_t g_defs[] = {
+    DEVICE_BOOL_CHANNEL("power", true),
+    DEVICE_NUMBER_CHANNEL("temp", true, 16, 30, 0.5f),
+    DEVICE_CHOICE_CHANNEL("mode", true, "auto", "cool", "dry"),
+    DEVICE_STRING_CHANNEL("status", false),
+};
+
+#define CHANNEL_COUNT                   (sizeof(g_defs) / sizeof(g_defs[0]))
+
+typedef struct {
+    uint8_t blob[STATE_BLOB_MAX];
+    size_t len;
+} shared_t;
+
+static shared_t* g_shared;
+
+/* Run fn in a child process, its failed checks fail the parent */
+static void run_isolated(void (*fn)(size_t), size_t arg) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        host_test_failures = 0;
+        fn(arg);
+        _exit(HOST_TEST_RESULT());
+    }
+
+    int status;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* Boot with the first len bytes of the shared blob in NVS, none if 0 */
+static void boot(size_t defs, size_t len) {
+    host_nvs_erase();
+    if (len > 0)
+        CHECK(device_port_set_blob(STATE_KEY, g_shared->blob, len));
+
+    device_init("state");
+    device_add_channels(g_defs, defs);
+    device_seal();
+    CHECK(state_store_start(STATE_STORE_FLUSH_INTERVAL_MS));
+}
+
+static void set_values(bool power, float temp, const char* mode, const char* status) {
+    char* str;
+
+    device_set_channel_value_by_id(0, &power);
+    device_set_channel_value_by_id(1, &temp);
+    str = (char*) mode;
+    device_set_channel_value_by_id(2, &str);
+    str = (char*) status;
+    device_set_channel_value_by_id(3, &str);
+}
+
+static void save_child(size_t unused) {
+    boot(CHANNEL_COUNT, 0);
+    set_values(true, 21.5f, "cool", "running");
+    state_store_flush();
+
+    state_store_stats_t stats;
+    state_store_get_stats(&stats);
+    CHECK(stats.flash_writes == 1 && stats.changes == CHANNEL_COUNT);
+
+    g_shared->len = sizeof(g_shared->blob);
+    CHECK(device_port_get_blob(STATE_KEY, g_shared->blob, &g_shared->len));
+    CHECK(g_shared->len == stats.bytes_written);
+}
+
+/* Restored channels hold the saved values, the others stay unset */
+static void check_restored(uint32_t restored) {
+    device_value_t values[CHANNEL_COUNT];
+    char strs[64];
+
+    device_snapshot(values, CHANNEL_COUNT, strs, sizeof(strs));
+    CHECK(values[0].value.bool_val == (restored > 0));
+    CHECK(values[1].value.num_val == ((restored > 1) ? 21.5f : 0.0f));
+    if (restored > 2)
+        CHECK(values[2].value.str_val != NULL && strcmp(values[2].value.str_val, "cool") == 0);
+    if (restored > 3)
+        CHECK(values[3].value.str_val != NULL && strcmp(values[3].value.str_val, "running") == 0);
+    else
+        CHECK(values[3].value.str_val == NULL || values[3].value.str_val[0] == '\0');
+}
+
+static void restore_child(size_t len) {
+    boot(CHANNEL_COUNT, len);
+
+    state_store_stats_t stats;
+    state_store_get_stats(&stats);
+    CHECK(stats.changes == 0);
+    if (len == g_shared->len)
+        CHECK(stats.restored == CHANNEL_COUNT);
+    else
+        CHECK(stats.restored < CHANNEL_COUNT);
+    check_restored(stats.restored);
+}
+
+static void test_round_trip(void) {
+    g_shared->len = 0;
+    run_isolated(save_child, 0);
+    CHECK(g_shared->len > STATE_HEADER_SIZE);
+    run_isolated(restore_child, g_shared->len);
+}
+
+static void other_schema_child(size_t unused) {
+    /* One channel fewer, another fingerprint */
+    boot(CHANNEL_COUNT - 1, g_shared->len);
+
+    state_store_stats_t stats;
+    state_store_get_stats(&stats);
+    CHECK(stats.restored == 0);
+
+    device_value_t values[CHANNEL_COUNT - 1];
+    device_snapshot(values, CHANNEL_COUNT - 1, NULL, 0);
+    CHECK(!values[0].value.bool_val);
+}
+
+static void test_other_schema_ignored(void) {
+    run_isolated(other_schema_child, 0);
+}
+
+static void test_truncated_blob(void) {
+    /* Cut at every length, records read before the cut are kept and the rest dropped */
+    for (size_t len = 1; len < g_shared->len; len++)
+        run_isolated(restore_child, len);
+}
+
+static void unchanged_child(size_t unused) {
+    boot(CHANNEL_COUNT, g_shared->len);
+    uint32_t writes = host_nvs_writes();
+    state_store_stats_t stats;
+
+    /* Changed and changed back, what would be written is in flash already */
+    set_values(false, 21.5f, "cool", "running");
+    set_values(true, 21.5f, "cool", "running");
+    state_store_flush();
+    state_store_get_stats(&stats);
+    CHECK(stats.flushes == 1 && stats.skipped == 1 && stats.flash_writes == 0);
+    CHECK(host_nvs_writes() == writes);
+
+    /* Nothing changed since, nothing to do */
+    state_store_flush();
+    state_store_get_stats(&stats);
+    CHECK(stats.flushes == 1);
+
+    set_values(true, 22.0f, "cool", "running");
+    state_store_flush();
+    state_store_get_stats(&stats);
+    CHECK(stats.flash_writes == 1 && host_nvs_writes() == writes + 1);
+}
+
+static void test_unchanged_not_rewritten(void) {
+    run_isolated(unchanged_child, 0);
+}
+
+int main(void) {
+    host_log_level = ESP_LOG_NONE;
+
+    g_shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_shared == MAP_FAILED)
+        return 1;
+
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_other_schema_ignored);
+    RUN_TEST(test_truncated_blob);
+    RUN_TEST(test_unchanged_not_rewritten);
+    return HOST_TEST_RESULT();
+}
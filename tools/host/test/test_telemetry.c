@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "device.h"
+#include "host_test.h"
+#include "telemetry.h"
+
+/* Telemetry flushed by hand into a capturing publish that can be made to fail.
+ * The flush task is started with an interval long enough to stay out of the way. */
+
+#define CAPTURE_MAX                     8
+#define SPARE_CHANNELS                  21
+
+static char g_messages[CAPTURE_MAX][TELEMETRY_MAX_PAYLOAD + 1];
+static int g_message_count;
+static bool g_fail;
+
+/* Run once after the next message is captured, as another task would between two messages */
+static void (*g_on_publish)(void);
+
+static int capture_publish(const char* topic, const char* data, size_t len) {
+    if (g_fail || g_message_count == CAPTURE_MAX)
+        return -1;
+
+    memcpy(g_messages[g_message_count], data, len);
+    g_messages[g_message_count][len] = '\0';
+    g_message_count++;
+    if (g_on_publish != NULL) {
+        void (*on_publish)(void) = g_on_publish;
+        g_on_publish = NULL;
+        on_publish();
+    }
+    return 0;
+}
+
+static void flush(void) {
+    g_message_count = 0;
+    telemetry_flush();
+}
+
+static void set_bool(const char* name, bool val) {
+    device_set_channel_value(name, &val);
+}
+
+static void set_number(const char* name, float val) {
+    device_set_channel_value(name, &val);
+}
+
+static void test_coalesce(void) {
+    set_bool("power", true);
+    set_bool("power", false);
+    set_bool("power", true);
+    set_number("temp", 21);
+    set_number("temp", 22.5f);
+
+    flush();
+    CHECK(g_message_count == 1);
+    CHECK(strcmp(g_messages[0], "{\"power\":true,\"temp\":22.5}") == 0);
+
+    /* Nothing changed since */
+    flush();
+    CHECK(g_message_count == 0);
+}
+
+static void test_failed_publish_requeues(void) {
+    set_bool("power", false);
+
+    g_fail = true;
+    flush();
+    g_fail = false;
+
+    flush();
+    CHECK(g_message_count == 1);
+    CHECK(strcmp(g_messages[0], "{\"power\":false}") == 0);
+}
+
+static void test_split_large_batch(void) {
+    char value[200];
+    char name[8];
+
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    for (int i = 0; i < 8; i++) {
+        const char* val = value;
+        snprintf(name, sizeof(name), "text%d", i);
+        device_set_channel_value(name, &val);
+    }
+
+    flush();
+    CHECK(g_message_count == 2);
+    for (int i = 0; i < g_message_count; i++)
+        CHECK(strlen(g_messages[i]) < TELEMETRY_MAX_PAYLOAD);
+
+    telemetry_stats_t stats;
+    telemetry_get_stats(&stats);
+    CHECK(stats.publishes >= 4 && stats.failed == 1);
+}
+
+/* Windows reported in a message that failed go out with the next one */
+static void test_windows_survive_failed_publish(void) {
+    for (int i = 1; i <= 4; i++)
+        set_number("flow", (float) i);
+    usleep(30 * 1000);
+
+    g_fail = true;
+    flush();
+    g_fail = false;
+
+    flush();
+    CHECK(g_message_count == 1);
+    CHECK(strstr(g_messages[0], "\"flow\":[{\"min\":1,\"max\":4,\"mean\":2.5,\"last\":4,\"count\":4}]") != NULL);
+
+    /* Sent once only */
+    flush();
+    CHECK(g_message_count == 0);
+}
+
+static void test_windows_survive_payload_full(void) {
+    char value[TELEMETRY_MAX_PAYLOAD - 40];
+    const char* val = value;
+
+    memset(value, 'y', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    device_set_channel_value("text0", &val);
+
+    for (int i = 1; i <= 2; i++)
+        set_number("flow", (float) i);
+    usleep(30 * 1000);
+
+    /* The string fills the first message, the windows wait for the next */
+    flush();
+    CHECK(g_message_count == 2);
+    CHECK(strstr(g_messages[0], "flow") == NULL);
+    CHECK(strstr(g_messages[1], "\"count\":2") != NULL);
+}
+
+/* Adds two channels and sets the second one while the first message goes out */
+static void add_late_channels(void) {
+    device_add_bool_channel("late0", false, NULL, NULL);
+    device_add_bool_channel("late1", false, NULL, NULL);
+    set_bool("late1", true);
+}
+
+static void test_channel_added_during_flush(void) {
+    set_bool("power", true);
+
+    /* IDs 32 and 33, past the bitmap sized before the first message */
+    g_on_publish = add_late_channels;
+    flush();
+    CHECK(device_get_channel_id("late1") == 33);
+    CHECK(g_message_count == 2);
+    CHECK(strcmp(g_messages[0], "{\"power\":true}") == 0);
+    CHECK(strcmp(g_messages[1], "{\"late1\":true}") == 0);
+}
+
+int main(void) {
+    device_init("telemetry");
+    device_add_bool_channel("power", true, NULL, NULL);
+    device_add_nummber_channel("temp", true, NULL, NULL, 16, 30, 0.5f);
+    for (int i = 0; i < 8; i++) {
+        static char names[8][8];
+        snprintf(names[i], sizeof(names[i]), "text%d", i);
+        device_add_string_channel(names[i], false, NULL, NULL);
+    }
+    device_add_aggregate_channel("flow", false, NULL, NULL, 0, 100, 0, 20);
+
+    /* Up to the last ID of the first bitmap word, runtime channels go past it */
+    for (int i = 0; i < SPARE_CHANNELS; i++) {
+        static char names[SPARE_CHANNELS][8];
+        snprintf(names[i], sizeof(names[i]), "spare%d", i);
+        device_add_bool_channel(names[i], false, NULL, NULL);
+    }
+    device_seal();
+
+    if (!telemetry_start("up/telemetry/test", 3600 * 1000, capture_publish))
+        return 1;
+
+    RUN_TEST(test_coalesce);
+    RUN_TEST(test_failed_publish_requeues);
+    RUN_TEST(test_split_large_batch);
+    RUN_TEST(test_windows_survive_failed_publish);
+    RUN_TEST(test_windows_survive_payload_full);
+    RUN_TEST(test_channel_added_during_flush);
+    return HOST_TEST_RESULT();
+}
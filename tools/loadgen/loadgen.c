@@ -0,0 +1,527 @@
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mosquitto.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "codec.h"
+#include "device.h"
+
+/* Fleet load generator. Simulated devices built from the firmware device model
+ * run the provisioning handshake, then send telemetry and take commands against
+ * an MQTT broker, one connection each, all driven from one poll loop.
+ * With -s an in-process server answers provisioning and sends commands.
+ * Thousands of devices need a matching open file limit (ulimit -n). */
+
+#define PROV_DOWNSTREAM_TOPIC           "down/provision/"
+#define PROV_UPSTREAM_TOPIC             "up/provision/"
+#define SERVER_COMMAND_TOPIC            "down/command/"
+#define DEVICE_TELEMETRY_TOPIC          "up/telemetry/"
+
+#define LOADGEN_TOPIC_MAX               64
+#define LOADGEN_PAYLOAD_MAX             1024
+#define LOADGEN_KEEPALIVE_S             60
+#define LOADGEN_POLL_MS                 10
+
+/* Same schema as the example firmware */
+static const device_channel_def_t sim_channels[] = {
+    DEVICE_BOOL_CHANNEL("power", true),
+    DEVICE_NUMBER_CHANNEL("temp", true, 20, 30, 1),
+    DEVICE_CHOICE_CHANNEL("mode", true, "mode1", "mode2", "mode3"),
+};
+
+#define SIM_CHANNEL_COUNT               (sizeof(sim_channels) / sizeof(sim_channels[0]))
+
+typedef struct {
+    device_t* device;
+    struct mosquitto* client;
+    int64_t prov_start_us;          /* provisioning document sent */
+    int64_t prov_latency_us;        /* 0 until acknowledged */
+    int64_t next_report_us;
+    bool connected;
+    bool refused;
+} sim_device_t;
+
+static struct {
+    const char* host;
+    int port;
+    uint32_t device_count;
+    uint32_t duration_s;
+    uint32_t timeout_s;
+    double telemetry_rate;          /* messages per device per second */
+    double command_rate;            /* server commands per second, whole fleet */
+    bool server;
+} g_opts = {
+    .host = "localhost",
+    .port = 1883,
+    .device_count = 1000,
+    .duration_s = 30,
+    .timeout_s = 60,
+    .telemetry_rate = 1.0,
+    .command_rate = 10.0,
+};
+
+static struct {
+    uint32_t connected;
+    uint32_t prov_sent;
+    uint32_t prov_acked;
+    uint32_t prov_refused;
+    uint32_t telemetry_sent;
+    uint32_t telemetry_failed;
+    uint32_t commands_received;
+    uint32_t commands_applied;
+    uint32_t server_prov_answered;
+    uint32_t server_commands_sent;
+} g_stats;
+
+static sim_device_t* g_devices;
+static struct mosquitto* g_server;
+
+/* Connections serviced by the last poll, parallel to its pollfd array */
+static struct mosquitto** g_polled;
+static bool g_server_ready;
+
+static const char* TAG = "loadgen";
+
+/* Locally administered MAC, unique per index */
+static void sim_device_id(uint32_t index, char* id) {
+    sprintf(id, "02%02X%02X%02X%02X%02X", 0x10, (index >> 24) & 0xFF, (index >> 16) & 0xFF,
+                (index >> 8) & 0xFF, index & 0xFF);
+}
+
+/* Device index from the last topic level, -1 if not one of ours */
+static int64_t sim_device_index(const char* topic) {
+    const char* id = strrchr(topic, '/');
+    id = (id != NULL) ? id + 1 : topic;
+    if (strlen(id) != 12 || strncmp(id, "0210", 4) != 0)
+        return -1;
+
+    uint32_t index = (uint32_t) strtoul(id + 4, NULL, 16);
+    return (index < g_opts.device_count) ? (int64_t) index : -1;
+}
+
+static void sim_publish_provision(sim_device_t* sim) {
+    char topic[LOADGEN_TOPIC_MAX];
+    char doc[LOADGEN_PAYLOAD_MAX];
+
+    size_t len = device_write_mqtt_provision_in(sim->device, CODEC_JSON, doc, sizeof(doc));
+    snprintf(topic, sizeof(topic), "%s%s", PROV_UPSTREAM_TOPIC, sim->device->id);
+
+    sim->prov_start_us = esp_timer_get_time();
+    if (mosquitto_publish(sim->client, NULL, topic, len, doc, 2, false) == MOSQ_ERR_SUCCESS)
+        g_stats.prov_sent++;
+}
+
+static void sim_on_connect(struct mosquitto* client, void* obj, int rc) {
+    sim_device_t* sim = obj;
+    char topic[LOADGEN_TOPIC_MAX];
+
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Device %s refused by broker: %s", sim->device->id, mosquitto_connack_string(rc));
+        return;
+    }
+
+    sim->connected = true;
+    g_stats.connected++;
+
+    /* Like the firmware: listen for the response, then announce the schema */
+    snprintf(topic, sizeof(topic), "%s%s", PROV_DOWNSTREAM_TOPIC, sim->device->id);
+    mosquitto_subscribe(client, NULL, topic, 0);
+    snprintf(topic, sizeof(topic), "%s%s", SERVER_COMMAND_TOPIC, sim->device->id);
+    mosquitto_subscribe(client, NULL, topic, 0);
+    sim_publish_provision(sim);
+}
+
+static bool prov_status_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    int* status = ctx;
+    if (key_len == 6 && memcmp(key, "status", 6) == 0 && value->type == CODEC_VALUE_NUMBER)
+        *status = (int) value->num_val;
+    return true;
+}
+
+typedef struct {
+    sim_device_t* sim;
+    device_update_t updates[SIM_CHANNEL_COUNT];
+    char strs[SIM_CHANNEL_COUNT][32];
+    uint16_t count;
+} sim_command_t;
+
+/* Decoded command member to a typed update, unknown channels are left to the device to reject */
+static bool sim_command_member(const char* key, size_t key_len, const codec_value_t* value, void* ctx) {
+    sim_command_t* cmd = ctx;
+    char name[32];
+
+    if (cmd->count >= SIM_CHANNEL_COUNT || key_len >= sizeof(name))
+        return false;
+
+    memcpy(name, key, key_len);
+    name[key_len] = '\0';
+
+    device_update_t* update = &cmd->updates[cmd->count];
+    update->channel_id = device_get_channel_id_in(cmd->sim->device, name);
+
+    switch (value->type) {
+    case CODEC_VALUE_BOOL:
+        update->type = DEVICE_VALUE_BOOL;
+        update->value.bool_val = value->bool_val;
+        break;
+
+    case CODEC_VALUE_NUMBER:
+        update->type = DEVICE_VALUE_NUMBER;
+        update->value.num_val = (float) value->num_val;
+        break;
+
+    case CODEC_VALUE_STRING:
+        if (value->str_len >= sizeof(cmd->strs[0]))
+            return true;
+        memcpy(cmd->strs[cmd->count], value->str, value->str_len);
+        cmd->strs[cmd->count][value->str_len] = '\0';
+        update->type = DEVICE_VALUE_STRING;
+        update->value.str_val = cmd->strs[cmd->count];
+        break;
+
+    default:
+        return true;
+    }
+
+    cmd->count++;
+    return true;
+}
+
+static void sim_on_message(struct mosquitto* client, void* obj, const struct mosquitto_message* msg) {
+    sim_device_t* sim = obj;
+
+    if (strncmp(msg->topic, PROV_DOWNSTREAM_TOPIC, strlen(PROV_DOWNSTREAM_TOPIC)) == 0) {
+        int status = 0;
+        codec_decode_map(CODEC_JSON, msg->payload, msg->payloadlen, prov_status_member, &status);
+        if (sim->prov_latency_us != 0 || sim->refused)
+            return;
+
+        if (status != 1) {
+            sim->refused = true;
+            g_stats.prov_refused++;
+            return;
+        }
+
+        sim->prov_latency_us = esp_timer_get_time() - sim->prov_start_us;
+        g_stats.prov_acked++;
+        return;
+    }
+
+    if (strncmp(msg->topic, SERVER_COMMAND_TOPIC, strlen(SERVER_COMMAND_TOPIC)) == 0) {
+        sim_command_t cmd = { .sim = sim };
+        g_stats.commands_received++;
+        if (codec_decode_map(CODEC_JSON, msg->payload, msg->payloadlen, sim_command_member, &cmd))
+            g_stats.commands_applied += device_update_channels_in(sim->device, cmd.updates, cmd.count);
+    }
+}
+
+/* Server side: acknowledge every provisioning document, payloads stay JSON */
+static void server_on_message(struct mosquitto* client, void* obj, const struct mosquitto_message* msg) {
+    static const char resp[] = "{\"status\":1,\"codec\":\"json\"}";
+    char topic[LOADGEN_TOPIC_MAX];
+
+    int64_t index = sim_device_index(msg->topic);
+    if (index < 0)
+        return;
+
+    snprintf(topic, sizeof(topic), "%s%s", PROV_DOWNSTREAM_TOPIC, g_devices[index].device->id);
+    if (mosquitto_publish(client, NULL, topic, sizeof(resp) - 1, resp, 1, false) == MOSQ_ERR_SUCCESS)
+        g_stats.server_prov_answered++;
+}
+
+static void server_on_subscribe(struct mosquitto* client, void* obj, int mid, int qos_count, const int* granted_qos) {
+    g_server_ready = true;
+}
+
+/* Service every connection once, waiting up to timeout_ms for traffic */
+static void loadgen_poll(struct pollfd* fds, int timeout_ms) {
+    struct mosquitto** clients = g_polled;
+    nfds_t count = 0;
+
+    for (uint32_t i = 0; i <= g_opts.device_count; i++) {
+        struct mosquitto* client = (i < g_opts.device_count) ? g_devices[i].client : g_server;
+        if (client == NULL || mosquitto_socket(client) < 0)
+            continue;
+
+        fds[count].fd = mosquitto_socket(client);
+        fds[count].events = POLLIN | (mosquitto_want_write(client) ? POLLOUT : 0);
+        fds[count].revents = 0;
+        clients[count++] = client;
+    }
+
+    poll(fds, count, timeout_ms);
+
+    for (nfds_t i = 0; i < count; i++) {
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            mosquitto_loop_read(clients[i], 1);
+        if (fds[i].revents & POLLOUT)
+            mosquitto_loop_write(clients[i], 1);
+        mosquitto_loop_misc(clients[i]);
+    }
+}
+
+typedef struct {
+    codec_writer_t writer;
+    uint16_t count;
+} sim_report_t;
+
+static bool sim_report_channel(const device_channel_t* channel, const device_value_t* value, void* ctx) {
+    sim_report_t* report = ctx;
+    codec_write_key(&report->writer, channel->name);
+
+    switch (value->type) {
+    case DEVICE_VALUE_BOOL:
+        codec_write_bool(&report->writer, value->value.bool_val);
+        break;
+
+    case DEVICE_VALUE_NUMBER:
+        codec_write_number(&report->writer, value->value.num_val);
+        break;
+
+    case DEVICE_VALUE_STRING:
+        if (value->value.str_val != NULL)
+            codec_write_string(&report->writer, value->value.str_val);
+        else
+            codec_write_null(&report->writer);
+        break;
+
+    default:
+        codec_write_null(&report->writer);
+        break;
+    }
+
+    report->count++;
+    return true;
+}
+
+/* Change some values through the device model and publish what it reports */
+static void sim_send_telemetry(sim_device_t* sim) {
+    static const char* const modes[] = { "mode1", "mode2", "mode3" };
+    uint8_t payload[LOADGEN_PAYLOAD_MAX];
+    char topic[LOADGEN_TOPIC_MAX];
+
+    device_update_t updates[] = {
+        { .channel_id = 0, .type = DEVICE_VALUE_BOOL, .value.bool_val = rand() & 1 },
+        { .channel_id = 1, .type = DEVICE_VALUE_NUMBER, .value.num_val = 20 + rand() % 11 },
+        { .channel_id = 2, .type = DEVICE_VALUE_STRING, .value.str_val = modes[rand() % 3] },
+    };
+    device_update_channels_in(sim->device, updates, SIM_CHANNEL_COUNT);
+
+    sim_report_t report = { .count = 0 };
+    codec_writer_init(&report.writer, CODEC_JSON, payload, sizeof(payload));
+    codec_write_map_begin(&report.writer);
+    device_report_changes_in(sim->device, sim_report_channel, &report);
+    codec_write_map_end(&report.writer);
+    size_t len = codec_writer_finish(&report.writer);
+
+    /* Nothing changed, like the firmware nothing is sent */
+    if (report.count == 0)
+        return;
+
+    snprintf(topic, sizeof(topic), "%s%s", DEVICE_TELEMETRY_TOPIC, sim->device->id);
+    if (mosquitto_publish(sim->client, NULL, topic, len, payload, 0, false) == MOSQ_ERR_SUCCESS)
+        g_stats.telemetry_sent++;
+    else
+        g_stats.telemetry_failed++;
+}
+
+static void server_send_command(void) {
+    static const char cmd[] = "{\"power\":true,\"temp\":24,\"mode\":\"mode2\"}";
+    char topic[LOADGEN_TOPIC_MAX];
+
+    sim_device_t* sim = &g_devices[rand() % g_opts.device_count];
+    if (sim->prov_latency_us == 0)
+        return;
+
+    snprintf(topic, sizeof(topic), "%s%s", SERVER_COMMAND_TOPIC, sim->device->id);
+    if (mosquitto_publish(g_server, NULL, topic, sizeof(cmd) - 1, cmd, 0, false) == MOSQ_ERR_SUCCESS)
+        g_stats.server_commands_sent++;
+}
+
+static int compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void report_handshake(int64_t elapsed_us) {
+    int64_t* latencies = malloc(g_opts.device_count * sizeof(int64_t));
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; latencies != NULL && i < g_opts.device_count; i++) {
+        if (g_devices[i].prov_latency_us != 0)
+            latencies[count++] = g_devices[i].prov_latency_us;
+    }
+
+    printf("devices           %u (%u connected)\n", g_opts.device_count, g_stats.connected);
+    printf("provisioned       %u (%u refused, %u timed out)\n", g_stats.prov_acked, g_stats.prov_refused,
+                g_opts.device_count - g_stats.prov_acked - g_stats.prov_refused);
+    printf("provisioning      %.1f devices/s over %.2f s\n",
+                g_stats.prov_acked / (elapsed_us / 1e6), elapsed_us / 1e6);
+
+    if (count > 0) {
+        qsort(latencies, count, sizeof(int64_t), compare_i64);
+        printf("handshake         p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+                    latencies[count / 2] / 1e3, latencies[(count - 1) * 99 / 100] / 1e3, latencies[count - 1] / 1e3);
+    }
+    free(latencies);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "usage: %s [-h host] [-p port] [-n devices] [-d seconds] [-t timeout]\n"
+        "          [-r telemetry/s per device] [-c commands/s] [-s] [-v]\n"
+        "  -s  answer provisioning and send commands from this process\n"
+        "  -v  log the device model at info level\n", name);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:n:d:t:r:c:sv")) != -1) {
+        switch (opt) {
+        case 'h': g_opts.host = optarg; break;
+        case 'p': g_opts.port = atoi(optarg); break;
+        case 'n': g_opts.device_count = strtoul(optarg, NULL, 0); break;
+        case 'd': g_opts.duration_s = strtoul(optarg, NULL, 0); break;
+        case 't': g_opts.timeout_s = strtoul(optarg, NULL, 0); break;
+        case 'r': g_opts.telemetry_rate = atof(optarg); break;
+        case 'c': g_opts.command_rate = atof(optarg); break;
+        case 's': g_opts.server = true; break;
+        case 'v': host_log_level = ESP_LOG_INFO; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (g_opts.device_count == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    mosquitto_lib_init();
+    g_devices = calloc(g_opts.device_count, sizeof(sim_device_t));
+    struct pollfd* fds = calloc(g_opts.device_count + 1, sizeof(struct pollfd));
+    g_polled = calloc(g_opts.device_count + 1, sizeof(struct mosquitto*));
+    if (g_devices == NULL || fds == NULL || g_polled == NULL) {
+        ESP_LOGE(TAG, "No memory for %u devices", g_opts.device_count);
+        return 1;
+    }
+
+    /* Server first, so no provisioning document is missed */
+    if (g_opts.server) {
+        g_server = mosquitto_new("loadgen-server", true, NULL);
+        if (g_server == NULL)
+            return 1;
+
+        mosquitto_message_callback_set(g_server, server_on_message);
+        mosquitto_subscribe_callback_set(g_server, server_on_subscribe);
+        if (mosquitto_connect(g_server, g_opts.host, g_opts.port, LOADGEN_KEEPALIVE_S) != MOSQ_ERR_SUCCESS) {
+            ESP_LOGE(TAG, "Server connection to %s:%d failed", g_opts.host, g_opts.port);
+            return 1;
+        }
+        mosquitto_subscribe(g_server, NULL, PROV_UPSTREAM_TOPIC "+", 1);
+        while (!g_server_ready)
+            loadgen_poll(fds, LOADGEN_POLL_MS);
+    }
+
+    size_t device_bytes = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (uint32_t i = 0; i < g_opts.device_count; i++) {
+        sim_device_t* sim = &g_devices[i];
+        char id[13];
+
+        sim_device_id(i, id);
+        sim->device = device_create("loadgen", id, sim_channels, SIM_CHANNEL_COUNT);
+        sim->client = mosquitto_new(id, true, sim);
+        if (sim->device == NULL || sim->client == NULL) {
+            ESP_LOGE(TAG, "Failed to create device %s", id);
+            return 1;
+        }
+        device_bytes += device_get_footprint_in(sim->device);
+
+        mosquitto_connect_callback_set(sim->client, sim_on_connect);
+        mosquitto_message_callback_set(sim->client, sim_on_message);
+        if (mosquitto_connect(sim->client, g_opts.host, g_opts.port, LOADGEN_KEEPALIVE_S) != MOSQ_ERR_SUCCESS)
+            ESP_LOGW(TAG, "Device %s could not connect", id);
+
+        /* Keep handshakes flowing while the fleet is still connecting */
+        loadgen_poll(fds, 0);
+    }
+
+    printf("device model      %zu bytes per device\n", device_bytes / g_opts.device_count);
+
+    /* Handshake phase: until every device is answered or the timeout */
+    int64_t deadline = start + (int64_t) g_opts.timeout_s * 1000000;
+    while (g_stats.prov_acked + g_stats.prov_refused < g_opts.device_count && esp_timer_get_time() < deadline)
+        loadgen_poll(fds, LOADGEN_POLL_MS);
+
+    int64_t last_ack = start;
+    for (uint32_t i = 0; i < g_opts.device_count; i++) {
+        int64_t ack = g_devices[i].prov_start_us + g_devices[i].prov_latency_us;
+        if (g_devices[i].prov_latency_us != 0 && ack > last_ack)
+            last_ack = ack;
+    }
+    report_handshake(last_ack - start);
+
+    /* Traffic phase: telemetry from provisioned devices, commands from the server */
+    uint32_t telemetry_base = g_stats.telemetry_sent;
+    uint32_t command_base = g_stats.commands_received;
+    int64_t period_us = (g_opts.telemetry_rate > 0) ? (int64_t) (1e6 / g_opts.telemetry_rate) : 0;
+    int64_t traffic_start = esp_timer_get_time();
+    int64_t traffic_end = traffic_start + (int64_t) g_opts.duration_s * 1000000;
+    double commands_due = 0;
+
+    for (uint32_t i = 0; i < g_opts.device_count; i++)
+        g_devices[i].next_report_us = traffic_start + (period_us ? rand() % period_us : 0);
+
+    int64_t last = traffic_start;
+    for (int64_t now = traffic_start; now < traffic_end; now = esp_timer_get_time()) {
+        for (uint32_t i = 0; period_us && i < g_opts.device_count; i++) {
+            sim_device_t* sim = &g_devices[i];
+            if (sim->prov_latency_us == 0 || now < sim->next_report_us)
+                continue;
+            sim_send_telemetry(sim);
+            sim->next_report_us += period_us;
+        }
+
+        if (g_server != NULL) {
+            commands_due += g_opts.command_rate * (now - last) / 1e6;
+            for (; commands_due >= 1; commands_due--)
+                server_send_command();
+        }
+        last = now;
+
+        loadgen_poll(fds, LOADGEN_POLL_MS);
+    }
+
+    double seconds = (esp_timer_get_time() - traffic_start) / 1e6;
+    printf("telemetry         %.1f msg/s (%u failed)\n", (g_stats.telemetry_sent - telemetry_base) / seconds,
+                g_stats.telemetry_failed);
+    printf("commands          %.1f msg/s received, %u channel updates applied\n",
+                (g_stats.commands_received - command_base) / seconds, g_stats.commands_applied);
+    if (g_server != NULL)
+        printf("server            %u provisioning answers, %u commands sent\n",
+                    g_stats.server_prov_answered, g_stats.server_commands_sent);
+
+    for (uint32_t i = 0; i < g_opts.device_count; i++) {
+        mosquitto_disconnect(g_devices[i].client);
+        mosquitto_destroy(g_devices[i].client);
+        device_destroy(g_devices[i].device);
+    }
+    if (g_server != NULL) {
+        mosquitto_disconnect(g_server);
+        mosquitto_destroy(g_server);
+    }
+    mosquitto_lib_cleanup();
+
+    free(fds);
+    free(g_polled);
+    free(g_devices);
+    return 0;
+}